@@ -0,0 +1,77 @@
+#include "AttributeList.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace ntfs {
+
+	std::vector<AttributeListEntry> parse_attribute_list(const uint8_t* data, size_t len)
+	{
+		std::vector<AttributeListEntry>	entries;
+		size_t							pos = 0;
+
+		// Entries are 8 byte aligned, and never shorter than the fixed part of one
+		while (len - pos >= sizeof(NTFS_ATTRIBUTE_LIST)) {
+			NTFS_ATTRIBUTE_LIST raw;
+
+			memcpy(&raw, data + pos, sizeof(raw));
+			if (raw.Length < offsetof(NTFS_ATTRIBUTE_LIST, Reserved) || raw.Length > len - pos)
+				throw ATTRIBUTE_LIST_ERROR("Attribute list entry runs past the end of the list!", ERROR_FILE_CORRUPT);
+
+			if (raw.NameLen && raw.NameOffset + (raw.NameLen * sizeof(WCHAR)) > raw.Length)
+				throw ATTRIBUTE_LIST_ERROR("Attribute list entry name lies outside of the entry!", ERROR_FILE_CORRUPT);
+
+			AttributeListEntry entry;
+			entry.type = raw.AttributeType;
+			entry.lowVcn = raw.LowVcn;
+			entry.frn = raw.FileReferenceNumber;
+			entry.attributeNumber = raw.AttributeNumber;
+			entry.name.resize(raw.NameLen);
+			if (raw.NameLen)
+				memcpy(&entry.name[0], data + pos + raw.NameOffset, raw.NameLen * sizeof(WCHAR));
+
+			entries.push_back(std::move(entry));
+			pos += raw.Length;
+		}
+
+		return entries;
+	}
+
+	std::vector<uint64_t> extension_records(const std::vector<AttributeListEntry>& entries, uint64_t baseRecNum)
+	{
+		std::vector<uint64_t> records;
+
+		for (auto& entry : entries) {
+			if (reference_record(entry.frn) != baseRecNum)
+				records.push_back(reference_record(entry.frn));
+		}
+
+		std::sort(records.begin(), records.end());
+		records.erase(std::unique(records.begin(), records.end()), records.end());
+
+		return records;
+	}
+
+	bool is_extension_of(const NTFS_FILE_RECORD_HEADER* record, size_t size, uint64_t recNum, uint64_t baseFrn)
+	{
+		if (size < sizeof(NTFS_FILE_RECORD_HEADER) || record->RecordHeader.Type != static_cast<ULONG>(NtfsRecordType::File))
+			return false;
+
+		if (!(static_cast<USHORT>(record->Flags) & static_cast<USHORT>(FileRecordFlags::RecordInUse)))
+			return false;
+
+		if (reference_record(record->BaseFileRecord) != reference_record(baseFrn) || reference_record(baseFrn) == recNum)
+			return false;
+
+		// Sequence numbers of 0 predate their use (and are never checked by NTFS either)
+		if (reference_sequence(baseFrn) && reference_sequence(record->BaseFileRecord) && reference_sequence(baseFrn) != reference_sequence(record->BaseFileRecord))
+			return false;
+
+		// Records from NTFS 3.1 on know their own number
+		if (record->RecordHeader.UsaOffset >= offsetof(NTFS_FILE_RECORD_HEADER, UpdateSequenceNumber) && record->MftRecordNumber != static_cast<ULONG>(recNum))
+			return false;
+
+		return true;
+	}
+
+}
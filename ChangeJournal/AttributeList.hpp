@@ -0,0 +1,80 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_defs.h"
+
+#define ATTRIBUTE_LIST_ERROR(msg, err)\
+	std::runtime_error(("[AttributeList] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	/**
+	* One entry of an $ATTRIBUTE_LIST: where a single attribute (or one LowVcn segment of a nonresident
+	* attribute) of a file lives.
+	*/
+	struct AttributeListEntry {
+		NtfsAttributeType			type;
+		uint64_t					lowVcn;
+		uint64_t					frn;			// the record holding the attribute (the base record, or an extension)
+		uint16_t					attributeNumber;
+		std::basic_string<WCHAR>	name;
+	};
+
+	/**
+	* Parses the value of an $ATTRIBUTE_LIST attribute.
+	*
+	* @throws std::runtime_error if an entry is malformed or runs past the end of the list
+	* @param data The attribute's value
+	* @param len The length of the value, in bytes
+	* @return the entries, in the order they appear
+	*/
+	std::vector<AttributeListEntry> parse_attribute_list(const uint8_t* data, size_t len);
+
+	/**
+	* Returns the record numbers of the extension records an attribute list refers to.
+	*
+	* @param entries The parsed attribute list
+	* @param baseRecNum The record number of the base record the list belongs to, which is left out
+	* @return the distinct record numbers, in ascending order
+	*/
+	std::vector<uint64_t> extension_records(const std::vector<AttributeListEntry>& entries, uint64_t baseRecNum);
+
+	/**
+	* Indicates whether a record read from recNum is an in-use extension record of a given file, which
+	* guards against lists that point at records that have since been freed and reused.
+	*
+	* @param record The record, already fixed up
+	* @param size The size of the record, in bytes
+	* @param recNum The record number record was read from
+	* @param baseFrn The file reference number (including sequence number) of the base record
+	*/
+	bool is_extension_of(const NTFS_FILE_RECORD_HEADER* record, size_t size, uint64_t recNum, uint64_t baseFrn);
+
+}
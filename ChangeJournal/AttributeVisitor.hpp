@@ -0,0 +1,259 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+
+#define ATTRIBUTE_VISITOR_ERROR(msg, err)\
+	std::runtime_error(("[AttributeVisitor] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+// Attribute walking runs for every record of every scan, so everything in here is a template or inline,
+// leaving the compiler free to inline the caller's handlers into the loop.
+namespace ntfs {
+
+	/**
+	* Forward iterator over the attributes of a file record. Raw records come straight off the disk, so
+	* every attribute is bounds checked against the record before it's handed out.
+	*/
+	class AttributeIterator {
+	public:
+		typedef std::forward_iterator_tag	iterator_category;
+		typedef NTFS_ATTRIBUTE*				value_type;
+		typedef std::ptrdiff_t				difference_type;
+		typedef NTFS_ATTRIBUTE**			pointer;
+		typedef NTFS_ATTRIBUTE*				reference;
+
+		AttributeIterator() = default;
+
+		/**
+		* @throws std::runtime_error if the first attribute is malformed
+		* @param first The first attribute of the record
+		* @param end One past the last byte of the record
+		*/
+		AttributeIterator(unsigned char* first, unsigned char* end) : current(first), limit(end)
+		{
+			check();
+		}
+
+		NTFS_ATTRIBUTE* operator*() const { return reinterpret_cast<NTFS_ATTRIBUTE*>(current); }
+		NTFS_ATTRIBUTE* operator->() const { return reinterpret_cast<NTFS_ATTRIBUTE*>(current); }
+
+		/**
+		* @throws std::runtime_error if the next attribute is malformed
+		*/
+		AttributeIterator& operator++()
+		{
+			current += reinterpret_cast<NTFS_ATTRIBUTE*>(current)->Length;
+			check();
+			return *this;
+		}
+
+		AttributeIterator operator++(int)
+		{
+			AttributeIterator prev = *this;
+			++(*this);
+			return prev;
+		}
+
+		bool operator==(const AttributeIterator& other) const { return current == other.current; }
+		bool operator!=(const AttributeIterator& other) const { return current != other.current; }
+
+	private:
+		// Collapses to the end iterator at the end marker, and rejects attributes that don't fit the record.
+		void check()
+		{
+			auto attr = reinterpret_cast<NTFS_ATTRIBUTE*>(current);
+
+			if (!current || current + sizeof(ULONG) > limit || attr->AttributeType == NtfsAttributeType::AttributeEndOfRecord) {
+				current = nullptr;
+				return;
+			}
+
+			if (current + sizeof(NTFS_ATTRIBUTE) > limit || attr->Length < sizeof(NTFS_ATTRIBUTE) || attr->Length > static_cast<size_t>(limit - current))
+				throw ATTRIBUTE_VISITOR_ERROR("Unable to process MFT record! Malformed attribute encountered.", ERROR_FILE_CORRUPT);
+		}
+
+		unsigned char*	current = nullptr;
+		unsigned char*	limit = nullptr;
+	};
+
+	/**
+	* The attributes of one file record, for use with range-for:
+	*
+	*     for (auto attr : attributes(record, size)) { ... }
+	*/
+	class AttributeRange {
+	public:
+		/**
+		* @throws std::runtime_error if the record is too small to hold a header
+		* @param record The record to walk; it must already have been fixed up
+		* @param size The size of the record, in bytes
+		*/
+		AttributeRange(NTFS_FILE_RECORD_HEADER* record, size_t size) : record(record), size(size)
+		{
+			if (!record || size < sizeof(NTFS_FILE_RECORD_HEADER))
+				throw ATTRIBUTE_VISITOR_ERROR("Unable to process MFT record! Bad parameters provided.", ERROR_INVALID_PARAMETER);
+		}
+
+		AttributeIterator begin() const
+		{
+			auto base = reinterpret_cast<unsigned char*>(record);
+			return AttributeIterator(base + record->AttributeOffset, base + size);
+		}
+
+		AttributeIterator end() const
+		{
+			return AttributeIterator();
+		}
+
+	private:
+		NTFS_FILE_RECORD_HEADER*	record;
+		size_t						size;
+	};
+
+	inline AttributeRange attributes(NTFS_FILE_RECORD_HEADER* record, size_t size)
+	{
+		return AttributeRange(record, size);
+	}
+
+	inline AttributeRange attributes(std::vector<uint8_t>& record)
+	{
+		return AttributeRange(reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(record.data()), record.size());
+	}
+
+	/**
+	* Maps an attribute type to the structure its (resident) value is laid out as; unsigned char for
+	* attributes without one.
+	*/
+	template <NtfsAttributeType Type> struct attribute_value { typedef unsigned char type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeStandardInformation> { typedef STANDARD_INFORMATION type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeAttributeList> { typedef NTFS_ATTRIBUTE_LIST type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeFileName> { typedef FILENAME_ATTRIBUTE type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeObjectId> { typedef OBJECTID_ATTRIBUTE type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeVolumeInformation> { typedef VOLUME_INFORMATION type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeIndexRoot> { typedef INDEX_ROOT type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeReparsePoint> { typedef REPARSE_POINT type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeEAInformation> { typedef EA_INFORMATION type; };
+	template <> struct attribute_value<NtfsAttributeType::AttributeEA> { typedef EA_ATTRIBUTE type; };
+
+	/**
+	* Returns a pointer to the value of a resident attribute, viewed as T.
+	*
+	* @throws std::runtime_error if the value doesn't fit inside the attribute
+	* @return the value, or nullptr if the attribute is nonresident
+	*/
+	template <typename T>
+	T* resident_value(NTFS_ATTRIBUTE* attr)
+	{
+		auto res = reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr);
+
+		if (attr->NonResident)
+			return nullptr;
+
+		if (attr->Length < sizeof(NTFS_RESIDENT_ATTRIBUTE) || res->Offset > attr->Length || res->ValueLength > attr->Length - res->Offset)
+			throw ATTRIBUTE_VISITOR_ERROR("Resident attribute value lies outside of the attribute!", ERROR_FILE_CORRUPT);
+
+		return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(attr) + res->Offset);
+	}
+
+	/**
+	* A handler bound to one attribute type; built with on<Type>(func), and consumed by visit_attributes.
+	*/
+	template <NtfsAttributeType Type, typename Func>
+	struct AttributeHandler {
+		Func func;
+	};
+
+	/**
+	* Binds func to attributes of type Type. func may take either (NTFS_ATTRIBUTE*), or
+	* (attribute_value<Type>::type*, NTFS_ATTRIBUTE*), in which case it is handed the attribute's
+	* resident value (nullptr when the attribute is nonresident).
+	*/
+	template <NtfsAttributeType Type, typename Func>
+	AttributeHandler<Type, typename std::decay<Func>::type> on(Func&& func)
+	{
+		return { std::forward<Func>(func) };
+	}
+
+	namespace detail {
+		template <NtfsAttributeType Type, typename Func>
+		auto invoke_handler(Func& func, NTFS_ATTRIBUTE* attr, int) -> decltype(func(static_cast<typename attribute_value<Type>::type*>(nullptr), attr), void())
+		{
+			func(resident_value<typename attribute_value<Type>::type>(attr), attr);
+		}
+
+		template <NtfsAttributeType Type, typename Func>
+		auto invoke_handler(Func& func, NTFS_ATTRIBUTE* attr, long) -> decltype(func(attr), void())
+		{
+			func(attr);
+		}
+
+		template <NtfsAttributeType Type, typename Func>
+		void dispatch(AttributeHandler<Type, Func>& handler, NTFS_ATTRIBUTE* attr)
+		{
+			if (attr->AttributeType == Type)
+				invoke_handler<Type>(handler.func, attr, 0);
+		}
+
+		// Anything that isn't bound to a type sees every attribute
+		template <typename Func>
+		void dispatch(Func& func, NTFS_ATTRIBUTE* attr)
+		{
+			func(attr);
+		}
+	}
+
+	/**
+	* Walks the attributes of a record once, handing each one to every handler that wants it. Handlers
+	* are either bound to a type with on<Type>(), or plain callables taking (NTFS_ATTRIBUTE*) that see every
+	* attribute:
+	*
+	*     visit_attributes(record, size,
+	*         on<NtfsAttributeType::AttributeFileName>([&](FILENAME_ATTRIBUTE* fn, NTFS_ATTRIBUTE*) { ... }),
+	*         on<NtfsAttributeType::AttributeData>([&](NTFS_ATTRIBUTE* data) { ... }));
+	*
+	* @throws std::runtime_error if the record is malformed, or whatever a handler throws
+	* @param record The record to walk; it must already have been fixed up
+	* @param size The size of the record, in bytes
+	* @param handlers The handlers to apply
+	*/
+	template <typename... Handlers>
+	void visit_attributes(NTFS_FILE_RECORD_HEADER* record, size_t size, Handlers&&... handlers)
+	{
+		for (auto attr : attributes(record, size)) {
+			int expand[] = { 0, (detail::dispatch(handlers, attr), 0)... };
+			(void)expand;
+		}
+	}
+
+}
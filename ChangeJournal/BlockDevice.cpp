@@ -0,0 +1,545 @@
+#include "BlockDevice.hpp"
+#include "Fixup.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+	// Lifecycle of a record in MappedImageDevice::fixupStates
+	enum FixupState : uint8_t {
+		FixupUnseen = 0,	// nobody has asked for the record yet
+		FixupBusy,			// a thread is fixing the record up right now
+		FixupValid,			// fixed up (or without the expected signature, and left as-is)
+		FixupInvalid		// failed update sequence validation
+	};
+
+	bool file_exists(const std::string& path)
+	{
+		std::ifstream f(path, std::ios::binary);
+		return f.good();
+	}
+
+	// NTFS allows clusters of up to 2MB, and file records and index blocks of 256 bytes to 64KB
+	constexpr uint64_t max_cluster_size = 0x200000;
+	constexpr uint64_t min_block_size = 0x100;
+	constexpr uint64_t max_block_size = 0x10000;
+
+	// File record and index block sizes are stored as a signed byte: positive values are
+	// a count of clusters, negative values are a power of two in bytes. Sizes that can't
+	// be represented come back as 0.
+	uint64_t clusters_or_shift(ULONG raw, uint32_t bytesPerCluster)
+	{
+		auto v = static_cast<int8_t>(raw & 0xFF);
+		if (v < 0)
+			return (-v < 32) ? (uint64_t(1) << -v) : 0;
+		return static_cast<uint64_t>(v) * bytesPerCluster;
+	}
+
+	bool valid_block_size(uint64_t size)
+	{
+		return size >= min_block_size && size <= max_block_size && !(size & (size - 1));
+	}
+}
+
+namespace ntfs {
+
+#ifdef _WIN32
+	ImageFileDevice::ImageFileDevice(const std::string& path) : fileSize(0)
+	{
+		LARGE_INTEGER li = { 0 };
+
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (INVALID_HANDLE_VALUE == file)
+			throw BLOCK_DEVICE_ERROR("Unable to open image file!", GetLastError());
+
+		if (!GetFileSizeEx(file, &li)) {
+			auto err = GetLastError();
+			CloseHandle(file);
+			throw BLOCK_DEVICE_ERROR("Unable to query image file size!", err);
+		}
+		fileSize = li.QuadPart;
+	}
+
+	ImageFileDevice::~ImageFileDevice()
+	{
+		if (INVALID_HANDLE_VALUE != file)
+			CloseHandle(file);
+	}
+
+	void ImageFileDevice::read(uint64_t offset, void* buf, size_t len)
+	{
+		unsigned char* out = static_cast<unsigned char*>(buf);
+
+		if (offset + len > fileSize)
+			throw BLOCK_DEVICE_ERROR("Read past the end of the image!", ERROR_HANDLE_EOF);
+
+		while (len) {
+			OVERLAPPED		ov = { 0 };
+			unsigned long	bytesRead = 0;
+			unsigned long	chunk = static_cast<unsigned long>(std::min<size_t>(len, 0x40000000));
+
+			ov.Offset = static_cast<DWORD>(offset);
+			ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			if (!ReadFile(file, out, chunk, &bytesRead, &ov) || 0 == bytesRead)
+				throw BLOCK_DEVICE_ERROR("Failed to read from image!", GetLastError());
+
+			out += bytesRead;
+			offset += bytesRead;
+			len -= bytesRead;
+		}
+	}
+#else
+	ImageFileDevice::ImageFileDevice(const std::string& path) : fileSize(0)
+	{
+		struct stat st {};
+
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (-1 == fd)
+			throw BLOCK_DEVICE_ERROR("Unable to open image file!", errno);
+
+		if (-1 == fstat(fd, &st)) {
+			auto err = errno;
+			close(fd);
+			throw BLOCK_DEVICE_ERROR("Unable to query image file size!", err);
+		}
+		fileSize = st.st_size;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	ImageFileDevice::~ImageFileDevice()
+	{
+		if (-1 != fd)
+			close(fd);
+	}
+
+	void ImageFileDevice::read(uint64_t offset, void* buf, size_t len)
+	{
+		unsigned char* out = static_cast<unsigned char*>(buf);
+
+		if (offset + len > fileSize)
+			throw BLOCK_DEVICE_ERROR("Read past the end of the image!", ERROR_HANDLE_EOF);
+
+		while (len) {
+			auto got = pread(fd, out, len, static_cast<off_t>(offset));
+			if (got < 0 && EINTR == errno)
+				continue;
+			if (got <= 0)
+				throw BLOCK_DEVICE_ERROR("Failed to read from image!", errno);
+
+			out += got;
+			offset += got;
+			len -= got;
+		}
+	}
+
+	bool ImageFileDevice::nativeRange(uint64_t offset, int& fd, uint64_t& fileOffset, uint64_t& contiguous)
+	{
+		if (offset >= fileSize)
+			return false;
+
+		fd = this->fd;
+		fileOffset = offset;
+		contiguous = fileSize - offset;
+
+		return true;
+	}
+#endif
+
+	uint64_t ImageFileDevice::size() const
+	{
+		return fileSize;
+	}
+
+#ifdef _WIN32
+	MappedImageDevice::MappedImageDevice(const std::string& path) : file(INVALID_HANDLE_VALUE), mapping(nullptr), pristine(nullptr), writable(nullptr), fileSize(0), fixupRecordSize(0)
+	{
+		LARGE_INTEGER li = { 0 };
+
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (INVALID_HANDLE_VALUE == file)
+			throw BLOCK_DEVICE_ERROR("Unable to open image file!", GetLastError());
+
+		if (!GetFileSizeEx(file, &li) || 0 == li.QuadPart || static_cast<ULONGLONG>(li.QuadPart) > SIZE_MAX) {
+			CloseHandle(file);
+			throw BLOCK_DEVICE_ERROR("Image file is empty, or too large to map!", ERROR_NOT_SUPPORTED);
+		}
+		fileSize = li.QuadPart;
+
+		// A write-copy section can back both a plain read view and a copy-on-write view
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (mapping) {
+			pristine = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			writable = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+		}
+
+		if (!pristine || !writable) {
+			auto err = GetLastError();
+			release();
+			throw BLOCK_DEVICE_ERROR("Unable to map image file!", err);
+		}
+	}
+
+	MappedImageDevice::~MappedImageDevice()
+	{
+		release();
+	}
+
+	void MappedImageDevice::release()
+	{
+		if (writable)
+			UnmapViewOfFile(writable);
+		if (pristine)
+			UnmapViewOfFile(pristine);
+		if (mapping)
+			CloseHandle(mapping);
+		if (INVALID_HANDLE_VALUE != file)
+			CloseHandle(file);
+
+		writable = pristine = nullptr;
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+	}
+#else
+	MappedImageDevice::MappedImageDevice(const std::string& path) : pristine(nullptr), writable(nullptr), fileSize(0), fixupRecordSize(0)
+	{
+		struct stat st {};
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (-1 == fd)
+			throw BLOCK_DEVICE_ERROR("Unable to open image file!", errno);
+
+		if (-1 == fstat(fd, &st) || 0 == st.st_size || static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+			close(fd);
+			throw BLOCK_DEVICE_ERROR("Image file is empty, or too large to map!", ERROR_NOT_SUPPORTED);
+		}
+		fileSize = st.st_size;
+
+		void* ro = mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ, MAP_SHARED, fd, 0);
+		void* cow = mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		auto err = errno;
+
+		// The mappings keep the file referenced on their own
+		close(fd);
+
+		pristine = (MAP_FAILED == ro) ? nullptr : static_cast<uint8_t*>(ro);
+		writable = (MAP_FAILED == cow) ? nullptr : static_cast<uint8_t*>(cow);
+		if (!pristine || !writable) {
+			release();
+			throw BLOCK_DEVICE_ERROR("Unable to map image file!", err);
+		}
+
+		madvise(pristine, static_cast<size_t>(fileSize), MADV_SEQUENTIAL);
+	}
+
+	MappedImageDevice::~MappedImageDevice()
+	{
+		release();
+	}
+
+	void MappedImageDevice::release()
+	{
+		if (writable)
+			munmap(writable, static_cast<size_t>(fileSize));
+		if (pristine)
+			munmap(pristine, static_cast<size_t>(fileSize));
+
+		writable = pristine = nullptr;
+	}
+#endif
+
+	uint64_t MappedImageDevice::size() const
+	{
+		return fileSize;
+	}
+
+	void MappedImageDevice::read(uint64_t offset, void* buf, size_t len)
+	{
+		if (offset > fileSize || len > fileSize - offset)
+			throw BLOCK_DEVICE_ERROR("Read past the end of the image!", ERROR_HANDLE_EOF);
+
+		memcpy(buf, pristine + offset, len);
+	}
+
+	const uint8_t* MappedImageDevice::view(uint64_t offset, size_t len)
+	{
+		if (offset > fileSize || len > fileSize - offset)
+			return nullptr;
+
+		return pristine + offset;
+	}
+
+	uint8_t* MappedImageDevice::fixedUpView(uint64_t offset, size_t len, NtfsRecordType type)
+	{
+		if (!len || offset > fileSize || len > fileSize - offset)
+			return nullptr;
+
+		std::call_once(fixupInit, [&] {
+			fixupRecordSize = len;
+			fixupStates = std::vector<std::atomic<uint8_t>>(static_cast<size_t>(fileSize / len));
+		});
+
+		// The states only track records of one size; anything else has to be copied and fixed up by the caller
+		if (len != fixupRecordSize)
+			return nullptr;
+
+		uint8_t*	rec = writable + offset;
+		auto&		state = fixupStates[static_cast<size_t>(offset / len)];
+		uint8_t		current = state.load(std::memory_order_acquire);
+
+		// Exactly one caller fixes a record up; anyone asking for it meanwhile waits for the result
+		while (FixupValid != current && FixupInvalid != current) {
+			uint8_t expected = FixupUnseen;
+			if (FixupUnseen == current && state.compare_exchange_strong(expected, FixupBusy, std::memory_order_acquire)) {
+				bool ok = reinterpret_cast<NTFS_RECORD_HEADER*>(rec)->Type != static_cast<ULONG>(type) || apply_fixup(rec, len);
+				current = ok ? FixupValid : FixupInvalid;
+				state.store(current, std::memory_order_release);
+				break;
+			}
+			std::this_thread::yield();
+			current = state.load(std::memory_order_acquire);
+		}
+
+		if (FixupInvalid == current)
+			throw BLOCK_DEVICE_ERROR("Record failed update sequence validation!", ERROR_FILE_CORRUPT);
+
+		return rec;
+	}
+
+	SplitImageDevice::SplitImageDevice(std::vector<std::shared_ptr<BlockDevice>> parts) : segments(std::move(parts))
+	{
+		uint64_t total = 0;
+
+		if (segments.empty())
+			throw BLOCK_DEVICE_ERROR("No image segments provided!", ERROR_INVALID_PARAMETER);
+
+		for (auto& s : segments) {
+			if (!s)
+				throw BLOCK_DEVICE_ERROR("Bad image segment provided!", ERROR_INVALID_PARAMETER);
+			starts.push_back(total);
+			total += s->size();
+		}
+		starts.push_back(total);
+	}
+
+	uint64_t SplitImageDevice::size() const
+	{
+		return starts.back();
+	}
+
+	void SplitImageDevice::read(uint64_t offset, void* buf, size_t len)
+	{
+		unsigned char* out = static_cast<unsigned char*>(buf);
+
+		if (offset + len > size())
+			throw BLOCK_DEVICE_ERROR("Read past the end of the image!", ERROR_HANDLE_EOF);
+
+		// Find the last segment starting at or before offset, then walk forward as
+		// the read crosses segment boundaries.
+		size_t idx = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+		while (len) {
+			uint64_t local = offset - starts[idx];
+			size_t chunk = static_cast<size_t>(std::min<uint64_t>(len, starts[idx + 1] - offset));
+
+			segments[idx]->read(local, out, chunk);
+			out += chunk;
+			offset += chunk;
+			len -= chunk;
+			++idx;
+		}
+	}
+
+#ifndef _WIN32
+	bool SplitImageDevice::nativeRange(uint64_t offset, int& fd, uint64_t& fileOffset, uint64_t& contiguous)
+	{
+		if (offset >= size())
+			return false;
+
+		size_t idx = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+		if (!segments[idx]->nativeRange(offset - starts[idx], fd, fileOffset, contiguous))
+			return false;
+
+		contiguous = std::min<uint64_t>(contiguous, starts[idx + 1] - offset);
+		return true;
+	}
+#endif
+
+	const uint8_t* SplitImageDevice::view(uint64_t offset, size_t len)
+	{
+		if (offset >= size())
+			return nullptr;
+
+		// Segments are mapped separately, so only ranges inside a single segment are contiguous
+		size_t idx = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+		if (offset + len > starts[idx + 1])
+			return nullptr;
+
+		return segments[idx]->view(offset - starts[idx], len);
+	}
+
+	uint8_t* SplitImageDevice::fixedUpView(uint64_t offset, size_t len, NtfsRecordType type)
+	{
+		if (offset >= size())
+			return nullptr;
+
+		size_t idx = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+		if (offset + len > starts[idx + 1])
+			return nullptr;
+
+		return segments[idx]->fixedUpView(offset - starts[idx], len, type);
+	}
+
+#ifdef _WIN32
+	VolumeHandleDevice::VolumeHandleDevice(std::shared_ptr<void> volHandle) : vhandle(volHandle), volSize(0), sectorSize(0)
+	{
+		GET_LENGTH_INFORMATION	lenInfo = { 0 };
+		DISK_GEOMETRY			geom = { 0 };
+		unsigned long			bytesRead = 0;
+
+		if (!vhandle)
+			throw BLOCK_DEVICE_ERROR("Invalid volume handle provided!", ERROR_INVALID_PARAMETER);
+
+		if (!DeviceIoControl(vhandle.get(), IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &lenInfo, sizeof(lenInfo), &bytesRead, nullptr))
+			throw BLOCK_DEVICE_ERROR("Unable to query volume length!", GetLastError());
+
+		if (!DeviceIoControl(vhandle.get(), IOCTL_DISK_GET_DRIVE_GEOMETRY, nullptr, 0, &geom, sizeof(geom), &bytesRead, nullptr))
+			throw BLOCK_DEVICE_ERROR("Unable to query volume geometry!", GetLastError());
+
+		volSize = lenInfo.Length.QuadPart;
+		sectorSize = geom.BytesPerSector ? geom.BytesPerSector : 512;
+	}
+
+	uint64_t VolumeHandleDevice::size() const
+	{
+		return volSize;
+	}
+
+	void VolumeHandleDevice::read(uint64_t offset, void* buf, size_t len)
+	{
+		uint64_t				alignedStart = offset - (offset % sectorSize);
+		uint64_t				alignedEnd = ((offset + len + sectorSize - 1) / sectorSize) * sectorSize;
+		unsigned char*			out = static_cast<unsigned char*>(buf);
+		std::vector<uint8_t>	bounce;
+
+		if (offset + len > volSize)
+			throw BLOCK_DEVICE_ERROR("Read past the end of the volume!", ERROR_HANDLE_EOF);
+
+		// Only bounce through a temporary buffer if the caller's request isn't sector aligned
+		if (alignedStart != offset || alignedEnd != offset + len) {
+			bounce.resize(static_cast<size_t>(alignedEnd - alignedStart));
+			out = bounce.data();
+		}
+
+		for (uint64_t pos = alignedStart; pos < alignedEnd; ) {
+			OVERLAPPED		ov = { 0 };
+			unsigned long	bytesRead = 0;
+			unsigned long	chunk = static_cast<unsigned long>(std::min<uint64_t>(alignedEnd - pos, 0x40000000));
+
+			ov.Offset = static_cast<DWORD>(pos);
+			ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+			if (!ReadFile(vhandle.get(), out + (pos - alignedStart), chunk, &bytesRead, &ov) || 0 == bytesRead)
+				throw BLOCK_DEVICE_ERROR("Failed to read from volume!", GetLastError());
+
+			pos += bytesRead;
+		}
+
+		if (!bounce.empty())
+			memcpy(buf, bounce.data() + (offset - alignedStart), len);
+	}
+#endif
+
+	std::shared_ptr<BlockDevice> open_image(const std::string& path, bool mapped)
+	{
+		const std::string firstExt = ".001";
+		std::vector<std::shared_ptr<BlockDevice>> parts;
+
+		auto open_segment = [mapped](const std::string& name) -> std::shared_ptr<BlockDevice> {
+			if (mapped) {
+				try {
+					return std::make_shared<MappedImageDevice>(name);
+				}
+				catch (const std::runtime_error&) {
+					// Most likely out of address space (e.g., a 32-bit build); plain reads still work
+				}
+			}
+			return std::make_shared<ImageFileDevice>(name);
+		};
+
+		if (path.size() <= firstExt.size() || path.compare(path.size() - firstExt.size(), firstExt.size(), firstExt))
+			return open_segment(path);
+
+		auto base = path.substr(0, path.size() - 3);
+		for (unsigned i = 1; i < 1000; ++i) {
+			auto num = std::to_string(i);
+			auto name = base + std::string(3 - num.size(), '0') + num;
+			if (i > 1 && !file_exists(name))
+				break;
+			parts.push_back(open_segment(name));
+		}
+
+		if (1 == parts.size())
+			return parts.front();
+
+		return std::make_shared<SplitImageDevice>(std::move(parts));
+	}
+
+	VolumeGeometry parse_boot_block(const BOOT_BLOCK& boot)
+	{
+		VolumeGeometry geom = {};
+		uint32_t spc = boot.SectorsPerCluster;
+
+		if (memcmp(boot.Format, "NTFS    ", sizeof(boot.Format)))
+			throw BLOCK_DEVICE_ERROR("Boot sector does not describe an NTFS volume!", ERROR_FILE_CORRUPT);
+
+		geom.bytesPerSector = boot.BytesPerSector;
+		if (geom.bytesPerSector < 256 || geom.bytesPerSector > 4096 || (geom.bytesPerSector & (geom.bytesPerSector - 1)))
+			throw BLOCK_DEVICE_ERROR("Boot sector has an invalid sector size!", ERROR_FILE_CORRUPT);
+
+		// Very large cluster sizes are stored as a negative power of two
+		if (spc > 0x80)
+			spc = (256 - spc < 32) ? (1u << (256 - spc)) : 0;
+
+		if (0 == spc || (spc & (spc - 1)) || static_cast<uint64_t>(geom.bytesPerSector) * spc > max_cluster_size)
+			throw BLOCK_DEVICE_ERROR("Boot sector has an invalid cluster size!", ERROR_FILE_CORRUPT);
+
+		uint64_t recordSize = clusters_or_shift(boot.ClustersPerFileRecord, geom.bytesPerSector * spc);
+		uint64_t indexSize = clusters_or_shift(boot.ClustersPerIndexBlock, geom.bytesPerSector * spc);
+
+		if (!valid_block_size(recordSize) || recordSize < geom.bytesPerSector)
+			throw BLOCK_DEVICE_ERROR("Boot sector has an invalid file record size!", ERROR_FILE_CORRUPT);
+
+		if (!valid_block_size(indexSize))
+			throw BLOCK_DEVICE_ERROR("Boot sector has an invalid index block size!", ERROR_FILE_CORRUPT);
+
+		geom.bytesPerCluster = geom.bytesPerSector * spc;
+		geom.bytesPerFileRecord = static_cast<uint32_t>(recordSize);
+		geom.bytesPerIndexBlock = static_cast<uint32_t>(indexSize);
+		geom.totalSectors = boot.TotalSectors;
+		geom.totalClusters = boot.TotalSectors / spc;
+		geom.mftStartLcn = boot.MftStartLcn;
+		geom.mft2StartLcn = boot.Mft2StartLcn;
+		geom.volumeSerial = boot.VolumeSerialNo.QuadPart;
+
+		if (geom.mftStartLcn >= geom.totalClusters)
+			throw BLOCK_DEVICE_ERROR("Boot sector places the MFT outside the volume!", ERROR_FILE_CORRUPT);
+
+		return geom;
+	}
+
+	VolumeGeometry read_volume_geometry(BlockDevice& dev)
+	{
+		BOOT_BLOCK boot;
+
+		static_assert(sizeof(BOOT_BLOCK) == 512, "BOOT_BLOCK must describe exactly one 512 byte sector");
+		dev.read(0, &boot, sizeof(boot));
+
+		return parse_boot_block(boot);
+	}
+}
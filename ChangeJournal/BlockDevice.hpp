@@ -0,0 +1,252 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include <vector>
+#include <stdexcept>
+#include "ntfs_defs.h"
+
+#define BLOCK_DEVICE_ERROR(msg, err)\
+	std::runtime_error(("[BlockDevice] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	/**
+	* A source of raw volume bytes. Implementations must support positional reads from
+	* multiple threads at once, since scans may have several reads outstanding.
+	*/
+	class BlockDevice {
+	public:
+		virtual ~BlockDevice() = default;
+
+		/**
+		* Returns the size of the underlying device, in bytes.
+		*/
+		virtual uint64_t size() const = 0;
+
+		/**
+		* Reads exactly len bytes starting at byte offset into buf.
+		*
+		* @throws std::runtime_error if the read fails or runs past the end of the device
+		* @param offset The byte offset to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		*/
+		virtual void read(uint64_t offset, void* buf, size_t len) = 0;
+
+#ifndef _WIN32
+		/**
+		* Reports whether the bytes at offset live in a plain file descriptor, so that asynchronous readers
+		* (e.g., io_uring) can read them directly.
+		*
+		* @param offset The device offset being asked about
+		* @param fd Receives the file descriptor holding offset
+		* @param fileOffset Receives the offset within fd that corresponds to offset
+		* @param contiguous Receives the number of bytes, starting at offset, that are contiguous within fd
+		* @return true if the range is backed by fd, false if reads must go through read()
+		*/
+		virtual bool nativeRange(uint64_t /*offset*/, int& /*fd*/, uint64_t& /*fileOffset*/, uint64_t& /*contiguous*/) { return false; }
+#endif
+
+		/**
+		* Returns a pointer to a range of the device, if the device is memory mapped, so that it can be read
+		* without copying it.
+		*
+		* @param offset The byte offset the view should begin at
+		* @param len The number of bytes the caller intends to read
+		* @return a pointer to the range, or nullptr if the device isn't mapped or the range isn't contiguous in memory
+		*/
+		virtual const uint8_t* view(uint64_t /*offset*/, size_t /*len*/) { return nullptr; }
+
+		/**
+		* Returns a pointer to a multi-sector record (e.g., an MFT record) of a memory mapped device, with its
+		* update sequence fixups applied (see apply_fixup). The device fixes each record up once, in a private
+		* copy-on-write mapping, no matter how many callers share it; neither read() nor view() ever see the
+		* change. Records that don't carry the expected signature are returned as-is.
+		*
+		* @throws std::runtime_error if the record fails update sequence validation
+		* @param offset The byte offset of the record
+		* @param len The size of the record, in bytes; every caller must use the same size for a given offset
+		* @param type The signature the record should carry
+		* @return a pointer to the record, or nullptr if the device isn't mapped or the record isn't contiguous in memory
+		*/
+		virtual uint8_t* fixedUpView(uint64_t /*offset*/, size_t /*len*/, NtfsRecordType /*type*/) { return nullptr; }
+	};
+
+	/**
+	* A single raw (dd-style) image file.
+	*/
+	class ImageFileDevice : public BlockDevice {
+	public:
+		ImageFileDevice(const std::string& path);
+		~ImageFileDevice();
+		ImageFileDevice(const ImageFileDevice&) = delete;
+		ImageFileDevice& operator=(const ImageFileDevice&) = delete;
+
+		uint64_t size() const override;
+		void read(uint64_t offset, void* buf, size_t len) override;
+#ifndef _WIN32
+		bool nativeRange(uint64_t offset, int& fd, uint64_t& fileOffset, uint64_t& contiguous) override;
+#endif
+
+	private:
+#ifdef _WIN32
+		HANDLE		file;
+#else
+		int			fd;
+#endif
+		uint64_t	fileSize;
+	};
+
+	/**
+	* A single raw image file, memory mapped twice: once read-only, which backs read() and view(), and
+	* once as a private copy-on-write mapping, which backs fixedUpView(). Reads become copies out of the
+	* page cache, and records can be fixed up where they lie without disturbing what read() returns.
+	*/
+	class MappedImageDevice : public BlockDevice {
+	public:
+		/**
+		* @throws std::runtime_error if the file can't be opened or mapped (e.g., it doesn't fit the address space)
+		* @param path The path to the image file
+		*/
+		MappedImageDevice(const std::string& path);
+		~MappedImageDevice();
+		MappedImageDevice(const MappedImageDevice&) = delete;
+		MappedImageDevice& operator=(const MappedImageDevice&) = delete;
+
+		uint64_t size() const override;
+		void read(uint64_t offset, void* buf, size_t len) override;
+		const uint8_t* view(uint64_t offset, size_t len) override;
+		uint8_t* fixedUpView(uint64_t offset, size_t len, NtfsRecordType type) override;
+
+	private:
+		void release();
+
+#ifdef _WIN32
+		HANDLE		file;
+		HANDLE		mapping;
+#endif
+		uint8_t*	pristine;
+		uint8_t*	writable;
+		uint64_t	fileSize;
+		// One state per record slot (offset / fixupRecordSize), telling whether fixedUpView() has fixed the
+		// record up yet; allocated on first use, for the record size it was first asked for.
+		std::once_flag						fixupInit;
+		size_t								fixupRecordSize;
+		std::vector<std::atomic<uint8_t>>	fixupStates;
+	};
+
+	/**
+	* A raw image split across several consecutive segment files (image.001, image.002, ...),
+	* presented as one contiguous device.
+	*/
+	class SplitImageDevice : public BlockDevice {
+	public:
+		SplitImageDevice(std::vector<std::shared_ptr<BlockDevice>> parts);
+
+		uint64_t size() const override;
+		void read(uint64_t offset, void* buf, size_t len) override;
+#ifndef _WIN32
+		bool nativeRange(uint64_t offset, int& fd, uint64_t& fileOffset, uint64_t& contiguous) override;
+#endif
+		const uint8_t* view(uint64_t offset, size_t len) override;
+		uint8_t* fixedUpView(uint64_t offset, size_t len, NtfsRecordType type) override;
+
+	private:
+		std::vector<std::shared_ptr<BlockDevice>>	segments;
+		// starts[i] is the byte offset at which segments[i] begins; starts.back() is the total size
+		std::vector<uint64_t>						starts;
+	};
+
+#ifdef _WIN32
+	/**
+	* A live volume, opened with CreateFile (e.g., \\.\C:). Reads are widened to whole
+	* sectors internally, since volume handles reject unaligned requests.
+	*/
+	class VolumeHandleDevice : public BlockDevice {
+	public:
+		VolumeHandleDevice(std::shared_ptr<void> volHandle);
+
+		uint64_t size() const override;
+		void read(uint64_t offset, void* buf, size_t len) override;
+
+	private:
+		std::shared_ptr<void>	vhandle;
+		uint64_t				volSize;
+		uint32_t				sectorSize;
+	};
+#endif
+
+	/**
+	* The volume layout described by an NTFS boot sector.
+	*/
+	struct VolumeGeometry {
+		uint32_t	bytesPerSector;
+		uint32_t	bytesPerCluster;
+		uint32_t	bytesPerFileRecord;
+		uint32_t	bytesPerIndexBlock;
+		uint64_t	totalSectors;
+		uint64_t	totalClusters;
+		uint64_t	mftStartLcn;
+		uint64_t	mft2StartLcn;
+		int64_t		volumeSerial;
+	};
+
+	/**
+	* Opens an image file, transparently joining split images when path names the first
+	* segment (i.e., ends in .001).
+	*
+	* @throws std::runtime_error if any segment cannot be opened
+	* @param path The path to the image (or its first segment)
+	* @param mapped Memory map the segments (see MappedImageDevice); any segment that can't be mapped
+	*        is read with ordinary reads instead.
+	* @return a shared_ptr to the resulting device
+	*/
+	std::shared_ptr<BlockDevice> open_image(const std::string& path, bool mapped = false);
+
+	/**
+	* Validates an NTFS boot sector and derives the volume geometry from it.
+	*
+	* @throws std::runtime_error if the boot sector is not a sane NTFS boot sector
+	* @param boot The boot sector to parse
+	* @return the geometry described by boot
+	*/
+	VolumeGeometry parse_boot_block(const BOOT_BLOCK& boot);
+
+	/**
+	* Reads and parses the boot sector at the start of dev.
+	*
+	* @throws std::runtime_error if the read fails, or the boot sector is not valid
+	* @param dev The device to read from
+	* @return the geometry of the volume contained on dev
+	*/
+	VolumeGeometry read_volume_geometry(BlockDevice& dev);
+
+}
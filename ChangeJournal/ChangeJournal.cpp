@@ -1,5 +1,21 @@
 #include "ChangeJournal.hpp"
+#include <cstring>
 
+namespace {
+	std::string stringify(PUSN_RECORD rec, ntfs::PathResolver* paths)
+	{
+		ntfs::JsonWriter	json(1024);
+		ntfs::UsnRecordJson	writer(paths);
+
+		if (nullptr == rec || !writer.write(json, reinterpret_cast<USN_RECORD_COMMON_HEADER*>(rec)))
+			return "";
+
+		// Without the NDJSON line break
+		return std::string(json.data(), json.size() - 1);
+	}
+}
+
+#ifdef _WIN32
 namespace {
 	constexpr bool boolify(BOOL f) { return !!f; }
 }
@@ -24,86 +40,66 @@ namespace ntfs {
 
 	std::vector<uint8_t> ChangeJournal::getRecords(USN& next)
 	{
-		READ_USN_JOURNAL_DATA_V0	rData = { 0 };
-		unsigned long				bytesRead = 0;
-		std::vector<uint8_t>		vec;
+		std::vector<uint8_t> vec(default_buffer_size);
 
 		auto jInfo = getJournalData();
 
-		vec.resize(default_buffer_size);
+		vec.resize(readRecords(next, jInfo->UsnJournalID, vec.data(), vec.size()));
+		return vec;
+	}
+
+	size_t ChangeJournal::readRecords(USN& next, DWORDLONG journalId, uint8_t* buf, size_t len)
+	{
+		READ_USN_JOURNAL_DATA_V1	rData = { 0 };
+		unsigned long				bytesRead = 0;
+
 		rData.ReasonMask = (uint32_t)-1;
-		rData.UsnJournalID = jInfo->UsnJournalID;
+		rData.UsnJournalID = journalId;
 		rData.StartUsn = next;
+		rData.MinMajorVersion = minVersion;
+		rData.MaxMajorVersion = maxVersion;
+
+		// The V0 request (everything but the versions) still works on systems that predate V1
+		DWORD inLen = (2 == minVersion && 2 == maxVersion) ? sizeof(READ_USN_JOURNAL_DATA_V0) : sizeof(READ_USN_JOURNAL_DATA_V1);
 
-		if (!DeviceIoControl(vhandle.get(), FSCTL_READ_USN_JOURNAL, &rData, sizeof(rData), vec.data(), vec.size(), &bytesRead, nullptr)) {
+		if (!DeviceIoControl(vhandle.get(), FSCTL_READ_USN_JOURNAL, &rData, inLen, buf, static_cast<DWORD>(std::min<size_t>(len, UINT32_MAX)), &bytesRead, nullptr)) {
 
 			unsigned long error = GetLastError();
-			// Return an empty vector if the query failed because
+			// Return nothing if the query failed because
 			// no more records exist past the current point
 			if (ERROR_NO_MORE_ITEMS == error) {
 				if (sizeof(USN) <= bytesRead)
-					next = *(reinterpret_cast<USN*>(vec.data()));
+					next = *(reinterpret_cast<USN*>(buf));
 				else
 					next = 0;
 
-				vec.resize(0);
-				return vec;
+				return 0;
 			}
 			else {
 				throw CG_API_INTERACTION_ERROR("An error occurred while reading the change journal!", error);
 			}
 		}
-		// If we don't do this, we would need to pack along bytesRead somehow.
-		// This could be changed for performance reasons (extra copies being bad and all)
-		// down the road, but this is currently done for 1.) convenience, and 2.) due to this
-		// probably not being our biggest bottleneck currently (since we have to go to disk for
-		// more records).
-		vec.resize(bytesRead);
-		if(vec.size() >= sizeof(USN))
-			next = *(reinterpret_cast<USN*>(vec.data()));
 
-		return vec;
+		if (bytesRead >= sizeof(USN))
+			next = *(reinterpret_cast<USN*>(buf));
+
+		return bytesRead;
+	}
+
+	void ChangeJournal::setRecordVersions(WORD minMajor, WORD maxMajor)
+	{
+		minVersion = minMajor;
+		maxVersion = maxMajor;
 	}
 
 	bool ChangeJournal::mapBuffer(std::vector<uint8_t>& buf, std::function<void(PUSN_RECORD)> func)
 	{
-		bool success = true;
-		unsigned char* begin = buf.data();
-		unsigned char* current = nullptr;
-		size_t size = buf.size();
-		
-		if (size <= (sizeof(USN) + sizeof(USN_RECORD)))
-			return false;
-
-		current = (begin + sizeof(USN));
-
-		while (current < (begin + size)) {
-			func(reinterpret_cast<PUSN_RECORD>(current));
-			current = (current + (reinterpret_cast<PUSN_RECORD>(current)->RecordLength));
-		} 		
-		
-		return success;
+		return visitBuffer(buf, func);
 	}
 
 	void ChangeJournal::mapRecords(std::function<void(PUSN_RECORD)> func)
 	{
-		bool success = true;
-		try {
-			auto data = getJournalData();
-			auto recordNum = data->FirstUsn;
-
-			while (success) {
-				auto vec = getRecords(recordNum);
-				if (!vec.size())
-					success = false;
-
-				success = mapBuffer(vec, func);
-			}
-		}
-		catch (const std::exception& e) {
-			throw std::runtime_error((std::string("[ChangeJournal] An exception occurred! Failed to map change journal records! Caught: ") + e.what()));
-		}
-
+		visitRecords(func);
 	}
 
 	std::unique_ptr<USN_JOURNAL_DATA> ChangeJournal::getJournalData()
@@ -168,44 +164,17 @@ namespace ntfs {
 
 		return success;
 	}
+}
+#endif
 
+namespace ntfs {
 	std::string usn_stringify_to_json(PUSN_RECORD rec)
 	{
-		wchar_t buf[MAX_PATH + 1] = { 0 };
-		std::stringstream ss;
-		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
-
-		if (nullptr == rec)
-			return "";
-
-		auto size = ((sizeof(wchar_t) * MAX_PATH) < USN_FIELD_BY_VERSION(rec, FileNameLength) ? sizeof(wchar_t) * MAX_PATH : USN_FIELD_BY_VERSION(rec, FileNameLength));
-
-		// This may seem like an odd choice, but we find ourselves in the strange situation of having
-		// a buffer of wchar_t's in the record that is not guarenteed to be NULL terminated, and a 
-		// byte (rather than character) count, which causes bad behavior if std::wstring(buf, count) is used,
-		// or if wstring tmp = buf is used. It's probably unlikely that FileNameLength will be bigger than 
-		// MAX_PATH * sizeof(wchar_t), but in the case that it is, we truncate (since that's an exceptional case,
-		// and our fixed-sized buffer is "MAX_PATH" in length).
-		_snwprintf_s(buf, size, L"%s", USN_FIELD_BY_VERSION(rec, FileName));
-
-		ss << "{ \"Filename\" : \"" << conv.to_bytes(buf) << "\", " << "\"MajorVersion\" : " << USN_FIELD_BY_VERSION(rec, MajorVersion) << ", \"Usn\" : "
-			<< USN_FIELD_BY_VERSION(rec, Usn) << ", \"TimeStamp\" : " << USN_FIELD_BY_VERSION(rec, TimeStamp.QuadPart) << ", \"Reason\" : " << USN_FIELD_BY_VERSION(rec, Reason)
-			<< ", \"SourceInfo\" : " << USN_FIELD_BY_VERSION(rec, SourceInfo) << ", \"SecurityId\" : " << USN_FIELD_BY_VERSION(rec, SecurityId) << ", \"FileAttributes\" : "
-			<< USN_FIELD_BY_VERSION(rec, FileAttributes) << ", \"FileReferenceNumber\" : ";
-		
-		if (rec->MajorVersion == 2) {
-			ss << reinterpret_cast<PUSN_RECORD_V2>(rec)->FileReferenceNumber << ", \"ParentFileReferenceNumber\" : "
-				<< reinterpret_cast<PUSN_RECORD_V2>(rec)->ParentFileReferenceNumber;
-		}
-		else {
-			auto tmp = reinterpret_cast<PUSN_RECORD_V3>(rec);
-			ss << "\"" << bytes_to_string(std::begin(tmp->FileReferenceNumber.Identifier), std::end(tmp->FileReferenceNumber.Identifier)) << "\", "
-			 << "\"ParentFileReferenceNumber\" : "
-			 << "\"" << bytes_to_string(std::begin(tmp->ParentFileReferenceNumber.Identifier), std::end(tmp->ParentFileReferenceNumber.Identifier)) << "\"";
-		}
-
-		ss << " }";
+		return stringify(rec, nullptr);
+	}
 
-		return ss.str();
+	std::string usn_stringify_to_json(PUSN_RECORD rec, PathResolver& paths)
+	{
+		return stringify(rec, &paths);
 	}
-}
\ No newline at end of file
+}
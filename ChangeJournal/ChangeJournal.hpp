@@ -23,16 +23,22 @@
 * SOFTWARE.
 *********************************************************************************/
 
-#include <Windows.h>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <vector>
 #include <sstream>
 #include <iomanip>
 #include <functional>
 #include <codecvt>
+#include <cstring>
 #include <stdint.h>
 #include <iostream>
 #include <string>
+#include "ntfs_compat.h"
+#include "PathResolver.hpp"
+#include "RecordJson.hpp"
+#include "UsnRecord.hpp"
 
 /// Helper macro to obtain a field from the correct offset of a given PUSN_RECORD.
 #define USN_FIELD_BY_VERSION(rec, field)\
@@ -47,9 +53,144 @@
 namespace ntfs {
 
 	constexpr uint32_t default_buffer_size = 8196;
+
+	// How much of the journal is read at once when walking all of it (by visitRecords, or a UsnCursor)
+	constexpr size_t default_batch_size = 1024 * 1024;
+#ifdef _WIN32
 	constexpr uint32_t vol_share_mask = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
 	constexpr uint32_t vol_access_mask = GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE;
+#endif
+
+	/**
+	* Forward iterator over the USN_RECORDs in a buffer filled by FSCTL_READ_USN_JOURNAL (or NtfsJournal). Record
+	* lengths come from the file system, but are still checked against the buffer before a record is handed out.
+	*/
+	class UsnRecordIterator {
+	public:
+		typedef std::forward_iterator_tag	iterator_category;
+		typedef PUSN_RECORD					value_type;
+		typedef std::ptrdiff_t				difference_type;
+		typedef PUSN_RECORD*				pointer;
+		typedef PUSN_RECORD					reference;
+
+		UsnRecordIterator() = default;
+
+		/**
+		* @throws std::runtime_error if the first record doesn't fit the buffer
+		* @param first The first record in the buffer
+		* @param end One past the last valid byte of the buffer
+		*/
+		UsnRecordIterator(unsigned char* first, unsigned char* end) : current(first), limit(end)
+		{
+			check();
+		}
+
+		PUSN_RECORD operator*() const { return reinterpret_cast<PUSN_RECORD>(current); }
+		PUSN_RECORD operator->() const { return reinterpret_cast<PUSN_RECORD>(current); }
+
+		/**
+		* @throws std::runtime_error if the next record doesn't fit the buffer
+		*/
+		UsnRecordIterator& operator++()
+		{
+			current += reinterpret_cast<PUSN_RECORD>(current)->RecordLength;
+			check();
+			return *this;
+		}
+
+		UsnRecordIterator operator++(int)
+		{
+			UsnRecordIterator prev = *this;
+			++(*this);
+			return prev;
+		}
+
+		bool operator==(const UsnRecordIterator& other) const { return current == other.current; }
+		bool operator!=(const UsnRecordIterator& other) const { return current != other.current; }
+
+	private:
+		void check()
+		{
+			if (!current || current >= limit) {
+				current = nullptr;
+				return;
+			}
 
+			// The common header (RecordLength, MajorVersion, MinorVersion) must fit before the length can be trusted
+			auto length = (static_cast<size_t>(limit - current) >= sizeof(DWORD) + 2 * sizeof(WORD)) ? reinterpret_cast<PUSN_RECORD>(current)->RecordLength : 0;
+			if (length < sizeof(DWORD) + 2 * sizeof(WORD) || length > static_cast<size_t>(limit - current))
+				throw CG_API_INTERACTION_ERROR("Malformed USN record encountered!", ERROR_INVALID_DATA);
+		}
+
+		unsigned char*	current = nullptr;
+		unsigned char*	limit = nullptr;
+	};
+
+	/**
+	* The records contained in a buffer returned by ChangeJournal::getRecords (i.e., following the leading
+	* USN), for use with range-for:
+	*
+	*     for (auto rec : usn_records(buf)) { ... }
+	*/
+	class UsnRecordRange {
+	public:
+		UsnRecordRange(std::vector<uint8_t>& buf) : UsnRecordRange(buf.data(), buf.size())
+		{
+		}
+
+		/**
+		* @param buf A buffer in the same format, e.g., as filled by ChangeJournal::readRecords
+		* @param len The number of valid bytes in buf
+		*/
+		UsnRecordRange(uint8_t* buf, size_t len) : first(buf + std::min<size_t>(len, sizeof(USN))), last(buf + len)
+		{
+		}
+
+		UsnRecordIterator begin() const { return UsnRecordIterator(first, last); }
+		UsnRecordIterator end() const { return UsnRecordIterator(); }
+
+	private:
+		unsigned char*	first;
+		unsigned char*	last;
+	};
+
+	inline UsnRecordRange usn_records(std::vector<uint8_t>& buf)
+	{
+		return UsnRecordRange(buf);
+	}
+
+	/**
+	* Returns the file reference number of the file a USN record describes. Only the low 64 bits of a
+	* 128 bit (V3) file ID are meaningful on NTFS.
+	*/
+	inline uint64_t usn_file_reference(PUSN_RECORD rec)
+	{
+		uint64_t frn = 0;
+
+		if (rec->MajorVersion == 2)
+			frn = rec->FileReferenceNumber;
+		else
+			memcpy(&frn, reinterpret_cast<PUSN_RECORD_V3>(rec)->FileReferenceNumber.Identifier, sizeof(frn));
+
+		return frn;
+	}
+
+	/**
+	* Returns the file reference number of the directory containing the file a USN record describes.
+	*/
+	inline uint64_t usn_parent_reference(PUSN_RECORD rec)
+	{
+		uint64_t frn = 0;
+
+		if (rec->MajorVersion == 2)
+			frn = rec->ParentFileReferenceNumber;
+		else
+			memcpy(&frn, reinterpret_cast<PUSN_RECORD_V3>(rec)->ParentFileReferenceNumber.Identifier, sizeof(frn));
+
+		return frn;
+	}
+
+#ifdef _WIN32
 	class ChangeJournal {
 	public:
 		ChangeJournal(std::shared_ptr<void> vol);
@@ -87,8 +228,23 @@ namespace ntfs {
 		*/
 		std::vector<uint8_t> getRecords(USN& next);
 
+		/**
+		* Same as getRecords, but reads into a buffer the caller owns (and can reuse), and doesn't query the
+		* journal first.
+		*
+		* @throws std::runtime_error if operation fails fatally (e.g., volume handle is bad, or journalId isn't the
+		*         current journal's)
+		* @param next As input, the USN to start with; replaced upon completion with the next USN past the records read.
+		* @param journalId The ID of the journal to read, as returned by getJournalData
+		* @param buf The buffer to read into
+		* @param len The size of buf, in bytes
+		* @return the number of bytes of buf filled; sizeof(USN) or less indicates that no more items were available
+		*/
+		size_t readRecords(USN& next, DWORDLONG journalId, uint8_t* buf, size_t len);
+
 		/**
 		* Walks the buffer of USN_RECORDs contained in vector buf, and applies callable func to each or them.
+		* A thin wrapper around visitBuffer.
 		*
 		* @param buf Vector containing a buffer of USN_RECORDs
 		* @param func A std::function that will be called with a pointer to each record in the buffer.
@@ -98,13 +254,36 @@ namespace ntfs {
 		bool mapBuffer(std::vector<uint8_t>& buf, std::function<void(PUSN_RECORD)> func);
 
 		/**
-		* Walks the change journal, starting from the first record, and maps func over all records.
+		* Walks the change journal, starting from the first record, and maps func over all records. A thin
+		* wrapper around visitRecords.
 		*
 		* @throws std::runtime_error if an exception occurs during processing.
 		* @param func a std::function that will be called with a pointer to each record in the change journal
 		*/
 		void mapRecords(std::function<void(PUSN_RECORD)> func);
 
+		/**
+		* Same as mapBuffer, but takes any callable, so that it can be inlined into the loop.
+		*
+		* @throws std::runtime_error if a record doesn't fit the buffer
+		* @param buf Vector containing a buffer of USN_RECORDs
+		* @param func Called as func(PUSN_RECORD) for each record in the buffer.
+		* @return Will return true unless the buffer is <= sizeof(USN) + sizeof(USN_RECORD); used to indicate
+		*         termination of operation.
+		*/
+		template <typename Func>
+		bool visitBuffer(std::vector<uint8_t>& buf, Func&& func);
+
+		/**
+		* Same as mapRecords, but takes any callable, so that it can be inlined into the loop. The journal is
+		* queried once, and read default_batch_size bytes at a time into a single buffer.
+		*
+		* @throws std::runtime_error if an exception occurs during processing.
+		* @param func Called as func(PUSN_RECORD) for each record in the change journal.
+		*/
+		template <typename Func>
+		void visitRecords(Func&& func);
+
 		/**
 		* Retrieve the current USN Change Journal's data.
 		*
@@ -114,6 +293,16 @@ namespace ntfs {
 		*/
 		std::unique_ptr<USN_JOURNAL_DATA> getJournalData();
 
+		/**
+		* Sets the major versions of the records to read. Only V2 records are read by default; asking for anything
+		* else reads with READ_USN_JOURNAL_DATA_V1, which needs Windows 8 or later. Range tracking (V4) records
+		* also need range tracking to be enabled on the journal.
+		*
+		* @param minMajor The oldest version to return
+		* @param maxMajor The newest version to return
+		*/
+		void setRecordVersions(WORD minMajor, WORD maxMajor);
+
 		/**
 		* Attempts to create a new USN Change Journal
 		*
@@ -141,8 +330,11 @@ namespace ntfs {
 
 	private:
 		std::shared_ptr<void> vhandle;
+		WORD minVersion = 2;
+		WORD maxVersion = 2;
 
 	};
+#endif
 
 	/**
 	* Converts a congiuous range of bytes to a hex string
@@ -162,13 +354,59 @@ namespace ntfs {
 		return oss.str();
 	}
 
-	
 	/**
-	* Will generate a JSON string out of the provided USN_RECORD.
+	* Will generate a JSON string out of the provided USN_RECORD. Meant for the odd record; use
+	* UsnRecordJson to write many of them.
 	*
 	* @param rec A pointer to the USN_RECORD to serialize.
 	* @return a std::string containing the serialized record, or an empty string if a NULL value was provided.
 	*/
 	std::string usn_stringify_to_json(PUSN_RECORD rec);
 
+	/**
+	* Will generate a JSON string out of the provided USN_RECORD, adding the full path of the file ("Path")
+	* whenever paths knows the file's parent directory.
+	*
+	* @param rec A pointer to the USN_RECORD to serialize.
+	* @param paths A resolver built from the same volume's MFT.
+	* @return a std::string containing the serialized record, or an empty string if a NULL value was provided.
+	*/
+	std::string usn_stringify_to_json(PUSN_RECORD rec, PathResolver& paths);
+
+#ifdef _WIN32
+	template <typename Func>
+	bool ChangeJournal::visitBuffer(std::vector<uint8_t>& buf, Func&& func)
+	{
+		if (buf.size() <= (sizeof(USN) + sizeof(USN_RECORD)))
+			return false;
+
+		for (auto rec : usn_records(buf))
+			func(rec);
+
+		return true;
+	}
+
+	template <typename Func>
+	void ChangeJournal::visitRecords(Func&& func)
+	{
+		try {
+			auto					data = getJournalData();
+			auto					recordNum = data->FirstUsn;
+			std::vector<uint8_t>	buf(default_batch_size);
+
+			for (;;) {
+				size_t len = readRecords(recordNum, data->UsnJournalID, buf.data(), buf.size());
+				if (len <= sizeof(USN))
+					break;
+
+				for (auto rec : UsnRecordRange(buf.data(), len))
+					func(rec);
+			}
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error((std::string("[ChangeJournal] An exception occurred! Failed to map change journal records! Caught: ") + e.what()));
+		}
+	}
+#endif
+
 }
\ No newline at end of file
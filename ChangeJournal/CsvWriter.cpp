@@ -0,0 +1,172 @@
+#include "CsvWriter.hpp"
+#include "TextFormat.hpp"
+#include <algorithm>
+
+namespace {
+	inline bool needs_quotes(uint32_t c)
+	{
+		return ',' == c || '"' == c || '\r' == c || '\n' == c;
+	}
+
+	template <typename Char>
+	bool any_needs_quotes(const Char* s, size_t len)
+	{
+		for (size_t i = 0; i < len; ++i) {
+			if (needs_quotes(static_cast<uint16_t>(s[i])))
+				return true;
+		}
+
+		return false;
+	}
+
+	// Quotes inside a quoted field are doubled
+	inline char* write_quoted(char* p, char c)
+	{
+		if ('"' == c)
+			*p++ = '"';
+
+		*p++ = c;
+		return p;
+	}
+}
+
+namespace ntfs {
+
+	CsvWriter::CsvWriter(size_t capacity) : buf(new char[std::max<size_t>(capacity, 64)]), cap(std::max<size_t>(capacity, 64))
+	{
+	}
+
+	CsvWriter& CsvWriter::field(const WCHAR* s, size_t count)
+	{
+		bool quoted = any_needs_quotes(s, count);
+
+		// At worst, every code unit becomes three bytes, or a doubled quote
+		char* p = beginField(count * 3 + 2);
+
+		if (quoted) {
+			*p++ = '"';
+			p = format_utf8(p, s, count, write_quoted);
+			*p++ = '"';
+		}
+		else {
+			p = format_utf8(p, s, count, [](char* q, char c) {
+				*q = c;
+				return q + 1;
+			});
+		}
+
+		len = p - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::field(const char* s, size_t count)
+	{
+		bool	quoted = any_needs_quotes(reinterpret_cast<const unsigned char*>(s), count);
+		char*	p = beginField(count * 2 + 2);
+
+		if (quoted) {
+			*p++ = '"';
+			for (size_t i = 0; i < count; ++i)
+				p = write_quoted(p, s[i]);
+			*p++ = '"';
+		}
+		else {
+			memcpy(p, s, count);
+			p += count;
+		}
+
+		len = p - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::hexField(uint64_t v)
+	{
+		char* p = beginField(18);
+
+		*p++ = '0';
+		*p++ = 'x';
+		len = format_hex(p, v) - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::hexField(uint64_t high, uint64_t low)
+	{
+		char* p = beginField(34);
+
+		*p++ = '0';
+		*p++ = 'x';
+		p = format_hex(p, high);
+		len = format_hex(p, low) - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::emptyField()
+	{
+		len = beginField(0) - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::names(const char* names)
+	{
+		size_t	n = strlen(names);
+		char*	p = beginField(n);
+
+		memcpy(p, names, n);
+		len = p + n - buf.get();
+		return endRow();
+	}
+
+	CsvWriter& CsvWriter::endRow()
+	{
+		if (cap - len < 2)
+			grow(2);
+
+		buf[len++] = '\r';
+		buf[len++] = '\n';
+		first = true;
+		return *this;
+	}
+
+	void CsvWriter::clear()
+	{
+		len = 0;
+		first = true;
+	}
+
+	char* CsvWriter::beginField(size_t n)
+	{
+		if (cap - len < n + 1)
+			grow(n + 1);
+
+		char* p = buf.get() + len;
+
+		if (!first)
+			*p++ = ',';
+
+		first = false;
+		return p;
+	}
+
+	void CsvWriter::grow(size_t n)
+	{
+		size_t					newCap = std::max(cap * 2, len + n);
+		std::unique_ptr<char[]>	newBuf(new char[newCap]);
+
+		memcpy(newBuf.get(), buf.get(), len);
+		buf = std::move(newBuf);
+		cap = newCap;
+	}
+
+	CsvWriter& CsvWriter::writeUnsigned(uint64_t v)
+	{
+		len = format_decimal(beginField(max_decimal_length), v) - buf.get();
+		return *this;
+	}
+
+	CsvWriter& CsvWriter::writeSigned(int64_t v)
+	{
+		len = format_decimal(beginField(max_decimal_length), v) - buf.get();
+		return *this;
+	}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <stdint.h>
+#include "ntfs_compat.h"
+
+namespace ntfs {
+
+	constexpr size_t default_csv_capacity = 64 * 1024;
+
+	/**
+	* Writes RFC 4180 CSV straight into a buffer it owns; the CSV counterpart of JsonWriter. Fields are only
+	* quoted when they hold a comma, a quote or a line break, and UTF-16 text is transcoded to UTF-8.
+	*
+	* Separators are placed automatically; endRow() ends each row with CRLF.
+	*
+	*     csv.field(usn).field(name, len).endRow();
+	*/
+	class CsvWriter {
+	public:
+		/**
+		* @param capacity The initial size of the buffer, in bytes
+		*/
+		CsvWriter(size_t capacity = default_csv_capacity);
+
+		/**
+		* Writes an integer.
+		*/
+		template <typename T>
+		typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, CsvWriter&>::type field(T v)
+		{
+			return std::is_signed<T>::value ? writeSigned(static_cast<int64_t>(v)) : writeUnsigned(static_cast<uint64_t>(v));
+		}
+
+		/**
+		* Writes a UTF-16 string, transcoded to UTF-8.
+		*
+		* @param s The string, which needn't be NUL terminated
+		* @param len The length of s, in characters
+		*/
+		CsvWriter& field(const WCHAR* s, size_t len);
+
+		/**
+		* Writes a UTF-8 string.
+		*
+		* @param s The string, which needn't be NUL terminated
+		* @param len The length of s, in bytes
+		*/
+		CsvWriter& field(const char* s, size_t len);
+
+		/**
+		* Writes a 64 bit value as 16 hex digits (e.g., 0x000000000000002a).
+		*/
+		CsvWriter& hexField(uint64_t v);
+
+		/**
+		* Writes a 128 bit value as 32 hex digits, high half first.
+		*/
+		CsvWriter& hexField(uint64_t high, uint64_t low);
+
+		CsvWriter& emptyField();
+
+		/**
+		* Writes a whole row of field names (e.g., a header); names are written as is, so they must not need quoting.
+		*
+		* @param names The names, separated by commas
+		*/
+		CsvWriter& names(const char* names);
+
+		CsvWriter& endRow();
+
+		/**
+		* Returns what's been written so far; size() bytes long, and not NUL terminated.
+		*/
+		const char* data() const { return buf.get(); }
+		size_t size() const { return len; }
+
+		std::string str() const { return std::string(buf.get(), len); }
+
+		/**
+		* Discards what's been written, keeping the buffer.
+		*/
+		void clear();
+
+	private:
+		// Makes room for a separator and n more bytes, writes the separator, and returns where the bytes go
+		char* beginField(size_t n);
+
+		void grow(size_t n);
+		CsvWriter& writeUnsigned(uint64_t v);
+		CsvWriter& writeSigned(int64_t v);
+
+		std::unique_ptr<char[]>	buf;
+		size_t					len = 0;
+		size_t					cap = 0;
+		bool					first = true;	// whether the next field starts a row
+	};
+
+}
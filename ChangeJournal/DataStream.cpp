@@ -0,0 +1,410 @@
+#include "DataStream.hpp"
+#include "AttributeVisitor.hpp"
+#include "Lznt1.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+
+namespace {
+	// Handed out by stream() for sparse and uninitialized ranges, so that they never cost a read
+	const uint8_t zero_block[64 * 1024] = {};
+
+	// No version of NTFS uses compression units of more than 16 clusters; this leaves plenty of room
+	constexpr uint8_t max_compression_unit = 8;
+
+	bool has_name(ntfs::NTFS_ATTRIBUTE* attr, const std::basic_string<WCHAR>& name)
+	{
+		if (attr->NameLen != name.size())
+			return false;
+
+		if (attr->NameOffset + (attr->NameLen * sizeof(WCHAR)) > attr->Length)
+			throw DATA_STREAM_ERROR("Attribute name lies outside of the attribute!", ERROR_FILE_CORRUPT);
+
+		return std::equal(name.begin(), name.end(), reinterpret_cast<WCHAR*>(reinterpret_cast<unsigned char*>(attr) + attr->NameOffset));
+	}
+}
+
+namespace ntfs {
+
+	DataStream::DataStream(VolOps& vol, uint64_t recNum, const std::basic_string<WCHAR>& name, size_t readahead) : device(vol.getBlockDevice()), bytesPerCluster(0), readahead(std::max<size_t>(readahead, 1))
+	{
+		bool found = false;
+		bool lznt1 = false;
+
+		if (!device)
+			throw DATA_STREAM_ERROR("Reading file data needs a block device!", ERROR_NOT_SUPPORTED);
+
+		bytesPerCluster = vol.getGeometry().bytesPerCluster;
+
+		// The runs are taken from the records just read, rather than from a cache that may be stale
+		auto recs = vol.getFileRecords(recNum);
+		for (auto& rec : recs) {
+			for (auto attr : attributes(rec)) {
+				if (NtfsAttributeType::AttributeData != attr->AttributeType || !has_name(attr, name))
+					continue;
+
+				USHORT format = attr->Flags & AttributeCompressionMask;
+				if ((attr->Flags & AttributeEncrypted) || (format && AttributeCompressed != format))
+					throw DATA_STREAM_ERROR("Encrypted streams, and compression formats other than LZNT1, are not supported!", ERROR_NOT_SUPPORTED);
+
+				// Resident values are never actually compressed, whatever their flags say
+				if (!attr->NonResident) {
+					auto data = resident_value<uint8_t>(attr);
+					value.assign(data, data + reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength);
+					dataSize = initSize = value.size();
+					map.reset();
+					return;
+				}
+
+				if (attr->Length < sizeof(NTFS_NONRESIDENT_ATTRIBUTE))
+					throw DATA_STREAM_ERROR("Data attribute is truncated!", ERROR_FILE_CORRUPT);
+
+				if (!map)
+					map.reset(new ExtentMap());
+				map->addSegment(reinterpret_cast<NTFS_NONRESIDENT_ATTRIBUTE*>(attr));
+				isSparse = isSparse || (attr->Flags & AttributeSparse);
+				lznt1 = lznt1 || format;
+				found = true;
+			}
+		}
+
+		if (!found)
+			throw DATA_STREAM_ERROR("Requested data stream was not found!", ERROR_FILE_NOT_FOUND);
+
+		dataSize = map->dataSize();
+		initSize = std::min(map->initializedSize(), dataSize);
+
+		if (lznt1) {
+			if (!map->compressionUnit() || map->compressionUnit() > max_compression_unit)
+				throw DATA_STREAM_ERROR("Compressed stream has a bad compression unit size!", ERROR_FILE_CORRUPT);
+
+			unitSize = static_cast<size_t>(bytesPerCluster) << map->compressionUnit();
+		}
+	}
+
+	size_t DataStream::read(void* buf, size_t len)
+	{
+		uint8_t*	out = static_cast<uint8_t*>(buf);
+		size_t		done = 0;
+
+		if (position >= dataSize)
+			return 0;
+
+		len = static_cast<size_t>(std::min<uint64_t>(len, dataSize - position));
+
+		// Nothing is gained by going through the window when the caller's buffer is at least as big
+		if (!map || len >= readahead) {
+			done = copy(position, out, len);
+			position += done;
+			return done;
+		}
+
+		while (done < len) {
+			if (position < windowOffset || position >= windowOffset + windowLen) {
+				window.resize(readahead);
+				windowOffset = position;
+				windowLen = copy(position, window.data(), readahead);
+				if (!windowLen)
+					break;
+			}
+
+			size_t n = static_cast<size_t>(std::min<uint64_t>(len - done, windowOffset + windowLen - position));
+			memcpy(out + done, window.data() + (position - windowOffset), n);
+			done += n;
+			position += n;
+		}
+
+		return done;
+	}
+
+	size_t DataStream::readAt(uint64_t offset, void* buf, size_t len)
+	{
+		return copy(offset, static_cast<uint8_t*>(buf), len);
+	}
+
+	bool DataStream::stream(std::function<bool(uint64_t, const uint8_t*, size_t)> func, uint64_t offset, uint64_t len)
+	{
+		if (offset >= dataSize)
+			return true;
+
+		uint64_t end = offset + std::min(len, dataSize - offset);
+
+		if (!map)
+			return func(offset, value.data() + offset, static_cast<size_t>(end - offset));
+
+		if (unitSize)
+			return streamCompressed(func, offset, end);
+
+		while (offset < end) {
+			int64_t			deviceOffset = 0;
+			size_t			n = extent(offset, end, deviceOffset);
+			const uint8_t*	data = zero_block;
+
+			if (deviceOffset < 0) {
+				n = std::min(n, sizeof(zero_block));
+			}
+			else if (!(data = device->view(deviceOffset, n))) {
+				// The window is about to be overwritten, so read() mustn't trust it any longer
+				window.resize(readahead);
+				windowLen = 0;
+				device->read(deviceOffset, window.data(), n);
+				data = window.data();
+			}
+
+			if (!func(offset, data, n))
+				return false;
+
+			offset += n;
+		}
+
+		return true;
+	}
+
+	uint64_t DataStream::nextDataOffset(uint64_t offset) const
+	{
+		if (offset >= dataSize)
+			return dataSize;
+
+		if (!map || unitSize)
+			return offset;
+
+		while (offset < initSize) {
+			uint64_t	remaining = 0;
+			int64_t		lcn = map->lookup(offset / bytesPerCluster, &remaining);
+
+			// Unmapped ranges are left for the read to complain about
+			if (sparse_lcn != lcn || !remaining)
+				return offset;
+
+			offset = ((offset / bytesPerCluster) + remaining) * bytesPerCluster;
+		}
+
+		return dataSize;
+	}
+
+	size_t DataStream::extent(uint64_t offset, uint64_t end, int64_t& deviceOffset) const
+	{
+		uint64_t	len = std::min<uint64_t>(end - offset, readahead);
+		uint64_t	remaining = 0;
+
+		// Past the initialized size the stream reads as zeros, whatever the runs say
+		if (offset >= initSize) {
+			deviceOffset = -1;
+			return static_cast<size_t>(len);
+		}
+
+		len = std::min(len, initSize - offset);
+
+		int64_t lcn = map->lookup(offset / bytesPerCluster, &remaining);
+		if (unmapped_lcn == lcn)
+			throw DATA_STREAM_ERROR("Requested range is not mapped by the stream's data runs!", ERROR_FILE_CORRUPT);
+
+		len = std::min(len, (remaining * bytesPerCluster) - (offset % bytesPerCluster));
+		deviceOffset = (sparse_lcn == lcn) ? -1 : static_cast<int64_t>((lcn * bytesPerCluster) + (offset % bytesPerCluster));
+
+		return static_cast<size_t>(len);
+	}
+
+	size_t DataStream::copy(uint64_t offset, uint8_t* out, size_t len)
+	{
+		if (offset >= dataSize)
+			return 0;
+
+		len = static_cast<size_t>(std::min<uint64_t>(len, dataSize - offset));
+
+		if (!map) {
+			memcpy(out, value.data() + offset, len);
+			return len;
+		}
+
+		if (unitSize)
+			return copyCompressed(offset, out, len);
+
+		for (size_t done = 0; done < len;) {
+			int64_t	deviceOffset = 0;
+			size_t	n = extent(offset + done, offset + len, deviceOffset);
+
+			if (deviceOffset < 0)
+				memset(out + done, 0, n);
+			else
+				device->read(deviceOffset, out + done, n);
+
+			done += n;
+		}
+
+		return len;
+	}
+
+	size_t DataStream::copyCompressed(uint64_t offset, uint8_t* out, size_t len)
+	{
+		uint64_t	end = offset + len;
+		uint64_t	dataEnd = std::min(end, initSize);
+		uint64_t	pos = offset;
+
+		while (pos < dataEnd) {
+			uint64_t	first = pos / unitSize;
+			uint64_t	count = 0;
+
+			// Whole units are decompressed straight into the caller's buffer; partial ones go through units
+			if (0 == pos % unitSize)
+				count = std::min<uint64_t>({ batchUnits(), (end - pos) / unitSize, ((dataEnd + unitSize - 1) / unitSize) - first });
+
+			if (count) {
+				decodeUnits(first, static_cast<size_t>(count), out + (pos - offset));
+				pos += count * unitSize;
+				continue;
+			}
+
+			if (cachedUnit != first) {
+				units.resize(unitSize);
+				cachedUnit = UINT64_MAX;
+				decodeUnits(first, 1, units.data());
+				cachedUnit = first;
+			}
+
+			size_t n = static_cast<size_t>(std::min(end, (first + 1) * unitSize) - pos);
+			memcpy(out + (pos - offset), units.data() + (pos % unitSize), n);
+			pos += n;
+		}
+
+		// Past the initialized size the stream reads as zeros, whatever the units decompress to
+		if (end > initSize) {
+			uint64_t zeroFrom = std::max(offset, initSize);
+			memset(out + (zeroFrom - offset), 0, static_cast<size_t>(end - zeroFrom));
+		}
+
+		return len;
+	}
+
+	bool DataStream::streamCompressed(std::function<bool(uint64_t, const uint8_t*, size_t)>& func, uint64_t offset, uint64_t end)
+	{
+		while (offset < end) {
+			if (offset >= initSize) {
+				size_t n = static_cast<size_t>(std::min<uint64_t>(end - offset, sizeof(zero_block)));
+				if (!func(offset, zero_block, n))
+					return false;
+
+				offset += n;
+				continue;
+			}
+
+			uint64_t	first = offset / unitSize;
+			size_t		count = static_cast<size_t>(std::min<uint64_t>(batchUnits(), ((std::min(end, initSize) + unitSize - 1) / unitSize) - first));
+			uint64_t	batchStart = first * unitSize;
+			uint64_t	batchEnd = batchStart + (count * unitSize);
+
+			units.resize(count * unitSize);
+			cachedUnit = UINT64_MAX;
+			decodeUnits(first, count, units.data());
+
+			if (batchEnd > initSize)
+				memset(units.data() + (initSize - batchStart), 0, static_cast<size_t>(batchEnd - initSize));
+
+			uint64_t pieceEnd = std::min(end, batchEnd);
+			if (!func(offset, units.data() + (offset - batchStart), static_cast<size_t>(pieceEnd - offset)))
+				return false;
+
+			offset = pieceEnd;
+		}
+
+		return true;
+	}
+
+	size_t DataStream::batchUnits() const
+	{
+		return std::max<size_t>(1, readahead / unitSize);
+	}
+
+	void DataStream::decodeUnits(uint64_t first, size_t count, uint8_t* out)
+	{
+		scratch.resize(count * unitSize);
+
+		if (count > 1 && !pool)
+			pool = std::make_shared<WorkStealingPool>();
+
+		if (count < 2 || pool->threadCount() < 2) {
+			for (size_t i = 0; i < count; ++i)
+				decodeUnit(first + i, out + (i * unitSize), scratch.data());
+			return;
+		}
+
+		// The pool may be shared with other streams, so this waits on its own units rather than on the pool
+		std::mutex				lock;
+		std::condition_variable	done;
+		size_t					remaining = count;
+		std::exception_ptr		error;
+
+		for (size_t i = 0; i < count; ++i) {
+			pool->submit([&, i] {
+				try {
+					decodeUnit(first + i, out + (i * unitSize), scratch.data() + (i * unitSize));
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> guard(lock);
+					if (!error)
+						error = std::current_exception();
+				}
+
+				std::lock_guard<std::mutex> guard(lock);
+				if (!--remaining)
+					done.notify_all();
+			});
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [&] { return 0 == remaining; });
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	void DataStream::decodeUnit(uint64_t unit, uint8_t* out, uint8_t* raw) const
+	{
+		uint64_t	unitClusters = unitSize / bytesPerCluster;
+		uint64_t	vcn = unit * unitClusters;
+		uint64_t	stored = 0;
+		bool		hole = false;
+
+		// A unit is stored one of three ways: entirely sparse (all zeros), with every cluster allocated
+		// (not compressed at all), or as compressed data in its first clusters followed by a sparse run.
+		for (uint64_t v = vcn; v < vcn + unitClusters;) {
+			uint64_t	remaining = 0;
+			int64_t		lcn = map->lookup(v, &remaining);
+
+			if (unmapped_lcn == lcn) {
+				if (v < map->clusterCount())
+					throw DATA_STREAM_ERROR("Compression unit is not mapped by the stream's data runs!", ERROR_FILE_CORRUPT);
+				break;
+			}
+
+			uint64_t n = std::min(remaining, vcn + unitClusters - v);
+			if (sparse_lcn == lcn)
+				hole = true;
+			else if (hole)
+				throw DATA_STREAM_ERROR("Compression unit has data after its sparse run!", ERROR_FILE_CORRUPT);
+			else
+				stored += n;
+
+			v += n;
+		}
+
+		uint8_t* dest = hole ? raw : out;
+		for (uint64_t v = vcn; v < vcn + stored;) {
+			uint64_t	remaining = 0;
+			int64_t		lcn = map->lookup(v, &remaining);
+			uint64_t	n = std::min(remaining, vcn + stored - v);
+
+			device->read(static_cast<uint64_t>(lcn) * bytesPerCluster, dest + ((v - vcn) * bytesPerCluster), static_cast<size_t>(n * bytesPerCluster));
+			v += n;
+		}
+
+		size_t produced = static_cast<size_t>(stored * bytesPerCluster);
+		if (hole)
+			produced = stored ? lznt1_decompress(raw, produced, out, unitSize) : 0;
+
+		memset(out + produced, 0, unitSize - produced);
+	}
+
+}
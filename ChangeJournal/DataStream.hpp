@@ -0,0 +1,191 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_defs.h"
+#include "VolumeOptions.hpp"
+#include "ThreadPool.hpp"
+
+#define DATA_STREAM_ERROR(msg, err)\
+	std::runtime_error(("[DataStream] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	// The most a stream reads from the device at once, and the size of its readahead window
+	constexpr size_t default_stream_readahead = 1024 * 1024;
+
+	/**
+	* Reads the contents of one of a file's $DATA streams (the unnamed stream, or a named alternate stream)
+	* straight off a block device, following the stream's data runs. Physically contiguous runs are read
+	* with one read each, up to the readahead size. Sparse runs, and everything between the stream's
+	* initialized size and its data size, are returned as zeros without touching the device.
+	*
+	* Compressed (LZNT1) streams are read a compression unit at a time. When a read spans several units,
+	* they're read and decompressed in parallel on a thread pool, which is either shared with setThreadPool
+	* or started on first use.
+	*
+	* There are two ways to read: read()/readAt() copy into the caller's buffer, and stream() hands the
+	* caller each piece of the file in turn, pointing straight into the image when it's memory mapped.
+	* A DataStream is not safe to use from several threads at once; open one per thread instead.
+	*/
+	class DataStream {
+	public:
+		/**
+		* Locates the stream, following the file's attribute list if it has one.
+		*
+		* @throws std::runtime_error if no block device is set, the file's records can't be read, the file has
+		*         no such stream, or the stream is encrypted or compressed with something other than LZNT1
+		* @param vol The volume the file lives on; must outlive the DataStream
+		* @param recNum The file's base record
+		* @param name The name of the stream; empty for the unnamed (default) stream
+		* @param readahead The size of the readahead window, in bytes
+		*/
+		DataStream(VolOps& vol, uint64_t recNum, const std::basic_string<WCHAR>& name = std::basic_string<WCHAR>(), size_t readahead = default_stream_readahead);
+
+		/**
+		* Returns the size of the stream, in bytes.
+		*/
+		uint64_t size() const { return dataSize; }
+
+		/**
+		* Returns the number of bytes at the start of the stream that have ever been written; the rest read as zeros.
+		*/
+		uint64_t initializedSize() const { return initSize; }
+
+		/**
+		* Indicates whether the stream's value is stored inside its file record.
+		*/
+		bool resident() const { return !map; }
+
+		/**
+		* Indicates whether the stream is marked sparse.
+		*/
+		bool sparse() const { return isSparse; }
+
+		/**
+		* Indicates whether the stream is compressed.
+		*/
+		bool compressed() const { return 0 != unitSize; }
+
+		/**
+		* Shares a thread pool for decompressing compression units, e.g., between the streams of every file
+		* being hashed. Must not be called with the pool a stream is itself being read from.
+		*
+		* @param pool The pool to decompress on; an empty pointer goes back to starting one on first use
+		*/
+		void setThreadPool(std::shared_ptr<WorkStealingPool> pool) { this->pool = pool; }
+
+		/**
+		* Finds where the stream's data resumes after a hole, by walking its data runs rather than reading
+		* zeros (much like SEEK_DATA). Streams that aren't sparse (and compressed or resident ones) have no
+		* holes to skip, so offset is returned as is.
+		*
+		* @param offset The offset into the stream to start looking from
+		* @return the offset of the first byte at or after offset that isn't in a sparse run, or size() if
+		*         there's nothing but holes (or zeros past the initialized size) from offset onward
+		*/
+		uint64_t nextDataOffset(uint64_t offset) const;
+
+		/**
+		* Returns the offset the next read() begins at.
+		*/
+		uint64_t tell() const { return position; }
+
+		/**
+		* Moves the offset the next read() begins at; seeking past the end is allowed, and reads nothing.
+		*/
+		void seek(uint64_t offset) { position = offset; }
+
+		/**
+		* Reads from the current position onward, and advances the position past what was read. Small reads
+		* are served from the readahead window; large ones are read straight into buf.
+		*
+		* @throws std::runtime_error if the device can't be read, or part of the stream isn't mapped
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		* @return the number of bytes read, which is only less than len at the end of the stream
+		*/
+		size_t read(void* buf, size_t len);
+
+		/**
+		* Reads from an arbitrary offset, leaving the current position (and the readahead window) alone.
+		*
+		* @throws std::runtime_error if the device can't be read, or part of the stream isn't mapped
+		* @param offset The offset into the stream to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		* @return the number of bytes read, which is only less than len at the end of the stream
+		*/
+		size_t readAt(uint64_t offset, void* buf, size_t len);
+
+		/**
+		* Hands a range of the stream to func, a piece at a time and in order, without copying it when the
+		* device is memory mapped. Pieces are never longer than the readahead size (or, for compressed
+		* streams, one compression unit if that's larger), and the pointer passed to func is only good until
+		* func returns.
+		*
+		* @throws std::runtime_error if the device can't be read, part of the stream isn't mapped, or func throws
+		* @param func Called as func(offset, data, len) for each piece; returns false to stop early
+		* @param offset The offset into the stream to begin at
+		* @param len The number of bytes to hand over; clamped to the end of the stream
+		* @return false if func stopped early, true otherwise
+		*/
+		bool stream(std::function<bool(uint64_t, const uint8_t*, size_t)> func, uint64_t offset = 0, uint64_t len = UINT64_MAX);
+
+	private:
+		size_t extent(uint64_t offset, uint64_t end, int64_t& deviceOffset) const;
+		size_t copy(uint64_t offset, uint8_t* out, size_t len);
+		size_t copyCompressed(uint64_t offset, uint8_t* out, size_t len);
+		bool streamCompressed(std::function<bool(uint64_t, const uint8_t*, size_t)>& func, uint64_t offset, uint64_t end);
+		size_t batchUnits() const;
+		void decodeUnits(uint64_t first, size_t count, uint8_t* out);
+		void decodeUnit(uint64_t unit, uint8_t* out, uint8_t* raw) const;
+
+		std::shared_ptr<BlockDevice>		device;
+		uint64_t							bytesPerCluster;
+		size_t								readahead;
+		std::unique_ptr<ExtentMap>			map;		// empty for resident streams
+		std::vector<uint8_t>				value;		// the value of a resident stream
+		uint64_t							dataSize = 0;
+		uint64_t							initSize = 0;
+		bool								isSparse = false;
+		size_t								unitSize = 0;	// the size of a compression unit; 0 if not compressed
+		std::shared_ptr<WorkStealingPool>	pool;
+		std::vector<uint8_t>				units;		// decompressed units, for ranges that don't cover them
+		uint64_t							cachedUnit = UINT64_MAX;	// the unit units holds for copyCompressed
+		std::vector<uint8_t>				scratch;	// compressed units, as read from the device
+		uint64_t							position = 0;
+		std::vector<uint8_t>				window;		// allocated on first use
+		uint64_t							windowOffset = 0;
+		size_t								windowLen = 0;
+	};
+
+}
@@ -0,0 +1,529 @@
+#include "FileIndex.hpp"
+#include "AttributeVisitor.hpp"
+#include "IndexSnapshot.hpp"
+#include "MftReader.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+	enum ParsedTime {
+		TimeCreation = 0,
+		TimeChange,
+		TimeWrite,
+		TimeAccess
+	};
+
+	struct ColumnSource {
+		const void*	data;
+		uint64_t	bytes;
+		uint32_t	elementSize;
+	};
+
+	template <typename T>
+	ColumnSource column_source(const ntfs::IndexColumn<T>& col)
+	{
+		return { col.data(), col.size() * sizeof(T), sizeof(T) };
+	}
+
+	// Points col at its column within a mapped snapshot, after checking that the column holds what we expect
+	template <typename T>
+	void attach_column(ntfs::IndexColumn<T>& col, const ntfs::SnapshotHeader& header, ntfs::SnapshotColumnId id, const uint8_t* base, bool verify)
+	{
+		auto& desc = header.Columns[id];
+
+		if (sizeof(T) != desc.ElementSize || (ntfs::SnapshotNames != id && desc.Bytes / sizeof(T) != header.RecordCount))
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot column has an unexpected shape!", ERROR_FILE_CORRUPT);
+
+		if (verify && ntfs::crc32c(base + desc.Offset, static_cast<size_t>(desc.Bytes)) != desc.Checksum)
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot column checksum mismatch!", ERROR_FILE_CORRUPT);
+
+		col.attach(reinterpret_cast<const T*>(base + desc.Offset), static_cast<size_t>(desc.Bytes / sizeof(T)));
+	}
+}
+
+namespace ntfs {
+
+	void FileIndex::build(VolOps& vol, const ParallelScanOptions& opts)
+	{
+		*this = FileIndex();
+		state.volumeSerial = vol.getGeometry().volumeSerial;
+		resize(static_cast<size_t>(vol.getFileCount()));
+
+		vol.parallelScan([](uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size) {
+			Parsed p;
+			parse(recNum, record, size, p);
+			return p;
+		}, [this](uint64_t, const Parsed& p) {
+			merge(p);
+		}, opts);
+
+		shrink();
+	}
+
+	void FileIndex::addRecord(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size)
+	{
+		Parsed p;
+
+		parse(recNum, record, size, p);
+		merge(p);
+	}
+
+	void FileIndex::refresh(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size)
+	{
+		Parsed p;
+
+		parse(recNum, record, size, p);
+		clearRow(recNum);
+		merge(p);
+	}
+
+	void FileIndex::remove(uint64_t recNum)
+	{
+		clearRow(recNum);
+	}
+
+	void FileIndex::shrink()
+	{
+		// Mapped columns have no spare capacity to give back
+		if (backing)
+			return;
+
+		sequenceCol.edit().shrink_to_fit();
+		flagCol.edit().shrink_to_fit();
+		nameTypeCol.edit().shrink_to_fit();
+		nameLenCol.edit().shrink_to_fit();
+		nameOffsetCol.edit().shrink_to_fit();
+		attributeCol.edit().shrink_to_fit();
+		parentCol.edit().shrink_to_fit();
+		dataSizeCol.edit().shrink_to_fit();
+		allocSizeCol.edit().shrink_to_fit();
+		creationCol.edit().shrink_to_fit();
+		changeCol.edit().shrink_to_fit();
+		writeCol.edit().shrink_to_fit();
+		accessCol.edit().shrink_to_fit();
+		pool.edit().shrink_to_fit();
+	}
+
+	uint64_t FileIndex::size() const
+	{
+		return flagCol.size();
+	}
+
+	uint64_t FileIndex::fileCount() const
+	{
+		return files;
+	}
+
+	uint64_t FileIndex::memoryUsage() const
+	{
+		return sequenceCol.heapBytes() + flagCol.heapBytes() + nameTypeCol.heapBytes() + nameLenCol.heapBytes()
+			+ nameOffsetCol.heapBytes() + attributeCol.heapBytes() + parentCol.heapBytes() + dataSizeCol.heapBytes()
+			+ allocSizeCol.heapBytes() + creationCol.heapBytes() + changeCol.heapBytes() + writeCol.heapBytes()
+			+ accessCol.heapBytes() + pool.heapBytes();
+	}
+
+	bool FileIndex::contains(uint64_t recNum) const
+	{
+		return recNum < flagCol.size() && (flagCol[static_cast<size_t>(recNum)] & IndexPresent);
+	}
+
+	uint64_t FileIndex::frn(uint64_t recNum) const
+	{
+		return recNum | (static_cast<uint64_t>(sequenceCol[static_cast<size_t>(recNum)]) << 48);
+	}
+
+	uint16_t FileIndex::sequence(uint64_t recNum) const
+	{
+		return sequenceCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::parent(uint64_t recNum) const
+	{
+		return parentCol[static_cast<size_t>(recNum)];
+	}
+
+	uint8_t FileIndex::flags(uint64_t recNum) const
+	{
+		return flagCol[static_cast<size_t>(recNum)];
+	}
+
+	bool FileIndex::isDirectory(uint64_t recNum) const
+	{
+		return 0 != (flagCol[static_cast<size_t>(recNum)] & IndexDirectory);
+	}
+
+	uint8_t FileIndex::nameType(uint64_t recNum) const
+	{
+		return nameTypeCol[static_cast<size_t>(recNum)];
+	}
+
+	const WCHAR* FileIndex::nameData(uint64_t recNum) const
+	{
+		return pool.data() + nameOffsetCol[static_cast<size_t>(recNum)];
+	}
+
+	size_t FileIndex::nameLength(uint64_t recNum) const
+	{
+		return nameLenCol[static_cast<size_t>(recNum)];
+	}
+
+	std::basic_string<WCHAR> FileIndex::name(uint64_t recNum) const
+	{
+		return std::basic_string<WCHAR>(nameData(recNum), nameLength(recNum));
+	}
+
+	uint32_t FileIndex::attributes(uint64_t recNum) const
+	{
+		return attributeCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::dataSize(uint64_t recNum) const
+	{
+		return dataSizeCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::allocatedSize(uint64_t recNum) const
+	{
+		return allocSizeCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::creationTime(uint64_t recNum) const
+	{
+		return creationCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::changeTime(uint64_t recNum) const
+	{
+		return changeCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::lastWriteTime(uint64_t recNum) const
+	{
+		return writeCol[static_cast<size_t>(recNum)];
+	}
+
+	uint64_t FileIndex::lastAccessTime(uint64_t recNum) const
+	{
+		return accessCol[static_cast<size_t>(recNum)];
+	}
+
+	const IndexCheckpoint& FileIndex::checkpoint() const
+	{
+		return state;
+	}
+
+	void FileIndex::setCheckpoint(const IndexCheckpoint& current)
+	{
+		state = current;
+	}
+
+	void FileIndex::save(const std::string& path) const
+	{
+		static const char	padding[snapshot_alignment] = { 0 };
+		std::string			temp = path + ".tmp";
+		SnapshotHeader		header = {};
+		ColumnSource		sources[SnapshotColumnCount] = {
+			column_source(sequenceCol), column_source(flagCol), column_source(nameTypeCol), column_source(nameLenCol),
+			column_source(nameOffsetCol), column_source(attributeCol), column_source(parentCol), column_source(dataSizeCol),
+			column_source(allocSizeCol), column_source(creationCol), column_source(changeCol), column_source(writeCol),
+			column_source(accessCol), column_source(pool)
+		};
+		uint64_t			offset = sizeof(SnapshotHeader);
+
+		header.Magic = snapshot_magic;
+		header.Version = snapshot_version;
+		header.HeaderSize = sizeof(SnapshotHeader);
+		header.ByteOrder = snapshot_byte_order;
+		header.ColumnCount = SnapshotColumnCount;
+		header.RecordCount = size();
+		header.FileCount = files;
+		header.VolumeSerial = state.volumeSerial;
+		header.JournalId = state.journalId;
+		header.LastUsn = state.lastUsn;
+
+		for (uint32_t i = 0; i < SnapshotColumnCount; ++i) {
+			offset = (offset + snapshot_alignment - 1) & ~(snapshot_alignment - 1);
+			header.Columns[i].Offset = offset;
+			header.Columns[i].Bytes = sources[i].bytes;
+			header.Columns[i].ElementSize = sources[i].elementSize;
+			header.Columns[i].Checksum = crc32c(sources[i].data, static_cast<size_t>(sources[i].bytes));
+			offset += sources[i].bytes;
+		}
+		header.FileSize = offset;
+		header.HeaderChecksum = snapshot_header_checksum(header);
+
+		{
+			std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+
+			if (!out)
+				throw FILE_INDEX_ERROR("Unable to create index snapshot!", ERROR_OPEN_FAILED);
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			for (uint32_t i = 0; i < SnapshotColumnCount; ++i) {
+				out.write(padding, static_cast<std::streamsize>(header.Columns[i].Offset - out.tellp()));
+				out.write(static_cast<const char*>(sources[i].data), static_cast<std::streamsize>(sources[i].bytes));
+			}
+
+			out.flush();
+			if (!out) {
+				out.close();
+				std::remove(temp.c_str());
+				throw FILE_INDEX_ERROR("Unable to write index snapshot!", ERROR_WRITE_FAULT);
+			}
+		}
+
+#ifdef _WIN32
+		if (!MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+		if (std::rename(temp.c_str(), path.c_str()))
+#endif
+		{
+			std::remove(temp.c_str());
+			throw FILE_INDEX_ERROR("Unable to replace index snapshot!", ERROR_WRITE_FAULT);
+		}
+	}
+
+	void FileIndex::load(const std::string& path, bool verify)
+	{
+		auto			file = std::make_shared<MappedImageDevice>(path);
+		SnapshotHeader	header;
+		FileIndex		loaded;
+
+		if (file->size() < sizeof(header))
+			throw INDEX_SNAPSHOT_ERROR("File is too small to be an index snapshot!", ERROR_INVALID_DATA);
+
+		file->read(0, &header, sizeof(header));
+		validate_snapshot_header(header, file->size());
+
+		// The view is read-only, so every page stays shared with the page cache
+		auto base = file->view(0, static_cast<size_t>(file->size()));
+		if (!base)
+			throw FILE_INDEX_ERROR("Unable to map index snapshot!", ERROR_NOT_SUPPORTED);
+
+		attach_column(loaded.sequenceCol, header, SnapshotSequence, base, verify);
+		attach_column(loaded.flagCol, header, SnapshotFlags, base, verify);
+		attach_column(loaded.nameTypeCol, header, SnapshotNameType, base, verify);
+		attach_column(loaded.nameLenCol, header, SnapshotNameLength, base, verify);
+		attach_column(loaded.nameOffsetCol, header, SnapshotNameOffset, base, verify);
+		attach_column(loaded.attributeCol, header, SnapshotAttributes, base, verify);
+		attach_column(loaded.parentCol, header, SnapshotParent, base, verify);
+		attach_column(loaded.dataSizeCol, header, SnapshotDataSize, base, verify);
+		attach_column(loaded.allocSizeCol, header, SnapshotAllocSize, base, verify);
+		attach_column(loaded.creationCol, header, SnapshotCreationTime, base, verify);
+		attach_column(loaded.changeCol, header, SnapshotChangeTime, base, verify);
+		attach_column(loaded.writeCol, header, SnapshotWriteTime, base, verify);
+		attach_column(loaded.accessCol, header, SnapshotAccessTime, base, verify);
+		attach_column(loaded.pool, header, SnapshotNames, base, verify);
+
+		loaded.files = header.FileCount;
+		loaded.state.volumeSerial = header.VolumeSerial;
+		loaded.state.journalId = header.JournalId;
+		loaded.state.lastUsn = header.LastUsn;
+		loaded.backing = file;
+
+		*this = std::move(loaded);
+	}
+
+	void FileIndex::parse(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size, Parsed& out)
+	{
+		out = Parsed();
+		out.base = 0 == record->BaseFileRecord;
+		out.owner = out.base ? recNum : reference_record(record->BaseFileRecord);
+		out.sequence = out.base ? record->SequenceCount : reference_sequence(record->BaseFileRecord);
+		out.directory = out.base && 0 != (static_cast<USHORT>(record->Flags) & static_cast<USHORT>(FileRecordFlags::RecordDirectory));
+
+		visit_attributes(record, size,
+			on<NtfsAttributeType::AttributeStandardInformation>([&](STANDARD_INFORMATION* si, NTFS_ATTRIBUTE* attr) {
+				// NTFS 1.2 records stop short after the file attributes
+				if (!si || reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength < offsetof(STANDARD_INFORMATION, Reserved))
+					return;
+
+				out.times[TimeCreation] = si->CreationTime;
+				out.times[TimeChange] = si->ChangeTime;
+				out.times[TimeWrite] = si->LastWriteTime;
+				out.times[TimeAccess] = si->LastAccessTime;
+				out.attributes = si->FileAttributes;
+				out.seen |= IndexStandardInfo;
+			}),
+			on<NtfsAttributeType::AttributeFileName>([&](FILENAME_ATTRIBUTE* fn, NTFS_ATTRIBUTE* attr) {
+				if (!fn || reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength < offsetof(FILENAME_ATTRIBUTE, Name) + (fn->NameLen * sizeof(WCHAR)))
+					return;
+
+				if ((out.seen & IndexNamed) && filename_rank(out.nameType) <= filename_rank(fn->NameType))
+					return;
+
+				std::copy(fn->Name, fn->Name + fn->NameLen, out.name);
+				out.nameLen = fn->NameLen;
+				out.nameType = fn->NameType;
+				out.parent = fn->DirectoryFileRefNumber;
+				out.seen |= IndexNamed;
+			}),
+			on<NtfsAttributeType::AttributeData>([&](unsigned char* value, NTFS_ATTRIBUTE* attr) {
+				if (attr->NameLen)
+					return;
+
+				if (value) {
+					out.dataSize = out.allocSize = reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength;
+					out.seen |= IndexData;
+					return;
+				}
+
+				// Only the first extent of a stream carries its sizes
+				auto nonres = reinterpret_cast<NTFS_NONRESIDENT_ATTRIBUTE*>(attr);
+				if (attr->Length < sizeof(NTFS_NONRESIDENT_ATTRIBUTE) || nonres->LowVcn)
+					return;
+
+				out.dataSize = nonres->DataSize;
+				out.allocSize = nonres->AllocSize;
+				out.seen |= IndexData;
+			}));
+	}
+
+	void FileIndex::merge(const Parsed& rec)
+	{
+		size_t row = static_cast<size_t>(rec.owner);
+
+		thaw();
+		if (rec.owner >= flagCol.size())
+			resize(row + 1);
+
+		auto&		sequences = sequenceCol.edit();
+		uint8_t&	flags = flagCol.edit()[row];
+
+		if (rec.base) {
+			// A reused record slot starts over
+			if (sequences[row] != rec.sequence)
+				clearRow(rec.owner);
+
+			if (!(flags & IndexPresent))
+				++files;
+
+			flags |= IndexPresent | (rec.directory ? IndexDirectory : 0);
+			sequences[row] = rec.sequence;
+		}
+		else if (sequences[row] != rec.sequence) {
+			// An extension that belongs to an older incarnation of its base record is stale
+			if (flags & IndexPresent)
+				return;
+
+			clearRow(rec.owner);
+			sequences[row] = rec.sequence;
+		}
+
+		if ((rec.seen & IndexNamed) && (!(flags & IndexNamed) || filename_rank(rec.nameType) < filename_rank(nameTypeCol[row]))) {
+			auto& names = pool.edit();
+
+			if (flags & IndexNamed)
+				deadNames += nameLenCol[row];
+
+			if (names.size() + rec.nameLen > UINT32_MAX)
+				throw FILE_INDEX_ERROR("File name pool has outgrown 32 bit offsets!", ERROR_NOT_SUPPORTED);
+
+			nameOffsetCol.edit()[row] = static_cast<uint32_t>(names.size());
+			nameLenCol.edit()[row] = rec.nameLen;
+			nameTypeCol.edit()[row] = rec.nameType;
+			parentCol.edit()[row] = rec.parent;
+			names.insert(names.end(), rec.name, rec.name + rec.nameLen);
+		}
+
+		if (rec.seen & IndexStandardInfo) {
+			attributeCol.edit()[row] = rec.attributes;
+			creationCol.edit()[row] = rec.times[TimeCreation];
+			changeCol.edit()[row] = rec.times[TimeChange];
+			writeCol.edit()[row] = rec.times[TimeWrite];
+			accessCol.edit()[row] = rec.times[TimeAccess];
+		}
+
+		if (rec.seen & IndexData) {
+			dataSizeCol.edit()[row] = rec.dataSize;
+			allocSizeCol.edit()[row] = rec.allocSize;
+		}
+
+		flags |= rec.seen;
+	}
+
+	void FileIndex::resize(size_t records)
+	{
+		sequenceCol.edit().resize(records);
+		flagCol.edit().resize(records);
+		nameTypeCol.edit().resize(records);
+		nameLenCol.edit().resize(records);
+		nameOffsetCol.edit().resize(records);
+		attributeCol.edit().resize(records);
+		parentCol.edit().resize(records);
+		dataSizeCol.edit().resize(records);
+		allocSizeCol.edit().resize(records);
+		creationCol.edit().resize(records);
+		changeCol.edit().resize(records);
+		writeCol.edit().resize(records);
+		accessCol.edit().resize(records);
+	}
+
+	void FileIndex::thaw()
+	{
+		if (!backing)
+			return;
+
+		sequenceCol.edit();
+		flagCol.edit();
+		nameTypeCol.edit();
+		nameLenCol.edit();
+		nameOffsetCol.edit();
+		attributeCol.edit();
+		parentCol.edit();
+		dataSizeCol.edit();
+		allocSizeCol.edit();
+		creationCol.edit();
+		changeCol.edit();
+		writeCol.edit();
+		accessCol.edit();
+		pool.edit();
+		backing.reset();
+	}
+
+	void FileIndex::clearRow(uint64_t recNum)
+	{
+		size_t row = static_cast<size_t>(recNum);
+
+		if (recNum >= flagCol.size() || !flagCol[row])
+			return;
+
+		thaw();
+
+		auto& flags = flagCol.edit()[row];
+		if (flags & IndexPresent)
+			--files;
+
+		if (flags & IndexNamed)
+			deadNames += nameLenCol[row];
+
+		flags = 0;
+
+		// Churn leaves old names behind; rewrite the pool once they make up half of it
+		if (deadNames * 2 > pool.size())
+			compactNames();
+	}
+
+	void FileIndex::compactNames()
+	{
+		auto&				names = pool.edit();
+		auto&				offsets = nameOffsetCol.edit();
+		std::vector<WCHAR>	packed;
+
+		packed.reserve(static_cast<size_t>(names.size() - deadNames));
+		for (size_t row = 0; row < flagCol.size(); ++row) {
+			if (!(flagCol[row] & IndexNamed))
+				continue;
+
+			auto start = names.begin() + offsets[row];
+			offsets[row] = static_cast<uint32_t>(packed.size());
+			packed.insert(packed.end(), start, start + nameLenCol[row]);
+		}
+
+		names.swap(packed);
+		deadNames = 0;
+	}
+
+}
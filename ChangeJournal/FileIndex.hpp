@@ -0,0 +1,342 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <climits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+#include "BlockDevice.hpp"
+#include "VolumeOptions.hpp"
+
+#define FILE_INDEX_ERROR(msg, err)\
+	std::runtime_error(("[FileIndex] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	/**
+	* Per-file flags kept by a FileIndex.
+	*/
+	enum FileIndexFlags : uint8_t {
+		IndexPresent = 0x01,		// the record is an in-use base record
+		IndexDirectory = 0x02,
+		IndexNamed = 0x04,			// a $FILE_NAME has been seen
+		IndexStandardInfo = 0x08,	// a $STANDARD_INFORMATION has been seen
+		IndexData = 0x10			// the unnamed $DATA attribute has been seen
+	};
+
+	/**
+	* The volume and change journal position an index reflects, so a saved index can be brought up to
+	* date (or thrown away) when it is loaded again.
+	*/
+	struct IndexCheckpoint {
+		int64_t		volumeSerial = 0;
+		uint64_t	journalId = 0;
+		int64_t		lastUsn = 0;
+	};
+
+	/**
+	* One column of a FileIndex. A column either owns its elements, or borrows them from memory someone
+	* else keeps alive (i.e., a mapped snapshot); reads look the same either way, and edit() turns a
+	* borrowed column into an owned one.
+	*/
+	template <typename T>
+	class IndexColumn {
+	public:
+		const T* data() const { return borrowed ? borrowed : owned.data(); }
+		size_t size() const { return borrowed ? count : owned.size(); }
+		const T& operator[](size_t i) const { return data()[i]; }
+		const T* begin() const { return data(); }
+		const T* end() const { return data() + size(); }
+
+		/**
+		* Returns the number of heap bytes held by the column (borrowed elements don't count).
+		*/
+		uint64_t heapBytes() const { return owned.capacity() * sizeof(T); }
+
+		/**
+		* Points the column at count elements at p, releasing anything it owned.
+		*/
+		void attach(const T* p, size_t n)
+		{
+			std::vector<T>().swap(owned);
+			borrowed = p;
+			count = n;
+		}
+
+		/**
+		* Returns the column's own storage, copying borrowed elements into it first.
+		*/
+		std::vector<T>& edit()
+		{
+			if (borrowed) {
+				owned.assign(borrowed, borrowed + count);
+				borrowed = nullptr;
+				count = 0;
+			}
+			return owned;
+		}
+
+	private:
+		std::vector<T>	owned;
+		const T*		borrowed = nullptr;
+		size_t			count = 0;
+	};
+
+	/**
+	* A compact, columnar (structure of arrays) index of every file on a volume. Each column is one array
+	* indexed by MFT record number, and every file's preferred name is packed into a single UTF-16 pool, so
+	* a file costs a fixed handful of bytes plus its name, and scans over one column (e.g., every name, or
+	* every size) walk contiguous memory.
+	*
+	* Unused record slots keep their place in the columns (flagged as not present); the MFT is densely
+	* populated in practice, and this keeps record number to row lookups free.
+	*/
+	class FileIndex {
+	public:
+		/**
+		* Builds the index from the MFT of vol, replacing anything added so far. Records are parsed in
+		* parallel with VolOps::parallelScan.
+		*
+		* @throws std::runtime_error if vol isn't backed by a block device, or the MFT can't be read
+		* @param vol The volume to index
+		* @param opts The options passed on to parallelScan
+		*/
+		void build(VolOps& vol, const ParallelScanOptions& opts = ParallelScanOptions());
+
+		/**
+		* Adds one file record to the index. Extension records are credited to their base record, so
+		* records can be added in any order.
+		*
+		* @throws std::runtime_error if the record is malformed, or the name pool outgrows 32 bit offsets
+		* @param recNum The number of the record
+		* @param record The record, with fixups applied
+		* @param size The size of the record, in bytes
+		*/
+		void addRecord(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size);
+
+		/**
+		* Replaces everything known about a base record with what the record holds now (e.g., after a
+		* rename, or after its slot was reused for a new file). Attributes held in extension records have
+		* to be added again afterwards with addRecord.
+		*
+		* @throws std::runtime_error if the record is malformed, or the name pool outgrows 32 bit offsets
+		* @param recNum The number of the record
+		* @param record The in-use base record, with fixups applied
+		* @param size The size of the record, in bytes
+		*/
+		void refresh(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size);
+
+		/**
+		* Forgets a record (e.g., because its file was deleted).
+		*/
+		void remove(uint64_t recNum);
+
+		/**
+		* Releases any spare capacity held by the columns (e.g., once a build is complete).
+		*/
+		void shrink();
+
+		/**
+		* Returns one more than the highest record number the columns have room for.
+		*/
+		uint64_t size() const;
+
+		/**
+		* Returns the number of files (in-use base records) in the index.
+		*/
+		uint64_t fileCount() const;
+
+		/**
+		* Returns the number of heap bytes held by the columns and the name pool; columns still mapped from a
+		* snapshot aren't counted.
+		*/
+		uint64_t memoryUsage() const;
+
+		/**
+		* Indicates whether recNum is an in-use base record.
+		*/
+		bool contains(uint64_t recNum) const;
+
+		/**
+		* Returns the file reference number (record number and sequence number) of a record.
+		*/
+		uint64_t frn(uint64_t recNum) const;
+
+		/**
+		* Returns the sequence number of a record.
+		*/
+		uint16_t sequence(uint64_t recNum) const;
+
+		/**
+		* Returns the file reference number of the directory containing a file's preferred name.
+		*/
+		uint64_t parent(uint64_t recNum) const;
+
+		/**
+		* Returns the FileIndexFlags of a record.
+		*/
+		uint8_t flags(uint64_t recNum) const;
+
+		/**
+		* Indicates whether a record is a directory.
+		*/
+		bool isDirectory(uint64_t recNum) const;
+
+		/**
+		* Returns the $FILE_NAME namespace of a file's preferred name (0 POSIX, 1 Win32, 2 DOS, 3 Win32 & DOS).
+		*/
+		uint8_t nameType(uint64_t recNum) const;
+
+		/**
+		* Returns a pointer to a file's preferred name within the name pool; it isn't NULL terminated.
+		*/
+		const WCHAR* nameData(uint64_t recNum) const;
+
+		/**
+		* Returns the length of a file's preferred name, in characters.
+		*/
+		size_t nameLength(uint64_t recNum) const;
+
+		/**
+		* Returns a copy of a file's preferred name.
+		*/
+		std::basic_string<WCHAR> name(uint64_t recNum) const;
+
+		/**
+		* Returns the $FILE_ATTRIBUTE_* flags from a file's $STANDARD_INFORMATION.
+		*/
+		uint32_t attributes(uint64_t recNum) const;
+
+		/**
+		* Returns the logical size of a file's unnamed data stream, in bytes.
+		*/
+		uint64_t dataSize(uint64_t recNum) const;
+
+		/**
+		* Returns the space allocated to a file's unnamed data stream, in bytes.
+		*/
+		uint64_t allocatedSize(uint64_t recNum) const;
+
+		/**
+		* The four $STANDARD_INFORMATION timestamps of a file, as FILETIMEs.
+		*/
+		uint64_t creationTime(uint64_t recNum) const;
+		uint64_t changeTime(uint64_t recNum) const;
+		uint64_t lastWriteTime(uint64_t recNum) const;
+		uint64_t lastAccessTime(uint64_t recNum) const;
+
+		/**
+		* Whole columns, for scans that want to walk one attribute of every file; each is indexed by
+		* record number. Name offsets index into namePool().
+		*/
+		const IndexColumn<uint8_t>& flagColumn() const { return flagCol; }
+		const IndexColumn<uint64_t>& parentColumn() const { return parentCol; }
+		const IndexColumn<uint32_t>& nameOffsetColumn() const { return nameOffsetCol; }
+		const IndexColumn<uint8_t>& nameLengthColumn() const { return nameLenCol; }
+		const IndexColumn<uint64_t>& dataSizeColumn() const { return dataSizeCol; }
+		const IndexColumn<WCHAR>& namePool() const { return pool; }
+
+		/**
+		* Returns the volume and journal state the index reflects.
+		*/
+		const IndexCheckpoint& checkpoint() const;
+
+		/**
+		* Records the journal state the index reflects (build() only knows the volume serial).
+		*/
+		void setCheckpoint(const IndexCheckpoint& current);
+
+		/**
+		* Writes the index to a snapshot file (see IndexSnapshot.hpp). The snapshot is written beside path
+		* and then renamed over it, so readers never see a partial snapshot.
+		*
+		* @throws std::runtime_error if the file can't be written
+		* @param path The file to write
+		*/
+		void save(const std::string& path) const;
+
+		/**
+		* Replaces the index with a snapshot file, which is memory mapped and queried in place rather than
+		* read in. The mapping is kept for as long as the index uses it; the first change made to the index
+		* (e.g., addRecord) copies the columns out of it.
+		*
+		* @throws std::runtime_error if the file can't be mapped, isn't a snapshot, is from an incompatible
+		*         version, or fails its checksums
+		* @param path The snapshot to load
+		* @param verify Whether to checksum every column too, rather than just the header
+		*/
+		void load(const std::string& path, bool verify = true);
+
+	private:
+		// Everything parsed out of one record, before it is merged into the columns
+		struct Parsed {
+			uint64_t	owner;
+			uint16_t	sequence;
+			bool		base;
+			bool		directory;
+			uint8_t		seen;
+			uint8_t		nameType;
+			uint8_t		nameLen;
+			uint64_t	parent;
+			uint32_t	attributes;
+			uint64_t	dataSize;
+			uint64_t	allocSize;
+			uint64_t	times[4];
+			WCHAR		name[UCHAR_MAX];
+		};
+
+		static void parse(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size, Parsed& out);
+		void merge(const Parsed& rec);
+		void resize(size_t records);
+		void thaw();
+		void clearRow(uint64_t recNum);
+		void compactNames();
+
+		uint64_t					files = 0;
+		// Characters in the name pool no longer referenced by any record
+		uint64_t					deadNames = 0;
+		IndexCheckpoint				state;
+		// The mapped snapshot the columns point into, if any
+		std::shared_ptr<BlockDevice>	backing;
+		IndexColumn<uint16_t>		sequenceCol;
+		IndexColumn<uint8_t>		flagCol;
+		IndexColumn<uint8_t>		nameTypeCol;
+		IndexColumn<uint8_t>		nameLenCol;
+		IndexColumn<uint32_t>		nameOffsetCol;
+		IndexColumn<uint32_t>		attributeCol;
+		IndexColumn<uint64_t>		parentCol;
+		IndexColumn<uint64_t>		dataSizeCol;
+		IndexColumn<uint64_t>		allocSizeCol;
+		IndexColumn<uint64_t>		creationCol;
+		IndexColumn<uint64_t>		changeCol;
+		IndexColumn<uint64_t>		writeCol;
+		IndexColumn<uint64_t>		accessCol;
+		IndexColumn<WCHAR>			pool;
+	};
+
+}
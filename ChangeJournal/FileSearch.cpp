@@ -0,0 +1,377 @@
+#include "FileSearch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <regex>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NTFS_SEARCH_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	// Substring scans read up to this many characters past the end of a name (and ignore them)
+	constexpr size_t scan_padding = 8;
+
+	inline unsigned lowest_bit(unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+		return static_cast<unsigned>(bit);
+#else
+		return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+	}
+
+	// Case folding is either a lookup in an upcase table, or nothing at all
+	inline WCHAR fold_char(const WCHAR* table, WCHAR c)
+	{
+		return table ? table[static_cast<uint16_t>(c)] : c;
+	}
+
+	/**
+	* Finds a literal (already folded) needle within names, where they lie in the name pool. Rather than
+	* folding every name before looking at it, each end of the needle is expanded into the few characters
+	* that fold to it (e.g., 'a' and 'A'), and those are compared against eight starting positions at
+	* once; only positions where both ends match are folded and checked in full.
+	*/
+	class LiteralScanner {
+	public:
+		LiteralScanner(const std::basic_string<WCHAR>& needle, const WCHAR* table) : needle(needle), table(table)
+		{
+			firstCount = variants(needle.front(), firstSet);
+			lastCount = variants(needle.back(), lastSet);
+		}
+
+		// Whether the needle occurs in hay, which must be followed by scan_padding readable characters
+		bool find(const WCHAR* hay, size_t hayLen) const
+		{
+			size_t len = needle.size();
+
+			if (len > hayLen)
+				return false;
+
+			size_t last = hayLen - len;
+
+#ifdef NTFS_SEARCH_SSE2
+			for (size_t i = 0; i <= last; i += 8) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + len - 1));
+				unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(matches(a, firstSet, firstCount), matches(b, lastSet, lastCount))));
+
+				while (mask) {
+					unsigned	bit = lowest_bit(mask);
+					size_t		pos = i + (bit / 2);
+
+					if (pos > last)
+						break;
+
+					if (equalAt(hay + pos))
+						return true;
+
+					mask &= ~(3u << bit);
+				}
+			}
+#else
+			for (size_t pos = 0; pos <= last; ++pos) {
+				if (equalAt(hay + pos))
+					return true;
+			}
+#endif
+			return false;
+		}
+
+	private:
+		static constexpr size_t max_variants = 4;
+
+		bool equalAt(const WCHAR* p) const
+		{
+			if (!table)
+				return 0 == memcmp(p, needle.data(), needle.size() * sizeof(WCHAR));
+
+			for (size_t i = 0; i < needle.size(); ++i) {
+				if (fold_char(table, p[i]) != needle[i])
+					return false;
+			}
+			return true;
+		}
+
+#ifdef NTFS_SEARCH_SSE2
+		// Every character that folds to c; with more than max_variants of them the end isn't used as a filter
+		size_t variants(WCHAR c, __m128i* set) const
+		{
+			size_t count = 0;
+
+			if (!table) {
+				set[count++] = _mm_set1_epi16(static_cast<short>(c));
+				return count;
+			}
+
+			for (uint32_t v = 0; v < 0x10000; ++v) {
+				if (table[v] != c)
+					continue;
+
+				if (count == max_variants)
+					return SIZE_MAX;
+
+				set[count++] = _mm_set1_epi16(static_cast<short>(v));
+			}
+
+			return count;
+		}
+
+		static __m128i matches(__m128i chars, const __m128i* set, size_t count)
+		{
+			if (SIZE_MAX == count)
+				return _mm_set1_epi16(-1);
+
+			__m128i eq = _mm_setzero_si128();
+			for (size_t i = 0; i < count; ++i)
+				eq = _mm_or_si128(eq, _mm_cmpeq_epi16(chars, set[i]));
+
+			return eq;
+		}
+
+		__m128i		firstSet[max_variants];
+		__m128i		lastSet[max_variants];
+#else
+		size_t variants(WCHAR, void*) const { return 0; }
+
+		void*		firstSet = nullptr;
+		void*		lastSet = nullptr;
+#endif
+		size_t						firstCount;
+		size_t						lastCount;
+		std::basic_string<WCHAR>	needle;
+		const WCHAR*				table;
+	};
+
+	// The literal runs of a glob pattern (e.g., "IMG", ".JPG" for "IMG*.JPG")
+	std::vector<std::basic_string<WCHAR>> glob_literals(const std::basic_string<WCHAR>& pat)
+	{
+		std::vector<std::basic_string<WCHAR>>	literals(1);
+
+		for (auto c : pat) {
+			if ('*' == c || '?' == c) {
+				if (!literals.back().empty())
+					literals.emplace_back();
+			}
+			else {
+				literals.back() += c;
+			}
+		}
+
+		return literals;
+	}
+
+	// Whether all of name matches pat, where * matches any run of characters and ? any single one
+	bool glob_match(const WCHAR* name, size_t nameLen, const WCHAR* pat, size_t patLen, const WCHAR* table)
+	{
+		size_t n = 0;
+		size_t p = 0;
+		size_t starPat = SIZE_MAX;
+		size_t starName = 0;
+
+		while (n < nameLen) {
+			if (p < patLen && ('?' == pat[p] || pat[p] == fold_char(table, name[n]))) {
+				++n;
+				++p;
+			}
+			else if (p < patLen && '*' == pat[p]) {
+				starPat = p++;
+				starName = n;
+			}
+			else if (SIZE_MAX != starPat) {
+				// Let the last * swallow one more character, and try again from there
+				p = starPat + 1;
+				n = ++starName;
+			}
+			else {
+				return false;
+			}
+		}
+
+		while (p < patLen && '*' == pat[p])
+			++p;
+
+		return p == patLen;
+	}
+}
+
+namespace ntfs {
+
+	FileSearch::FileSearch(const FileIndex& index, size_t threads) : index(index), pool(new WorkStealingPool(threads)), upcase(default_upcase_table()), trigrams(nullptr), trigramCase(false)
+	{
+	}
+
+	void FileSearch::setUpcaseTable(std::vector<WCHAR> table)
+	{
+		if (table.size() != 0x10000)
+			throw FILE_SEARCH_ERROR("Upcase table must map every UTF-16 code unit!", ERROR_INVALID_PARAMETER);
+
+		upcase.swap(table);
+		trigramCase = false;
+	}
+
+	void FileSearch::setTrigramIndex(const TrigramIndex* trigrams)
+	{
+		this->trigrams = trigrams;
+		if (trigrams)
+			upcase = trigrams->upcaseTable();
+
+		trigramCase = nullptr != trigrams;
+	}
+
+	std::vector<uint64_t> FileSearch::find(const SearchQuery& query)
+	{
+		std::basic_string<WCHAR>			pattern = query.pattern;
+		std::wregex							re;
+		uint64_t							records = index.size();
+		uint64_t							chunks = (records + default_search_chunk_records - 1) / default_search_chunk_records;
+		std::vector<std::vector<uint64_t>>	found(static_cast<size_t>(chunks));
+		std::atomic<size_t>					total(0);
+		size_t								limit = query.maxResults ? query.maxResults : SIZE_MAX;
+		bool								fold = query.ignoreCase && MatchKind::Regex != query.kind;
+		std::vector<uint64_t>				out;
+
+		if (pattern.empty())
+			throw FILE_SEARCH_ERROR("Search pattern is empty!", ERROR_INVALID_PARAMETER);
+
+		if (MatchKind::Regex == query.kind) {
+			try {
+				auto flags = std::regex_constants::ECMAScript | std::regex_constants::optimize;
+				if (query.ignoreCase)
+					flags |= std::regex_constants::icase;
+				re.assign(std::wstring(pattern.begin(), pattern.end()), flags);
+			}
+			catch (const std::regex_error& e) {
+				throw FILE_SEARCH_ERROR("Invalid regular expression! " + std::string(e.what()) + " ", ERROR_INVALID_PARAMETER);
+			}
+		}
+
+		if (fold) {
+			for (auto& c : pattern)
+				c = upcase[static_cast<uint16_t>(c)];
+		}
+
+		const WCHAR*	table = fold ? upcase.data() : nullptr;
+
+		// With trigrams, only the candidates they give are looked at, which is too little work to spread out
+		if (trigrams && MatchKind::Regex != query.kind && (!fold || trigramCase)) {
+			std::vector<uint32_t>	rows;
+			bool					narrowed = (MatchKind::Glob == query.kind) ? trigrams->candidates(glob_literals(query.pattern), rows) : trigrams->candidates({ query.pattern }, rows);
+			auto					same = [table](WCHAR n, WCHAR p) { return p == fold_char(table, n); };
+
+			if (narrowed) {
+				for (auto row : rows) {
+					if (row >= records || !index.contains(row) || !(index.flags(row) & IndexNamed) || (index.isDirectory(row) ? !query.directories : !query.files))
+						continue;
+
+					const WCHAR*	name = index.nameData(row);
+					size_t			len = index.nameLength(row);
+					bool			match = false;
+
+					if (MatchKind::Glob == query.kind)
+						match = glob_match(name, len, pattern.data(), pattern.size(), table);
+					else if (MatchKind::Prefix == query.kind)
+						match = len >= pattern.size() && std::equal(name, name + pattern.size(), pattern.begin(), same);
+					else
+						match = std::search(name, name + len, pattern.begin(), pattern.end(), same) != name + len;
+
+					if (match) {
+						out.push_back(index.frn(row));
+						if (out.size() >= limit)
+							break;
+					}
+				}
+
+				return out;
+			}
+		}
+
+		LiteralScanner	scanner(pattern, table);
+
+		for (uint64_t c = 0; c < chunks; ++c) {
+			pool->submit([&, c] {
+				const uint8_t*		flags = index.flagColumn().data();
+				const uint32_t*		offsets = index.nameOffsetColumn().data();
+				const uint8_t*		lengths = index.nameLengthColumn().data();
+				const WCHAR*		names = index.namePool().data();
+				const WCHAR*		poolEnd = names + index.namePool().size();
+				uint64_t			end = std::min(records, (c + 1) * default_search_chunk_records);
+				WCHAR				scratch[UCHAR_MAX + scan_padding] = { 0 };
+				std::wstring		wide;
+				auto&				hits = found[static_cast<size_t>(c)];
+
+				for (uint64_t row = c * default_search_chunk_records; row < end; ++row) {
+					uint8_t			f = flags[row];
+					size_t			len = lengths[row];
+					const WCHAR*	name = names + offsets[row];
+					bool			match = false;
+
+					if (!(f & IndexPresent) || !(f & IndexNamed) || !((f & IndexDirectory) ? query.directories : query.files))
+						continue;
+
+					switch (query.kind) {
+					case MatchKind::Regex:
+						wide.assign(name, name + len);
+						match = std::regex_search(wide, re);
+						break;
+					case MatchKind::Prefix:
+						match = len >= pattern.size() && std::equal(pattern.begin(), pattern.end(), name, [table](WCHAR p, WCHAR n) { return p == fold_char(table, n); });
+						break;
+					case MatchKind::Glob:
+						match = glob_match(name, len, pattern.data(), pattern.size(), table);
+						break;
+					default:
+						// Vector loads run a little past the end of the name, which is only a problem at the end of the pool
+						if (name + len + scan_padding > poolEnd) {
+							std::copy(name, name + len, scratch);
+							name = scratch;
+						}
+						match = scanner.find(name, len);
+						break;
+					}
+
+					if (match) {
+						hits.push_back(index.frn(row));
+						if (++total >= limit)
+							return;
+					}
+
+					// Someone else may have filled the quota already
+					if (0 == (row & 0xFFF) && total.load(std::memory_order_relaxed) >= limit)
+						return;
+				}
+			});
+		}
+		pool->wait();
+
+		out.reserve(std::min(total.load(), limit));
+		for (auto& hits : found)
+			out.insert(out.end(), hits.begin(), hits.end());
+
+		if (out.size() > limit)
+			out.resize(limit);
+
+		return out;
+	}
+
+	std::vector<SearchHit> FileSearch::find(const SearchQuery& query, PathResolver& paths)
+	{
+		std::vector<SearchHit> hits;
+
+		for (auto frn : find(query)) {
+			hits.push_back({ frn, std::basic_string<WCHAR>() });
+			paths.appendPath(frn, hits.back().path);
+		}
+
+		return hits;
+	}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+#include "FileIndex.hpp"
+#include "PathResolver.hpp"
+#include "ThreadPool.hpp"
+#include "TrigramIndex.hpp"
+
+#define FILE_SEARCH_ERROR(msg, err)\
+	std::runtime_error(("[FileSearch] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	constexpr size_t default_search_chunk_records = 64 * 1024;
+
+	enum class MatchKind {
+		Substring,	// the name contains the pattern
+		Prefix,		// the name begins with the pattern
+		Glob,		// the whole name matches a pattern of literals, * (any run) and ? (any one character)
+		Regex		// the name contains a match for an ECMAScript regular expression
+	};
+
+	struct SearchQuery {
+		std::basic_string<WCHAR>	pattern;
+		MatchKind					kind = MatchKind::Substring;
+		bool						ignoreCase = true;
+		bool						files = true;			// include files
+		bool						directories = true;		// include directories
+		size_t						maxResults = 0;			// 0 for no limit
+	};
+
+	struct SearchHit {
+		uint64_t					frn;
+		std::basic_string<WCHAR>	path;					// empty unless a resolver was given
+	};
+
+	/**
+	* Searches the names held by a FileIndex. The index's records are split into chunks that are matched on
+	* a work-stealing pool, each thread walking the name pool directly; literal patterns are scanned for with
+	* SSE2 where available. Case is folded with an upcase table, which defaults to the C library's idea of
+	* case and may be replaced with the volume's own $UpCase.
+	*
+	* Given a TrigramIndex, substring, prefix and glob searches only look at the records the trigrams say
+	* can match, which turns most searches from a scan of the volume into a handful of lookups.
+	*
+	* A FileSearch only reads the index, but the index mustn't change during a search, and a single
+	* FileSearch runs one search at a time.
+	*/
+	class FileSearch {
+	public:
+		/**
+		* @param index The index to search; must outlive the FileSearch
+		* @param threads The number of threads to search with; 0 uses one per hardware thread
+		*/
+		FileSearch(const FileIndex& index, size_t threads = 0);
+
+		/**
+		* Replaces the table used to fold case (e.g., with the volume's $UpCase).
+		*
+		* @throws std::runtime_error if the table doesn't map all 65536 UTF-16 code units
+		* @param table table[c] is the uppercase form of c
+		*/
+		void setUpcaseTable(std::vector<WCHAR> table);
+
+		/**
+		* Narrows searches with a trigram index of the same FileIndex, and adopts its upcase table. Case
+		* insensitive searches go back to scanning if setUpcaseTable() is called afterwards; if the trigram
+		* index's table is replaced instead, this must be called again.
+		*
+		* @param trigrams The trigram index to use (it must outlive the FileSearch, and be kept current), or
+		*        nullptr to always scan
+		*/
+		void setTrigramIndex(const TrigramIndex* trigrams);
+
+		/**
+		* Finds the records whose preferred name matches query.
+		*
+		* @throws std::runtime_error if the pattern is empty or isn't a valid regular expression
+		* @param query What to look for
+		* @return the file reference numbers of the matches, in record number order. If query.maxResults
+		*         is reached the search stops early, and which of the matches are returned is unspecified.
+		*/
+		std::vector<uint64_t> find(const SearchQuery& query);
+
+		/**
+		* Same as find(query), but also resolves the path of every match.
+		*
+		* @param query What to look for
+		* @param paths A resolver for the same volume, on which resolveAll() has been called
+		* @return the matches, in record number order
+		*/
+		std::vector<SearchHit> find(const SearchQuery& query, PathResolver& paths);
+
+	private:
+		const FileIndex&					index;
+		std::unique_ptr<WorkStealingPool>	pool;
+		std::vector<WCHAR>					upcase;
+		const TrigramIndex*					trigrams;
+		bool								trigramCase;	// upcase is the table the trigrams were folded with
+	};
+
+}
@@ -0,0 +1,123 @@
+#include "Fixup.hpp"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NTFS_FIXUP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+	inline uint32_t load32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint16_t load16(const uint8_t* p)
+	{
+		uint16_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	ntfs::RecordStatus classify(uint32_t type, uint32_t expected)
+	{
+		if (type == expected)
+			return ntfs::RecordStatus::Valid;
+
+		return (type == static_cast<uint32_t>(ntfs::NtfsRecordType::Bad)) ? ntfs::RecordStatus::Bad : ntfs::RecordStatus::Empty;
+	}
+}
+
+namespace ntfs {
+
+	bool apply_fixup(uint8_t* rec, size_t size)
+	{
+		auto		header = reinterpret_cast<NTFS_RECORD_HEADER*>(rec);
+		size_t		strides = size / update_sequence_stride;
+
+		if (header->UsaCount < 2 || (header->UsaCount - 1u) != strides || header->UsaOffset + header->UsaCount * sizeof(USHORT) > size)
+			return false;
+
+		auto usa = reinterpret_cast<USHORT*>(rec + header->UsaOffset);
+		for (size_t i = 1; i < header->UsaCount; ++i) {
+			if (*reinterpret_cast<USHORT*>(rec + (i * update_sequence_stride) - sizeof(USHORT)) != usa[0])
+				return false;
+		}
+
+		for (size_t i = 1; i < header->UsaCount; ++i) {
+			auto trailer = reinterpret_cast<USHORT*>(rec + (i * update_sequence_stride) - sizeof(USHORT));
+			if (*trailer != usa[i])
+				*trailer = usa[i];
+		}
+
+		return true;
+	}
+
+	size_t apply_fixups(uint8_t* buf, size_t count, size_t recordSize, NtfsRecordType expected, RecordStatus* status)
+	{
+		size_t			strides = recordSize / update_sequence_stride;
+		uint32_t		want = static_cast<uint32_t>(expected);
+		size_t			valid = 0;
+		size_t			i = 0;
+
+		if (!buf || !status || !strides || recordSize % update_sequence_stride)
+			return 0;
+
+		// Pass 1: signatures, four records at a time.
+#ifdef NTFS_FIXUP_SSE2
+		const __m128i expect = _mm_set1_epi32(static_cast<int>(want));
+		for (; i + 4 <= count; i += 4) {
+			const uint8_t* p = buf + (i * recordSize);
+			__m128i types = _mm_set_epi32(static_cast<int>(load32(p + 3 * recordSize)), static_cast<int>(load32(p + 2 * recordSize)),
+				static_cast<int>(load32(p + recordSize)), static_cast<int>(load32(p)));
+
+			if (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi32(types, expect))) {
+				status[i] = status[i + 1] = status[i + 2] = status[i + 3] = RecordStatus::Valid;
+				continue;
+			}
+
+			for (size_t j = 0; j < 4; ++j)
+				status[i + j] = classify(load32(p + j * recordSize), want);
+		}
+#endif
+		for (; i < count; ++i)
+			status[i] = classify(load32(buf + (i * recordSize)), want);
+
+		// Pass 2: validate the update sequence array headers and every stride trailer, and restore the saved
+		// values into the records that check out. A record has only a couple of strides, so the trailers are
+		// just compared one by one.
+		for (i = 0; i < count; ++i) {
+			uint8_t* rec = buf + (i * recordSize);
+
+			if (RecordStatus::Valid != status[i])
+				continue;
+
+			auto header = reinterpret_cast<const NTFS_RECORD_HEADER*>(rec);
+			if ((header->UsaCount - 1u) != strides || (header->UsaOffset & 1) || header->UsaOffset + header->UsaCount * sizeof(USHORT) > recordSize) {
+				status[i] = RecordStatus::Malformed;
+				continue;
+			}
+
+			auto		usa = rec + header->UsaOffset;
+			uint16_t	usn = load16(usa);
+			size_t		s = 1;
+
+			while (s <= strides && load16(rec + (s * update_sequence_stride) - sizeof(USHORT)) == usn)
+				++s;
+
+			if (s <= strides) {
+				status[i] = RecordStatus::Torn;
+				continue;
+			}
+
+			for (s = 1; s <= strides; ++s)
+				memcpy(rec + (s * update_sequence_stride) - sizeof(USHORT), usa + (s * sizeof(USHORT)), sizeof(USHORT));
+			++valid;
+		}
+
+		return valid;
+	}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ntfs_defs.h"
+
+namespace ntfs {
+
+	/**
+	* The outcome of fixing up a single record in a batch.
+	*/
+	enum class RecordStatus : uint8_t {
+		Valid = 0,
+		Empty,		// doesn't carry the expected signature (e.g., a never used, zero filled slot)
+		Bad,		// marked "BAAD" by chkdsk
+		Malformed,	// the update sequence array doesn't fit the record
+		Torn,		// at least one stride doesn't end with the update sequence number
+		Unused		// marked free in the $MFT's bitmap, so never read (see MftReader)
+	};
+
+	/**
+	* Applies the update sequence array of a multi-sector record (FILE, INDX) in place, replacing
+	* the last two bytes of every protected stride with the values saved in the array. Nothing is written
+	* unless the whole record checks out, and trailers that already hold their saved value are left alone,
+	* so records inside a copy-on-write mapping only dirty the pages that actually change.
+	*
+	* @param rec The record to fix up
+	* @param size The size of the record, in bytes
+	* @return false if the record is torn (a stride doesn't end with the update sequence number) or
+	*         if its update sequence array doesn't fit the record; true otherwise.
+	*/
+	bool apply_fixup(uint8_t* rec, size_t size);
+
+	/**
+	* Applies fixups, in place, to count consecutive records of recordSize bytes each (e.g., a large
+	* read of the $MFT, or of an $INDEX_ALLOCATION stream). Signatures are checked four records at a
+	* time with SSE2 where available, and nothing is allocated.
+	*
+	* @param buf The start of the first record
+	* @param count The number of records in buf
+	* @param recordSize The size of each record, in bytes; must be a multiple of update_sequence_stride
+	* @param expected The signature every record is expected to carry
+	* @param status Receives count entries, one per record; records not marked Valid are left untouched.
+	* @return the number of records that were successfully fixed up
+	*/
+	size_t apply_fixups(uint8_t* buf, size_t count, size_t recordSize, NtfsRecordType expected, RecordStatus* status);
+
+}
@@ -0,0 +1,95 @@
+#include "IndexSnapshot.hpp"
+#include <cstddef>
+#include <cstring>
+
+namespace {
+	// Slice-by-8 tables for the reflected Castagnoli polynomial
+	struct Crc32cTables {
+		uint32_t t[8][256];
+
+		Crc32cTables()
+		{
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+				t[0][i] = crc;
+			}
+
+			for (uint32_t i = 0; i < 256; ++i) {
+				for (int slice = 1; slice < 8; ++slice)
+					t[slice][i] = (t[slice - 1][i] >> 8) ^ t[0][t[slice - 1][i] & 0xFF];
+			}
+		}
+	};
+
+	const Crc32cTables& crc32c_tables()
+	{
+		static const Crc32cTables tables;
+		return tables;
+	}
+}
+
+namespace ntfs {
+
+	uint32_t crc32c(const void* data, size_t len, uint32_t crc)
+	{
+		const auto&				t = crc32c_tables().t;
+		const unsigned char*	p = static_cast<const unsigned char*>(data);
+
+		crc = ~crc;
+		while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+			crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+			--len;
+		}
+
+		// Eight bytes at a time; this assumes a little endian host, like every platform NTFS runs on
+		for (; len >= 8; len -= 8, p += 8) {
+			uint32_t lo;
+			uint32_t hi;
+
+			memcpy(&lo, p, sizeof(lo));
+			memcpy(&hi, p + 4, sizeof(hi));
+			lo ^= crc;
+			crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+				^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		}
+
+		while (len--)
+			crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+		return ~crc;
+	}
+
+	uint32_t snapshot_header_checksum(const SnapshotHeader& header)
+	{
+		return crc32c(&header, offsetof(SnapshotHeader, HeaderChecksum));
+	}
+
+	void validate_snapshot_header(const SnapshotHeader& header, uint64_t fileSize)
+	{
+		if (snapshot_magic != header.Magic)
+			throw INDEX_SNAPSHOT_ERROR("File is not an index snapshot!", ERROR_INVALID_DATA);
+
+		if (snapshot_version != header.Version || sizeof(SnapshotHeader) != header.HeaderSize || SnapshotColumnCount != header.ColumnCount)
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot was written by an incompatible version!", ERROR_NOT_SUPPORTED);
+
+		if (snapshot_byte_order != header.ByteOrder)
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot was written with a different byte order!", ERROR_NOT_SUPPORTED);
+
+		if (snapshot_header_checksum(header) != header.HeaderChecksum)
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot header checksum mismatch!", ERROR_FILE_CORRUPT);
+
+		if (header.FileSize != fileSize)
+			throw INDEX_SNAPSHOT_ERROR("Index snapshot is truncated!", ERROR_FILE_CORRUPT);
+
+		for (auto& col : header.Columns) {
+			if (col.Offset % snapshot_alignment || col.Offset < sizeof(SnapshotHeader) || col.Offset > fileSize || col.Bytes > fileSize - col.Offset)
+				throw INDEX_SNAPSHOT_ERROR("Index snapshot column lies outside of the file!", ERROR_FILE_CORRUPT);
+
+			if (!col.ElementSize || col.Bytes % col.ElementSize)
+				throw INDEX_SNAPSHOT_ERROR("Index snapshot column is not a whole number of elements!", ERROR_FILE_CORRUPT);
+		}
+	}
+
+}
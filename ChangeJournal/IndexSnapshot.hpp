@@ -0,0 +1,113 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+#include "ntfs_defs.h"
+
+#define INDEX_SNAPSHOT_ERROR(msg, err)\
+	std::runtime_error(("[IndexSnapshot] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+// The on-disk layout of a FileIndex snapshot: a fixed header followed by each column, stored exactly as it
+// is laid out in memory, so a mapped snapshot can be queried without being read in. Any change to the
+// layout (or to what a column means) must bump snapshot_version.
+namespace ntfs {
+
+	constexpr uint64_t snapshot_magic = 0x005844495346544EULL;	// "NTFSIDX"
+	constexpr uint32_t snapshot_version = 1;
+	constexpr uint32_t snapshot_byte_order = 0x01020304;
+	// Columns start on cache line boundaries, which also keeps every element naturally aligned
+	constexpr uint64_t snapshot_alignment = 64;
+
+	enum SnapshotColumnId : uint32_t {
+		SnapshotSequence = 0,
+		SnapshotFlags,
+		SnapshotNameType,
+		SnapshotNameLength,
+		SnapshotNameOffset,
+		SnapshotAttributes,
+		SnapshotParent,
+		SnapshotDataSize,
+		SnapshotAllocSize,
+		SnapshotCreationTime,
+		SnapshotChangeTime,
+		SnapshotWriteTime,
+		SnapshotAccessTime,
+		SnapshotNames,
+		SnapshotColumnCount
+	};
+
+	struct SnapshotColumn {
+		uint64_t	Offset;			// from the start of the file
+		uint64_t	Bytes;
+		uint32_t	ElementSize;
+		uint32_t	Checksum;		// crc32c of the column's bytes
+	};
+
+	struct SnapshotHeader {
+		uint64_t		Magic;
+		uint32_t		Version;
+		uint32_t		HeaderSize;
+		uint32_t		ByteOrder;
+		uint32_t		ColumnCount;
+		uint64_t		FileSize;
+		uint64_t		RecordCount;
+		uint64_t		FileCount;
+		int64_t			VolumeSerial;
+		uint64_t		JournalId;
+		int64_t			LastUsn;
+		SnapshotColumn	Columns[SnapshotColumnCount];
+		uint32_t		HeaderChecksum;	// crc32c of the header up to this field
+		uint32_t		Reserved;
+	};
+
+	/**
+	* Computes (or continues) a CRC-32C (Castagnoli) checksum.
+	*
+	* @param data The bytes to checksum
+	* @param len The number of bytes at data
+	* @param crc The checksum of whatever preceded data, when checksumming in pieces
+	* @return the checksum of everything so far
+	*/
+	uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+	/**
+	* Computes the checksum that belongs in header.HeaderChecksum.
+	*/
+	uint32_t snapshot_header_checksum(const SnapshotHeader& header);
+
+	/**
+	* Checks that a header describes a snapshot this build can map: the magic, version, byte order and
+	* header checksum match, and every column lies, aligned, within the file.
+	*
+	* @throws std::runtime_error describing the first problem found
+	* @param header The header to check
+	* @param fileSize The size of the file the header was read from
+	*/
+	void validate_snapshot_header(const SnapshotHeader& header, uint64_t fileSize);
+
+}
@@ -0,0 +1,163 @@
+#include "IndexUpdater.hpp"
+#include "AttributeList.hpp"
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+	// Whether a record read back for recNum is the live base record of a file
+	bool live_base_record(const std::vector<uint8_t>& raw, uint64_t recNum)
+	{
+		auto record = reinterpret_cast<const ntfs::NTFS_FILE_RECORD_HEADER*>(raw.data());
+
+		if (raw.size() < sizeof(ntfs::NTFS_FILE_RECORD_HEADER) || record->RecordHeader.Type != static_cast<ULONG>(ntfs::NtfsRecordType::File))
+			return false;
+
+		if (!(static_cast<USHORT>(record->Flags) & static_cast<USHORT>(ntfs::FileRecordFlags::RecordInUse)) || record->BaseFileRecord)
+			return false;
+
+		// FSCTL_GET_NTFS_FILE_RECORD hands back the closest in-use record below a free one; records from
+		// NTFS 3.1 on know their own number, which catches that
+		if (record->RecordHeader.UsaOffset >= offsetof(ntfs::NTFS_FILE_RECORD_HEADER, UpdateSequenceNumber) && record->MftRecordNumber != static_cast<ULONG>(recNum))
+			return false;
+
+		return true;
+	}
+}
+
+namespace ntfs {
+
+	IndexUpdater::IndexUpdater(FileIndex& index, VolOps& vol, PathResolver* paths, TrigramIndex* trigrams) : index(index), vol(vol), paths(paths), trigrams(trigrams)
+	{
+	}
+
+	void IndexUpdater::touch(uint64_t frn)
+	{
+		touched.push_back(reference_record(frn));
+	}
+
+	size_t IndexUpdater::flush()
+	{
+		size_t					done = 0;
+		uint64_t				records = vol.getFileCount();
+		std::vector<uint64_t>	extensions;
+		std::vector<uint64_t>	owners;		// the base record (and sequence number) each extension should belong to
+
+		std::sort(touched.begin(), touched.end());
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+		// New files may have landed past the end of the MFT as the volume first saw it
+		if (!touched.empty() && touched.back() >= records && vol.getBlockDevice()) {
+			vol.reloadMft();
+			records = vol.getFileCount();
+		}
+
+		for (auto recNum : touched) {
+			std::vector<uint8_t> raw;
+
+			if (recNum < records)
+				raw = vol.getMftRecord(recNum);
+
+			// Any runlists cached for the file may describe its old contents
+			if (vol.getBlockDevice())
+				vol.getExtentCache()->invalidate(recNum);
+
+			if (live_base_record(raw, recNum)) {
+				auto record = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(raw.data());
+
+				index.refresh(recNum, record, raw.size());
+
+				// Whatever the file keeps in extension records is read once every base record has been
+				auto list = vol.readAttributeList(record, raw.size());
+				if (!list.empty()) {
+					for (auto ext : extension_records(parse_attribute_list(list.data(), list.size()), recNum)) {
+						extensions.push_back(ext);
+						owners.push_back((static_cast<uint64_t>(record->SequenceCount) << 48) | recNum);
+					}
+				}
+			}
+			else {
+				index.remove(recNum);
+			}
+
+			++done;
+		}
+
+		if (!extensions.empty()) {
+			auto extRecs = vol.getMftRecords(extensions);
+
+			for (size_t i = 0; i < extRecs.size(); ++i) {
+				auto record = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(extRecs[i].data());
+
+				if (is_extension_of(record, extRecs[i].size(), extensions[i], owners[i]))
+					index.addRecord(extensions[i], record, extRecs[i].size());
+			}
+		}
+
+		for (auto recNum : touched) {
+			if (paths) {
+				paths->remove(recNum);
+				if (index.contains(recNum) && (index.flags(recNum) & IndexNamed))
+					paths->add(recNum, index.sequence(recNum), index.parent(recNum), index.nameData(recNum), index.nameLength(recNum), index.nameType(recNum), index.isDirectory(recNum));
+			}
+
+			if (trigrams)
+				trigrams->update(recNum);
+		}
+
+		touched.clear();
+		return done;
+	}
+
+	size_t IndexUpdater::pending()
+	{
+		std::sort(touched.begin(), touched.end());
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+		return touched.size();
+	}
+
+	void IndexUpdater::apply(PUSN_RECORD rec)
+	{
+		touch(usn_file_reference(rec));
+	}
+
+	template <typename Journal>
+	bool IndexUpdater::catchUpFrom(Journal& journal)
+	{
+		UsnCursor<Journal>	cursor(journal, default_batch_size, 1);
+		auto&				data = cursor.journalData();
+		auto				checkpoint = index.checkpoint();
+
+		if (checkpoint.journalId != data.UsnJournalID || checkpoint.lastUsn < data.LowestValidUsn)
+			return false;
+
+		cursor.seek(checkpoint.lastUsn);
+		for (;;) {
+			auto batch = cursor.read();
+			if (batch.empty())
+				break;
+
+			for (auto rec : batch)
+				apply(rec);
+
+			flush();
+			checkpoint.lastUsn = cursor.tell();
+			index.setCheckpoint(checkpoint);
+		}
+
+		return true;
+	}
+
+#ifdef _WIN32
+	bool IndexUpdater::catchUp(ChangeJournal& journal)
+	{
+		return catchUpFrom(journal);
+	}
+#endif
+
+	bool IndexUpdater::catchUp(NtfsJournal& journal)
+	{
+		return catchUpFrom(journal);
+	}
+
+}
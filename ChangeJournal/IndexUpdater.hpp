@@ -0,0 +1,115 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+#include "FileIndex.hpp"
+#include "PathResolver.hpp"
+#include "TrigramIndex.hpp"
+#include "VolumeOptions.hpp"
+#include "ChangeJournal.hpp"
+#include "NtfsJournal.hpp"
+#include "UsnCursor.hpp"
+
+namespace ntfs {
+
+	/**
+	* Keeps a FileIndex (and optionally a PathResolver) current by following the change journal, rather
+	* than rescanning the MFT. Instead of interpreting each USN reason, the updater notes which files
+	* records mention, and then re-reads each of those files' MFT records once; whatever the MFT says now
+	* (created, deleted, renamed, resized, ...) is what the index ends up with. The work done is therefore
+	* proportional to the number of files that changed, not to the size of the volume.
+	*/
+	class IndexUpdater {
+	public:
+		/**
+		* @param index The index to maintain; its checkpoint says where in the journal it is up to
+		* @param vol The volume the index was built from, used to re-read changed records
+		* @param paths A resolver to maintain alongside the index, or nullptr
+		* @param trigrams A trigram index of index to maintain alongside it, or nullptr
+		*/
+		IndexUpdater(FileIndex& index, VolOps& vol, PathResolver* paths = nullptr, TrigramIndex* trigrams = nullptr);
+
+		/**
+		* Notes that a file has changed; nothing is re-read until flush().
+		*
+		* @param frn The file reference number of the file (the sequence number is ignored)
+		*/
+		void touch(uint64_t frn);
+
+		/**
+		* Re-reads the MFT record of every file touched since the last flush, and updates the index (and
+		* resolver and trigrams) to match. The extension records of files with attribute lists are gathered
+		* up and read together, once all of the base records have been.
+		*
+		* @throws std::runtime_error if a record can't be read (e.g., it was caught mid-write); the files
+		*         touched remain pending, so flush() may simply be retried
+		* @return the number of records re-read
+		*/
+		size_t flush();
+
+		/**
+		* Returns the number of distinct files waiting for flush().
+		*/
+		size_t pending();
+
+		/**
+		* Notes the file a USN record describes as changed.
+		*/
+		void apply(PUSN_RECORD rec);
+
+#ifdef _WIN32
+		/**
+		* Reads the journal from the index's checkpoint up to its end, applying every record, and advancing
+		* the checkpoint after each buffer of records has been flushed.
+		*
+		* @throws std::runtime_error if the journal or the MFT can't be read
+		* @param journal The change journal of the volume the index was built from
+		* @return false if the journal can no longer bring the index up to date (it was recreated, or records
+		*         the index hasn't seen have been purged), in which case the index must be rebuilt
+		*/
+		bool catchUp(ChangeJournal& journal);
+#endif
+
+		/**
+		* Same as catchUp(ChangeJournal&), but reads the journal straight off the volume, e.g., to bring a
+		* snapshot of a volume up to date from a later image of it.
+		*/
+		bool catchUp(NtfsJournal& journal);
+
+	private:
+		template <typename Journal>
+		bool catchUpFrom(Journal& journal);
+
+		FileIndex&				index;
+		VolOps&					vol;
+		PathResolver*			paths;
+		TrigramIndex*			trigrams;
+		std::vector<uint64_t>	touched;
+	};
+
+}
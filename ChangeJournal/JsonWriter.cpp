@@ -0,0 +1,253 @@
+#include "JsonWriter.hpp"
+#include "TextFormat.hpp"
+#include <algorithm>
+
+namespace {
+	// Writes a character that JSON requires to be escaped (quotes, backslashes and control characters)
+	char* write_escape(char* p, uint32_t c)
+	{
+		*p++ = '\\';
+
+		switch (c) {
+		case '"':
+		case '\\':
+			*p++ = static_cast<char>(c);
+			break;
+		case '\b':
+			*p++ = 'b';
+			break;
+		case '\f':
+			*p++ = 'f';
+			break;
+		case '\n':
+			*p++ = 'n';
+			break;
+		case '\r':
+			*p++ = 'r';
+			break;
+		case '\t':
+			*p++ = 't';
+			break;
+		default:
+			*p++ = 'u';
+			*p++ = '0';
+			*p++ = '0';
+			*p++ = ntfs::hex_digits[c >> 4];
+			*p++ = ntfs::hex_digits[c & 0xF];
+			break;
+		}
+
+		return p;
+	}
+
+	inline bool needs_escape(uint32_t c)
+	{
+		return c < 0x20 || '"' == c || '\\' == c;
+	}
+}
+
+namespace ntfs {
+
+	JsonWriter::JsonWriter(size_t capacity) : buf(new char[std::max<size_t>(capacity, 64)]), cap(std::max<size_t>(capacity, 64))
+	{
+	}
+
+	JsonWriter& JsonWriter::beginObject()
+	{
+		separate();
+		*reserve(1) = '{';
+		++len;
+		comma = false;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::endObject()
+	{
+		*reserve(1) = '}';
+		++len;
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::beginArray()
+	{
+		separate();
+		*reserve(1) = '[';
+		++len;
+		comma = false;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::endArray()
+	{
+		*reserve(1) = ']';
+		++len;
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::key(const char* name)
+	{
+		size_t	n = strlen(name);
+		char*	p = reserve(n + 4);
+
+		if (comma)
+			*p++ = ',';
+
+		*p++ = '"';
+		memcpy(p, name, n);
+		p += n;
+		*p++ = '"';
+		*p++ = ':';
+
+		len = p - buf.get();
+		comma = false;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::value(bool v)
+	{
+		separate();
+		memcpy(reserve(5), v ? "true" : "false", v ? 4 : 5);
+		len += v ? 4 : 5;
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::value(const WCHAR* s, size_t count)
+	{
+		separate();
+
+		// At worst, every code unit becomes a six byte \u00XX escape
+		char* p = reserve(count * 6 + 2);
+
+		*p++ = '"';
+		p = format_utf8(p, s, count, [](char* q, char c) {
+			if (needs_escape(c))
+				return write_escape(q, c);
+
+			*q = c;
+			return q + 1;
+		});
+		*p++ = '"';
+
+		len = p - buf.get();
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::value(const char* s, size_t count)
+	{
+		separate();
+
+		char* p = reserve(count * 6 + 2);
+
+		*p++ = '"';
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t c = static_cast<unsigned char>(s[i]);
+
+			if (needs_escape(c))
+				p = write_escape(p, c);
+			else
+				*p++ = s[i];
+		}
+		*p++ = '"';
+
+		len = p - buf.get();
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::hexValue(uint64_t v)
+	{
+		separate();
+
+		char* p = reserve(20);
+
+		*p++ = '"';
+		*p++ = '0';
+		*p++ = 'x';
+		p = format_hex(p, v);
+		*p++ = '"';
+
+		len = p - buf.get();
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::hexValue(uint64_t high, uint64_t low)
+	{
+		separate();
+
+		char* p = reserve(36);
+
+		*p++ = '"';
+		*p++ = '0';
+		*p++ = 'x';
+		p = format_hex(p, high);
+		p = format_hex(p, low);
+		*p++ = '"';
+
+		len = p - buf.get();
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::null()
+	{
+		separate();
+		memcpy(reserve(4), "null", 4);
+		len += 4;
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::endLine()
+	{
+		*reserve(1) = '\n';
+		++len;
+		comma = false;
+		return *this;
+	}
+
+	void JsonWriter::clear()
+	{
+		len = 0;
+		comma = false;
+	}
+
+	void JsonWriter::grow(size_t n)
+	{
+		size_t					newCap = std::max(cap * 2, len + n);
+		std::unique_ptr<char[]>	newBuf(new char[newCap]);
+
+		memcpy(newBuf.get(), buf.get(), len);
+		buf = std::move(newBuf);
+		cap = newCap;
+	}
+
+	void JsonWriter::separate()
+	{
+		if (comma) {
+			*reserve(1) = ',';
+			++len;
+		}
+	}
+
+	JsonWriter& JsonWriter::writeUnsigned(uint64_t v)
+	{
+		separate();
+		len = format_decimal(reserve(max_decimal_length), v) - buf.get();
+		comma = true;
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::writeSigned(int64_t v)
+	{
+		separate();
+		len = format_decimal(reserve(max_decimal_length), v) - buf.get();
+		comma = true;
+		return *this;
+	}
+
+}
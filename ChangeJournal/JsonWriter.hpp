@@ -0,0 +1,142 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <stdint.h>
+#include "ntfs_compat.h"
+
+namespace ntfs {
+
+	constexpr size_t default_json_capacity = 64 * 1024;
+
+	/**
+	* Writes JSON straight into a buffer it owns, without going through streams or locales: integers are
+	* formatted by hand, and UTF-16 names are transcoded to UTF-8 and escaped in a single pass (unpaired
+	* surrogates become U+FFFD; nothing is truncated). The buffer only grows, so a writer that's clear()ed
+	* and reused for every batch stops allocating once it's big enough for one.
+	*
+	* Commas are placed automatically. Output is compact, and endLine() ends a line of NDJSON.
+	*
+	*     json.beginObject().key("Usn").value(usn).key("Name").value(name, len).endObject().endLine();
+	*/
+	class JsonWriter {
+	public:
+		/**
+		* @param capacity The initial size of the buffer, in bytes
+		*/
+		JsonWriter(size_t capacity = default_json_capacity);
+
+		JsonWriter& beginObject();
+		JsonWriter& endObject();
+		JsonWriter& beginArray();
+		JsonWriter& endArray();
+
+		/**
+		* Writes the key of the next member of an object. Keys are written as is, so they must not need escaping.
+		*/
+		JsonWriter& key(const char* name);
+
+		/**
+		* Writes an integer.
+		*/
+		template <typename T>
+		typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, JsonWriter&>::type value(T v)
+		{
+			return std::is_signed<T>::value ? writeSigned(static_cast<int64_t>(v)) : writeUnsigned(static_cast<uint64_t>(v));
+		}
+
+		JsonWriter& value(bool v);
+
+		/**
+		* Writes a UTF-16 string (e.g., a file name), transcoded to UTF-8.
+		*
+		* @param s The string, which needn't be NUL terminated
+		* @param len The length of s, in characters
+		*/
+		JsonWriter& value(const WCHAR* s, size_t len);
+
+		/**
+		* Writes a UTF-8 string.
+		*
+		* @param s The string, which needn't be NUL terminated
+		* @param len The length of s, in bytes
+		*/
+		JsonWriter& value(const char* s, size_t len);
+
+		/**
+		* Writes a 64 bit value as a string of 16 hex digits (e.g., "0x000000000000002a").
+		*/
+		JsonWriter& hexValue(uint64_t v);
+
+		/**
+		* Writes a 128 bit value as a string of 32 hex digits, high half first.
+		*/
+		JsonWriter& hexValue(uint64_t high, uint64_t low);
+
+		JsonWriter& null();
+
+		/**
+		* Ends a line of NDJSON; the next value starts a new document.
+		*/
+		JsonWriter& endLine();
+
+		/**
+		* Returns what's been written so far; size() bytes long, and not NUL terminated.
+		*/
+		const char* data() const { return buf.get(); }
+		size_t size() const { return len; }
+
+		std::string str() const { return std::string(buf.get(), len); }
+
+		/**
+		* Discards what's been written, keeping the buffer.
+		*/
+		void clear();
+
+	private:
+		// Makes room for n more bytes, and returns where they go
+		char* reserve(size_t n)
+		{
+			if (cap - len < n)
+				grow(n);
+			return buf.get() + len;
+		}
+
+		void grow(size_t n);
+		void separate();
+		JsonWriter& writeUnsigned(uint64_t v);
+		JsonWriter& writeSigned(int64_t v);
+
+		std::unique_ptr<char[]>	buf;
+		size_t					len = 0;
+		size_t					cap = 0;
+		bool					comma = false;	// whether the next value needs a comma before it
+	};
+
+}
@@ -0,0 +1,113 @@
+#include "Lznt1.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	constexpr uint16_t chunk_size_mask = 0x0FFF;
+	constexpr uint16_t chunk_compressed = 0x8000;
+
+	/**
+	* Decodes the tokens of one compressed chunk into [out, end), returning the number of bytes produced.
+	*/
+	size_t decode_chunk(const uint8_t* in, const uint8_t* inEnd, uint8_t* out, uint8_t* end)
+	{
+		uint8_t*	start = out;
+		// Back references split their 16 bits between offset and length according to how far into the
+		// chunk they are: the further in, the more bits go to the offset. split is the first position at
+		// which the offset gains another bit.
+		unsigned	lengthBits = 12;
+		size_t		split = 0x10;
+
+		while (in < inEnd && out < end) {
+			uint8_t flags = *in++;
+
+			for (unsigned bit = 0; bit < 8 && in < inEnd && out < end; ++bit, flags >>= 1) {
+				if (!(flags & 1)) {
+					*out++ = *in++;
+					continue;
+				}
+
+				if (inEnd - in < 2)
+					throw LZNT1_ERROR("Back reference runs past the end of its chunk!", ERROR_INVALID_DATA);
+
+				size_t pos = static_cast<size_t>(out - start);
+				while (pos > split) {
+					--lengthBits;
+					split <<= 1;
+				}
+
+				uint16_t	token = static_cast<uint16_t>(in[0] | (in[1] << 8));
+				size_t		offset = static_cast<size_t>(token >> lengthBits) + 1;
+				size_t		len = static_cast<size_t>(token & ((1u << lengthBits) - 1)) + 3;
+				in += 2;
+
+				if (offset > pos)
+					throw LZNT1_ERROR("Back reference reaches before the start of its chunk!", ERROR_INVALID_DATA);
+
+				if (len > static_cast<size_t>(end - out))
+					len = static_cast<size_t>(end - out);
+
+				const uint8_t* src = out - offset;
+
+				// Copies can overlap their own output (e.g., a run of one repeated byte), so they only go
+				// a word at a time when the source is at least a word behind, and there's room to overshoot.
+				if (offset >= sizeof(uint64_t) && static_cast<size_t>(end - out) >= len + sizeof(uint64_t)) {
+					for (size_t i = 0; i < len; i += sizeof(uint64_t))
+						memcpy(out + i, src + i, sizeof(uint64_t));
+					out += len;
+				}
+				else {
+					for (size_t i = 0; i < len; ++i)
+						out[i] = src[i];
+					out += len;
+				}
+			}
+		}
+
+		return static_cast<size_t>(out - start);
+	}
+}
+
+namespace ntfs {
+
+	size_t lznt1_decompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outLen)
+	{
+		const uint8_t*	inEnd = in + inLen;
+		size_t			written = 0;
+
+		while (inEnd - in >= 2 && written < outLen) {
+			uint16_t header = static_cast<uint16_t>(in[0] | (in[1] << 8));
+			if (!header)
+				break;
+
+			size_t len = static_cast<size_t>(header & chunk_size_mask) + 1;
+			in += 2;
+
+			if (len > static_cast<size_t>(inEnd - in))
+				throw LZNT1_ERROR("Chunk runs past the end of the compressed data!", ERROR_INVALID_DATA);
+
+			size_t room = std::min(lznt1_chunk_size, outLen - written);
+			size_t produced = 0;
+
+			if (header & chunk_compressed) {
+				produced = decode_chunk(in, in + len, out + written, out + written + room);
+			}
+			else {
+				produced = std::min(len, room);
+				memcpy(out + written, in, produced);
+			}
+
+			in += len;
+			written += produced;
+
+			// Short chunks stand for a whole chunk's worth of output, the rest of which is zeros
+			if (produced < room && inEnd - in >= 2 && (in[0] | in[1])) {
+				memset(out + written, 0, room - produced);
+				written += room - produced;
+			}
+		}
+
+		return written;
+	}
+
+}
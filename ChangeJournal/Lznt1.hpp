@@ -0,0 +1,57 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <string>
+#include "ntfs_defs.h"
+
+#define LZNT1_ERROR(msg, err)\
+	std::runtime_error(("[Lznt1] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	// LZNT1 compresses its input in independent chunks of this many bytes
+	constexpr size_t lznt1_chunk_size = 4096;
+
+	/**
+	* Decompresses an LZNT1 stream (e.g., one compression unit of a compressed attribute). Each chunk
+	* stands for lznt1_chunk_size bytes of output; a chunk that decodes to fewer bytes is padded with
+	* zeros, unless it's the last one. Decoding stops at the end of the input, at a zero chunk header,
+	* or once out is full. Nothing is allocated, and nothing is written outside of out.
+	*
+	* @throws std::runtime_error if the stream is malformed (e.g., a back reference reaches before the
+	*         start of its chunk, or a chunk runs past the end of the input)
+	* @param in The compressed data
+	* @param inLen The size of the compressed data, in bytes
+	* @param out The destination buffer
+	* @param outLen The size of the destination buffer, in bytes
+	* @return the number of bytes written to out
+	*/
+	size_t lznt1_decompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outLen);
+
+}
@@ -0,0 +1,118 @@
+#include "MftBitmap.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	inline unsigned lowest_bit(uint64_t word)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+#ifdef _M_X64
+		_BitScanForward64(&bit, word);
+#else
+		if (!_BitScanForward(&bit, static_cast<unsigned long>(word))) {
+			_BitScanForward(&bit, static_cast<unsigned long>(word >> 32));
+			bit += 32;
+		}
+#endif
+		return static_cast<unsigned>(bit);
+#else
+		return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+	}
+
+	inline unsigned bit_count(uint64_t word)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return static_cast<unsigned>(__popcnt64(word));
+#elif defined(_MSC_VER)
+		return static_cast<unsigned>(__popcnt(static_cast<unsigned>(word)) + __popcnt(static_cast<unsigned>(word >> 32)));
+#else
+		return static_cast<unsigned>(__builtin_popcountll(word));
+#endif
+	}
+}
+
+namespace ntfs {
+
+	MftBitmap::MftBitmap(const uint8_t* bits, size_t len, uint64_t records) : words(static_cast<size_t>((records + 63) / 64), ~uint64_t(0)), records(records)
+	{
+		size_t bytes = std::min<size_t>(len, static_cast<size_t>((records + 7) / 8));
+
+		// Bit n of the bitmap is bit n % 8 of byte n / 8, which is bit n % 64 of a little endian word
+		if (bytes)
+			memcpy(words.data(), bits, bytes);
+
+		if (bytes % sizeof(uint64_t))
+			words[bytes / sizeof(uint64_t)] |= ~uint64_t(0) << ((bytes % sizeof(uint64_t)) * 8);
+
+		// Keep the bits past the last slot clear, so scans never have to check for them
+		if (records % 64)
+			words.back() &= (uint64_t(1) << (records % 64)) - 1;
+
+		for (auto w : words)
+			used += bit_count(w);
+	}
+
+	uint64_t MftBitmap::nextInUse(uint64_t from) const
+	{
+		return scan(from, 0);
+	}
+
+	uint64_t MftBitmap::nextFree(uint64_t from) const
+	{
+		return scan(from, ~uint64_t(0));
+	}
+
+	uint64_t MftBitmap::scan(uint64_t from, uint64_t invert) const
+	{
+		if (from >= records)
+			return records;
+
+		size_t		i = static_cast<size_t>(from / 64);
+		uint64_t	word = (words[i] ^ invert) & (~uint64_t(0) << (from % 64));
+
+		while (!word) {
+			if (++i == words.size())
+				return records;
+			word = words[i] ^ invert;
+		}
+
+		// Inverted scans see the clear bits past the last slot as free; clamping takes care of them
+		return std::min<uint64_t>(records, (static_cast<uint64_t>(i) * 64) + lowest_bit(word));
+	}
+
+	bool MftBitmap::nextRun(uint64_t from, uint64_t limit, uint64_t maxGap, uint64_t maxCount, uint64_t& first, uint64_t& count) const
+	{
+		limit = std::min(limit, records);
+		first = nextInUse(from);
+		if (first >= limit || !maxCount)
+			return false;
+
+		uint64_t end = std::min(limit, first + maxCount);
+		uint64_t last = first;	// one past the last slot in use so far
+
+		while (last < end) {
+			uint64_t free = nextFree(last);
+			if (free >= end) {
+				last = end;
+				break;
+			}
+
+			uint64_t next = nextInUse(free);
+			last = free;
+			if (next >= end || next - free > maxGap)
+				break;
+
+			last = next;
+		}
+
+		count = last - first;
+		return true;
+	}
+
+}
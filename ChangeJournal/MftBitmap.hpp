@@ -0,0 +1,100 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace ntfs {
+
+	/**
+	* The $MFT's $BITMAP attribute: one bit per record slot, set for slots in use. Bits are kept in 64-bit
+	* words, so that runs of used and free slots are found a word at a time with bit scans, rather than a
+	* bit at a time.
+	*/
+	class MftBitmap {
+	public:
+		MftBitmap() = default;
+
+		/**
+		* @param bits The raw value of the $BITMAP attribute
+		* @param len The size of the value, in bytes
+		* @param records The number of record slots in the MFT. Slots the value is too short to cover are
+		*        treated as in use, so that nothing is ever skipped on the bitmap's account by mistake.
+		*/
+		MftBitmap(const uint8_t* bits, size_t len, uint64_t records);
+
+		/**
+		* Returns the number of record slots covered.
+		*/
+		uint64_t size() const { return records; }
+
+		/**
+		* Returns the number of record slots in use.
+		*/
+		uint64_t count() const { return used; }
+
+		/**
+		* Indicates whether a record slot is in use; slots past the end are not.
+		*/
+		bool inUse(uint64_t recNum) const
+		{
+			return recNum < records && (words[static_cast<size_t>(recNum / 64)] >> (recNum % 64)) & 1;
+		}
+
+		/**
+		* Returns the first slot at or after from that is in use, or size() if there are none.
+		*/
+		uint64_t nextInUse(uint64_t from) const;
+
+		/**
+		* Returns the first slot at or after from that is free, or size() if there are none.
+		*/
+		uint64_t nextFree(uint64_t from) const;
+
+		/**
+		* Finds the next range worth reading: it starts at the first slot in use at or after from, and runs
+		* on through later slots in use, bridging free gaps of up to maxGap slots.
+		*
+		* @param from The first slot to consider
+		* @param limit One past the last slot to consider
+		* @param maxGap The longest run of free slots to read through rather than end the range at
+		* @param maxCount The most slots the range may span
+		* @param first Receives the first slot of the range
+		* @param count Receives the number of slots in the range
+		* @return false if no slot from from up to limit is in use
+		*/
+		bool nextRun(uint64_t from, uint64_t limit, uint64_t maxGap, uint64_t maxCount, uint64_t& first, uint64_t& count) const;
+
+	private:
+		uint64_t scan(uint64_t from, uint64_t invert) const;
+
+		std::vector<uint64_t>	words;
+		uint64_t				records = 0;
+		uint64_t				used = 0;
+	};
+
+}
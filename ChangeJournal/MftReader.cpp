@@ -0,0 +1,222 @@
+#include "MftReader.hpp"
+#include <algorithm>
+
+namespace ntfs {
+
+	uint64_t MftRecordBatch::firstRecord() const
+	{
+		return first;
+	}
+
+	size_t MftRecordBatch::size() const
+	{
+		return count;
+	}
+
+	uint32_t MftRecordBatch::recordSize() const
+	{
+		return recSize;
+	}
+
+	uint64_t MftRecordBatch::recordNumber(size_t i) const
+	{
+		return first + i;
+	}
+
+	NTFS_FILE_RECORD_HEADER* MftRecordBatch::record(size_t i)
+	{
+		if (i >= count || RecordStatus::Valid != statuses[i])
+			return nullptr;
+
+		return reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(buffer.data() + (i * recSize));
+	}
+
+	bool MftRecordBatch::inUse(size_t i)
+	{
+		auto rec = record(i);
+		return rec && (static_cast<USHORT>(rec->Flags) & static_cast<USHORT>(FileRecordFlags::RecordInUse));
+	}
+
+	RecordStatus MftRecordBatch::status(size_t i) const
+	{
+		return statuses[i];
+	}
+
+	MftReader::MftReader(VolOps& vol, size_t readSize, size_t prefetch, ReadBackend backend, bool skipUnused) :
+		vol(vol), nextRecord(0), queuedRecord(0), prefetchDepth(prefetch), backend(backend)
+	{
+		auto& geom = this->vol.getGeometry();
+
+		recSize = geom.bytesPerFileRecord;
+		bytesPerCluster = geom.bytesPerCluster;
+		totalRecords = this->vol.getFileCount();
+		recordsPerRead = std::max<size_t>(1, readSize / recSize);
+		mftExtents = this->vol.getMftExtents();
+
+		// Skipping is only an optimization, so a bitmap that can't be read just means reading everything
+		if (skipUnused) {
+			try {
+				bitmap = this->vol.getMftBitmap();
+			}
+			catch (const std::runtime_error&) {
+				bitmap.reset();
+			}
+		}
+	}
+
+	bool MftReader::next(MftRecordBatch& batch)
+	{
+		if (!prefetchDepth) {
+			uint64_t first = 0, count = 0;
+			if (!nextRange(nextRecord, totalRecords, first, count)) {
+				nextRecord = totalRecords;
+				return false;
+			}
+
+			nextRecord = first + read(first, static_cast<size_t>(count), batch);
+			return true;
+		}
+
+		// The pipeline is only created once someone actually streams, since readers used purely for
+		// positional read()s (e.g., by parallel scans) never need it.
+		if (!pipeline)
+			pipeline.reset(new ReadPipeline(vol.getBlockDevice(), prefetchDepth, backend));
+
+		fill();
+		if (ahead.empty())
+			return false;
+
+		Prefetch p = std::move(ahead.front());
+		ahead.pop_front();
+		nextRecord = p.first + p.count;
+		pipeline->wait();
+
+		batch.first = p.first;
+		batch.recSize = recSize;
+		batch.count = p.count;
+		batch.buffer.swap(p.buffer);
+		batch.statuses.resize(batch.count);
+		spare.push_back(std::move(p.buffer));
+
+		// Get the next read going before spending any time on this one
+		fill();
+		apply_fixups(batch.buffer.data(), batch.count, recSize, NtfsRecordType::File, batch.statuses.data());
+		markUnused(batch, 0, batch.count);
+
+		return true;
+	}
+
+	void MftReader::fill()
+	{
+		while (ahead.size() < prefetchDepth && queuedRecord < totalRecords) {
+			Prefetch	p;
+			uint64_t	first = 0, count = 0;
+
+			if (!nextRange(queuedRecord, totalRecords, first, count)) {
+				queuedRecord = totalRecords;
+				break;
+			}
+
+			p.first = first;
+			p.count = static_cast<size_t>(count);
+			if (!spare.empty()) {
+				p.buffer = std::move(spare.back());
+				spare.pop_back();
+			}
+			p.buffer.resize(p.count * recSize);
+
+			pipeline->submit(p.first, *mftExtents, bytesPerCluster, p.first * recSize, p.buffer.data(), p.buffer.size());
+			queuedRecord = p.first + p.count;
+			ahead.push_back(std::move(p));
+		}
+	}
+
+	void MftReader::drain()
+	{
+		while (!ahead.empty()) {
+			try {
+				pipeline->wait();
+			}
+			catch (const std::runtime_error&) {
+				// Nobody will look at the data, so a failed read doesn't matter
+			}
+			spare.push_back(std::move(ahead.front().buffer));
+			ahead.pop_front();
+		}
+	}
+
+	size_t MftReader::read(uint64_t firstRecord, size_t count, MftRecordBatch& batch)
+	{
+		batch.first = firstRecord;
+		batch.recSize = recSize;
+		batch.count = (firstRecord < totalRecords) ? static_cast<size_t>(std::min<uint64_t>(count, totalRecords - firstRecord)) : 0;
+		batch.buffer.resize(batch.count * recSize);
+		batch.statuses.resize(batch.count);
+
+		if (!batch.count)
+			return 0;
+
+		if (!bitmap) {
+			vol.readMft(firstRecord * recSize, batch.buffer.data(), batch.buffer.size());
+			apply_fixups(batch.buffer.data(), batch.count, recSize, NtfsRecordType::File, batch.statuses.data());
+			return batch.count;
+		}
+
+		// Only the ranges holding records in use are read; everything else stays Unused
+		uint64_t end = firstRecord + batch.count;
+		uint64_t runFirst = 0, runCount = 0;
+
+		std::fill(batch.statuses.begin(), batch.statuses.end(), RecordStatus::Unused);
+		for (uint64_t pos = firstRecord; nextRange(pos, end, runFirst, runCount); pos = runFirst + runCount) {
+			size_t at = static_cast<size_t>(runFirst - firstRecord);
+
+			vol.readMft(runFirst * recSize, batch.buffer.data() + (at * recSize), static_cast<size_t>(runCount * recSize));
+			apply_fixups(batch.buffer.data() + (at * recSize), static_cast<size_t>(runCount), recSize, NtfsRecordType::File, batch.statuses.data() + at);
+			markUnused(batch, at, static_cast<size_t>(runCount));
+		}
+
+		return batch.count;
+	}
+
+	bool MftReader::nextRange(uint64_t from, uint64_t limit, uint64_t& first, uint64_t& count) const
+	{
+		if (!bitmap) {
+			first = from;
+			count = std::min<uint64_t>(recordsPerRead, limit - std::min(from, limit));
+			return count > 0;
+		}
+
+		return bitmap->nextRun(from, limit, default_mft_skip_gap, recordsPerRead, first, count);
+	}
+
+	void MftReader::markUnused(MftRecordBatch& batch, size_t from, size_t count) const
+	{
+		if (!bitmap)
+			return;
+
+		// Slots read through because they lay in a short gap are still reported as unused
+		for (size_t i = from; i < from + count; ++i) {
+			if (!bitmap->inUse(batch.first + i))
+				batch.statuses[i] = RecordStatus::Unused;
+		}
+	}
+
+	void MftReader::seek(uint64_t recNum)
+	{
+		if (pipeline)
+			drain();
+
+		nextRecord = queuedRecord = std::min(recNum, totalRecords);
+	}
+
+	uint64_t MftReader::tell() const
+	{
+		return nextRecord;
+	}
+
+	uint64_t MftReader::recordCount() const
+	{
+		return totalRecords;
+	}
+
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "VolumeOptions.hpp"
+#include "Fixup.hpp"
+#include "ReadPipeline.hpp"
+
+namespace ntfs {
+
+	constexpr size_t default_mft_read_size = 4 * 1024 * 1024;
+
+	// Runs of free record slots shorter than this are read through rather than skipped, since a separate
+	// read costs more than a few records' worth of bytes
+	constexpr uint64_t default_mft_skip_gap = 16;
+
+	/**
+	* A run of consecutive MFT records read in one go by an MftReader. The batch owns its buffer,
+	* and keeps it across calls to MftReader::next, so reusing one batch doesn't reallocate.
+	*/
+	class MftRecordBatch {
+	public:
+		/**
+		* Returns the number of the first record in the batch.
+		*/
+		uint64_t firstRecord() const;
+
+		/**
+		* Returns the number of records contained in the batch.
+		*/
+		size_t size() const;
+
+		/**
+		* Returns the size of each record in the batch, in bytes.
+		*/
+		uint32_t recordSize() const;
+
+		/**
+		* Returns the MFT record number of the i'th record in the batch.
+		*/
+		uint64_t recordNumber(size_t i) const;
+
+		/**
+		* Returns a pointer to the i'th record in the batch (with fixups applied).
+		*
+		* @param i The index of the record within the batch
+		* @return the record, or nullptr if the slot doesn't contain a valid FILE record (never used, or torn).
+		*/
+		NTFS_FILE_RECORD_HEADER* record(size_t i);
+
+		/**
+		* Indicates whether the i'th record in the batch is valid and currently in use.
+		*/
+		bool inUse(size_t i);
+
+		/**
+		* Returns the outcome of fixing up the i'th record in the batch (e.g., to report torn records).
+		*/
+		RecordStatus status(size_t i) const;
+
+	private:
+		friend class MftReader;
+
+		std::vector<uint8_t>		buffer;
+		std::vector<RecordStatus>	statuses;
+		uint64_t					first = 0;
+		size_t						count = 0;
+		uint32_t					recSize = 0;
+	};
+
+	/**
+	* Streams the whole $MFT off of a block device in large sequential reads, following the $MFT's
+	* data runs, and hands the records out in batches. While the caller works on one batch, next() keeps
+	* the following reads in flight through a ReadPipeline, so parsing and I/O overlap.
+	*
+	* By default, record slots the $MFT's bitmap marks free are never read: next() skips over long free
+	* runs entirely (so batches may begin anywhere), and both next() and read() report free slots as
+	* RecordStatus::Unused.
+	*/
+	class MftReader {
+	public:
+		/**
+		* @throws std::runtime_error if vol isn't backed by a block device
+		* @param vol The volume to read the MFT of; must have a block device set.
+		* @param readSize The number of bytes to read at a time (rounded down to a whole number of records).
+		* @param prefetch The number of reads next() keeps in flight ahead of the caller; 0 reads synchronously.
+		* @param backend The mechanism used to issue prefetched reads.
+		* @param skipUnused Skip the slots the $MFT's bitmap marks free; if the bitmap can't be read, every slot is read.
+		*/
+		MftReader(VolOps& vol, size_t readSize = default_mft_read_size, size_t prefetch = default_pipeline_depth, ReadBackend backend = ReadBackend::Auto, bool skipUnused = true);
+
+		/**
+		* Reads the next batch of records into batch.
+		*
+		* @throws std::runtime_error if the read fails
+		* @param batch The batch to fill; its buffer is reused between calls.
+		* @return false once the end of the MFT has been reached, otherwise true.
+		*/
+		bool next(MftRecordBatch& batch);
+
+		/**
+		* Reads count records starting at firstRecord into batch, without moving the reader's position. Since
+		* nothing in the reader changes, several threads may call read() on one reader at once.
+		*
+		* @throws std::runtime_error if the read fails
+		* @param firstRecord The first record to read
+		* @param count The number of records to read; clamped to the end of the MFT.
+		* @param batch The batch to fill; its buffer is reused between calls.
+		* @return the number of records in batch (including Unused ones).
+		*/
+		size_t read(uint64_t firstRecord, size_t count, MftRecordBatch& batch);
+
+		/**
+		* Positions the reader so that the next batch begins at recNum, discarding any prefetched reads.
+		*/
+		void seek(uint64_t recNum);
+
+		/**
+		* Returns the number of the record the next batch will begin at.
+		*/
+		uint64_t tell() const;
+
+		/**
+		* Returns the total number of record slots in the MFT.
+		*/
+		uint64_t recordCount() const;
+
+	private:
+		struct Prefetch {
+			uint64_t				first;
+			size_t					count;
+			std::vector<uint8_t>	buffer;
+		};
+
+		void fill();
+		void drain();
+		bool nextRange(uint64_t from, uint64_t limit, uint64_t& first, uint64_t& count) const;
+		void markUnused(MftRecordBatch& batch, size_t from, size_t count) const;
+
+		VolOps								vol;
+		std::shared_ptr<const ExtentMap>	mftExtents;
+		std::shared_ptr<const MftBitmap>	bitmap;		// empty when every slot is read
+		uint32_t							recSize;
+		uint32_t							bytesPerCluster;
+		uint64_t							totalRecords;
+		uint64_t							nextRecord;
+		uint64_t							queuedRecord;
+		size_t								recordsPerRead;
+		size_t								prefetchDepth;
+		ReadBackend							backend;
+		std::deque<Prefetch>				ahead;
+		std::vector<std::vector<uint8_t>>	spare;
+		// Declared after the buffers it reads into, so it is destroyed (and drained) first
+		std::unique_ptr<ReadPipeline>		pipeline;
+	};
+
+	template <typename Map, typename Sink>
+	void VolOps::parallelScan(Map map, Sink sink, const ParallelScanOptions& opts)
+	{
+		typedef decltype(map(uint64_t(), static_cast<NTFS_FILE_RECORD_HEADER*>(nullptr), size_t())) Result;
+		typedef std::vector<std::pair<uint64_t, Result>> Results;
+
+		scanChunks(opts, [&map](MftRecordBatch& batch) {
+			auto results = std::make_shared<Results>();
+
+			for (size_t i = 0; i < batch.size(); ++i) {
+				if (batch.inUse(i))
+					results->emplace_back(batch.recordNumber(i), map(batch.recordNumber(i), batch.record(i), batch.recordSize()));
+			}
+
+			return std::static_pointer_cast<void>(results);
+		}, [&sink](std::shared_ptr<void>& payload) {
+			for (auto& r : *std::static_pointer_cast<Results>(payload))
+				sink(r.first, std::move(r.second));
+		});
+	}
+
+}
@@ -0,0 +1,149 @@
+#include "NtfsJournal.hpp"
+#include "PathLookup.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+	const WCHAR journal_name[] = { '$', 'U', 's', 'n', 'J', 'r', 'n', 'l' };
+	const WCHAR data_name[] = { '$', 'J' };
+	const WCHAR max_name[] = { '$', 'M', 'a', 'x' };
+
+	// The contents of $UsnJrnl:$Max
+	struct USN_JOURNAL_MAX {
+		ULONGLONG	MaximumSize;
+		ULONGLONG	AllocationDelta;
+		ULONGLONG	UsnJournalID;
+		LONGLONG	LowestValidUsn;
+	};
+
+	/**
+	* Returns the length of the record at rec, or 0 if what's there isn't a whole record of a known version
+	* whose Usn is usn (zero padding included).
+	*/
+	size_t record_length(uint64_t usn, const uint8_t* rec, size_t avail)
+	{
+		auto	header = reinterpret_cast<const USN_RECORD_COMMON_HEADER*>(rec);
+		bool	valid = false;
+
+		if (avail < sizeof(USN_RECORD_COMMON_HEADER) || (header->RecordLength & 7))
+			return 0;
+
+		ntfs::visit_usn_record(rec, [&](auto view) {
+			valid = decltype(view)::valid(rec, avail) && static_cast<uint64_t>(view.usn()) == usn;
+		});
+
+		return valid ? header->RecordLength : 0;
+	}
+}
+
+namespace ntfs {
+
+	NtfsJournal::NtfsJournal(VolOps& vol, size_t chunkSize) : info(), chunk(std::max<size_t>(usn_page_size, (chunkSize + usn_page_size - 1) & ~(usn_page_size - 1)))
+	{
+		PathLookup		lookup(vol);
+		USN_JOURNAL_MAX	limits = {};
+
+		uint64_t frn = lookup.find(static_cast<uint64_t>(MftRecordNumber::MftExtend), journal_name, sizeof(journal_name) / sizeof(journal_name[0]));
+		if (!frn)
+			throw NTFS_JOURNAL_ERROR("Volume has no change journal!", ERROR_FILE_NOT_FOUND);
+
+		DataStream maxStream(vol, reference_record(frn), std::basic_string<WCHAR>(std::begin(max_name), std::end(max_name)));
+		if (maxStream.readAt(0, &limits, sizeof(limits)) < sizeof(limits))
+			throw NTFS_JOURNAL_ERROR("The journal's $Max stream is truncated!", ERROR_FILE_CORRUPT);
+
+		journal = std::make_unique<DataStream>(vol, reference_record(frn), std::basic_string<WCHAR>(std::begin(data_name), std::end(data_name)), chunk);
+
+		info.UsnJournalID = limits.UsnJournalID;
+		info.LowestValidUsn = limits.LowestValidUsn;
+		info.FirstUsn = static_cast<USN>(journal->nextDataOffset(static_cast<uint64_t>(std::max<USN>(0, limits.LowestValidUsn))));
+		info.NextUsn = static_cast<USN>(journal->size());
+		info.MaxUsn = INT64_MAX;
+		info.MaximumSize = limits.MaximumSize;
+		info.AllocationDelta = limits.AllocationDelta;
+	}
+
+	std::unique_ptr<USN_JOURNAL_DATA> NtfsJournal::getJournalData()
+	{
+		return std::make_unique<USN_JOURNAL_DATA>(info);
+	}
+
+	std::vector<uint8_t> NtfsJournal::getRecords(USN& next)
+	{
+		std::vector<uint8_t> buf(sizeof(USN) + chunk);
+
+		buf.resize(fill(next, buf.data(), chunk));
+		return buf;
+	}
+
+	size_t NtfsJournal::readRecords(USN& next, DWORDLONG journalId, uint8_t* buf, size_t len)
+	{
+		if (journalId != info.UsnJournalID)
+			throw NTFS_JOURNAL_ERROR("Journal ID doesn't match the volume's journal!", ERROR_INVALID_PARAMETER);
+
+		if (len < sizeof(USN) + usn_page_size)
+			throw NTFS_JOURNAL_ERROR("Buffer can't hold a page of records!", ERROR_INVALID_PARAMETER);
+
+		return fill(next, buf, (len - sizeof(USN)) & ~(usn_page_size - 1));
+	}
+
+	bool NtfsJournal::mapBuffer(std::vector<uint8_t>& buf, std::function<void(PUSN_RECORD)> func)
+	{
+		return visitBuffer(buf, func);
+	}
+
+	void NtfsJournal::mapRecords(std::function<void(PUSN_RECORD)> func)
+	{
+		visitRecords(func);
+	}
+
+	size_t NtfsJournal::fill(USN& next, uint8_t* buf, size_t readSize)
+	{
+		uint64_t	offset = static_cast<uint64_t>(std::max(next, info.FirstUsn));
+		size_t		kept = 0;
+
+		// Holes (and chunks with nothing but padding in them) are passed over until some records turn up
+		while (!kept && (offset = journal->nextDataOffset(offset)) < journal->size()) {
+			// Reads end on a page boundary, so that no record is cut short
+			uint64_t	end = std::min(journal->size(), ((offset + readSize) / usn_page_size) * usn_page_size);
+			size_t		len = journal->readAt(offset, buf + sizeof(USN), static_cast<size_t>(end - offset));
+
+			kept = compact_usn_records(offset, buf + sizeof(USN), len, minVersion, maxVersion);
+			offset += len;
+		}
+
+		next = static_cast<USN>(std::min(offset, journal->size()));
+		memcpy(buf, &next, sizeof(next));
+
+		return sizeof(USN) + kept;
+	}
+
+	size_t compact_usn_records(uint64_t offset, uint8_t* data, size_t len, WORD minVersion, WORD maxVersion)
+	{
+		size_t in = 0;
+		size_t out = 0;
+
+		while (in < len) {
+			size_t pageEnd = static_cast<size_t>(std::min<uint64_t>(len, (((offset + in) / usn_page_size) + 1) * usn_page_size - offset));
+			size_t length = record_length(offset + in, data + in, pageEnd - in);
+
+			// Whatever follows the last record in a page is padding; so is anything that doesn't parse
+			if (!length) {
+				in = pageEnd;
+				continue;
+			}
+
+			auto version = reinterpret_cast<USN_RECORD_COMMON_HEADER*>(data + in)->MajorVersion;
+			if (version >= minVersion && version <= maxVersion) {
+				if (out != in)
+					memmove(data + out, data + in, length);
+				out += length;
+			}
+
+			in += length;
+		}
+
+		return out;
+	}
+
+}
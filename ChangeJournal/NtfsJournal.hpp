@@ -1 +1,205 @@
 #pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_defs.h"
+#include "ChangeJournal.hpp"
+#include "DataStream.hpp"
+#include "UsnRecord.hpp"
+#include "VolumeOptions.hpp"
+
+#define NTFS_JOURNAL_ERROR(msg, err)\
+	std::runtime_error(("[NtfsJournal] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	// How much of $J is read (and handed out by getRecords) at once
+	constexpr size_t default_journal_chunk = 1024 * 1024;
+
+	// Records never straddle these; the rest of a page after its last record is zero filled
+	constexpr size_t usn_page_size = 4096;
+
+	/**
+	* Squeezes the page padding (and anything else that isn't a record) out of a piece of $J, in place,
+	* leaving the records of versions minVersion through maxVersion back to back at the start of data.
+	*
+	* @param offset The offset in $J that data was read from
+	* @param data The bytes read; records never straddle a page boundary, so this should end on one
+	* @param len The number of bytes in data
+	* @param minVersion The oldest record version to keep
+	* @param maxVersion The newest record version to keep
+	* @return the number of bytes of records kept
+	*/
+	size_t compact_usn_records(uint64_t offset, uint8_t* data, size_t len, WORD minVersion, WORD maxVersion);
+
+	/**
+	* Reads the change journal straight out of $Extend\$UsnJrnl, for volumes that can't be asked for it with
+	* FSCTL_READ_USN_JOURNAL (e.g., acquired images, or on hosts other than Windows). The interface follows
+	* ChangeJournal's, and buffers returned by getRecords have the same layout (a leading USN, followed by
+	* USN_RECORD_V2/V3 records), so anything that walks one with usn_records can walk the other.
+	*
+	* $J is a sparse stream that's only ever appended to; as the journal is trimmed, its head becomes one
+	* large hole. Holes are skipped by following the stream's data runs, so none of them is ever read.
+	* Each record's Usn is its offset in $J, which is what tells a record from leftover garbage; pages
+	* holding anything else are skipped, as are records of versions outside those asked for with
+	* setRecordVersions (2 and 3, by default).
+	*/
+	class NtfsJournal {
+	public:
+		/**
+		* Locates the journal, and reads its $Max stream.
+		*
+		* @throws std::runtime_error if no block device is set, the volume has no change journal, or its
+		*         records can't be read
+		* @param vol The volume to read the journal of; must outlive the NtfsJournal
+		* @param chunkSize How much of $J to read at once; rounded up to a whole number of pages
+		*/
+		NtfsJournal(VolOps& vol, size_t chunkSize = default_journal_chunk);
+
+		/**
+		* Returns the journal's data, as FSCTL_QUERY_USN_JOURNAL would. FirstUsn is where the stream's data
+		* begins, and NextUsn is its size.
+		*
+		* @throws std::bad_alloc if the unique_ptr allocation fails
+		* @return a unique_ptr containing the journal's USN_JOURNAL_DATA
+		*/
+		std::unique_ptr<USN_JOURNAL_DATA> getJournalData();
+
+		/**
+		* Sets the major versions of the records to return, like READ_USN_JOURNAL_DATA_V1's Min/MaxMajorVersion;
+		* e.g., 2 through 4 includes range tracking (V4) records.
+		*
+		* @param minMajor The oldest version to return
+		* @param maxMajor The newest version to return
+		*/
+		void setRecordVersions(WORD minMajor, WORD maxMajor) { minVersion = minMajor; maxVersion = maxMajor; }
+
+		/**
+		* Returns a buffer of the records from "next" onward, at most one chunk's worth. The value in next is
+		* replaced with the USN to continue from, which is also written to the start of the buffer.
+		*
+		* @throws std::runtime_error if $J can't be read
+		* @param next As input, the USN to start from (anything before FirstUsn starts at FirstUsn); upon
+		*        completion, the USN past the last record returned.
+		* @return A vector containing the next USN, followed by the records obtained. A vector holding nothing
+		*         but the USN indicates that there are no more records in the journal.
+		*/
+		std::vector<uint8_t> getRecords(USN& next);
+
+		/**
+		* Same as getRecords, but reads into a buffer the caller owns (and can reuse), as much of $J at a time
+		* as buf can hold (in whole pages) rather than one chunk.
+		*
+		* @throws std::runtime_error if $J can't be read, journalId isn't this journal's, or buf can't hold a page
+		* @param next As input, the USN to start from; replaced upon completion with the USN past the records read.
+		* @param journalId The ID of the journal to read, as returned by getJournalData
+		* @param buf The buffer to read into
+		* @param len The size of buf, in bytes; at least sizeof(USN) + usn_page_size
+		* @return the number of bytes of buf filled; sizeof(USN) indicates that there are no more records
+		*/
+		size_t readRecords(USN& next, DWORDLONG journalId, uint8_t* buf, size_t len);
+
+		/**
+		* Walks the buffer of USN_RECORDs contained in vector buf, and applies callable func to each or them.
+		* A thin wrapper around visitBuffer.
+		*
+		* @throws std::runtime_error if a record doesn't fit the buffer
+		* @param buf Vector containing a buffer returned by getRecords
+		* @param func A std::function that will be called with a pointer to each record in the buffer.
+		* @return false if the buffer holds no records, true otherwise
+		*/
+		bool mapBuffer(std::vector<uint8_t>& buf, std::function<void(PUSN_RECORD)> func);
+
+		/**
+		* Walks the journal, starting from the first record, and maps func over all records. A thin wrapper
+		* around visitRecords.
+		*
+		* @throws std::runtime_error if $J can't be read, or func throws
+		* @param func a std::function that will be called with a pointer to each record in the journal
+		*/
+		void mapRecords(std::function<void(PUSN_RECORD)> func);
+
+		/**
+		* Same as mapBuffer, but takes any callable, so that it can be inlined into the loop.
+		*/
+		template <typename Func>
+		bool visitBuffer(std::vector<uint8_t>& buf, Func&& func);
+
+		/**
+		* Same as mapRecords, but takes any callable, so that it can be inlined into the loop. One buffer is
+		* reused for the whole walk.
+		*/
+		template <typename Func>
+		void visitRecords(Func&& func);
+
+	private:
+		size_t fill(USN& next, uint8_t* buf, size_t readSize);
+
+		std::unique_ptr<DataStream>	journal;	// the $J stream
+		USN_JOURNAL_DATA			info;
+		size_t						chunk;
+		WORD						minVersion = 2;
+		WORD						maxVersion = 3;
+	};
+
+	template <typename Func>
+	bool NtfsJournal::visitBuffer(std::vector<uint8_t>& buf, Func&& func)
+	{
+		if (buf.size() <= sizeof(USN))
+			return false;
+
+		for (auto rec : usn_records(buf))
+			func(rec);
+
+		return true;
+	}
+
+	template <typename Func>
+	void NtfsJournal::visitRecords(Func&& func)
+	{
+		std::vector<uint8_t>	buf(sizeof(USN) + chunk);
+		USN						next = info.FirstUsn;
+
+		try {
+			for (;;) {
+				size_t len = fill(next, buf.data(), chunk);
+				if (len <= sizeof(USN))
+					break;
+
+				for (auto rec : UsnRecordRange(buf.data(), len))
+					func(rec);
+			}
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error((std::string("[NtfsJournal] Failed to map change journal records! Caught: ") + e.what()));
+		}
+	}
+
+}
@@ -0,0 +1,279 @@
+#include "OutputSink.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ntfs {
+
+#ifdef _WIN32
+	FileSink::FileSink(const std::string& path, size_t bufferSize) : owned(true), buf(std::max<size_t>(bufferSize, 1)), used(0)
+	{
+		if ("-" == path) {
+			file = GetStdHandle(STD_OUTPUT_HANDLE);
+			owned = false;
+		}
+		else {
+			file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		}
+
+		if (INVALID_HANDLE_VALUE == file || nullptr == file)
+			throw OUTPUT_SINK_ERROR("Unable to open output file!", GetLastError());
+	}
+
+	FileSink::~FileSink()
+	{
+		try {
+			flush();
+		}
+		catch (const std::exception&) {
+		}
+
+		if (owned)
+			CloseHandle(file);
+	}
+
+	void FileSink::writeOut(const uint8_t* data, size_t len)
+	{
+		while (len) {
+			unsigned long	written = 0;
+			DWORD			chunk = static_cast<DWORD>(std::min<size_t>(len, 0x40000000));
+
+			if (!WriteFile(file, data, chunk, &written, nullptr) || 0 == written)
+				throw OUTPUT_SINK_ERROR("Failed to write output!", GetLastError());
+
+			data += written;
+			len -= written;
+		}
+	}
+#else
+	FileSink::FileSink(const std::string& path, size_t bufferSize) : owned(true), buf(std::max<size_t>(bufferSize, 1)), used(0)
+	{
+		if ("-" == path) {
+			fd = STDOUT_FILENO;
+			owned = false;
+		}
+		else {
+			fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		}
+
+		if (-1 == fd)
+			throw OUTPUT_SINK_ERROR("Unable to open output file!", errno);
+	}
+
+	FileSink::~FileSink()
+	{
+		try {
+			flush();
+		}
+		catch (const std::exception&) {
+		}
+
+		if (owned)
+			close(fd);
+	}
+
+	void FileSink::writeOut(const uint8_t* data, size_t len)
+	{
+		while (len) {
+			auto written = ::write(fd, data, len);
+			if (written < 0 && EINTR == errno)
+				continue;
+			if (written <= 0)
+				throw OUTPUT_SINK_ERROR("Failed to write output!", errno);
+
+			data += written;
+			len -= written;
+		}
+	}
+#endif
+
+	void FileSink::write(const void* data, size_t len)
+	{
+		auto p = static_cast<const uint8_t*>(data);
+
+		if (len <= buf.size() - used) {
+			memcpy(buf.data() + used, p, len);
+			used += len;
+			return;
+		}
+
+		flush();
+
+		// Anything that wouldn't fit an empty buffer either goes out as is, rather than being copied in pieces
+		if (len >= buf.size()) {
+			writeOut(p, len);
+		}
+		else {
+			memcpy(buf.data(), p, len);
+			used = len;
+		}
+	}
+
+	void FileSink::flush()
+	{
+		size_t len = used;
+
+		used = 0;
+		writeOut(buf.data(), len);
+	}
+
+	AsyncSink::AsyncSink(std::unique_ptr<OutputSink> inner, size_t bufferSize, size_t buffers) : inner(std::move(inner)), busy(false), stopping(false)
+	{
+		if (!this->inner)
+			throw OUTPUT_SINK_ERROR("No sink to write to!", ERROR_INVALID_PARAMETER);
+
+		current.data.resize(std::max<size_t>(bufferSize, 1));
+		current.used = 0;
+
+		for (size_t i = 1; i < std::max<size_t>(buffers, 2); ++i)
+			spare.push_back(Chunk{ std::vector<uint8_t>(current.data.size()), 0 });
+
+		worker = std::thread(&AsyncSink::run, this);
+	}
+
+	AsyncSink::~AsyncSink()
+	{
+		try {
+			submit();
+		}
+		catch (const std::exception&) {
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+
+		// The thread is gone, so the error can be looked at without the lock
+		if (!error) {
+			try {
+				inner->flush();
+			}
+			catch (const std::exception&) {
+			}
+		}
+	}
+
+	void AsyncSink::write(const void* data, size_t len)
+	{
+		auto p = static_cast<const uint8_t*>(data);
+
+		rethrow();
+		while (len) {
+			size_t n = std::min(len, current.data.size() - current.used);
+
+			memcpy(current.data.data() + current.used, p, n);
+			current.used += n;
+			p += n;
+			len -= n;
+
+			if (current.used == current.data.size()) {
+				submit();
+				rethrow();
+			}
+		}
+	}
+
+	void AsyncSink::flush()
+	{
+		submit();
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			drained.wait(guard, [&] { return queued.empty() && !busy; });
+		}
+
+		rethrow();
+		inner->flush();
+	}
+
+	void AsyncSink::submit()
+	{
+		if (!current.used)
+			return;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			// Every buffer is queued; wait for the thread to finish one
+			drained.wait(guard, [&] { return !spare.empty(); });
+
+			queued.push_back(std::move(current));
+			current = std::move(spare.back());
+			current.used = 0;
+			spare.pop_back();
+		}
+
+		wake.notify_one();
+	}
+
+	void AsyncSink::rethrow()
+	{
+		std::exception_ptr e;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			e = error;
+		}
+
+		if (e)
+			std::rethrow_exception(e);
+	}
+
+	void AsyncSink::run()
+	{
+		for (;;) {
+			Chunk	chunk;
+			bool	failed = false;
+
+			{
+				std::unique_lock<std::mutex> guard(lock);
+
+				// Whatever's queued is still written out when stopping
+				wake.wait(guard, [&] { return stopping || !queued.empty(); });
+				if (queued.empty())
+					return;
+
+				chunk = std::move(queued.front());
+				queued.pop_front();
+				failed = !!error;
+				busy = true;
+			}
+
+			// After a failure, chunks are just handed back, so that writers waiting for a buffer don't wait forever
+			if (!failed) {
+				try {
+					inner->write(chunk.data.data(), chunk.used);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> guard(lock);
+					error = std::current_exception();
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				spare.push_back(std::move(chunk));
+				busy = false;
+			}
+			drained.notify_all();
+		}
+	}
+
+	std::unique_ptr<OutputSink> open_output(const std::string& path)
+	{
+		std::unique_ptr<OutputSink> file = std::make_unique<FileSink>(path);
+
+		if ("-" == path)
+			return file;
+
+		return std::make_unique<AsyncSink>(std::move(file));
+	}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "ntfs_compat.h"
+
+#define OUTPUT_SINK_ERROR(msg, err)\
+	std::runtime_error(("[OutputSink] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	constexpr size_t default_sink_buffer = 1024 * 1024;
+	constexpr size_t default_sink_buffers = 4;
+
+	/**
+	* Somewhere for results to go. Writes may be buffered; nothing is guaranteed to have left the sink until
+	* flush() returns.
+	*/
+	class OutputSink {
+	public:
+		virtual ~OutputSink() = default;
+
+		/**
+		* @throws std::runtime_error if the sink has failed
+		* @param data The bytes to write
+		* @param len The number of bytes to write
+		*/
+		virtual void write(const void* data, size_t len) = 0;
+
+		/**
+		* Pushes anything buffered out of the sink.
+		*
+		* @throws std::runtime_error if any write, buffered or not, failed
+		*/
+		virtual void flush() = 0;
+	};
+
+	/**
+	* Writes to a file (or standard output) in large chunks: small writes are gathered in a buffer, and
+	* writes at least as large as the buffer go straight to the file.
+	*/
+	class FileSink : public OutputSink {
+	public:
+		/**
+		* @throws std::runtime_error if the file can't be created
+		* @param path The file to create (replacing any that exists), or "-" for standard output
+		* @param bufferSize The size of the buffer, in bytes
+		*/
+		FileSink(const std::string& path, size_t bufferSize = default_sink_buffer);
+
+		/**
+		* Flushes the buffer; errors can't be reported from here, so call flush() first to see them.
+		*/
+		~FileSink();
+		FileSink(const FileSink&) = delete;
+		FileSink& operator=(const FileSink&) = delete;
+
+		void write(const void* data, size_t len) override;
+		void flush() override;
+
+	private:
+		void writeOut(const uint8_t* data, size_t len);
+
+#ifdef _WIN32
+		HANDLE					file;
+#else
+		int						fd;
+#endif
+		bool					owned;	// false for standard output, which isn't closed
+		std::vector<uint8_t>	buf;
+		size_t					used;
+	};
+
+	/**
+	* Hands writes to another sink on a background thread, so that producing results and writing them out
+	* overlap. Writes are copied into one of a few large buffers; a full buffer is queued for the thread,
+	* and the writer only waits when every buffer is queued.
+	*
+	* An error on the background thread is rethrown by the next write() or flush().
+	*/
+	class AsyncSink : public OutputSink {
+	public:
+		/**
+		* @param inner The sink the thread writes to
+		* @param bufferSize The size of each buffer, in bytes
+		* @param buffers The number of buffers (at least 2: one being filled, one being written)
+		*/
+		AsyncSink(std::unique_ptr<OutputSink> inner, size_t bufferSize = default_sink_buffer, size_t buffers = default_sink_buffers);
+
+		/**
+		* Writes out whatever's still buffered, and stops the thread. As with FileSink, call flush() first
+		* to see any errors.
+		*/
+		~AsyncSink();
+		AsyncSink(const AsyncSink&) = delete;
+		AsyncSink& operator=(const AsyncSink&) = delete;
+
+		void write(const void* data, size_t len) override;
+		void flush() override;
+
+	private:
+		struct Chunk {
+			std::vector<uint8_t>	data;
+			size_t					used;
+		};
+
+		void submit();
+		void rethrow();
+		void run();
+
+		std::unique_ptr<OutputSink>	inner;
+		Chunk						current;
+		std::deque<Chunk>			queued;
+		std::vector<Chunk>			spare;
+		bool						busy;		// whether the thread is writing a chunk it took off the queue
+		bool						stopping;
+		std::exception_ptr			error;
+		std::mutex					lock;
+		std::condition_variable		wake;		// the thread has work, or should stop
+		std::condition_variable		drained;	// a chunk was written, or the queue is empty
+		std::thread					worker;
+	};
+
+	/**
+	* Opens the usual sink for a path: a FileSink, written from a background thread unless it's standard output.
+	*
+	* @throws std::runtime_error if the file can't be created
+	* @param path The file to create, or "-" for standard output
+	*/
+	std::unique_ptr<OutputSink> open_output(const std::string& path);
+
+}
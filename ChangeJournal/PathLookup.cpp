@@ -0,0 +1,234 @@
+#include "PathLookup.hpp"
+#include "AttributeVisitor.hpp"
+#include "Fixup.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+	const WCHAR index_name[] = { '$', 'I', '3', '0' };
+
+	// Whether attr is one of a directory's filename index ($I30) attributes
+	bool is_filename_index(ntfs::NTFS_ATTRIBUTE* attr)
+	{
+		auto name = reinterpret_cast<WCHAR*>(reinterpret_cast<unsigned char*>(attr) + attr->NameOffset);
+
+		if (attr->NameLen != sizeof(index_name) / sizeof(index_name[0]) || attr->NameOffset + sizeof(index_name) > attr->Length)
+			return false;
+
+		return std::equal(std::begin(index_name), std::end(index_name), name);
+	}
+
+	inline bool is_separator(WCHAR c)
+	{
+		return '\\' == c || '/' == c;
+	}
+}
+
+namespace ntfs {
+
+	PathLookup::PathLookup(VolOps& vol) : vol(vol), upcase(0x10000), root(0)
+	{
+		if (!vol.getBlockDevice())
+			throw PATH_LOOKUP_ERROR("Path lookups need a block device!", ERROR_NOT_SUPPORTED);
+
+		auto map = vol.getExtentMap(static_cast<uint64_t>(MftRecordNumber::MftUpcase), NtfsAttributeType::AttributeData);
+		if (map->dataSize() < upcase.size() * sizeof(WCHAR))
+			throw PATH_LOOKUP_ERROR("$UpCase doesn't cover every UTF-16 code unit!", ERROR_FILE_CORRUPT);
+
+		vol.readExtents(*map, 0, upcase.data(), upcase.size() * sizeof(WCHAR));
+
+		auto rootRec = vol.getMftRecord(static_cast<uint64_t>(MftRecordNumber::MftRootFileIndex));
+		auto header = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(rootRec.data());
+		root = (static_cast<uint64_t>(header->SequenceCount) << 48) | static_cast<uint64_t>(MftRecordNumber::MftRootFileIndex);
+	}
+
+	uint64_t PathLookup::find(uint64_t dirFrn, const WCHAR* name, size_t len)
+	{
+		uint64_t				recNum = reference_record(dirFrn);
+		auto					recs = vol.getFileRecords(recNum);
+		auto					base = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(recs.front().data());
+		std::vector<uint8_t>	indexRoot;
+		ExtentMap				allocation;
+		bool					allocated = false;
+		uint64_t				found = 0;
+		uint64_t				child = 0;
+
+		if (recs.front().size() < sizeof(NTFS_FILE_RECORD_HEADER) || base->RecordHeader.Type != static_cast<ULONG>(NtfsRecordType::File))
+			return 0;
+
+		if (!(static_cast<USHORT>(base->Flags) & static_cast<USHORT>(FileRecordFlags::RecordInUse)) || !(static_cast<USHORT>(base->Flags) & static_cast<USHORT>(FileRecordFlags::RecordDirectory)) || base->BaseFileRecord)
+			return 0;
+
+		if (reference_sequence(dirFrn) && reference_sequence(dirFrn) != base->SequenceCount)
+			return 0;
+
+		// The index blocks' runs are taken from the records just read, rather than from a cache that may be stale
+		for (auto& rec : recs) {
+			for (auto attr : attributes(rec)) {
+				if (!is_filename_index(attr))
+					continue;
+
+				if (NtfsAttributeType::AttributeIndexRoot == attr->AttributeType) {
+					auto value = resident_value<uint8_t>(attr);
+					if (value)
+						indexRoot.assign(value, value + reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength);
+				}
+				else if (NtfsAttributeType::AttributeIndexAllocation == attr->AttributeType && attr->NonResident) {
+					if (attr->Length < sizeof(NTFS_NONRESIDENT_ATTRIBUTE))
+						throw PATH_LOOKUP_ERROR("Index allocation attribute is truncated!", ERROR_FILE_CORRUPT);
+
+					allocation.addSegment(reinterpret_cast<NTFS_NONRESIDENT_ATTRIBUTE*>(attr));
+					allocated = true;
+				}
+			}
+		}
+
+		if (indexRoot.size() < sizeof(INDEX_ROOT))
+			throw PATH_LOOKUP_ERROR("Directory has no usable $I30 index root!", ERROR_FILE_CORRUPT);
+
+		auto ir = reinterpret_cast<INDEX_ROOT*>(indexRoot.data());
+		if (NtfsAttributeType::AttributeFileName != ir->AttributeType)
+			throw PATH_LOOKUP_ERROR("Directory's $I30 index isn't an index of file names!", ERROR_FILE_CORRUPT);
+
+		if (!searchNode(indexRoot.data() + offsetof(INDEX_ROOT, DirectoryIndex), indexRoot.size() - offsetof(INDEX_ROOT, DirectoryIndex), name, len, found, child))
+			return found;
+
+		size_t		blockSize = ir->BytesPerIndexBlock;
+		uint64_t	bpc = vol.getGeometry().bytesPerCluster;
+
+		if (!allocated)
+			throw PATH_LOOKUP_ERROR("Index root refers to index blocks that don't exist!", ERROR_FILE_CORRUPT);
+
+		if (blockSize < update_sequence_stride || blockSize > 0x10000 || (blockSize & (blockSize - 1)))
+			throw PATH_LOOKUP_ERROR("Index block size is invalid!", ERROR_FILE_CORRUPT);
+
+		// Index block numbers count clusters, unless blocks are smaller than clusters, in which case they count 512 byte units
+		uint64_t				vcnSize = (blockSize >= bpc) ? bpc : 512;
+		std::vector<uint8_t>	block(blockSize);
+
+		for (size_t depth = 0; depth < max_index_depth; ++depth) {
+			auto header = reinterpret_cast<INDEX_BLOCK_HEADER*>(block.data());
+
+			vol.readExtents(allocation, child * vcnSize, block.data(), block.size());
+			if (header->RecordHeader.Type != static_cast<ULONG>(NtfsRecordType::Index) || !apply_fixup(block.data(), block.size()))
+				throw PATH_LOOKUP_ERROR("Index block failed update sequence validation!", ERROR_FILE_CORRUPT);
+
+			if (header->IndexBlockVcn != child)
+				throw PATH_LOOKUP_ERROR("Index block isn't the one its parent pointed at!", ERROR_FILE_CORRUPT);
+
+			if (!searchNode(block.data() + offsetof(INDEX_BLOCK_HEADER, DirectoryIndex), block.size() - offsetof(INDEX_BLOCK_HEADER, DirectoryIndex), name, len, found, child))
+				return found;
+		}
+
+		throw PATH_LOOKUP_ERROR("Directory index is too deep!", ERROR_FILE_CORRUPT);
+	}
+
+	uint64_t PathLookup::resolve(const std::basic_string<WCHAR>& path)
+	{
+		std::vector<uint64_t>	trail;
+		uint64_t				current = root;
+		size_t					pos = 0;
+
+		if (path.size() >= 2 && ':' == path[1])
+			pos = 2;
+
+		while (pos < path.size()) {
+			size_t end = pos;
+			while (end < path.size() && !is_separator(path[end]))
+				++end;
+
+			size_t len = end - pos;
+
+			if (2 == len && '.' == path[pos] && '.' == path[pos + 1]) {
+				if (!trail.empty()) {
+					current = trail.back();
+					trail.pop_back();
+				}
+			}
+			else if (len && !(1 == len && '.' == path[pos])) {
+				trail.push_back(current);
+				current = find(current, path.data() + pos, len);
+				if (!current)
+					return 0;
+			}
+
+			pos = end + 1;
+		}
+
+		return current;
+	}
+
+	int PathLookup::compare(const WCHAR* a, size_t aLen, const WCHAR* b, size_t bLen) const
+	{
+		size_t n = std::min(aLen, bLen);
+
+		for (size_t i = 0; i < n; ++i) {
+			uint16_t x = upcase[static_cast<uint16_t>(a[i])];
+			uint16_t y = upcase[static_cast<uint16_t>(b[i])];
+
+			if (x != y)
+				return (x < y) ? -1 : 1;
+		}
+
+		return (aLen == bLen) ? 0 : ((aLen < bLen) ? -1 : 1);
+	}
+
+	bool PathLookup::searchNode(const uint8_t* node, size_t size, const WCHAR* name, size_t len, uint64_t& found, uint64_t& child)
+	{
+		auto		index = reinterpret_cast<const DIRECTORY_INDEX*>(node);
+		size_t		pos = 0;
+		size_t		end = 0;
+		uint64_t	candidate = 0;
+
+		if (size < sizeof(DIRECTORY_INDEX) || index->EntriesOffset < sizeof(DIRECTORY_INDEX) || index->IndexBlockLenght > size || index->EntriesOffset > index->IndexBlockLenght)
+			throw PATH_LOOKUP_ERROR("Index node header is corrupt!", ERROR_FILE_CORRUPT);
+
+		found = 0;
+		pos = index->EntriesOffset;
+		end = index->IndexBlockLenght;
+
+		// Entries are sorted by their upcased names; the last entry carries no name, and sorts after all of them
+		while (pos + sizeof(DIRECTORY_ENTRY) <= end) {
+			auto	entry = reinterpret_cast<const DIRECTORY_ENTRY*>(node + pos);
+			int		order = -1;
+
+			if (entry->Length < sizeof(DIRECTORY_ENTRY) || entry->Length > end - pos || ((entry->Flags & EntrySubnode) && entry->Length < sizeof(DIRECTORY_ENTRY) + sizeof(uint64_t)))
+				throw PATH_LOOKUP_ERROR("Index entry runs past the end of its node!", ERROR_FILE_CORRUPT);
+
+			if (!(entry->Flags & EntryLast)) {
+				auto fn = reinterpret_cast<const FILENAME_ATTRIBUTE*>(entry + 1);
+
+				if (entry->AttributeLength < offsetof(FILENAME_ATTRIBUTE, Name) || sizeof(DIRECTORY_ENTRY) + entry->AttributeLength > entry->Length || offsetof(FILENAME_ATTRIBUTE, Name) + (fn->NameLen * sizeof(WCHAR)) > entry->AttributeLength)
+					throw PATH_LOOKUP_ERROR("Index entry key is malformed!", ERROR_FILE_CORRUPT);
+
+				order = compare(name, len, fn->Name, fn->NameLen);
+				if (0 == order) {
+					// Names that only differ in case sit side by side; prefer the one that matches exactly
+					if (std::equal(name, name + len, fn->Name)) {
+						found = entry->FileReferenceNumber;
+						return false;
+					}
+
+					if (!candidate)
+						candidate = entry->FileReferenceNumber;
+				}
+			}
+
+			if (order < 0) {
+				if (candidate || !(entry->Flags & EntrySubnode)) {
+					found = candidate;
+					return false;
+				}
+
+				memcpy(&child, node + pos + entry->Length - sizeof(uint64_t), sizeof(child));
+				return true;
+			}
+
+			pos += entry->Length;
+		}
+
+		throw PATH_LOOKUP_ERROR("Index node has no terminating entry!", ERROR_FILE_CORRUPT);
+	}
+
+}
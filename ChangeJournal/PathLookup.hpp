@@ -0,0 +1,100 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_defs.h"
+#include "VolumeOptions.hpp"
+
+#define PATH_LOOKUP_ERROR(msg, err)\
+	std::runtime_error(("[PathLookup] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	// Corrupt indexes could otherwise send a lookup around in circles
+	constexpr size_t max_index_depth = 32;
+
+	/**
+	* Finds files by path the way NTFS itself does: by descending the $I30 B+tree of each directory along
+	* the path, starting from the root directory, and comparing names with the volume's $UpCase table. A
+	* lookup reads a couple of records and a few index blocks per path component, rather than the whole MFT.
+	*
+	* Only works on a block device, since index blocks are read through their attribute's data runs.
+	*/
+	class PathLookup {
+	public:
+		/**
+		* Reads the volume's $UpCase table.
+		*
+		* @throws std::runtime_error if no block device is set, or $UpCase can't be read
+		* @param vol The volume to look paths up on; must outlive the PathLookup
+		*/
+		PathLookup(VolOps& vol);
+
+		/**
+		* Returns the volume's $UpCase table, in which table[c] is the uppercase form of c.
+		*/
+		const std::vector<WCHAR>& upcaseTable() const { return upcase; }
+
+		/**
+		* Returns the file reference number of the root directory.
+		*/
+		uint64_t rootDirectory() const { return root; }
+
+		/**
+		* Looks a single name up in a directory's index.
+		*
+		* @throws std::runtime_error if the directory's records or index blocks can't be read, or are corrupt
+		* @param dirFrn The directory to look in
+		* @param name The name to look for, in any case; both long and short (8.3) names are found
+		* @param len The length of name, in characters
+		* @return the file reference number of the entry, or 0 if the directory has no such entry
+		*/
+		uint64_t find(uint64_t dirFrn, const WCHAR* name, size_t len);
+
+		/**
+		* Resolves a path, relative to the root of the volume (e.g., \Windows\System32\drivers\etc\hosts).
+		* Either kind of slash may separate components, a leading drive letter is ignored, and "." and ".."
+		* components are followed.
+		*
+		* @throws std::runtime_error if a directory along the path can't be read, or is corrupt
+		* @param path The path to resolve
+		* @return the file reference number the path leads to, or 0 if some component doesn't exist
+		*/
+		uint64_t resolve(const std::basic_string<WCHAR>& path);
+
+	private:
+		int compare(const WCHAR* a, size_t aLen, const WCHAR* b, size_t bLen) const;
+		bool searchNode(const uint8_t* node, size_t size, const WCHAR* name, size_t len, uint64_t& found, uint64_t& child);
+
+		VolOps&				vol;
+		std::vector<WCHAR>	upcase;
+		uint64_t			root;
+	};
+
+}
@@ -0,0 +1,289 @@
+#include "PathResolver.hpp"
+#include "AttributeVisitor.hpp"
+#include "MftReader.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+namespace {
+	enum EntryFlags : uint8_t {
+		EntryPresent = 0x01,
+		EntryDirectory = 0x02
+	};
+
+	enum SliceState : uint32_t {
+		SliceUnknown = 0,
+		SliceVisiting,
+		SliceDone
+	};
+
+	const uint64_t root_record = static_cast<uint64_t>(ntfs::MftRecordNumber::MftRootFileIndex);
+
+	const WCHAR orphan_prefix[] = { '\\', '$', 'O', 'r', 'p', 'h', 'a', 'n' };
+}
+
+namespace ntfs {
+
+	PathResolver::PathResolver()
+	{
+		paths.assign(std::begin(orphan_prefix), std::end(orphan_prefix));
+	}
+
+	void PathResolver::build(VolOps& vol)
+	{
+		MftReader		reader(vol);
+		MftRecordBatch	batch;
+
+		entries.clear();
+		names.clear();
+		dirPaths.clear();
+		paths.assign(std::begin(orphan_prefix), std::end(orphan_prefix));
+
+		entries.resize(static_cast<size_t>(reader.recordCount()));
+		while (reader.next(batch)) {
+			for (size_t i = 0; i < batch.size(); ++i) {
+				if (batch.inUse(i))
+					addRecord(batch.recordNumber(i), batch.record(i), batch.recordSize());
+			}
+		}
+	}
+
+	void PathResolver::addRecord(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size)
+	{
+		uint64_t	owner = recNum;
+		uint16_t	sequence = record->SequenceCount;
+		bool		directory = 0 != (static_cast<USHORT>(record->Flags) & static_cast<USHORT>(FileRecordFlags::RecordDirectory));
+
+		// Names that spill into an extension record belong to the base record
+		if (record->BaseFileRecord) {
+			owner = reference_record(record->BaseFileRecord);
+			sequence = reference_sequence(record->BaseFileRecord);
+			directory = false;
+		}
+
+		visit_attributes(record, size, on<NtfsAttributeType::AttributeFileName>([&](FILENAME_ATTRIBUTE* fn, NTFS_ATTRIBUTE* attr) {
+			if (!fn || reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength < offsetof(FILENAME_ATTRIBUTE, Name) + (fn->NameLen * sizeof(WCHAR)))
+				return;
+
+			add(owner, sequence, fn->DirectoryFileRefNumber, fn->Name, fn->NameLen, fn->NameType, directory);
+		}));
+	}
+
+	void PathResolver::add(uint64_t recNum, uint16_t sequence, uint64_t parent, const WCHAR* name, size_t len, uint8_t nameType, bool directory)
+	{
+		uint8_t rank = filename_rank(nameType);
+
+		if (recNum >= entries.size())
+			entries.resize(static_cast<size_t>(recNum + 1));
+
+		Entry& e = entries[static_cast<size_t>(recNum)];
+
+		// A reused record slot starts over
+		if ((e.flags & EntryPresent) && e.sequence != sequence && sequence) {
+			invalidate(recNum);
+			e = Entry();
+		}
+
+		if (directory)
+			e.flags |= EntryDirectory;
+
+		if ((e.flags & EntryPresent) && e.rank <= rank)
+			return;
+
+		// Renaming a directory that children may already have been resolved under invalidates the cache
+		if (e.flags & EntryPresent)
+			invalidate(recNum);
+
+		e.parent = parent;
+		e.sequence = sequence;
+		e.nameOffset = names.size();
+		e.nameLen = static_cast<uint16_t>(std::min<size_t>(len, UINT16_MAX));
+		e.rank = rank;
+		e.flags |= EntryPresent;
+		names.insert(names.end(), name, name + e.nameLen);
+	}
+
+	void PathResolver::remove(uint64_t recNum)
+	{
+		if (recNum >= entries.size())
+			return;
+
+		invalidate(recNum);
+		entries[static_cast<size_t>(recNum)] = Entry();
+	}
+
+	void PathResolver::resolveAll()
+	{
+		for (uint64_t i = 0; i < entries.size(); ++i) {
+			if (entries[static_cast<size_t>(i)].flags & EntryDirectory)
+				directoryPath(i);
+		}
+	}
+
+	bool PathResolver::contains(uint64_t recNum) const
+	{
+		return recNum < entries.size() && (entries[static_cast<size_t>(recNum)].flags & EntryPresent);
+	}
+
+	bool PathResolver::isDirectory(uint64_t recNum) const
+	{
+		return contains(recNum) && (entries[static_cast<size_t>(recNum)].flags & EntryDirectory);
+	}
+
+	uint64_t PathResolver::size() const
+	{
+		return entries.size();
+	}
+
+	bool PathResolver::appendPath(uint64_t frn, std::basic_string<WCHAR>& out)
+	{
+		uint64_t	recNum = reference_record(frn);
+		uint64_t	parentRec = 0;
+		auto		e = lookup(frn);
+
+		if (!e)
+			return false;
+
+		if (root_record == recNum) {
+			out += WCHAR('\\');
+			return true;
+		}
+
+		if (validParent(recNum, parentRec)) {
+			const Slice& dir = directoryPath(parentRec);
+			out.append(paths.data() + dir.offset, dir.len);
+		}
+		else {
+			out.append(std::begin(orphan_prefix), std::end(orphan_prefix));
+		}
+
+		out += WCHAR('\\');
+		out.append(names.data() + e->nameOffset, e->nameLen);
+
+		return true;
+	}
+
+	std::basic_string<WCHAR> PathResolver::path(uint64_t frn)
+	{
+		std::basic_string<WCHAR> out;
+
+		appendPath(frn, out);
+		return out;
+	}
+
+	std::basic_string<WCHAR> PathResolver::name(uint64_t frn) const
+	{
+		auto e = lookup(frn);
+
+		if (!e)
+			return std::basic_string<WCHAR>();
+
+		return std::basic_string<WCHAR>(names.data() + e->nameOffset, e->nameLen);
+	}
+
+	uint64_t PathResolver::parent(uint64_t recNum) const
+	{
+		return contains(recNum) ? entries[static_cast<size_t>(recNum)].parent : 0;
+	}
+
+	void PathResolver::invalidate(uint64_t recNum)
+	{
+		// Only directories with a cached path can have cached descendants
+		if (recNum >= dirPaths.size() || SliceUnknown == dirPaths[static_cast<size_t>(recNum)].state)
+			return;
+
+		dirPaths.clear();
+		paths.resize(sizeof(orphan_prefix) / sizeof(orphan_prefix[0]));
+	}
+
+	const PathResolver::Entry* PathResolver::lookup(uint64_t frn) const
+	{
+		uint64_t	recNum = reference_record(frn);
+		uint16_t	sequence = reference_sequence(frn);
+
+		if (!contains(recNum))
+			return nullptr;
+
+		auto& e = entries[static_cast<size_t>(recNum)];
+		if (sequence && e.sequence && sequence != e.sequence)
+			return nullptr;
+
+		return &e;
+	}
+
+	bool PathResolver::validParent(uint64_t recNum, uint64_t& parentRec) const
+	{
+		auto& e = entries[static_cast<size_t>(recNum)];
+
+		parentRec = reference_record(e.parent);
+		return parentRec != recNum && nullptr != lookup(e.parent);
+	}
+
+	const PathResolver::Slice& PathResolver::directoryPath(uint64_t recNum)
+	{
+		static const Slice orphan = { 0, sizeof(orphan_prefix) / sizeof(orphan_prefix[0]), SliceDone };
+		static const Slice root = { 0, 0, SliceDone };
+
+		if (dirPaths.size() < entries.size())
+			dirPaths.resize(entries.size());
+
+		if (root_record == recNum)
+			return root;
+
+		if (SliceDone == dirPaths[static_cast<size_t>(recNum)].state)
+			return dirPaths[static_cast<size_t>(recNum)];
+
+		// Climb until we reach the root, a directory whose path is already known, or a broken link, then
+		// build the paths on the way back down, so that each directory is only ever built once.
+		const Slice*	base = &orphan;
+		uint64_t		cur = recNum;
+
+		chain.clear();
+		for (;;) {
+			uint64_t parentRec = 0;
+			Slice& slice = dirPaths[static_cast<size_t>(cur)];
+
+			if (SliceVisiting == slice.state)
+				break;
+
+			slice.state = SliceVisiting;
+			chain.push_back(cur);
+
+			if (!validParent(cur, parentRec))
+				break;
+
+			if (root_record == parentRec) {
+				base = &root;
+				break;
+			}
+
+			if (SliceDone == dirPaths[static_cast<size_t>(parentRec)].state) {
+				base = &dirPaths[static_cast<size_t>(parentRec)];
+				break;
+			}
+
+			cur = parentRec;
+		}
+
+		Slice parentSlice = *base;
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+			auto&	e = entries[static_cast<size_t>(*it)];
+			Slice&	slice = dirPaths[static_cast<size_t>(*it)];
+			size_t	start = paths.size();
+
+			// Grow first, then copy by offset, since growing may move the arena
+			paths.resize(start + parentSlice.len + 1 + e.nameLen);
+			std::copy(paths.begin() + static_cast<size_t>(parentSlice.offset), paths.begin() + static_cast<size_t>(parentSlice.offset + parentSlice.len), paths.begin() + start);
+			paths[start + parentSlice.len] = WCHAR('\\');
+			std::copy(names.begin() + static_cast<size_t>(e.nameOffset), names.begin() + static_cast<size_t>(e.nameOffset + e.nameLen), paths.begin() + start + parentSlice.len + 1);
+
+			slice.offset = start;
+			slice.len = static_cast<uint32_t>(paths.size() - start);
+			slice.state = SliceDone;
+			parentSlice = slice;
+		}
+
+		return dirPaths[static_cast<size_t>(recNum)];
+	}
+
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+
+#define PATH_RESOLVER_ERROR(msg, err)\
+	std::runtime_error(("[PathResolver] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	class VolOps;
+
+	/**
+	* Turns file reference numbers into full paths (e.g., \Windows\System32\ntdll.dll). A single pass over
+	* the MFT records every file's parent and preferred name into a dense table indexed by record number,
+	* with the names themselves packed into one arena. Directory paths are built at most once each and
+	* memoized (again in an arena), so resolving every record on the volume is linear in the number of
+	* records, rather than in records times depth.
+	*
+	* Path lookups fill the directory cache as they go, so a resolver isn't safe to share between threads
+	* until resolveAll() has been called; after that, lookups only read.
+	*/
+	class PathResolver {
+	public:
+		PathResolver();
+
+		/**
+		* Builds the table from the MFT of vol, replacing anything added so far.
+		*
+		* @throws std::runtime_error if vol isn't backed by a block device, or the MFT can't be read
+		* @param vol The volume to read the MFT of
+		*/
+		void build(VolOps& vol);
+
+		/**
+		* Records the file names contained in one file record. Extension records are credited to their
+		* base record, so records can be added in any order.
+		*
+		* @throws std::runtime_error if the record is malformed
+		* @param recNum The number of the record
+		* @param record The record, with fixups applied
+		* @param size The size of the record, in bytes
+		*/
+		void addRecord(uint64_t recNum, NTFS_FILE_RECORD_HEADER* record, size_t size);
+
+		/**
+		* Records a single name for a file. Win32 (and POSIX) names are preferred over DOS 8.3 names, and the
+		* first such name wins for files with several hard links.
+		*
+		* @param recNum The record number of the file
+		* @param sequence The file's sequence number
+		* @param parent The file reference number of the directory containing the name
+		* @param name The name, which needn't be NULL terminated
+		* @param len The length of name, in characters
+		* @param nameType The FILENAME_ATTRIBUTE namespace of the name (0 POSIX, 1 Win32, 2 DOS, 3 Win32 & DOS)
+		* @param directory Whether the file is a directory
+		*/
+		void add(uint64_t recNum, uint16_t sequence, uint64_t parent, const WCHAR* name, size_t len, uint8_t nameType, bool directory);
+
+		/**
+		* Forgets a file (e.g., because it was deleted). If the file was a directory whose path had been
+		* cached, the directory cache is dropped too.
+		*/
+		void remove(uint64_t recNum);
+
+		/**
+		* Computes and caches the path of every directory, after which path lookups no longer modify the
+		* resolver and may be made from several threads at once.
+		*/
+		void resolveAll();
+
+		/**
+		* Indicates whether a name is known for a record.
+		*/
+		bool contains(uint64_t recNum) const;
+
+		/**
+		* Indicates whether a record is a known directory.
+		*/
+		bool isDirectory(uint64_t recNum) const;
+
+		/**
+		* Returns one more than the highest record number the table has room for.
+		*/
+		uint64_t size() const;
+
+		/**
+		* Appends the full path of a file to out. Files whose parent chain is broken (the parent is unknown,
+		* was reused, or the chain loops) are placed under \$Orphan.
+		*
+		* @param frn The file reference number; if its sequence number is non-zero it must match the file's
+		* @param out The string to append to
+		* @return false (leaving out untouched) if the file isn't known, true otherwise
+		*/
+		bool appendPath(uint64_t frn, std::basic_string<WCHAR>& out);
+
+		/**
+		* Returns the full path of a file, or an empty string if the file isn't known (see appendPath).
+		*/
+		std::basic_string<WCHAR> path(uint64_t frn);
+
+		/**
+		* Returns the name of a file (the last component of its path), or an empty string if it isn't known.
+		*/
+		std::basic_string<WCHAR> name(uint64_t frn) const;
+
+		/**
+		* Returns the file reference number of the directory containing a file, or 0 if it isn't known.
+		*/
+		uint64_t parent(uint64_t recNum) const;
+
+	private:
+		struct Entry {
+			uint64_t	parent = 0;
+			uint64_t	nameOffset = 0;
+			uint16_t	nameLen = 0;
+			uint16_t	sequence = 0;
+			uint8_t		flags = 0;
+			uint8_t		rank = 0;
+		};
+
+		// A directory's memoized path, as a slice of the path arena
+		struct Slice {
+			uint64_t	offset = 0;
+			uint32_t	len = 0;
+			uint32_t	state = 0;
+		};
+
+		void invalidate(uint64_t recNum);
+		const Entry* lookup(uint64_t frn) const;
+		bool validParent(uint64_t recNum, uint64_t& parentRec) const;
+		const Slice& directoryPath(uint64_t recNum);
+
+		std::vector<Entry>		entries;
+		std::vector<WCHAR>		names;
+		std::vector<Slice>		dirPaths;
+		std::vector<WCHAR>		paths;
+		std::vector<uint64_t>	chain;
+	};
+
+}
@@ -0,0 +1,568 @@
+#include "ReadPipeline.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef NTFS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter)
+#undef NTFS_HAVE_IO_URING
+#endif
+#endif
+
+namespace ntfs {
+
+	class ReadEngine {
+	public:
+		virtual ~ReadEngine() = default;
+
+		/**
+		* Starts reading len bytes at offset into buf on behalf of read seq.
+		*
+		* @param started Incremented for every completion reap() will report for seq because of this call,
+		* as soon as the piece is issued (so it stays accurate if start throws part way through)
+		*/
+		virtual void start(uint64_t seq, uint64_t offset, unsigned char* buf, size_t len, size_t& started) = 0;
+
+		/**
+		* Blocks until a piece completes.
+		*
+		* @param error Receives the failure, if the piece failed
+		* @return the sequence number of the read the piece belongs to
+		*/
+		virtual uint64_t reap(std::exception_ptr& error) = 0;
+	};
+
+}
+
+namespace {
+
+	using ntfs::BlockDevice;
+	using ntfs::ReadEngine;
+
+	/**
+	* Issues blocking device reads from a handful of I/O threads. Works with any BlockDevice.
+	*/
+	class ThreadEngine : public ReadEngine {
+	public:
+		ThreadEngine(std::shared_ptr<BlockDevice> dev, size_t threads) : device(dev), stopping(false)
+		{
+			for (size_t i = 0; i < threads; ++i)
+				workers.emplace_back([this] { run(); });
+		}
+
+		~ThreadEngine()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+
+			for (auto& w : workers)
+				w.join();
+		}
+
+		void start(uint64_t seq, uint64_t offset, unsigned char* buf, size_t len, size_t& started) override
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				requests.push_back({ seq, offset, buf, len });
+				++started;
+			}
+			wake.notify_one();
+		}
+
+		uint64_t reap(std::exception_ptr& error) override
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			done.wait(guard, [this] { return !completions.empty(); });
+			auto c = std::move(completions.front());
+			completions.pop_front();
+
+			error = c.second;
+			return c.first;
+		}
+
+	private:
+		struct Request {
+			uint64_t		seq;
+			uint64_t		offset;
+			unsigned char*	buf;
+			size_t			len;
+		};
+
+		void run()
+		{
+			for (;;) {
+				Request				r;
+				std::exception_ptr	error;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					wake.wait(guard, [this] { return stopping || !requests.empty(); });
+					if (requests.empty())
+						return;
+
+					r = requests.front();
+					requests.pop_front();
+				}
+
+				try {
+					device->read(r.offset, r.buf, r.len);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					completions.emplace_back(r.seq, error);
+				}
+				done.notify_one();
+			}
+		}
+
+		std::shared_ptr<BlockDevice>							device;
+		std::vector<std::thread>								workers;
+		std::mutex												lock;
+		std::condition_variable									wake;
+		std::condition_variable									done;
+		std::deque<Request>										requests;
+		std::deque<std::pair<uint64_t, std::exception_ptr>>		completions;
+		bool													stopping;
+	};
+
+#ifdef NTFS_HAVE_IO_URING
+	// Largest single read handed to the kernel; completions report the byte count in an int.
+	constexpr size_t max_uring_read = 1 << 30;
+
+	/**
+	* Issues reads through an io_uring instance, talking to the kernel directly so there's no liburing
+	* dependency. Each piece has exactly one SQE outstanding at a time, and the number of pieces is capped
+	* at the size of the submission ring, so neither ring can overflow.
+	*/
+	class UringEngine : public ReadEngine {
+	public:
+		UringEngine(std::shared_ptr<BlockDevice> dev, unsigned entries) : device(dev), ringFd(-1), sqRing(nullptr), cqRing(nullptr), sqes(nullptr), unsubmitted(0)
+		{
+			io_uring_params p;
+
+			memset(&p, 0, sizeof(p));
+			ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+			if (ringFd < 0)
+				throw READ_PIPELINE_ERROR("Unable to create an io_uring instance!", errno);
+
+			sqRingSize = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+			cqRingSize = p.cq_off.cqes + (p.cq_entries * sizeof(io_uring_cqe));
+			if (p.features & IORING_FEAT_SINGLE_MMAP)
+				sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+			sqRing = map(sqRingSize, IORING_OFF_SQ_RING);
+			cqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? sqRing : map(cqRingSize, IORING_OFF_CQ_RING);
+			sqes = static_cast<io_uring_sqe*>(map(p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+			sqTail = reinterpret_cast<unsigned*>(static_cast<unsigned char*>(sqRing) + p.sq_off.tail);
+			sqMask = *reinterpret_cast<unsigned*>(static_cast<unsigned char*>(sqRing) + p.sq_off.ring_mask);
+			sqArray = reinterpret_cast<unsigned*>(static_cast<unsigned char*>(sqRing) + p.sq_off.array);
+			cqHead = reinterpret_cast<unsigned*>(static_cast<unsigned char*>(cqRing) + p.cq_off.head);
+			cqTail = reinterpret_cast<unsigned*>(static_cast<unsigned char*>(cqRing) + p.cq_off.tail);
+			cqMask = *reinterpret_cast<unsigned*>(static_cast<unsigned char*>(cqRing) + p.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(static_cast<unsigned char*>(cqRing) + p.cq_off.cqes);
+			sqeCount = p.sq_entries;
+
+			pieces.resize(sqeCount);
+			for (size_t i = 0; i < sqeCount; ++i)
+				freePieces.push_back(sqeCount - i - 1);
+		}
+
+		~UringEngine()
+		{
+			release();
+		}
+
+		void start(uint64_t seq, uint64_t offset, unsigned char* buf, size_t len, size_t& started) override
+		{
+			while (len) {
+				int			fd = -1;
+				uint64_t	fileOffset = 0;
+				uint64_t	contiguous = 0;
+
+				// Anything not sitting in a plain file (shouldn't happen for images) is read synchronously
+				if (!device->nativeRange(offset, fd, fileOffset, contiguous)) {
+					std::exception_ptr error;
+					try {
+						device->read(offset, buf, len);
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+					ready.emplace_back(seq, error);
+					++started;
+					break;
+				}
+
+				while (freePieces.empty())
+					collect(true);
+
+				size_t chunk = static_cast<size_t>(std::min<uint64_t>(std::min<uint64_t>(len, contiguous), max_uring_read));
+				size_t idx = freePieces.back();
+				freePieces.pop_back();
+
+				Piece& piece = pieces[idx];
+				piece.seq = seq;
+				piece.fd = fd;
+				piece.offset = fileOffset;
+				piece.iov.iov_base = buf;
+				piece.iov.iov_len = chunk;
+				queue(idx);
+				++started;
+
+				buf += chunk;
+				offset += chunk;
+				len -= chunk;
+			}
+
+			flush();
+		}
+
+		uint64_t reap(std::exception_ptr& error) override
+		{
+			while (ready.empty())
+				collect(true);
+
+			auto c = std::move(ready.front());
+			ready.pop_front();
+
+			error = c.second;
+			return c.first;
+		}
+
+	private:
+		struct Piece {
+			uint64_t	seq;
+			int			fd;
+			uint64_t	offset;
+			iovec		iov;
+		};
+
+		void* map(size_t len, uint64_t offset)
+		{
+			void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, static_cast<off_t>(offset));
+			if (MAP_FAILED == p) {
+				auto err = errno;
+				release();
+				throw READ_PIPELINE_ERROR("Unable to map the io_uring rings!", err);
+			}
+			return p;
+		}
+
+		void release()
+		{
+			if (sqes)
+				munmap(sqes, sqeCount * sizeof(io_uring_sqe));
+			if (cqRing && cqRing != sqRing)
+				munmap(cqRing, cqRingSize);
+			if (sqRing)
+				munmap(sqRing, sqRingSize);
+			if (-1 != ringFd)
+				close(ringFd);
+
+			sqes = nullptr;
+			sqRing = cqRing = nullptr;
+			ringFd = -1;
+		}
+
+		void queue(size_t idx)
+		{
+			Piece&			piece = pieces[idx];
+			unsigned		tail = *sqTail;
+			unsigned		slot = tail & sqMask;
+			io_uring_sqe*	sqe = &sqes[slot];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = piece.fd;
+			sqe->off = piece.offset;
+			sqe->addr = reinterpret_cast<uint64_t>(&piece.iov);
+			sqe->len = 1;
+			sqe->user_data = idx;
+
+			sqArray[slot] = slot;
+			__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+			++unsubmitted;
+		}
+
+		int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+		{
+			int ret;
+
+			do {
+				ret = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+			} while (ret < 0 && EINTR == errno);
+
+			if (ret < 0)
+				throw READ_PIPELINE_ERROR("io_uring_enter failed!", errno);
+
+			return ret;
+		}
+
+		void flush()
+		{
+			if (unsubmitted)
+				unsubmitted -= enter(unsubmitted, 0, 0);
+		}
+
+		// Moves completed pieces to ready, resubmitting the remainder of short reads. When block is set and
+		// nothing has completed yet, waits for at least one completion.
+		void collect(bool block)
+		{
+			unsigned head = *cqHead;
+			unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+			if (head == tail) {
+				if (!block)
+					return;
+
+				unsubmitted -= enter(unsubmitted, 1, IORING_ENTER_GETEVENTS);
+				tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			}
+
+			for (; head != tail; ++head) {
+				io_uring_cqe*	cqe = &cqes[head & cqMask];
+				size_t			idx = static_cast<size_t>(cqe->user_data);
+				Piece&			piece = pieces[idx];
+				int				res = cqe->res;
+
+				if (-EAGAIN == res || -EINTR == res) {
+					queue(idx);
+					continue;
+				}
+
+				if (res > 0 && static_cast<size_t>(res) < piece.iov.iov_len) {
+					piece.iov.iov_base = static_cast<unsigned char*>(piece.iov.iov_base) + res;
+					piece.iov.iov_len -= res;
+					piece.offset += res;
+					queue(idx);
+					continue;
+				}
+
+				std::exception_ptr error;
+				if (res < 0)
+					error = std::make_exception_ptr(READ_PIPELINE_ERROR("Failed to read from image!", -res));
+				else if (0 == res)
+					error = std::make_exception_ptr(READ_PIPELINE_ERROR("Read past the end of the image!", ERROR_HANDLE_EOF));
+
+				ready.emplace_back(piece.seq, error);
+				freePieces.push_back(idx);
+			}
+
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+			flush();
+		}
+
+		std::shared_ptr<BlockDevice>							device;
+		int														ringFd;
+		void*													sqRing;
+		void*													cqRing;
+		io_uring_sqe*											sqes;
+		size_t													sqRingSize;
+		size_t													cqRingSize;
+		size_t													sqeCount;
+		unsigned*												sqTail;
+		unsigned*												sqArray;
+		unsigned												sqMask;
+		unsigned*												cqHead;
+		unsigned*												cqTail;
+		unsigned												cqMask;
+		io_uring_cqe*											cqes;
+		unsigned												unsubmitted;
+		std::vector<Piece>										pieces;
+		std::vector<size_t>										freePieces;
+		std::deque<std::pair<uint64_t, std::exception_ptr>>		ready;
+	};
+
+	// Whether reads from dev can go through the ring at all
+	bool uring_capable(BlockDevice& dev)
+	{
+		int			fd = -1;
+		uint64_t	fileOffset = 0;
+		uint64_t	contiguous = 0;
+
+		return dev.nativeRange(0, fd, fileOffset, contiguous);
+	}
+#endif
+
+}
+
+namespace ntfs {
+
+	ReadPipeline::ReadPipeline(std::shared_ptr<BlockDevice> dev, size_t depth, ReadBackend backend) :
+		device(dev), kind(backend), queueDepth(std::max<size_t>(1, depth)), firstSeq(0), inFlight(0)
+	{
+		if (!device)
+			throw READ_PIPELINE_ERROR("No block device provided!", ERROR_INVALID_PARAMETER);
+
+#ifdef NTFS_HAVE_IO_URING
+		// Reads of a fragmented range become several pieces, so leave the ring some room beyond depth
+		unsigned entries = 8;
+		while (entries < queueDepth * 4 && entries < 4096)
+			entries <<= 1;
+
+		if (ReadBackend::IoUring == kind) {
+			engine.reset(new UringEngine(device, entries));
+		}
+		else if (ReadBackend::Auto == kind && uring_capable(*device)) {
+			// Older kernels, seccomp filters and containers commonly refuse io_uring; threads work everywhere
+			try {
+				engine.reset(new UringEngine(device, entries));
+				kind = ReadBackend::IoUring;
+			}
+			catch (const std::runtime_error&) {
+			}
+		}
+#else
+		if (ReadBackend::IoUring == kind)
+			throw READ_PIPELINE_ERROR("io_uring is not supported on this platform!", ERROR_NOT_SUPPORTED);
+#endif
+
+		if (!engine) {
+			engine.reset(new ThreadEngine(device, queueDepth));
+			kind = ReadBackend::Threads;
+		}
+	}
+
+	ReadPipeline::~ReadPipeline()
+	{
+		// The engine may still be writing into caller buffers; let every piece land before tearing down
+		while (inFlight) {
+			try {
+				reapOne();
+			}
+			catch (...) {
+				break;
+			}
+		}
+	}
+
+	void ReadPipeline::submit(uint64_t tag, uint64_t offset, void* buf, size_t len)
+	{
+		uint64_t seq = firstSeq + slots.size();
+
+		slots.push_back({ tag, 0, nullptr });
+		if (!len)
+			return;
+
+		size_t started = 0;
+		try {
+			engine->start(seq, offset, static_cast<unsigned char*>(buf), len, started);
+		}
+		catch (...) {
+			slots.back().error = std::current_exception();
+		}
+		slots.back().outstanding += started;
+		inFlight += started;
+	}
+
+	void ReadPipeline::submit(uint64_t tag, const ExtentMap& map, uint32_t bytesPerCluster, uint64_t offset, void* buf, size_t len)
+	{
+		struct Piece {
+			uint64_t		offset;
+			unsigned char*	out;
+			size_t			len;
+		};
+
+		std::vector<Piece>	pieces;
+		uint64_t			bpc = bytesPerCluster;
+		unsigned char*		out = static_cast<unsigned char*>(buf);
+		uint64_t			seq = firstSeq + slots.size();
+
+		// Map the whole range before starting anything, so a bad map doesn't leave reads half issued
+		while (len) {
+			uint64_t	remaining = 0;
+			int64_t		lcn = map.lookup(offset / bpc, &remaining);
+
+			if (unmapped_lcn == lcn)
+				throw READ_PIPELINE_ERROR("Requested range is not mapped by the attribute's data runs!", ERROR_FILE_CORRUPT);
+
+			size_t chunk = static_cast<size_t>(std::min<uint64_t>((remaining * bpc) - (offset % bpc), len));
+			if (sparse_lcn == lcn)
+				memset(out, 0, chunk);
+			else if (!pieces.empty() && pieces.back().offset + pieces.back().len == (lcn * bpc) + (offset % bpc))
+				pieces.back().len += chunk;
+			else
+				pieces.push_back({ (lcn * bpc) + (offset % bpc), out, chunk });
+
+			out += chunk;
+			offset += chunk;
+			len -= chunk;
+		}
+
+		size_t started = 0;
+		slots.push_back({ tag, 0, nullptr });
+		try {
+			for (auto& p : pieces)
+				engine->start(seq, p.offset, p.out, p.len, started);
+		}
+		catch (...) {
+			slots.back().error = std::current_exception();
+		}
+		slots.back().outstanding += started;
+		inFlight += started;
+	}
+
+	uint64_t ReadPipeline::wait()
+	{
+		if (slots.empty())
+			throw READ_PIPELINE_ERROR("No reads are outstanding!", ERROR_INVALID_PARAMETER);
+
+		while (slots.front().outstanding)
+			reapOne();
+
+		Slot slot = std::move(slots.front());
+		slots.pop_front();
+		++firstSeq;
+
+		if (slot.error)
+			std::rethrow_exception(slot.error);
+
+		return slot.tag;
+	}
+
+	size_t ReadPipeline::pending() const
+	{
+		return slots.size();
+	}
+
+	size_t ReadPipeline::depth() const
+	{
+		return queueDepth;
+	}
+
+	ReadBackend ReadPipeline::backend() const
+	{
+		return kind;
+	}
+
+	void ReadPipeline::reapOne()
+	{
+		std::exception_ptr	error;
+		uint64_t			seq = engine->reap(error);
+		Slot&				slot = slots[static_cast<size_t>(seq - firstSeq)];
+
+		--slot.outstanding;
+		--inFlight;
+		if (error && !slot.error)
+			slot.error = error;
+	}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <deque>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <stdint.h>
+#include "BlockDevice.hpp"
+#include "Runlist.hpp"
+
+#define READ_PIPELINE_ERROR(msg, err)\
+	std::runtime_error(("[ReadPipeline] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+// io_uring is only used where the kernel headers are available; everything else falls back to threads.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NTFS_HAVE_IO_URING 1
+#endif
+#endif
+
+namespace ntfs {
+
+	constexpr size_t default_pipeline_depth = 4;
+
+	// The backend doing the actual reads; defined in ReadPipeline.cpp
+	class ReadEngine;
+
+	enum class ReadBackend {
+		Auto,		// io_uring when the kernel allows it, threads otherwise
+		Threads,	// blocking reads on a small set of I/O threads
+		IoUring		// Linux io_uring; only reads that land in a plain file descriptor go through the ring
+	};
+
+	/**
+	* Keeps several large reads in flight against a block device, so that the caller can parse one buffer
+	* while the next ones are still being read. Reads are queued with submit() and collected, strictly in
+	* the order they were submitted, with wait().
+	*
+	* The caller owns the buffers; a buffer must stay alive and untouched until wait() has returned its tag.
+	* A pipeline is meant to be driven by a single thread.
+	*/
+	class ReadPipeline {
+	public:
+		/**
+		* @throws std::runtime_error if dev is null, or the requested backend can't be set up
+		* @param dev The device to read from
+		* @param depth The number of reads the caller intends to keep in flight (at least 1)
+		* @param backend The mechanism used to issue reads
+		*/
+		ReadPipeline(std::shared_ptr<BlockDevice> dev, size_t depth = default_pipeline_depth, ReadBackend backend = ReadBackend::Auto);
+		~ReadPipeline();
+		ReadPipeline(const ReadPipeline&) = delete;
+		ReadPipeline& operator=(const ReadPipeline&) = delete;
+
+		/**
+		* Queues a read of len bytes at device offset offset into buf.
+		*
+		* @param tag An arbitrary value handed back by wait() once the read completes
+		* @param offset The byte offset on the device to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		*/
+		void submit(uint64_t tag, uint64_t offset, void* buf, size_t len);
+
+		/**
+		* Queues a read of len bytes at offset offset within the attribute described by map. Sparse runs are
+		* zero filled immediately; every other run becomes its own device read.
+		*
+		* @throws std::runtime_error if part of the range isn't mapped by map
+		* @param tag An arbitrary value handed back by wait() once the read completes
+		* @param map The data runs of the attribute being read
+		* @param bytesPerCluster The volume's cluster size
+		* @param offset The byte offset within the attribute to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		*/
+		void submit(uint64_t tag, const ExtentMap& map, uint32_t bytesPerCluster, uint64_t offset, void* buf, size_t len);
+
+		/**
+		* Blocks until the oldest outstanding read has completed, and removes it from the pipeline.
+		*
+		* @throws std::runtime_error if nothing is outstanding, or if any part of the oldest read failed
+		* @return the tag the read was submitted with
+		*/
+		uint64_t wait();
+
+		/**
+		* Returns the number of reads submitted but not yet collected by wait().
+		*/
+		size_t pending() const;
+
+		/**
+		* Returns the depth the pipeline was created with.
+		*/
+		size_t depth() const;
+
+		/**
+		* Returns the backend actually in use (never ReadBackend::Auto).
+		*/
+		ReadBackend backend() const;
+
+	private:
+		struct Slot {
+			uint64_t			tag;
+			size_t				outstanding;
+			std::exception_ptr	error;
+		};
+
+		void reapOne();
+
+		std::shared_ptr<BlockDevice>	device;
+		std::unique_ptr<ReadEngine>		engine;
+		ReadBackend						kind;
+		size_t							queueDepth;
+		std::deque<Slot>				slots;
+		uint64_t						firstSeq;
+		size_t							inFlight;
+	};
+
+}
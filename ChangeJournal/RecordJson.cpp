@@ -0,0 +1,46 @@
+#include "RecordJson.hpp"
+
+namespace ntfs {
+
+	bool UsnRecordJson::write(JsonWriter& json, const USN_RECORD_COMMON_HEADER* rec)
+	{
+		return visit_usn_record(rec, [&](auto view) {
+			writeView(json, view);
+		});
+	}
+
+	void UsnRecordJson::writeBatch(JsonWriter& json, const uint8_t* buf, size_t len)
+	{
+		visit_usn_batch(buf, len, [&](auto view) {
+			writeView(json, view);
+		});
+	}
+
+	bool FileRecordJson::write(JsonWriter& json, const FileIndex& index, uint64_t recNum)
+	{
+		if (!index.contains(recNum))
+			return false;
+
+		json.beginObject();
+		json.key("Frn").value(index.frn(recNum));
+		json.key("ParentFrn").value(index.parent(recNum));
+		json.key("Name").value(index.nameData(recNum), index.nameLength(recNum));
+
+		path.clear();
+		if (paths && paths->appendPath(index.frn(recNum), path))
+			json.key("Path").value(path.data(), path.size());
+
+		json.key("Directory").value(index.isDirectory(recNum));
+		json.key("Size").value(index.dataSize(recNum));
+		json.key("AllocatedSize").value(index.allocatedSize(recNum));
+		json.key("Attributes").value(index.attributes(recNum));
+		json.key("CreationTime").value(index.creationTime(recNum));
+		json.key("ChangeTime").value(index.changeTime(recNum));
+		json.key("LastWriteTime").value(index.lastWriteTime(recNum));
+		json.key("LastAccessTime").value(index.lastAccessTime(recNum));
+		json.endObject().endLine();
+
+		return true;
+	}
+
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <string>
+#include <stdint.h>
+#include "ntfs_compat.h"
+#include "FileIndex.hpp"
+#include "JsonWriter.hpp"
+#include "PathResolver.hpp"
+#include "UsnRecord.hpp"
+
+namespace ntfs {
+
+	/**
+	* Writes USN records as NDJSON (one object per line), straight into a JsonWriter. Names and paths are
+	* written in full, however long they are.
+	*
+	* V2 records' file reference numbers are written as numbers; V3 and V4 records' 128 bit file IDs are
+	* written as hex strings. V4 (range tracking) records carry no name, and list the ranges that were
+	* written instead.
+	*/
+	class UsnRecordJson {
+	public:
+		/**
+		* @param paths If not null, records get a "Path" whenever paths knows the file's parent directory;
+		* must outlive the UsnRecordJson
+		*/
+		UsnRecordJson(PathResolver* paths = nullptr) : paths(paths) {}
+
+		/**
+		* Writes a line for a single record.
+		*
+		* @return false (writing nothing) if there's no view for the record's version
+		*/
+		bool write(JsonWriter& json, const USN_RECORD_COMMON_HEADER* rec);
+
+		/**
+		* Writes a line for a record that's already been visited (see visit_usn_record).
+		*/
+		template <typename View>
+		void writeView(JsonWriter& json, const View& view);
+
+		/**
+		* Writes a line for every record in a buffer returned by readRecords (or a UsnBatch).
+		*
+		* @throws std::runtime_error if a record doesn't fit the buffer
+		* @param buf The buffer, starting with the next USN
+		* @param len The number of valid bytes in buf
+		*/
+		void writeBatch(JsonWriter& json, const uint8_t* buf, size_t len);
+
+	private:
+		void writeIds(JsonWriter& json, const UsnRecordView<2>& view);
+
+		template <typename View>
+		void writeIds(JsonWriter& json, const View& view);
+
+		template <typename View>
+		void writeNamed(JsonWriter& json, const View& view);
+
+		void writeNamed(JsonWriter& json, const UsnRecordView<4>& view);
+
+		PathResolver*				paths;
+		std::basic_string<WCHAR>	path;	// reused, so paths don't cost an allocation apiece
+	};
+
+	/**
+	* Writes the files in a FileIndex as NDJSON, one object per file.
+	*/
+	class FileRecordJson {
+	public:
+		/**
+		* @param paths If not null, files get a "Path"; must outlive the FileRecordJson
+		*/
+		FileRecordJson(PathResolver* paths = nullptr) : paths(paths) {}
+
+		/**
+		* Writes a line for a file.
+		*
+		* @param index The index to read the file from
+		* @param recNum The file's (base) record number
+		* @return false (writing nothing) if the index doesn't hold the record
+		*/
+		bool write(JsonWriter& json, const FileIndex& index, uint64_t recNum);
+
+	private:
+		PathResolver*				paths;
+		std::basic_string<WCHAR>	path;
+	};
+
+	template <typename View>
+	void UsnRecordJson::writeView(JsonWriter& json, const View& view)
+	{
+		json.beginObject();
+		writeNamed(json, view);
+		json.endObject().endLine();
+	}
+
+	inline void UsnRecordJson::writeIds(JsonWriter& json, const UsnRecordView<2>& view)
+	{
+		json.key("FileReferenceNumber").value(view.fileReference());
+		json.key("ParentFileReferenceNumber").value(view.parentReference());
+	}
+
+	template <typename View>
+	void UsnRecordJson::writeIds(JsonWriter& json, const View& view)
+	{
+		auto file = view.fileId();
+		auto parent = view.parentId();
+
+		json.key("FileReferenceNumber").hexValue(file.high, file.low);
+		json.key("ParentFileReferenceNumber").hexValue(parent.high, parent.low);
+	}
+
+	template <typename View>
+	void UsnRecordJson::writeNamed(JsonWriter& json, const View& view)
+	{
+		json.key("Filename").value(view.name(), view.nameLength());
+		json.key("MajorVersion").value(static_cast<WORD>(View::version));
+		json.key("Usn").value(view.usn());
+		json.key("TimeStamp").value(view.timeStamp());
+		json.key("Reason").value(view.reason());
+		json.key("SourceInfo").value(view.sourceInfo());
+		json.key("SecurityId").value(view.securityId());
+		json.key("FileAttributes").value(view.fileAttributes());
+		writeIds(json, view);
+
+		// The record carries the file's name as of the change, which may differ from what the MFT has now
+		path.clear();
+		if (paths && paths->appendPath(view.parentReference(), path)) {
+			if (path.back() != '\\')
+				path += '\\';
+
+			path.append(view.name(), view.nameLength());
+			json.key("Path").value(path.data(), path.size());
+		}
+	}
+
+	inline void UsnRecordJson::writeNamed(JsonWriter& json, const UsnRecordView<4>& view)
+	{
+		json.key("MajorVersion").value(4);
+		json.key("Usn").value(view.usn());
+		json.key("Reason").value(view.reason());
+		json.key("SourceInfo").value(view.sourceInfo());
+		writeIds(json, view);
+		json.key("RemainingExtents").value(view.remainingExtents());
+
+		json.key("Extents").beginArray();
+		for (size_t i = 0; i < view.extentCount(); ++i) {
+			auto extent = view.extent(i);
+			json.beginObject().key("Offset").value(extent.Offset).key("Length").value(extent.Length).endObject();
+		}
+		json.endArray();
+	}
+
+}
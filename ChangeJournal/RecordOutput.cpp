@@ -0,0 +1,265 @@
+#include "RecordOutput.hpp"
+#include "CsvWriter.hpp"
+#include "RecordJson.hpp"
+#include "TextFormat.hpp"
+#include "UsnRecord.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+	// Text is handed to the sink once this much has been gathered
+	constexpr size_t spill_size = 48 * 1024;
+
+	bool has_extension(const std::string& path, const char* ext)
+	{
+		size_t n = strlen(ext);
+
+		if (path.size() < n)
+			return false;
+
+		return std::equal(ext, ext + n, path.end() - n, [](char a, char b) {
+			return a == ((b >= 'A' && b <= 'Z') ? static_cast<char>(b - 'A' + 'a') : b);
+		});
+	}
+
+	class JsonOutput : public ntfs::RecordOutput {
+	public:
+		JsonOutput(ntfs::OutputSink& sink, ntfs::PathResolver* paths) : sink(sink), records(paths), files(paths) {}
+
+		void writeUsnBatch(const uint8_t* buf, size_t len) override
+		{
+			records.writeBatch(json, buf, len);
+			spill();
+		}
+
+		bool writeFile(const ntfs::FileIndex& index, uint64_t recNum) override
+		{
+			if (!files.write(json, index, recNum))
+				return false;
+
+			if (json.size() >= spill_size)
+				spill();
+
+			return true;
+		}
+
+		void flush() override
+		{
+			spill();
+			sink.flush();
+		}
+
+	private:
+		void spill()
+		{
+			sink.write(json.data(), json.size());
+			json.clear();
+		}
+
+		ntfs::OutputSink&		sink;
+		ntfs::JsonWriter		json;
+		ntfs::UsnRecordJson		records;
+		ntfs::FileRecordJson	files;
+	};
+
+	class CsvOutput : public ntfs::RecordOutput {
+	public:
+		CsvOutput(ntfs::OutputSink& sink, ntfs::PathResolver* paths) : sink(sink), paths(paths) {}
+
+		void writeUsnBatch(const uint8_t* buf, size_t len) override
+		{
+			if (!usnHeader) {
+				csv.names("Usn,MajorVersion,TimeStamp,Reason,SourceInfo,SecurityId,FileAttributes,FileReferenceNumber,ParentFileReferenceNumber,Filename,Path,Extents");
+				usnHeader = true;
+			}
+
+			ntfs::visit_usn_batch(buf, len, [&](auto view) {
+				writeRecord(view);
+			});
+			spill();
+		}
+
+		bool writeFile(const ntfs::FileIndex& index, uint64_t recNum) override
+		{
+			if (!index.contains(recNum))
+				return false;
+
+			if (!fileHeader) {
+				csv.names("Frn,ParentFrn,Name,Path,Directory,Size,AllocatedSize,Attributes,CreationTime,ChangeTime,LastWriteTime,LastAccessTime");
+				fileHeader = true;
+			}
+
+			csv.field(index.frn(recNum)).field(index.parent(recNum)).field(index.nameData(recNum), index.nameLength(recNum));
+
+			path.clear();
+			if (paths && paths->appendPath(index.frn(recNum), path))
+				csv.field(path.data(), path.size());
+			else
+				csv.emptyField();
+
+			csv.field(index.isDirectory(recNum) ? 1 : 0).field(index.dataSize(recNum)).field(index.allocatedSize(recNum)).field(index.attributes(recNum));
+			csv.field(index.creationTime(recNum)).field(index.changeTime(recNum)).field(index.lastWriteTime(recNum)).field(index.lastAccessTime(recNum));
+			csv.endRow();
+
+			if (csv.size() >= spill_size)
+				spill();
+
+			return true;
+		}
+
+		void flush() override
+		{
+			spill();
+			sink.flush();
+		}
+
+	private:
+		void writeIds(const ntfs::UsnRecordView<2>& view)
+		{
+			csv.field(view.fileReference()).field(view.parentReference());
+		}
+
+		template <typename View>
+		void writeIds(const View& view)
+		{
+			auto file = view.fileId();
+			auto parent = view.parentId();
+
+			csv.hexField(file.high, file.low).hexField(parent.high, parent.low);
+		}
+
+		template <typename View>
+		void writeRecord(const View& view)
+		{
+			csv.field(view.usn()).field(static_cast<WORD>(View::version)).field(view.timeStamp()).field(view.reason());
+			csv.field(view.sourceInfo()).field(view.securityId()).field(view.fileAttributes());
+			writeIds(view);
+			csv.field(view.name(), view.nameLength());
+
+			path.clear();
+			if (View::has_name && paths && paths->appendPath(view.parentReference(), path)) {
+				if (path.back() != '\\')
+					path += '\\';
+
+				path.append(view.name(), view.nameLength());
+				csv.field(path.data(), path.size());
+			}
+			else {
+				csv.emptyField();
+			}
+
+			// Range tracking records' extents, as offset:length pairs separated by spaces
+			extents.clear();
+			for (size_t i = 0; i < view.extentCount(); ++i) {
+				auto	extent = view.extent(i);
+				char	tmp[2 * ntfs::max_decimal_length + 2];
+				char*	p = tmp;
+
+				if (i)
+					*p++ = ' ';
+
+				p = ntfs::format_decimal(p, static_cast<int64_t>(extent.Offset));
+				*p++ = ':';
+				p = ntfs::format_decimal(p, static_cast<int64_t>(extent.Length));
+				extents.append(tmp, p);
+			}
+
+			csv.field(extents.data(), extents.size());
+			csv.endRow();
+		}
+
+		void spill()
+		{
+			sink.write(csv.data(), csv.size());
+			csv.clear();
+		}
+
+		ntfs::OutputSink&			sink;
+		ntfs::PathResolver*			paths;
+		ntfs::CsvWriter				csv;
+		std::basic_string<WCHAR>	path;
+		std::string					extents;
+		bool						usnHeader = false;
+		bool						fileHeader = false;
+	};
+
+	class BinaryOutput : public ntfs::RecordOutput {
+	public:
+		BinaryOutput(ntfs::OutputSink& sink) : sink(sink) {}
+
+		// Records already are a binary format, and go out as read; only the leading USN is dropped
+		void writeUsnBatch(const uint8_t* buf, size_t len) override
+		{
+			if (len > sizeof(USN))
+				sink.write(buf + sizeof(USN), len - sizeof(USN));
+		}
+
+		bool writeFile(const ntfs::FileIndex& index, uint64_t recNum) override
+		{
+			if (!index.contains(recNum))
+				return false;
+
+			size_t nameLen = std::min<size_t>(index.nameLength(recNum), UINT16_MAX);
+			size_t nameBytes = nameLen * sizeof(WCHAR);
+			size_t size = (offsetof(ntfs::BINARY_FILE_ENTRY, Name) + nameBytes + 7) & ~static_cast<size_t>(7);
+
+			entry.assign(size, 0);
+
+			auto e = reinterpret_cast<ntfs::BINARY_FILE_ENTRY*>(entry.data());
+
+			e->RecordLength = static_cast<uint32_t>(size);
+			e->NameLength = static_cast<uint16_t>(nameLen);
+			e->Flags = index.isDirectory(recNum) ? ntfs::BinaryEntryDirectory : 0;
+			e->FileReferenceNumber = index.frn(recNum);
+			e->ParentFileReferenceNumber = index.parent(recNum);
+			e->DataSize = index.dataSize(recNum);
+			e->AllocatedSize = index.allocatedSize(recNum);
+			e->CreationTime = index.creationTime(recNum);
+			e->ChangeTime = index.changeTime(recNum);
+			e->LastWriteTime = index.lastWriteTime(recNum);
+			e->LastAccessTime = index.lastAccessTime(recNum);
+			e->FileAttributes = index.attributes(recNum);
+			memcpy(entry.data() + offsetof(ntfs::BINARY_FILE_ENTRY, Name), index.nameData(recNum), nameBytes);
+
+			sink.write(entry.data(), entry.size());
+			return true;
+		}
+
+		void flush() override
+		{
+			sink.flush();
+		}
+
+	private:
+		ntfs::OutputSink&		sink;
+		std::vector<uint8_t>	entry;
+	};
+}
+
+namespace ntfs {
+
+	OutputFormat output_format(const std::string& path)
+	{
+		if (has_extension(path, ".csv"))
+			return OutputFormat::Csv;
+
+		if (has_extension(path, ".bin"))
+			return OutputFormat::Binary;
+
+		return OutputFormat::Json;
+	}
+
+	std::unique_ptr<RecordOutput> make_record_output(OutputFormat format, OutputSink& sink, PathResolver* paths)
+	{
+		switch (format) {
+		case OutputFormat::Csv:
+			return std::make_unique<CsvOutput>(sink, paths);
+		case OutputFormat::Binary:
+			return std::make_unique<BinaryOutput>(sink);
+		default:
+			return std::make_unique<JsonOutput>(sink, paths);
+		}
+	}
+
+}
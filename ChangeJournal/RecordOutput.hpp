@@ -0,0 +1,116 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "ntfs_compat.h"
+#include "FileIndex.hpp"
+#include "OutputSink.hpp"
+#include "PathResolver.hpp"
+
+namespace ntfs {
+
+	enum class OutputFormat {
+		Json,		// NDJSON: one object per line (see UsnRecordJson and FileRecordJson)
+		Csv,		// RFC 4180 CSV, with a header row before the first USN record and before the first file
+		Binary		// USN records exactly as the journal holds them, and files as BINARY_FILE_ENTRYs
+	};
+
+	/**
+	* A file, as OutputFormat::Binary writes it. Entries follow one another, each RecordLength bytes long
+	* (a multiple of 8); the name is UTF-16, and isn't NUL terminated.
+	*/
+	struct BINARY_FILE_ENTRY {
+		uint32_t	RecordLength;
+		uint16_t	NameLength;		// in characters
+		uint16_t	Flags;			// BinaryEntryDirectory
+		uint64_t	FileReferenceNumber;
+		uint64_t	ParentFileReferenceNumber;
+		uint64_t	DataSize;
+		uint64_t	AllocatedSize;
+		uint64_t	CreationTime;
+		uint64_t	ChangeTime;
+		uint64_t	LastWriteTime;
+		uint64_t	LastAccessTime;
+		uint32_t	FileAttributes;
+		uint32_t	Reserved;
+		WCHAR		Name[1];
+	};
+
+	enum BinaryEntryFlags : uint16_t {
+		BinaryEntryDirectory = 0x0001
+	};
+
+	/**
+	* Picks a format from a file's extension: .csv and .bin, and NDJSON for everything else.
+	*/
+	OutputFormat output_format(const std::string& path);
+
+	/**
+	* Turns USN records and files into one of the OutputFormats, and writes them to a sink. Text is gathered
+	* into large chunks before it's handed to the sink.
+	*/
+	class RecordOutput {
+	public:
+		virtual ~RecordOutput() = default;
+
+		/**
+		* Writes every record in a buffer returned by readRecords (or a UsnBatch).
+		*
+		* @throws std::runtime_error if a record doesn't fit the buffer, or the sink fails
+		* @param buf The buffer, starting with the next USN
+		* @param len The number of valid bytes in buf
+		*/
+		virtual void writeUsnBatch(const uint8_t* buf, size_t len) = 0;
+
+		/**
+		* Writes a file.
+		*
+		* @throws std::runtime_error if the sink fails
+		* @param index The index to read the file from
+		* @param recNum The file's (base) record number
+		* @return false (writing nothing) if the index doesn't hold the record
+		*/
+		virtual bool writeFile(const FileIndex& index, uint64_t recNum) = 0;
+
+		/**
+		* Hands anything still gathered to the sink, and flushes the sink.
+		*
+		* @throws std::runtime_error if the sink fails
+		*/
+		virtual void flush() = 0;
+	};
+
+	/**
+	* @param format The format to write
+	* @param sink Where to write; must outlive the RecordOutput
+	* @param paths If not null, records and files get their full paths (binary output has no room for
+	* them); must outlive the RecordOutput
+	*/
+	std::unique_ptr<RecordOutput> make_record_output(OutputFormat format, OutputSink& sink, PathResolver* paths = nullptr);
+
+}
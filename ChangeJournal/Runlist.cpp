@@ -0,0 +1,266 @@
+#include "Runlist.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	// Reads an n byte little-endian field. When the caller knows at least eight bytes are
+	// readable at p, the field is loaded in one go and masked down to size.
+	inline uint64_t read_field(const unsigned char* p, unsigned n, bool wide)
+	{
+		uint64_t v = 0;
+
+		if (wide) {
+			memcpy(&v, p, sizeof(v));
+			return (n == 8) ? v : v & ((uint64_t(1) << (8 * n)) - 1);
+		}
+
+		for (unsigned i = 0; i < n; ++i)
+			v |= uint64_t(p[i]) << (8 * i);
+
+		return v;
+	}
+}
+
+namespace ntfs {
+
+	void decode_runlist(const NTFS_NONRESIDENT_ATTRIBUTE* attr, std::vector<DataRun>& out)
+	{
+		auto		base = reinterpret_cast<const unsigned char*>(attr);
+		uint64_t	vcn = attr->LowVcn;
+		int64_t		lcn = 0;
+
+		if (!attr->Attribute.NonResident || attr->RunArrayOffset < offsetof(NTFS_NONRESIDENT_ATTRIBUTE, AllocSize) || attr->RunArrayOffset >= attr->Attribute.Length)
+			throw EXTENT_MAP_ERROR("Attribute does not contain a mapping pairs array!", ERROR_INVALID_PARAMETER);
+
+		const unsigned char* p = base + attr->RunArrayOffset;
+		const unsigned char* end = base + attr->Attribute.Length;
+
+		// Each pair is a header byte (low nibble: size of the length field, high nibble: size of
+		// the signed LCN delta, 0 for sparse runs), followed by the little-endian fields themselves.
+		while (p < end && *p) {
+			unsigned	lenSize = *p & 0x0F;
+			unsigned	offSize = *p >> 4;
+			uint64_t	length = 0;
+
+			if (!lenSize || lenSize > 8 || offSize > 8 || p + 1 + lenSize + offSize > end)
+				throw EXTENT_MAP_ERROR("Mapping pairs array is malformed!", ERROR_FILE_CORRUPT);
+
+			length = read_field(p + 1, lenSize, p + 9 <= end);
+			if (0 == length || vcn + length < vcn)
+				throw EXTENT_MAP_ERROR("Mapping pairs array contains a bad run length!", ERROR_FILE_CORRUPT);
+
+			if (offSize) {
+				uint64_t raw = read_field(p + 1 + lenSize, offSize, p + 1 + lenSize + 8 <= end);
+				if (offSize < 8 && (raw >> (8 * offSize - 1)) & 1)
+					raw |= ~uint64_t(0) << (8 * offSize);
+
+				lcn += static_cast<int64_t>(raw);
+				if (lcn < 0)
+					throw EXTENT_MAP_ERROR("Mapping pairs array contains a negative LCN!", ERROR_FILE_CORRUPT);
+			}
+
+			out.push_back({ vcn, offSize ? lcn : sparse_lcn, length });
+			vcn += length;
+			p += 1 + lenSize + offSize;
+		}
+
+		// HighVcn is inclusive; an empty attribute has LowVcn 0 and HighVcn -1
+		if (vcn != attr->HighVcn + 1)
+			throw EXTENT_MAP_ERROR("Mapping pairs array does not match the attribute's VCN range!", ERROR_FILE_CORRUPT);
+	}
+
+	void ExtentMap::addSegment(const NTFS_NONRESIDENT_ATTRIBUTE* attr)
+	{
+		std::vector<DataRun> runs;
+		std::vector<DataRun> all;
+
+		decode_runlist(attr, runs);
+
+		if (0 == attr->LowVcn) {
+			allocSize = attr->AllocSize;
+			size_ = attr->DataSize;
+			initSize = attr->InitializedSize;
+			cu = attr->CompressionUnit;
+		}
+
+		if (runs.empty())
+			return;
+
+		for (size_t i = 0; i < size(); ++i) {
+			auto r = run(i);
+			if (unmapped_lcn == r.lcn)
+				continue;
+			if (r.vcn <= attr->HighVcn && attr->LowVcn < r.vcn + r.length)
+				throw EXTENT_MAP_ERROR("Attribute segment overlaps one already in the map!", ERROR_FILE_CORRUPT);
+			all.push_back(r);
+		}
+
+		all.insert(all.end(), runs.begin(), runs.end());
+		std::sort(all.begin(), all.end(), [](const DataRun& a, const DataRun& b) { return a.vcn < b.vcn; });
+
+		vcns.clear();
+		lcns.clear();
+		for (auto& r : all)
+			append(r.vcn, r.lcn, r.length);
+	}
+
+	void ExtentMap::append(uint64_t vcn, int64_t lcn, uint64_t length)
+	{
+		if (vcns.empty())
+			vcns.push_back(0);
+
+		uint64_t end = vcns.back();
+		if (vcn > end)
+			append(end, unmapped_lcn, vcn - end);
+
+		if (!lcns.empty()) {
+			auto last = lcns.back();
+			auto lastStart = vcns[vcns.size() - 2];
+			bool contiguous = (lcn < 0) ? (last == lcn) : (last >= 0 && last + static_cast<int64_t>(vcn - lastStart) == lcn);
+
+			if (contiguous) {
+				vcns.back() = vcn + length;
+				return;
+			}
+		}
+
+		lcns.push_back(lcn);
+		vcns.push_back(vcn + length);
+	}
+
+	int64_t ExtentMap::lookup(uint64_t vcn, uint64_t* remaining) const
+	{
+		if (lcns.empty() || vcn >= vcns.back()) {
+			if (remaining)
+				*remaining = 0;
+			return unmapped_lcn;
+		}
+
+		size_t idx = std::upper_bound(vcns.begin(), vcns.end(), vcn) - vcns.begin() - 1;
+		if (remaining)
+			*remaining = vcns[idx + 1] - vcn;
+
+		return (lcns[idx] < 0) ? lcns[idx] : lcns[idx] + static_cast<int64_t>(vcn - vcns[idx]);
+	}
+
+	size_t ExtentMap::size() const
+	{
+		return lcns.size();
+	}
+
+	DataRun ExtentMap::run(size_t i) const
+	{
+		return { vcns[i], lcns[i], vcns[i + 1] - vcns[i] };
+	}
+
+	uint64_t ExtentMap::clusterCount() const
+	{
+		return vcns.empty() ? 0 : vcns.back();
+	}
+
+	bool ExtentMap::complete() const
+	{
+		return std::find(lcns.begin(), lcns.end(), unmapped_lcn) == lcns.end();
+	}
+
+	uint64_t ExtentMap::allocatedSize() const
+	{
+		return allocSize;
+	}
+
+	uint64_t ExtentMap::dataSize() const
+	{
+		return size_;
+	}
+
+	uint64_t ExtentMap::initializedSize() const
+	{
+		return initSize;
+	}
+
+	uint8_t ExtentMap::compressionUnit() const
+	{
+		return cu;
+	}
+
+	bool ExtentCache::Key::operator==(const Key& other) const
+	{
+		return recNum == other.recNum && type == other.type && name == other.name;
+	}
+
+	size_t ExtentCache::KeyHash::operator()(const Key& k) const
+	{
+		size_t h = std::hash<uint64_t>()(k.recNum) ^ (static_cast<size_t>(k.type) * 0x9E3779B9u);
+		for (auto c : k.name)
+			h = (h * 31) + static_cast<size_t>(c);
+		return h;
+	}
+
+	ExtentCache::ExtentCache(size_t capacity) : capacity(std::max<size_t>(1, capacity))
+	{
+	}
+
+	std::shared_ptr<const ExtentMap> ExtentCache::find(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto it = index.find(Key{ recNum, type, name });
+		if (it == index.end())
+			return nullptr;
+
+		lru.splice(lru.begin(), lru, it->second);
+		return it->second->second;
+	}
+
+	void ExtentCache::insert(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name, std::shared_ptr<const ExtentMap> map)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		Key key{ recNum, type, name };
+
+		auto it = index.find(key);
+		if (it != index.end()) {
+			it->second->second = map;
+			lru.splice(lru.begin(), lru, it->second);
+			return;
+		}
+
+		if (lru.size() >= capacity) {
+			index.erase(lru.back().first);
+			lru.pop_back();
+		}
+
+		lru.emplace_front(key, map);
+		index.emplace(key, lru.begin());
+	}
+
+	void ExtentCache::invalidate(uint64_t recNum)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		for (auto it = lru.begin(); it != lru.end(); ) {
+			if (it->first.recNum == recNum) {
+				index.erase(it->first);
+				it = lru.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	void ExtentCache::clear()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		index.clear();
+		lru.clear();
+	}
+
+	size_t ExtentCache::size()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return lru.size();
+	}
+
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_defs.h"
+
+#define EXTENT_MAP_ERROR(msg, err)\
+	std::runtime_error(("[ExtentMap] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	constexpr int64_t sparse_lcn = -1;
+	constexpr int64_t unmapped_lcn = -2;
+	constexpr size_t default_extent_cache_size = 4096;
+
+	/**
+	* A single decoded mapping pair: length clusters starting at vcn live at lcn.
+	*/
+	struct DataRun {
+		uint64_t	vcn;
+		int64_t		lcn; // sparse_lcn for sparse runs, unmapped_lcn for VCNs no segment describes
+		uint64_t	length;
+	};
+
+	/**
+	* Decodes the mapping pairs array of a single nonresident attribute segment, appending its runs
+	* to out. Every field is checked against the bounds of the attribute, and the decoded runs must
+	* exactly cover LowVcn through HighVcn.
+	*
+	* @throws std::runtime_error if the mapping pairs are malformed
+	* @param attr The nonresident attribute (segment) to decode
+	* @param out The vector the decoded runs are appended to
+	*/
+	void decode_runlist(const NTFS_NONRESIDENT_ATTRIBUTE* attr, std::vector<DataRun>& out);
+
+	/**
+	* A compact VCN -> LCN table for one nonresident attribute, assembled from one or more
+	* LowVcn/HighVcn segments. Runs that are physically contiguous are merged.
+	*/
+	class ExtentMap {
+	public:
+		ExtentMap() = default;
+
+		/**
+		* Decodes a segment of the attribute and merges it into the map. Segments may be added in any order.
+		*
+		* @throws std::runtime_error if the segment is malformed, or overlaps one already added
+		* @param attr The attribute segment to add
+		*/
+		void addSegment(const NTFS_NONRESIDENT_ATTRIBUTE* attr);
+
+		/**
+		* Maps a VCN to an LCN.
+		*
+		* @param vcn The virtual cluster to look up
+		* @param remaining If provided, receives the number of clusters (starting at vcn) the returned mapping holds for
+		* @return the LCN vcn lives at, sparse_lcn if vcn lies in a sparse run, or unmapped_lcn if no segment describes it
+		*/
+		int64_t lookup(uint64_t vcn, uint64_t* remaining = nullptr) const;
+
+		/**
+		* Returns the number of runs in the map (including sparse and unmapped ones).
+		*/
+		size_t size() const;
+
+		/**
+		* Returns the i'th run in the map.
+		*/
+		DataRun run(size_t i) const;
+
+		/**
+		* Returns the number of clusters spanned by the map.
+		*/
+		uint64_t clusterCount() const;
+
+		/**
+		* Indicates whether every VCN from 0 to the end of the map is described by some segment.
+		*/
+		bool complete() const;
+
+		/**
+		* The attribute's sizes, and its compression unit, as recorded in its first (LowVcn == 0) segment.
+		*/
+		uint64_t allocatedSize() const;
+		uint64_t dataSize() const;
+		uint64_t initializedSize() const;
+		uint8_t compressionUnit() const;
+
+	private:
+		// vcns has one more element than lcns; run i covers [vcns[i], vcns[i + 1])
+		std::vector<uint64_t>	vcns;
+		std::vector<int64_t>	lcns;
+		uint64_t				allocSize = 0;
+		uint64_t				size_ = 0;
+		uint64_t				initSize = 0;
+		uint8_t					cu = 0;
+
+		void append(uint64_t vcn, int64_t lcn, uint64_t length);
+	};
+
+	/**
+	* A thread safe, bounded (least recently used) cache of decoded extent maps, keyed on the file
+	* record, attribute type and attribute name they were built from.
+	*/
+	class ExtentCache {
+	public:
+		ExtentCache(size_t capacity = default_extent_cache_size);
+
+		/**
+		* Looks up a previously inserted map.
+		*
+		* @return the map, or an empty shared_ptr if it isn't cached.
+		*/
+		std::shared_ptr<const ExtentMap> find(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name);
+
+		/**
+		* Inserts (or replaces) a map, evicting the least recently used entry if the cache is full.
+		*/
+		void insert(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name, std::shared_ptr<const ExtentMap> map);
+
+		/**
+		* Drops every map built from recNum (e.g., because the file has changed).
+		*/
+		void invalidate(uint64_t recNum);
+
+		/**
+		* Drops every cached map.
+		*/
+		void clear();
+
+		/**
+		* Returns the number of maps currently cached.
+		*/
+		size_t size();
+
+	private:
+		struct Key {
+			uint64_t					recNum;
+			NtfsAttributeType			type;
+			std::basic_string<WCHAR>	name;
+
+			bool operator==(const Key& other) const;
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key& k) const;
+		};
+
+		typedef std::list<std::pair<Key, std::shared_ptr<const ExtentMap>>> LruList;
+
+		std::mutex										lock;
+		size_t											capacity;
+		LruList											lru;
+		std::unordered_map<Key, LruList::iterator, KeyHash>	index;
+	};
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <cstring>
+#include <stdint.h>
+#include "ntfs_compat.h"
+
+// The formatting shared by the text writers (JsonWriter, CsvWriter). Everything writes to a caller supplied
+// pointer, which must have room for the worst case, and returns one past the last byte written.
+namespace ntfs {
+
+	// The most a 64 bit integer takes in decimal, sign included
+	constexpr size_t max_decimal_length = 21;
+
+	const char decimal_digit_pairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	const char hex_digits[] = "0123456789abcdef";
+
+	/**
+	* Writes v in decimal, two digits at a time.
+	*/
+	inline char* format_decimal(char* p, uint64_t v)
+	{
+		char	tmp[20];
+		char*	end = tmp + sizeof(tmp);
+		char*	q = end;
+
+		while (v >= 100) {
+			size_t i = static_cast<size_t>(v % 100) * 2;
+
+			v /= 100;
+			*--q = decimal_digit_pairs[i + 1];
+			*--q = decimal_digit_pairs[i];
+		}
+
+		if (v >= 10) {
+			size_t i = static_cast<size_t>(v) * 2;
+
+			*--q = decimal_digit_pairs[i + 1];
+			*--q = decimal_digit_pairs[i];
+		}
+		else {
+			*--q = static_cast<char>('0' + v);
+		}
+
+		memcpy(p, q, end - q);
+		return p + (end - q);
+	}
+
+	inline char* format_decimal(char* p, int64_t v)
+	{
+		if (v < 0) {
+			*p++ = '-';
+			return format_decimal(p, 0 - static_cast<uint64_t>(v));
+		}
+
+		return format_decimal(p, static_cast<uint64_t>(v));
+	}
+
+	/**
+	* Writes v as exactly 16 hex digits, without a prefix.
+	*/
+	inline char* format_hex(char* p, uint64_t v)
+	{
+		for (int shift = 60; shift >= 0; shift -= 4)
+			*p++ = hex_digits[(v >> shift) & 0xF];
+
+		return p;
+	}
+
+	/**
+	* Transcodes UTF-16 to UTF-8. File names are just sequences of code units, so they may well hold unpaired
+	* surrogates; those become U+FFFD. Needs room for 3 bytes per code unit, plus whatever escape adds.
+	*
+	* @param escape Called as escape(p, c) for each ASCII character c; writes it (escaped, if need be) and
+	* returns one past what it wrote
+	*/
+	template <typename Escape>
+	char* format_utf8(char* p, const WCHAR* s, size_t len, Escape&& escape)
+	{
+		for (size_t i = 0; i < len; ++i) {
+			uint32_t c = static_cast<uint16_t>(s[i]);
+
+			if (c < 0x80) {
+				p = escape(p, static_cast<char>(c));
+			}
+			else if (c < 0x800) {
+				*p++ = static_cast<char>(0xC0 | (c >> 6));
+				*p++ = static_cast<char>(0x80 | (c & 0x3F));
+			}
+			else if (c >= 0xD800 && c <= 0xDFFF) {
+				uint32_t low = (i + 1 < len) ? static_cast<uint16_t>(s[i + 1]) : 0;
+
+				if (c <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+					uint32_t cp = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+
+					*p++ = static_cast<char>(0xF0 | (cp >> 18));
+					*p++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+					*p++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					*p++ = static_cast<char>(0x80 | (cp & 0x3F));
+					++i;
+				}
+				else {
+					*p++ = static_cast<char>(0xEF);
+					*p++ = static_cast<char>(0xBF);
+					*p++ = static_cast<char>(0xBD);
+				}
+			}
+			else {
+				*p++ = static_cast<char>(0xE0 | (c >> 12));
+				*p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				*p++ = static_cast<char>(0x80 | (c & 0x3F));
+			}
+		}
+
+		return p;
+	}
+
+}
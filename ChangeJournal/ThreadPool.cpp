@@ -0,0 +1,141 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+namespace ntfs {
+
+	WorkStealingPool::WorkStealingPool(size_t threads) : queued(0), outstanding(0), nextQueue(0), stopping(false)
+	{
+		if (0 == threads)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (size_t i = 0; i < threads; ++i)
+			queues.emplace_back(new Queue());
+
+		for (size_t i = 0; i < threads; ++i)
+			workers.emplace_back(&WorkStealingPool::run, this, i);
+	}
+
+	WorkStealingPool::~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (auto& t : workers)
+			t.join();
+	}
+
+	void WorkStealingPool::submit(std::function<void()> task)
+	{
+		size_t target = 0;
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			if (error)
+				return;
+
+			++outstanding;
+			target = nextQueue++ % queues.size();
+		}
+
+		// Count the task under its queue's lock, so no worker can take (and uncount) it before it's counted
+		{
+			std::lock_guard<std::mutex> guard(queues[target]->lock);
+			queues[target]->tasks.push_back(std::move(task));
+			queued.fetch_add(1);
+		}
+
+		// Take (and drop) the state lock so a worker between checking queued and sleeping can't miss this
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+		}
+		wake.notify_one();
+	}
+
+	void WorkStealingPool::wait()
+	{
+		std::unique_lock<std::mutex> guard(stateLock);
+		idle.wait(guard, [this] { return 0 == outstanding; });
+
+		if (error) {
+			auto e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+	size_t WorkStealingPool::threadCount() const
+	{
+		return workers.size();
+	}
+
+	bool WorkStealingPool::take(size_t self, std::function<void()>& task)
+	{
+		// A task is uncounted under its queue's lock, as it was counted, so queued never includes one that's
+		// already been taken; otherwise a worker could spin on empty queues rather than sleep.
+		// Our own queue, oldest first...
+		{
+			std::lock_guard<std::mutex> guard(queues[self]->lock);
+			if (!queues[self]->tasks.empty()) {
+				task = std::move(queues[self]->tasks.front());
+				queues[self]->tasks.pop_front();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+
+		// ...then everyone else's, newest first.
+		for (size_t i = 1; i < queues.size(); ++i) {
+			auto& victim = *queues[(self + i) % queues.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.back());
+				victim.tasks.pop_back();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void WorkStealingPool::run(size_t self)
+	{
+		std::function<void()> task;
+
+		for (;;) {
+			if (queued.load() && take(self, task)) {
+				bool skip = false;
+
+				{
+					std::lock_guard<std::mutex> guard(stateLock);
+					skip = !!error;
+				}
+
+				if (!skip) {
+					try {
+						task();
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> guard(stateLock);
+						if (!error)
+							error = std::current_exception();
+					}
+				}
+				task = nullptr;
+
+				std::lock_guard<std::mutex> guard(stateLock);
+				if (0 == --outstanding)
+					idle.notify_all();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> guard(stateLock);
+			wake.wait(guard, [this] { return stopping || queued.load() > 0; });
+			if (stopping && 0 == queued.load())
+				return;
+		}
+	}
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ntfs {
+
+	/**
+	* A fixed size thread pool where every worker owns a queue. Tasks are dealt out round-robin;
+	* a worker runs its own tasks oldest first, and when it runs dry it steals the newest task from
+	* another worker's queue. Submitting work in ascending order therefore keeps completion roughly
+	* in ascending order too, which keeps ordered result merges from buffering much.
+	*/
+	class WorkStealingPool {
+	public:
+		/**
+		* @param threads The number of workers to start; 0 uses one per hardware thread.
+		*/
+		WorkStealingPool(size_t threads = 0);
+		~WorkStealingPool();
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		/**
+		* Queues a task. If a previously run task has thrown, the task is discarded instead.
+		*/
+		void submit(std::function<void()> task);
+
+		/**
+		* Blocks until every submitted task has finished.
+		*
+		* @throws the first exception thrown by a task since the last call to wait()
+		*/
+		void wait();
+
+		/**
+		* Returns the number of worker threads in the pool.
+		*/
+		size_t threadCount() const;
+
+	private:
+		struct Queue {
+			std::mutex							lock;
+			std::deque<std::function<void()>>	tasks;
+		};
+
+		void run(size_t self);
+		bool take(size_t self, std::function<void()>& task);
+
+		std::vector<std::unique_ptr<Queue>>	queues;
+		std::vector<std::thread>			workers;
+		std::mutex							stateLock;
+		std::condition_variable				wake;
+		std::condition_variable				idle;
+		std::atomic<size_t>					queued;
+		size_t								outstanding;
+		size_t								nextQueue;
+		bool								stopping;
+		std::exception_ptr					error;
+	};
+
+}
@@ -0,0 +1,379 @@
+#include "TrigramIndex.hpp"
+#include <algorithm>
+#include <cwctype>
+
+namespace {
+	inline uint64_t trigram_key(WCHAR a, WCHAR b, WCHAR c)
+	{
+		return (static_cast<uint64_t>(static_cast<uint16_t>(a)) << 32) | (static_cast<uint64_t>(static_cast<uint16_t>(b)) << 16) | static_cast<uint16_t>(c);
+	}
+
+	// Trigrams of 7-bit characters (i.e., most of them) are numbered through a flat table rather than a hash
+	const uint64_t ascii_trigram_mask = 0xFF80FF80FF80ULL;
+
+	inline size_t ascii_slot(uint64_t key)
+	{
+		return static_cast<size_t>(((key >> 32) << 14) | (((key >> 16) & 0x7F) << 7) | (key & 0x7F));
+	}
+
+	void put_varint(std::vector<uint8_t>& out, uint32_t value)
+	{
+		while (value >= 0x80) {
+			out.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	inline uint32_t get_varint(const uint8_t*& p)
+	{
+		uint32_t	value = 0;
+		unsigned	shift = 0;
+
+		while (*p & 0x80) {
+			value |= static_cast<uint32_t>(*p++ & 0x7F) << shift;
+			shift += 7;
+		}
+		return value | (static_cast<uint32_t>(*p++) << shift);
+	}
+
+	/**
+	* Walks one compressed posting list in ascending order, using its seek points to jump over the parts
+	* that can't hold what is being looked for.
+	*/
+	template <typename SeekPoint>
+	class PostingCursor {
+	public:
+		PostingCursor(const uint8_t* start, const SeekPoint* seeks, uint32_t count) : start(start), p(start), seeks(seeks), seekCount(count / ntfs::trigram_skip_interval), count(count), pos(0), row(0)
+		{
+		}
+
+		// Decodes the whole list into out
+		void decode(std::vector<uint32_t>& out)
+		{
+			out.reserve(out.size() + count);
+			while (pos < count)
+				out.push_back(next());
+		}
+
+		// Whether target is in the list; targets must be asked about in ascending order
+		bool seek(uint32_t target)
+		{
+			if (pos && row >= target)
+				return row == target;
+
+			// The last seek point before target, if that is further on than we are
+			auto it = std::lower_bound(seeks, seeks + seekCount, target, [](const SeekPoint& s, uint32_t t) { return s.row < t; });
+			if (it != seeks) {
+				uint32_t block = static_cast<uint32_t>(it - seeks);
+
+				if (block * ntfs::trigram_skip_interval > pos) {
+					pos = block * ntfs::trigram_skip_interval;
+					row = (it - 1)->row;
+					p = start + (it - 1)->offset;
+				}
+			}
+
+			while (pos < count) {
+				if (next() >= target)
+					return row == target;
+			}
+			return false;
+		}
+
+	private:
+		uint32_t next()
+		{
+			uint32_t delta = get_varint(p);
+
+			row = pos++ ? row + delta : delta;
+			return row;
+		}
+
+		const uint8_t*		start;
+		const uint8_t*		p;
+		const SeekPoint*	seeks;
+		uint32_t			seekCount;
+		uint32_t			count;
+		uint32_t			pos;		// of the next posting to decode
+		uint32_t			row;		// the last posting decoded
+	};
+}
+
+namespace ntfs {
+
+	std::vector<WCHAR> default_upcase_table()
+	{
+		std::vector<WCHAR> table(0x10000);
+
+		for (size_t c = 0; c < table.size(); ++c)
+			table[c] = static_cast<WCHAR>(std::towupper(static_cast<wint_t>(c)));
+
+		return table;
+	}
+
+	TrigramIndex::TrigramIndex(const FileIndex& index) : index(index), upcase(default_upcase_table()), compressedCount(0), pendingCount(0)
+	{
+	}
+
+	void TrigramIndex::setUpcaseTable(std::vector<WCHAR> table)
+	{
+		if (table.size() != 0x10000)
+			throw TRIGRAM_INDEX_ERROR("Upcase table must map every UTF-16 code unit!", ERROR_INVALID_PARAMETER);
+
+		upcase.swap(table);
+
+		terms.clear();
+		postings.clear();
+		skips.clear();
+		signatures.clear();
+		added.clear();
+		compressedCount = 0;
+		pendingCount = 0;
+	}
+
+	void TrigramIndex::build()
+	{
+		struct List {
+			std::vector<uint8_t>	bytes;
+			std::vector<SeekPoint>	seeks;
+			uint64_t				key;
+			uint32_t				count;
+			uint32_t				last;
+		};
+
+		std::vector<uint32_t>					asciiIds(1 << 21, UINT32_MAX);
+		std::unordered_map<uint64_t, uint32_t>	otherIds;
+		std::vector<List>						lists;
+		std::vector<uint64_t>					keys;
+		uint64_t								rows = std::min<uint64_t>(index.size(), UINT32_MAX);
+
+		terms.clear();
+		postings.clear();
+		skips.clear();
+		added.clear();
+		compressedCount = 0;
+		pendingCount = 0;
+		signatures.assign(static_cast<size_t>(rows), 0);
+
+		// Rows are visited in order, so every list comes out sorted without any sorting
+		for (uint64_t row = 0; row < rows; ++row) {
+			fold(row, keys);
+			if (keys.empty())
+				continue;
+
+			signatures[static_cast<size_t>(row)] = signature(row);
+
+			for (auto key : keys) {
+				uint32_t* id = nullptr;
+
+				if (!(key & ascii_trigram_mask))
+					id = &asciiIds[ascii_slot(key)];
+				else
+					id = &otherIds.emplace(key, UINT32_MAX).first->second;
+
+				if (UINT32_MAX == *id) {
+					*id = static_cast<uint32_t>(lists.size());
+					lists.emplace_back();
+					lists.back().key = key;
+					lists.back().count = 0;
+					lists.back().last = 0;
+				}
+
+				List& list = lists[*id];
+
+				put_varint(list.bytes, list.count ? static_cast<uint32_t>(row) - list.last : static_cast<uint32_t>(row));
+				list.last = static_cast<uint32_t>(row);
+
+				if (0 == (++list.count % trigram_skip_interval))
+					list.seeks.push_back({ list.last, static_cast<uint32_t>(list.bytes.size()) });
+			}
+		}
+
+		std::sort(lists.begin(), lists.end(), [](const List& a, const List& b) { return a.key < b.key; });
+
+		terms.reserve(lists.size());
+		for (auto& list : lists) {
+			terms.push_back({ list.key, postings.size(), list.count, static_cast<uint32_t>(skips.size()) });
+			postings.insert(postings.end(), list.bytes.begin(), list.bytes.end());
+			skips.insert(skips.end(), list.seeks.begin(), list.seeks.end());
+			compressedCount += list.count;
+
+			// Let go of each list as soon as it has been copied, so the peak stays near the final size
+			std::vector<uint8_t>().swap(list.bytes);
+			std::vector<SeekPoint>().swap(list.seeks);
+		}
+
+		postings.shrink_to_fit();
+		skips.shrink_to_fit();
+	}
+
+	void TrigramIndex::update(uint64_t recNum)
+	{
+		std::vector<uint64_t> keys;
+
+		// A removed file's postings are left in place; they'll be weeded out by whoever checks the candidates
+		if (recNum >= UINT32_MAX || !index.contains(recNum) || !(index.flags(recNum) & IndexNamed))
+			return;
+
+		if (recNum >= signatures.size())
+			signatures.resize(static_cast<size_t>(recNum + 1), 0);
+
+		uint64_t sig = signature(recNum);
+		if (sig == signatures[static_cast<size_t>(recNum)])
+			return;
+
+		signatures[static_cast<size_t>(recNum)] = sig;
+
+		fold(recNum, keys);
+		for (auto key : keys)
+			added[key].push_back(static_cast<uint32_t>(recNum));
+
+		pendingCount += keys.size();
+		if (pendingCount > std::max(trigram_min_pending, compressedCount / 8))
+			build();
+	}
+
+	bool TrigramIndex::candidates(const std::vector<std::basic_string<WCHAR>>& literals, std::vector<uint32_t>& rows) const
+	{
+		struct Source {
+			const Term*						term;
+			const std::vector<uint32_t>*	extra;
+			uint64_t						count;
+		};
+
+		std::vector<uint64_t>	keys;
+		std::vector<Source>		sources;
+		std::vector<uint32_t>	extra;
+
+		rows.clear();
+
+		for (auto& literal : literals) {
+			for (size_t i = 2; i < literal.size(); ++i)
+				keys.push_back(trigram_key(upcase[static_cast<uint16_t>(literal[i - 2])], upcase[static_cast<uint16_t>(literal[i - 1])], upcase[static_cast<uint16_t>(literal[i])]));
+		}
+
+		if (keys.empty())
+			return false;
+
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		for (auto key : keys) {
+			auto	term = lookup(key);
+			auto	it = added.find(key);
+			auto	more = (it != added.end()) ? &it->second : nullptr;
+
+			// Nothing has this trigram, so nothing can match
+			if (!term && !more)
+				return true;
+
+			sources.push_back({ term, more, (term ? term->count : 0) + (more ? more->size() : 0) });
+		}
+
+		// Start from the rarest trigram; every other one can only take candidates away
+		std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.count < b.count; });
+
+		for (size_t i = 0; i < sources.size(); ++i) {
+			auto& src = sources[i];
+
+			extra.clear();
+			if (src.extra) {
+				extra = *src.extra;
+				std::sort(extra.begin(), extra.end());
+			}
+
+			if (0 == i) {
+				if (src.term)
+					PostingCursor<SeekPoint>(postings.data() + src.term->offset, skips.data() + src.term->skip, src.term->count).decode(rows);
+
+				size_t middle = rows.size();
+				rows.insert(rows.end(), extra.begin(), extra.end());
+				std::inplace_merge(rows.begin(), rows.begin() + middle, rows.end());
+				rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+				continue;
+			}
+
+			PostingCursor<SeekPoint>	cursor(src.term ? postings.data() + src.term->offset : nullptr, src.term ? skips.data() + src.term->skip : nullptr, src.term ? src.term->count : 0);
+			size_t						kept = 0;
+
+			for (auto row : rows) {
+				if (cursor.seek(row) || std::binary_search(extra.begin(), extra.end(), row))
+					rows[kept++] = row;
+			}
+
+			rows.resize(kept);
+			if (rows.empty())
+				break;
+		}
+
+		return true;
+	}
+
+	size_t TrigramIndex::trigramCount() const
+	{
+		return terms.size();
+	}
+
+	uint64_t TrigramIndex::memoryUsage() const
+	{
+		uint64_t bytes = upcase.capacity() * sizeof(WCHAR) + terms.capacity() * sizeof(Term) + postings.capacity() + skips.capacity() * sizeof(SeekPoint) + signatures.capacity() * sizeof(uint64_t);
+
+		bytes += added.bucket_count() * sizeof(void*);
+		for (auto& entry : added)
+			bytes += sizeof(entry) + entry.second.capacity() * sizeof(uint32_t);
+
+		return bytes;
+	}
+
+	const TrigramIndex::Term* TrigramIndex::lookup(uint64_t key) const
+	{
+		auto it = std::lower_bound(terms.begin(), terms.end(), key, [](const Term& t, uint64_t k) { return t.key < k; });
+
+		return (it != terms.end() && it->key == key) ? &*it : nullptr;
+	}
+
+	void TrigramIndex::fold(uint64_t row, std::vector<uint64_t>& keys) const
+	{
+		uint8_t f = index.flagColumn()[static_cast<size_t>(row)];
+
+		keys.clear();
+		if (!(f & IndexPresent) || !(f & IndexNamed))
+			return;
+
+		size_t			len = index.nameLengthColumn()[static_cast<size_t>(row)];
+		const WCHAR*	name = index.namePool().data() + index.nameOffsetColumn()[static_cast<size_t>(row)];
+
+		if (len < 3)
+			return;
+
+		WCHAR a = upcase[static_cast<uint16_t>(name[0])];
+		WCHAR b = upcase[static_cast<uint16_t>(name[1])];
+		for (size_t i = 2; i < len; ++i) {
+			WCHAR c = upcase[static_cast<uint16_t>(name[i])];
+
+			keys.push_back(trigram_key(a, b, c));
+			a = b;
+			b = c;
+		}
+
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	}
+
+	uint64_t TrigramIndex::signature(uint64_t row) const
+	{
+		size_t			len = index.nameLengthColumn()[static_cast<size_t>(row)];
+		const WCHAR*	name = index.namePool().data() + index.nameOffsetColumn()[static_cast<size_t>(row)];
+		uint64_t		hash = 0xCBF29CE484222325ULL;
+
+		// FNV-1a over the folded name; 0 is kept for records that have never been indexed
+		for (size_t i = 0; i < len; ++i) {
+			hash ^= static_cast<uint16_t>(upcase[static_cast<uint16_t>(name[i])]);
+			hash *= 0x100000001B3ULL;
+		}
+
+		return hash | 1;
+	}
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "ntfs_defs.h"
+#include "FileIndex.hpp"
+
+#define TRIGRAM_INDEX_ERROR(msg, err)\
+	std::runtime_error(("[TrigramIndex] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+namespace ntfs {
+
+	// A seek point is kept for every this many postings, so long lists can be skipped through
+	constexpr uint32_t trigram_skip_interval = 128;
+
+	// Updates are folded into the compressed lists (by rebuilding them) once there are this many, or
+	// one for every eight compressed postings, whichever is more
+	constexpr size_t trigram_min_pending = 64 * 1024;
+
+	/**
+	* Returns an upcase table built from the C library's idea of case, for use until (or instead of) the
+	* volume's own $UpCase.
+	*/
+	std::vector<WCHAR> default_upcase_table();
+
+	/**
+	* An inverted index from every run of three (case folded) characters in a FileIndex's names to the
+	* records whose names contain it, so that substring searches only need to look at the few records
+	* that contain every trigram of the pattern, instead of at every name on the volume.
+	*
+	* Each posting list is a sorted run of record numbers, stored as variable length deltas, with a seek
+	* point every trigram_skip_interval postings so that intersecting a short list with a long one only
+	* decodes the parts of the long list that matter. Lists are only ever added to: when a file's name
+	* changes, the trigrams of its new name are appended to uncompressed side lists, and its old name's
+	* postings are left behind. Candidates are therefore a superset of the matches, and callers must check
+	* each against the name the FileIndex holds now (FileSearch does this).
+	*
+	* The index reads names from the FileIndex, which must outlive it. It doesn't notice changes to the
+	* FileIndex on its own; update() must be called for each record that changes (IndexUpdater does this).
+	*/
+	class TrigramIndex {
+	public:
+		/**
+		* Creates an empty index; see build().
+		*
+		* @param index The index whose names are to be indexed
+		*/
+		TrigramIndex(const FileIndex& index);
+
+		/**
+		* Replaces the table used to fold case (e.g., with the volume's $UpCase), and empties the index,
+		* since the existing postings were folded with the old table.
+		*
+		* @throws std::runtime_error if the table doesn't map all 65536 UTF-16 code units
+		* @param table table[c] is the uppercase form of c
+		*/
+		void setUpcaseTable(std::vector<WCHAR> table);
+
+		/**
+		* Returns the table names are folded with.
+		*/
+		const std::vector<WCHAR>& upcaseTable() const { return upcase; }
+
+		/**
+		* (Re)builds the index from every named record in the FileIndex.
+		*/
+		void build();
+
+		/**
+		* Indexes the current name of a record, if it has changed since the record was last indexed.
+		*
+		* @param recNum The record number of a record the FileIndex has just added, refreshed or removed
+		*/
+		void update(uint64_t recNum);
+
+		/**
+		* Finds the records whose names may contain all of the given literals (in any case).
+		*
+		* @param literals The strings every match must contain; ones shorter than three characters are ignored
+		* @param rows Receives the candidate record numbers, in ascending order
+		* @return false if none of the literals are long enough to narrow the search (rows is left empty)
+		*/
+		bool candidates(const std::vector<std::basic_string<WCHAR>>& literals, std::vector<uint32_t>& rows) const;
+
+		/**
+		* Returns the number of distinct trigrams indexed.
+		*/
+		size_t trigramCount() const;
+
+		/**
+		* Returns the number of postings awaiting the next build().
+		*/
+		size_t pending() const { return pendingCount; }
+
+		/**
+		* Returns the number of heap bytes used by the index.
+		*/
+		uint64_t memoryUsage() const;
+
+	private:
+		struct Term {
+			uint64_t	key;
+			uint64_t	offset;		// of the term's first posting in postings
+			uint32_t	count;
+			uint32_t	skip;		// of the term's first seek point in skips
+		};
+
+		struct SeekPoint {
+			uint32_t	row;		// the last record number before the point
+			uint32_t	offset;		// of the posting after row, relative to the term's first posting
+		};
+
+		const Term* lookup(uint64_t key) const;
+		void fold(uint64_t row, std::vector<uint64_t>& keys) const;
+		uint64_t signature(uint64_t row) const;
+
+		const FileIndex&									index;
+		std::vector<WCHAR>									upcase;
+		std::vector<Term>									terms;
+		std::vector<uint8_t>								postings;
+		std::vector<SeekPoint>								skips;
+		std::vector<uint64_t>								signatures;		// of the name each record was last indexed under
+		std::unordered_map<uint64_t, std::vector<uint32_t>>	added;
+		size_t												compressedCount;
+		size_t												pendingCount;
+	};
+
+}
@@ -0,0 +1,87 @@
+#include "UsnCursor.hpp"
+#include <cstring>
+#include <utility>
+
+namespace ntfs {
+
+	UsnBufferPool::UsnBufferPool(size_t bufferSize, size_t count) : size(bufferSize), count(count)
+	{
+	}
+
+	std::vector<uint8_t> UsnBufferPool::acquire()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			if (!idle.empty()) {
+				auto buf = std::move(idle.back());
+				idle.pop_back();
+				return buf;
+			}
+		}
+
+		return std::vector<uint8_t>(size);
+	}
+
+	void UsnBufferPool::release(std::vector<uint8_t>&& buf)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (idle.size() < count && buf.size() == size)
+			idle.push_back(std::move(buf));
+	}
+
+	UsnBatch::UsnBatch(std::shared_ptr<UsnBufferPool> pool, std::vector<uint8_t>&& buf, size_t len) : pool(pool), buf(std::move(buf)), len(len)
+	{
+	}
+
+	UsnBatch::~UsnBatch()
+	{
+		release();
+	}
+
+	UsnBatch::UsnBatch(UsnBatch&& other) noexcept : pool(std::move(other.pool)), buf(std::move(other.buf)), len(other.len)
+	{
+		other.len = 0;
+	}
+
+	UsnBatch& UsnBatch::operator=(UsnBatch&& other) noexcept
+	{
+		if (this != &other) {
+			release();
+			pool = std::move(other.pool);
+			buf = std::move(other.buf);
+			len = other.len;
+			other.len = 0;
+		}
+
+		return *this;
+	}
+
+	USN UsnBatch::nextUsn() const
+	{
+		USN next = 0;
+
+		if (len >= sizeof(USN))
+			memcpy(&next, buf.data(), sizeof(next));
+
+		return next;
+	}
+
+	void UsnBatch::release()
+	{
+		if (pool && !buf.empty()) {
+			try {
+				pool->release(std::move(buf));
+			}
+			catch (...) {
+				// Losing a buffer only costs an allocation later on
+			}
+		}
+
+		pool.reset();
+		buf = std::vector<uint8_t>();
+		len = 0;
+	}
+
+}
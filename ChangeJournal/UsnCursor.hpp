@@ -0,0 +1,185 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include "ntfs_compat.h"
+#include "ChangeJournal.hpp"
+#include "NtfsJournal.hpp"
+
+namespace ntfs {
+
+	// How many idle buffers a cursor's pool holds on to for reuse
+	constexpr size_t default_cursor_buffers = 4;
+
+	/**
+	* Buffers for journal reads, handed back out once they're returned instead of being freed. Batches give
+	* their buffers back when they're destroyed, which may happen on any thread, and after the cursor is gone.
+	*/
+	class UsnBufferPool {
+	public:
+		/**
+		* @param bufferSize The size of each buffer, in bytes
+		* @param count The most idle buffers to keep; buffers returned beyond that are freed
+		*/
+		UsnBufferPool(size_t bufferSize, size_t count);
+
+		/**
+		* Returns an idle buffer of bufferSize() bytes, allocating one only if none is idle.
+		*/
+		std::vector<uint8_t> acquire();
+
+		/**
+		* Returns a buffer to the pool.
+		*/
+		void release(std::vector<uint8_t>&& buf);
+
+		size_t bufferSize() const { return size; }
+
+	private:
+		std::mutex							lock;
+		std::vector<std::vector<uint8_t>>	idle;
+		size_t								size;
+		size_t								count;
+	};
+
+	/**
+	* One read's worth of USN records, in the format ChangeJournal::getRecords returns (the next USN, followed
+	* by the records). A batch owns its buffer until it's destroyed, so it can be handed to another thread;
+	* it's movable, but not copyable.
+	*
+	*     for (auto rec : batch) { ... }
+	*/
+	class UsnBatch {
+	public:
+		UsnBatch() = default;
+		UsnBatch(std::shared_ptr<UsnBufferPool> pool, std::vector<uint8_t>&& buf, size_t len);
+		~UsnBatch();
+		UsnBatch(UsnBatch&& other) noexcept;
+		UsnBatch& operator=(UsnBatch&& other) noexcept;
+		UsnBatch(const UsnBatch&) = delete;
+		UsnBatch& operator=(const UsnBatch&) = delete;
+
+		/**
+		* Indicates whether the batch holds no records.
+		*/
+		bool empty() const { return len <= sizeof(USN); }
+
+		/**
+		* Returns the USN following the last record in the batch.
+		*/
+		USN nextUsn() const;
+
+		/**
+		* Returns the batch as read, starting with the next USN; size() bytes long.
+		*/
+		const uint8_t* data() const { return buf.data(); }
+		size_t size() const { return len; }
+
+		UsnRecordIterator begin() { return empty() ? UsnRecordIterator() : UsnRecordRange(buf.data(), len).begin(); }
+		UsnRecordIterator end() { return UsnRecordIterator(); }
+
+	private:
+		void release();
+
+		std::shared_ptr<UsnBufferPool>	pool;
+		std::vector<uint8_t>			buf;
+		size_t							len = 0;
+	};
+
+	/**
+	* Walks a change journal (a ChangeJournal, or an NtfsJournal) one large batch at a time. The journal is
+	* queried once, when the cursor is created, and every read after that goes straight to the records, into
+	* a buffer taken from the cursor's pool. Once the caller is done with a batch, its buffer is reused for a
+	* later one, so a walk that keeps a few batches alive at once allocates a few buffers, and no more.
+	*
+	* The cursor itself is meant to be driven by a single thread; batches may be released from any thread.
+	*/
+	template <typename Journal>
+	class UsnCursor {
+	public:
+		/**
+		* Queries the journal, and starts at its first record.
+		*
+		* @throws std::runtime_error if the journal can't be queried
+		* @param journal The journal to read; must outlive the cursor
+		* @param bufferSize The size of each buffer, in bytes; one read fills at most one buffer
+		* @param buffers The most idle buffers to keep around for reuse
+		*/
+		UsnCursor(Journal& journal, size_t bufferSize = default_batch_size, size_t buffers = default_cursor_buffers)
+			: journal(journal), pool(std::make_shared<UsnBufferPool>(std::max<size_t>(bufferSize, default_buffer_size), buffers))
+		{
+			data = *journal.getJournalData();
+			position = data.FirstUsn;
+		}
+
+		/**
+		* Returns the journal's data, as of when the cursor was created.
+		*/
+		const USN_JOURNAL_DATA& journalData() const { return data; }
+
+		/**
+		* Returns the ID of the journal being read.
+		*/
+		DWORDLONG journalId() const { return data.UsnJournalID; }
+
+		/**
+		* Returns the USN the next read begins at.
+		*/
+		USN tell() const { return position; }
+
+		/**
+		* Moves the USN the next read begins at, e.g., to a checkpoint.
+		*/
+		void seek(USN usn) { position = usn; }
+
+		/**
+		* Reads the next batch of records, and advances past them. An empty batch means the cursor has caught
+		* up with the journal; on a live volume, later reads may turn up new records.
+		*
+		* @throws std::runtime_error if the journal can't be read (e.g., it was deleted or recreated)
+		* @return the records read
+		*/
+		UsnBatch read()
+		{
+			auto	buf = pool->acquire();
+			size_t	len = journal.readRecords(position, data.UsnJournalID, buf.data(), buf.size());
+
+			return UsnBatch(pool, std::move(buf), len);
+		}
+
+	private:
+		Journal&						journal;
+		std::shared_ptr<UsnBufferPool>	pool;
+		USN_JOURNAL_DATA				data;
+		USN								position = 0;
+	};
+
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+#include "ntfs_compat.h"
+
+#define USN_RECORD_ERROR(msg, err)\
+	std::runtime_error(("[UsnRecord] "  msg + std::to_string(__LINE__) + " " + std::to_string(err)))
+
+// Records are visited by the million, so everything in here is a template or inline; the version is looked at
+// once per record (or once per run of records of the same version), rather than once per field.
+namespace ntfs {
+
+	/**
+	* A 128 bit file ID, as V3 and V4 records carry them. V2 records' 64 bit file reference numbers become
+	* the low half. On NTFS, the high half is always zero.
+	*/
+	struct UsnFileId {
+		uint64_t	low = 0;
+		uint64_t	high = 0;
+
+		bool operator==(const UsnFileId& other) const { return low == other.low && high == other.high; }
+		bool operator!=(const UsnFileId& other) const { return !(*this == other); }
+	};
+
+	inline UsnFileId usn_file_id(DWORDLONG frn)
+	{
+		UsnFileId id;
+
+		id.low = frn;
+		return id;
+	}
+
+	inline UsnFileId usn_file_id(const FILE_ID_128& frn)
+	{
+		UsnFileId id;
+
+		memcpy(&id.low, frn.Identifier, sizeof(id.low));
+		memcpy(&id.high, frn.Identifier + sizeof(id.low), sizeof(id.high));
+		return id;
+	}
+
+	/**
+	* The fields V2 and V3 records share; the two only differ in the width of their file IDs.
+	*/
+	template <typename Record>
+	class UsnNamedRecordView {
+	public:
+		typedef Record record_type;
+
+		// Whether records of this version carry a name, a time stamp, a security ID and attributes
+		enum : bool { has_name = true };
+
+		explicit UsnNamedRecordView(const void* rec) : rec(static_cast<const Record*>(rec)) {}
+
+		/**
+		* Indicates whether len bytes at rec hold a whole record of this version, name included.
+		*/
+		static bool valid(const void* rec, size_t len)
+		{
+			auto r = static_cast<const Record*>(rec);
+
+			if (len < offsetof(Record, FileName) || r->RecordLength < offsetof(Record, FileName) || r->RecordLength > len)
+				return false;
+
+			return r->FileNameOffset >= offsetof(Record, FileName) && static_cast<size_t>(r->FileNameOffset) + r->FileNameLength <= r->RecordLength;
+		}
+
+		const Record* record() const { return rec; }
+		DWORD length() const { return rec->RecordLength; }
+		USN usn() const { return rec->Usn; }
+		LONGLONG timeStamp() const { return rec->TimeStamp.QuadPart; }
+		DWORD reason() const { return rec->Reason; }
+		DWORD sourceInfo() const { return rec->SourceInfo; }
+		DWORD securityId() const { return rec->SecurityId; }
+		DWORD fileAttributes() const { return rec->FileAttributes; }
+		UsnFileId fileId() const { return usn_file_id(rec->FileReferenceNumber); }
+		UsnFileId parentId() const { return usn_file_id(rec->ParentFileReferenceNumber); }
+		uint64_t fileReference() const { return fileId().low; }
+		uint64_t parentReference() const { return parentId().low; }
+
+		/**
+		* Returns the file's name, which is not NUL terminated; nameLength() characters long.
+		*/
+		const WCHAR* name() const { return reinterpret_cast<const WCHAR*>(reinterpret_cast<const uint8_t*>(rec) + rec->FileNameOffset); }
+		size_t nameLength() const { return rec->FileNameLength / sizeof(WCHAR); }
+
+		// Only range tracking (V4) records have extents
+		size_t extentCount() const { return 0; }
+		USN_RECORD_EXTENT extent(size_t) const { return USN_RECORD_EXTENT(); }
+
+	protected:
+		const Record* rec;
+	};
+
+	/**
+	* A typed view of a USN record of a given major version. Every version has the same interface, so that
+	* a generic lambda handed to visit_usn_record can take any of them; what a version doesn't record reads
+	* as zero (or, for names, as empty), and has_name tells which kind of record it is.
+	*/
+	template <WORD Version>
+	class UsnRecordView;
+
+	template <>
+	class UsnRecordView<2> : public UsnNamedRecordView<USN_RECORD_V2> {
+	public:
+		enum : WORD { version = 2 };
+
+		explicit UsnRecordView(const void* rec) : UsnNamedRecordView<USN_RECORD_V2>(rec) {}
+	};
+
+	template <>
+	class UsnRecordView<3> : public UsnNamedRecordView<USN_RECORD_V3> {
+	public:
+		enum : WORD { version = 3 };
+
+		explicit UsnRecordView(const void* rec) : UsnNamedRecordView<USN_RECORD_V3>(rec) {}
+	};
+
+	/**
+	* Range tracking records, which say which ranges of a file were written, rather than naming the file.
+	*/
+	template <>
+	class UsnRecordView<4> {
+	public:
+		typedef USN_RECORD_V4 record_type;
+
+		enum : WORD { version = 4 };
+		enum : bool { has_name = false };
+
+		explicit UsnRecordView(const void* rec) : rec(static_cast<const USN_RECORD_V4*>(rec)) {}
+
+		/**
+		* Indicates whether len bytes at rec hold a whole V4 record, extents included.
+		*/
+		static bool valid(const void* rec, size_t len)
+		{
+			auto r = static_cast<const USN_RECORD_V4*>(rec);
+
+			if (len < offsetof(USN_RECORD_V4, Extents) || r->Header.RecordLength < offsetof(USN_RECORD_V4, Extents) || r->Header.RecordLength > len)
+				return false;
+
+			return !r->NumberOfExtents || (r->ExtentSize >= sizeof(USN_RECORD_EXTENT) && offsetof(USN_RECORD_V4, Extents) + static_cast<size_t>(r->NumberOfExtents) * r->ExtentSize <= r->Header.RecordLength);
+		}
+
+		const USN_RECORD_V4* record() const { return rec; }
+		DWORD length() const { return rec->Header.RecordLength; }
+		USN usn() const { return rec->Usn; }
+		LONGLONG timeStamp() const { return 0; }
+		DWORD reason() const { return rec->Reason; }
+		DWORD sourceInfo() const { return rec->SourceInfo; }
+		DWORD securityId() const { return 0; }
+		DWORD fileAttributes() const { return 0; }
+		UsnFileId fileId() const { return usn_file_id(rec->FileReferenceNumber); }
+		UsnFileId parentId() const { return usn_file_id(rec->ParentFileReferenceNumber); }
+		uint64_t fileReference() const { return fileId().low; }
+		uint64_t parentReference() const { return parentId().low; }
+		const WCHAR* name() const { return nullptr; }
+		size_t nameLength() const { return 0; }
+
+		/**
+		* Returns the number of extents in this record; a change with more extents than fit in one record is
+		* split across several, and remainingExtents() says how many more follow.
+		*/
+		size_t extentCount() const { return rec->NumberOfExtents; }
+		DWORD remainingExtents() const { return rec->RemainingExtents; }
+
+		/**
+		* Returns the i'th extent (the offset and length of a range of the file that was written).
+		*/
+		USN_RECORD_EXTENT extent(size_t i) const
+		{
+			USN_RECORD_EXTENT e;
+
+			memcpy(&e, reinterpret_cast<const uint8_t*>(rec->Extents) + i * rec->ExtentSize, sizeof(e));
+			return e;
+		}
+
+	private:
+		const USN_RECORD_V4* rec;
+	};
+
+	/**
+	* Hands func a typed view of a single record. The record must already be known to fit its buffer, as
+	* records handed out by UsnRecordIterator are; records of other versions are passed over.
+	*
+	* @param rec The record
+	* @param func Called as func(UsnRecordView<N>), where N is the record's major version
+	* @return false if the record's version isn't one there's a view for
+	*/
+	template <typename Func>
+	bool visit_usn_record(const void* rec, Func&& func)
+	{
+		switch (static_cast<const USN_RECORD_COMMON_HEADER*>(rec)->MajorVersion) {
+		case 2:
+			func(UsnRecordView<2>(rec));
+			return true;
+		case 3:
+			func(UsnRecordView<3>(rec));
+			return true;
+		case 4:
+			func(UsnRecordView<4>(rec));
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/**
+	* Visits records from pos onward for as long as they're of the given version. Used by visit_usn_batch.
+	*
+	* @throws std::runtime_error if a record doesn't fit the buffer
+	* @return where the run ended: end, or the first record of another version
+	*/
+	template <WORD Version, typename Func>
+	const uint8_t* visit_usn_run(const uint8_t* pos, const uint8_t* end, Func& func)
+	{
+		typedef UsnRecordView<Version> View;
+
+		while (pos < end) {
+			auto header = reinterpret_cast<const USN_RECORD_COMMON_HEADER*>(pos);
+
+			if (static_cast<size_t>(end - pos) < sizeof(USN_RECORD_COMMON_HEADER))
+				throw USN_RECORD_ERROR("Malformed USN record encountered!", ERROR_INVALID_DATA);
+
+			if (Version != header->MajorVersion)
+				break;
+
+			if (!View::valid(pos, static_cast<size_t>(end - pos)))
+				throw USN_RECORD_ERROR("Malformed USN record encountered!", ERROR_INVALID_DATA);
+
+			func(View(pos));
+			pos += header->RecordLength;
+		}
+
+		return pos;
+	}
+
+	/**
+	* Hands func a typed view of each record in a buffer returned by getRecords or readRecords (i.e., the
+	* records following the leading USN). The version is only looked at when it changes, so a batch of
+	* records of one version goes through a single loop specialized for it. Records of versions there's
+	* no view for are passed over.
+	*
+	* @throws std::runtime_error if a record doesn't fit the buffer
+	* @param buf The buffer, starting with the next USN
+	* @param len The number of valid bytes in buf
+	* @param func Called as func(UsnRecordView<N>) for each record, where N is the record's major version
+	*/
+	template <typename Func>
+	void visit_usn_batch(const uint8_t* buf, size_t len, Func&& func)
+	{
+		const uint8_t*	pos = buf + std::min(len, sizeof(USN));
+		const uint8_t*	end = buf + len;
+
+		while (pos < end) {
+			auto header = reinterpret_cast<const USN_RECORD_COMMON_HEADER*>(pos);
+
+			if (static_cast<size_t>(end - pos) < sizeof(USN_RECORD_COMMON_HEADER))
+				throw USN_RECORD_ERROR("Malformed USN record encountered!", ERROR_INVALID_DATA);
+
+			switch (header->MajorVersion) {
+			case 2:
+				pos = visit_usn_run<2>(pos, end, func);
+				break;
+			case 3:
+				pos = visit_usn_run<3>(pos, end, func);
+				break;
+			case 4:
+				pos = visit_usn_run<4>(pos, end, func);
+				break;
+			default:
+				if (header->RecordLength < sizeof(USN_RECORD_COMMON_HEADER) || header->RecordLength > static_cast<size_t>(end - pos))
+					throw USN_RECORD_ERROR("Malformed USN record encountered!", ERROR_INVALID_DATA);
+
+				pos += header->RecordLength;
+				break;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,282 @@
+#include "VolumeBitmap.hpp"
+#include "DataStream.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NTFS_BITMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	constexpr uint64_t all_used = ~uint64_t(0);
+
+	inline unsigned lowest_bit(uint64_t word)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+#ifdef _M_X64
+		_BitScanForward64(&bit, word);
+#else
+		if (!_BitScanForward(&bit, static_cast<unsigned long>(word))) {
+			_BitScanForward(&bit, static_cast<unsigned long>(word >> 32));
+			bit += 32;
+		}
+#endif
+		return static_cast<unsigned>(bit);
+#else
+		return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+	}
+
+	inline unsigned highest_bit(uint64_t word)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+#ifdef _M_X64
+		_BitScanReverse64(&bit, word);
+#else
+		if (_BitScanReverse(&bit, static_cast<unsigned long>(word >> 32)))
+			bit += 32;
+		else
+			_BitScanReverse(&bit, static_cast<unsigned long>(word));
+#endif
+		return static_cast<unsigned>(bit);
+#else
+		return static_cast<unsigned>(63 - __builtin_clzll(word));
+#endif
+	}
+
+	inline unsigned bit_count(uint64_t word)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return static_cast<unsigned>(__popcnt64(word));
+#elif defined(_MSC_VER)
+		return static_cast<unsigned>(__popcnt(static_cast<unsigned>(word)) + __popcnt(static_cast<unsigned>(word >> 32)));
+#else
+		return static_cast<unsigned>(__builtin_popcountll(word));
+#endif
+	}
+
+	// How many of the next words (up to count) are all equal to fill, checked 64 bytes at a time
+	inline size_t uniform_words(const uint64_t* words, size_t count, uint64_t fill)
+	{
+		size_t i = 0;
+
+#ifdef NTFS_BITMAP_SSE2
+		const __m128i pattern = _mm_set1_epi32(static_cast<int>(fill));
+
+		for (; i + 8 <= count; i += 8) {
+			const __m128i* p = reinterpret_cast<const __m128i*>(words + i);
+			__m128i a = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p), pattern), _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), pattern));
+			__m128i b = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), pattern), _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), pattern));
+
+			if (0xFFFF != _mm_movemask_epi8(_mm_and_si128(a, b)))
+				break;
+		}
+#endif
+
+		while (i < count && words[i] == fill)
+			++i;
+
+		return i;
+	}
+}
+
+namespace ntfs {
+
+	FreeSpaceScanner::FreeSpaceScanner(uint64_t totalClusters, size_t regions)
+	{
+		regions = std::max<size_t>(1, regions);
+
+		stats.totalClusters = totalClusters;
+		stats.extentCounts.resize(free_extent_buckets);
+		stats.extentClusters.resize(free_extent_buckets);
+
+		// Regions are whole words, so a word's clusters are always counted toward a single region
+		stats.regionClusters = std::max<uint64_t>(64, (((totalClusters + regions - 1) / regions) + 63) & ~uint64_t(63));
+		stats.regionUsed.resize(static_cast<size_t>((totalClusters + stats.regionClusters - 1) / stats.regionClusters));
+	}
+
+	void FreeSpaceScanner::feed(const uint8_t* data, size_t len)
+	{
+		// Top up a partial word left over from the last piece first
+		if (carried) {
+			size_t n = std::min(len, sizeof(carry) - carried);
+			memcpy(carry + carried, data, n);
+			carried += n;
+			data += n;
+			len -= n;
+
+			if (carried < sizeof(carry))
+				return;
+
+			uint64_t word;
+			memcpy(&word, carry, sizeof(word));
+			scanWords(&word, 1);
+			carried = 0;
+		}
+
+		size_t whole = len / sizeof(uint64_t);
+
+		// Bit n of the bitmap is bit n % 8 of byte n / 8, which is bit n % 64 of a little endian word
+		if (0 == reinterpret_cast<uintptr_t>(data) % alignof(uint64_t)) {
+			scanWords(reinterpret_cast<const uint64_t*>(data), whole);
+		}
+		else {
+			uint64_t buf[512];
+			for (size_t done = 0; done < whole;) {
+				size_t n = std::min(whole - done, sizeof(buf) / sizeof(buf[0]));
+				memcpy(buf, data + (done * sizeof(uint64_t)), n * sizeof(uint64_t));
+				scanWords(buf, n);
+				done += n;
+			}
+		}
+
+		carried = len % sizeof(uint64_t);
+		memcpy(carry, data + (whole * sizeof(uint64_t)), carried);
+	}
+
+	FreeSpaceStats FreeSpaceScanner::finish()
+	{
+		if (carried) {
+			uint64_t word = all_used;
+			memcpy(&word, carry, carried);
+			carried = 0;
+			scanWords(&word, 1);
+		}
+
+		// Whatever the bitmap didn't reach is in use, as far as anyone can tell
+		if (position < stats.totalClusters) {
+			endRun(position);
+			for (uint64_t base = position; base < stats.totalClusters; base += 64)
+				addUsed(all_used, base);
+			position = stats.totalClusters;
+		}
+
+		endRun(stats.totalClusters);
+
+		// Clusters past the end were counted as in use along with the rest of the last word
+		if (stats.totalClusters % 64 && !stats.regionUsed.empty())
+			stats.regionUsed.back() -= 64 - (stats.totalClusters % 64);
+
+		stats.freeClusters = stats.totalClusters;
+		for (auto used : stats.regionUsed)
+			stats.freeClusters -= used;
+
+		return stats;
+	}
+
+	void FreeSpaceScanner::scanWords(const uint64_t* words, size_t count)
+	{
+		while (count && position < stats.totalClusters) {
+			uint64_t wordsLeft = ((stats.totalClusters - position) + 63) / 64;
+
+			// The last word may run past the end of the volume; those bits count as in use
+			if (wordsLeft == 1) {
+				uint64_t word = words[0];
+				if (stats.totalClusters % 64)
+					word |= all_used << (stats.totalClusters % 64);
+				scanWord(word, position);
+				position += 64;
+				return;
+			}
+
+			size_t limit = static_cast<size_t>(std::min<uint64_t>(count, wordsLeft - 1));
+			size_t n = 0;
+
+			// Long free stretches continue (or start) a run; long used stretches end one
+			if (0 == words[0] && (n = uniform_words(words, limit, 0)) > 1) {
+				if (!inRun) {
+					runStart = position;
+					inRun = true;
+				}
+			}
+			else if (all_used == words[0] && (n = uniform_words(words, limit, all_used)) > 1) {
+				endRun(position);
+				for (size_t i = 0; i < n; ++i)
+					addUsed(all_used, position + (i * 64));
+			}
+			else {
+				n = 1;
+				scanWord(words[0], position);
+			}
+
+			position += n * 64;
+			words += n;
+			count -= n;
+		}
+	}
+
+	void FreeSpaceScanner::scanWord(uint64_t word, uint64_t base)
+	{
+		unsigned pos = 0;
+
+		addUsed(word, base);
+
+		// Alternate between finding the end of the current free run (the next set bit), and the start of
+		// the next one (the next clear bit)
+		while (pos < 64) {
+			if (inRun) {
+				uint64_t rest = word >> pos;
+				if (!rest)
+					return;
+
+				pos += lowest_bit(rest);
+				endRun(base + pos);
+			}
+			else {
+				uint64_t rest = ~word >> pos;
+				if (!rest)
+					return;
+
+				pos += lowest_bit(rest);
+				runStart = base + pos;
+				inRun = true;
+			}
+		}
+	}
+
+	void FreeSpaceScanner::addUsed(uint64_t word, uint64_t base)
+	{
+		stats.regionUsed[static_cast<size_t>(base / stats.regionClusters)] += bit_count(word);
+	}
+
+	void FreeSpaceScanner::endRun(uint64_t end)
+	{
+		if (!inRun)
+			return;
+
+		uint64_t	len = end - runStart;
+		unsigned	bucket = highest_bit(len);
+
+		inRun = false;
+		++stats.freeExtents;
+		++stats.extentCounts[bucket];
+		stats.extentClusters[bucket] += len;
+
+		if (len > stats.largestFreeLength) {
+			stats.largestFreeLength = len;
+			stats.largestFreeLcn = runStart;
+		}
+	}
+
+	FreeSpaceStats volume_free_space(VolOps& vol, size_t regions)
+	{
+		uint64_t			total = vol.getGeometry().totalClusters;
+		DataStream			bitmap(vol, static_cast<uint64_t>(MftRecordNumber::MftBitmap));
+		FreeSpaceScanner	scanner(total, regions);
+
+		bitmap.stream([&](uint64_t, const uint8_t* data, size_t len) {
+			scanner.feed(data, len);
+			return true;
+		}, 0, (total + 7) / 8);
+
+		return scanner.finish();
+	}
+
+}
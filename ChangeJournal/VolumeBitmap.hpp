@@ -0,0 +1,106 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "VolumeOptions.hpp"
+
+namespace ntfs {
+
+	constexpr size_t default_bitmap_regions = 256;
+
+	// Free extents are binned by the highest set bit of their length, so there is one bucket per bit
+	constexpr size_t free_extent_buckets = 64;
+
+	/**
+	* What a volume's cluster bitmap says about its free space.
+	*/
+	struct FreeSpaceStats {
+		uint64_t				totalClusters = 0;
+		uint64_t				freeClusters = 0;
+		uint64_t				freeExtents = 0;			// maximal runs of free clusters
+		uint64_t				largestFreeLcn = 0;
+		uint64_t				largestFreeLength = 0;		// in clusters
+		std::vector<uint64_t>	extentCounts;				// [i] counts free extents of 2^i to 2^(i + 1) - 1 clusters
+		std::vector<uint64_t>	extentClusters;				// [i] sums the clusters of the extents counted in extentCounts[i]
+		uint64_t				regionClusters = 0;			// the size of each region; a multiple of 64
+		std::vector<uint64_t>	regionUsed;					// [i] counts the clusters in use in region i
+	};
+
+	/**
+	* Accumulates FreeSpaceStats from a cluster bitmap (bit n set if cluster n is in use) handed over in
+	* pieces of any size, e.g., as it's read off the disk. Whole words are counted with popcount, and runs
+	* of free clusters are found with bit scans; uniform stretches (entirely free, or entirely in use)
+	* are skipped 64 bytes at a time with SSE2 compares where available.
+	*/
+	class FreeSpaceScanner {
+	public:
+		/**
+		* @param totalClusters The number of clusters on the volume; bits past it are ignored
+		* @param regions The number of regions to report occupancy for
+		*/
+		FreeSpaceScanner(uint64_t totalClusters, size_t regions = default_bitmap_regions);
+
+		/**
+		* Scans the next piece of the bitmap.
+		*
+		* @param data The next len bytes of the bitmap
+		* @param len The size of the piece, in bytes
+		*/
+		void feed(const uint8_t* data, size_t len);
+
+		/**
+		* Finishes the scan and returns the results. Clusters the bitmap didn't cover are counted as in use.
+		*/
+		FreeSpaceStats finish();
+
+	private:
+		void scanWords(const uint64_t* words, size_t count);
+		void scanWord(uint64_t word, uint64_t base);
+		void addUsed(uint64_t word, uint64_t base);
+		void endRun(uint64_t end);
+
+		FreeSpaceStats	stats;
+		uint64_t		position = 0;		// the cluster the next bit stands for
+		uint64_t		runStart = 0;
+		bool			inRun = false;
+		uint8_t			carry[sizeof(uint64_t)];
+		size_t			carried = 0;
+	};
+
+	/**
+	* Reads the cluster bitmap of the volume ($Bitmap) with one sequential pass and reports on its free
+	* space and how fragmented it is.
+	*
+	* @throws std::runtime_error if no block device is set, or $Bitmap can't be read
+	* @param vol The volume to report on
+	* @param regions The number of regions to report occupancy for
+	* @return the volume's free space statistics
+	*/
+	FreeSpaceStats volume_free_space(VolOps& vol, size_t regions = default_bitmap_regions);
+
+}
@@ -1,9 +1,59 @@
 #include "VolumeOptions.hpp"
+#include "AttributeList.hpp"
+#include "AttributeVisitor.hpp"
+#include "Fixup.hpp"
+#include "MftReader.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <numeric>
+
+ntfs::NTFS_FILE_RECORD_HEADER* ntfs::MftRecordView::header() const
+{
+	return reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(ptr);
+}
+
+uint8_t* ntfs::MftRecordView::data() const
+{
+	return ptr;
+}
+
+size_t ntfs::MftRecordView::size() const
+{
+	return len;
+}
+
+bool ntfs::MftRecordView::empty() const
+{
+	return 0 == len;
+}
+
+uint8_t* ntfs::MftRecordView::begin() const
+{
+	return ptr;
+}
+
+uint8_t* ntfs::MftRecordView::end() const
+{
+	return ptr + len;
+}
+
+bool ntfs::MftRecordView::mapped() const
+{
+	return ptr && !owned;
+}
 
 ntfs::VolOps::VolOps(std::shared_ptr<void> volHandle) : vhandle(volHandle)
 {
 }
 
+ntfs::VolOps::VolOps(std::shared_ptr<BlockDevice> dev)
+{
+	setBlockDevice(dev);
+}
+
 void ntfs::VolOps::setVolHandle(std::shared_ptr<void> vh)
 {
 	if(vhandle)
@@ -17,7 +67,480 @@ std::shared_ptr<void> ntfs::VolOps::getVolHandle()
 	return vhandle;
 }
 
+void ntfs::VolOps::setBlockDevice(std::shared_ptr<BlockDevice> dev)
+{
+	if (!dev)
+		throw VOL_API_INTERACTION_ERROR("Invalid block device provided!", ERROR_INVALID_PARAMETER);
+
+	device = dev;
+	extentCache = std::make_shared<ExtentCache>();
+	mftExtents.reset();
+	mftBitmap.reset();
+	mftValidLength = 0;
+
+	try {
+		geometry = read_volume_geometry(*device);
+		loadMft();
+	}
+	catch (...) {
+		device.reset();
+		throw;
+	}
+}
+
+std::shared_ptr<ntfs::BlockDevice> ntfs::VolOps::getBlockDevice()
+{
+	return device;
+}
+
+const ntfs::VolumeGeometry& ntfs::VolOps::getGeometry()
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	return geometry;
+}
+
+void ntfs::VolOps::readClusters(uint64_t lcn, uint64_t count, void* buf)
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	if (lcn + count > geometry.totalClusters)
+		throw VOL_API_INTERACTION_ERROR("Cluster range lies outside of the volume!", ERROR_INVALID_PARAMETER);
+
+	device->read(lcn * geometry.bytesPerCluster, buf, static_cast<size_t>(count * geometry.bytesPerCluster));
+}
+
+std::shared_ptr<const ntfs::ExtentMap> ntfs::VolOps::getMftExtents()
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	return mftExtents;
+}
+
+std::shared_ptr<const ntfs::MftBitmap> ntfs::VolOps::getMftBitmap()
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	if (mftBitmap)
+		return mftBitmap;
+
+	uint64_t				records = mftValidLength / geometry.bytesPerFileRecord;
+	size_t					needed = static_cast<size_t>((records + 7) / 8);
+	auto					recs = getFileRecords(static_cast<uint64_t>(MftRecordNumber::Mft));
+	std::vector<uint8_t>	bits;
+	bool					found = false;
+
+	for (auto& rec : recs) {
+		for (auto attr : attributes(rec)) {
+			if (attr->AttributeType != NtfsAttributeType::AttributeBitmap || attr->NameLen || attr->NonResident)
+				continue;
+
+			auto value = resident_value<uint8_t>(attr);
+			bits.assign(value, value + reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength);
+			found = true;
+		}
+	}
+
+	// The bitmap usually outgrows its record; only the part covering records that exist is read
+	if (!found) {
+		auto map = buildExtentMap(recs, NtfsAttributeType::AttributeBitmap, std::basic_string<WCHAR>());
+		bits.resize(static_cast<size_t>(std::min<uint64_t>(map->dataSize(), needed)));
+		readExtents(*map, 0, bits.data(), bits.size());
+	}
+
+	mftBitmap = std::make_shared<MftBitmap>(bits.data(), bits.size(), records);
+	return mftBitmap;
+}
+
+uint64_t ntfs::VolOps::getInUseFileCount()
+{
+	return getMftBitmap()->count();
+}
+
+void ntfs::VolOps::reloadMft()
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	loadMft();
+}
+
+std::shared_ptr<ntfs::ExtentCache> ntfs::VolOps::getExtentCache()
+{
+	return extentCache;
+}
+
+std::shared_ptr<const ntfs::ExtentMap> ntfs::VolOps::getExtentMap(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name)
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	auto map = extentCache->find(recNum, type, name);
+	if (map)
+		return map;
+
+	// Fragmented attributes continue in extension records
+	auto recs = getFileRecords(recNum);
+	map = buildExtentMap(recs, type, name);
+	extentCache->insert(recNum, type, name, map);
+
+	return map;
+}
+
+void ntfs::VolOps::readExtents(const ExtentMap& map, uint64_t offset, void* buf, size_t len)
+{
+	uint64_t				bpc = geometry.bytesPerCluster;
+	unsigned char*			out = static_cast<unsigned char*>(buf);
+
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	// Issue one read per run the range touches; a record may even straddle runs when clusters
+	// are smaller than records.
+	while (len) {
+		uint64_t	remaining = 0;
+		uint64_t	vcn = offset / bpc;
+		int64_t		lcn = map.lookup(vcn, &remaining);
+
+		if (unmapped_lcn == lcn)
+			throw VOL_API_INTERACTION_ERROR("Requested range is not mapped by the attribute's data runs!", ERROR_FILE_CORRUPT);
+
+		size_t chunk = static_cast<size_t>(std::min<uint64_t>((remaining * bpc) - (offset % bpc), len));
+		if (sparse_lcn == lcn)
+			memset(out, 0, chunk);
+		else
+			device->read((lcn * bpc) + (offset % bpc), out, chunk);
+
+		out += chunk;
+		offset += chunk;
+		len -= chunk;
+	}
+}
+
+std::shared_ptr<const ntfs::ExtentMap> ntfs::VolOps::buildExtentMap(std::vector<std::vector<uint8_t>>& records, NtfsAttributeType type, const std::basic_string<WCHAR>& name)
+{
+	auto map = std::make_shared<ExtentMap>();
+	bool found = false;
+
+	for (auto& record : records) {
+		for (auto attr : attributes(record)) {
+			if (attr->AttributeType != type || !attr->NonResident || attr->NameLen != name.size())
+				continue;
+
+			if (attr->NameOffset + (attr->NameLen * sizeof(WCHAR)) > attr->Length)
+				throw VOL_API_INTERACTION_ERROR("Attribute name lies outside of the attribute!", ERROR_FILE_CORRUPT);
+
+			if (!std::equal(name.begin(), name.end(), reinterpret_cast<WCHAR*>(reinterpret_cast<unsigned char*>(attr) + attr->NameOffset)))
+				continue;
+
+			map->addSegment(reinterpret_cast<NTFS_NONRESIDENT_ATTRIBUTE*>(attr));
+			found = true;
+		}
+	}
+
+	if (!found)
+		throw VOL_API_INTERACTION_ERROR("Requested nonresident attribute was not found!", ERROR_FILE_NOT_FOUND);
+
+	return map;
+}
+
+void ntfs::VolOps::loadMft()
+{
+	std::vector<std::vector<uint8_t>>	recs(1, std::vector<uint8_t>(geometry.bytesPerFileRecord));
+	auto&								rec = recs.front();
+	auto								header = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(rec.data());
+
+	// Record 0 always lives at the start of the $MFT, which lets us find everything else.
+	device->read(geometry.mftStartLcn * geometry.bytesPerCluster, rec.data(), rec.size());
+	if (reinterpret_cast<NTFS_RECORD_HEADER*>(rec.data())->Type != static_cast<ULONG>(NtfsRecordType::File) || !apply_fixup(rec.data(), rec.size()))
+		throw VOL_API_INTERACTION_ERROR("The $MFT's own file record is corrupt!", ERROR_FILE_CORRUPT);
+
+	mftExtents = buildExtentMap(recs, NtfsAttributeType::AttributeData, std::basic_string<WCHAR>());
+	mftValidLength = mftExtents->initializedSize();
+	mftBitmap.reset();
+
+	if (!mftExtents->size() || 0 == mftValidLength)
+		throw VOL_API_INTERACTION_ERROR("Unable to locate the $MFT's data attribute!", ERROR_FILE_CORRUPT);
+
+	// A badly fragmented $MFT keeps the rest of its runs in extension records, which the runs in record 0
+	// always cover, so they can be read with the partial map.
+	auto list = readAttributeList(header, rec.size());
+	if (!list.empty()) {
+		uint64_t	baseFrn = (static_cast<uint64_t>(header->SequenceCount) << 48) | static_cast<uint64_t>(MftRecordNumber::Mft);
+		auto		extensions = extension_records(parse_attribute_list(list.data(), list.size()), static_cast<uint64_t>(MftRecordNumber::Mft));
+		auto		extRecs = getMftRecords(extensions);
+
+		for (size_t i = 0; i < extRecs.size(); ++i) {
+			if (is_extension_of(reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(extRecs[i].data()), extRecs[i].size(), extensions[i], baseFrn))
+				recs.push_back(std::move(extRecs[i]));
+		}
+
+		mftExtents = buildExtentMap(recs, NtfsAttributeType::AttributeData, std::basic_string<WCHAR>());
+	}
+
+	extentCache->insert(static_cast<uint64_t>(MftRecordNumber::Mft), NtfsAttributeType::AttributeData, std::basic_string<WCHAR>(), mftExtents);
+}
+
+void ntfs::VolOps::readMft(uint64_t offset, void* buf, size_t len)
+{
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	if (offset + len > mftValidLength)
+		throw VOL_API_INTERACTION_ERROR("Requested range lies past the end of the MFT!", ERROR_INVALID_PARAMETER);
+
+	readExtents(*mftExtents, offset, buf, len);
+}
+
+void ntfs::VolOps::scanChunks(const ParallelScanOptions& opts, std::function<std::shared_ptr<void>(MftRecordBatch&)> process, std::function<void(std::shared_ptr<void>&)> deliver)
+{
+	MftReader										reader(*this, default_mft_read_size, default_pipeline_depth, ReadBackend::Auto, opts.skipUnused);
+	WorkStealingPool								pool(opts.threads);
+	size_t											chunk = std::max<size_t>(1, opts.chunkRecords);
+	uint64_t										chunks = (reader.recordCount() + chunk - 1) / chunk;
+	uint64_t										window = pool.threadCount() * scan_chunks_per_thread;
+	std::mutex										lock;
+	std::mutex										sinkLock;
+	std::vector<std::unique_ptr<MftRecordBatch>>	spare;
+	std::map<uint64_t, std::shared_ptr<void>>		finished;
+	std::function<void(uint64_t)>					scan;
+	uint64_t										submitted = 0;
+	uint64_t										completed = 0;
+	uint64_t										nextChunk = 0;
+	bool											delivering = false;
+
+	// Only a window of chunks is in flight at once, and each one retired (delivered, when ordered) lets
+	// another in; that bounds both the batches in use and the results parked waiting for a slow chunk.
+	// Called with lock held.
+	auto topUp = [&](uint64_t retired) {
+		for (; submitted < chunks && submitted < retired + window; ++submitted) {
+			uint64_t c = submitted;
+			pool.submit([&scan, c] { scan(c); });
+		}
+	};
+
+	scan = [&](uint64_t c) {
+		std::unique_ptr<MftRecordBatch> batch;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!spare.empty()) {
+				batch = std::move(spare.back());
+				spare.pop_back();
+			}
+		}
+		if (!batch)
+			batch.reset(new MftRecordBatch());
+
+		reader.read(c * chunk, chunk, *batch);
+		auto result = process(*batch);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			spare.push_back(std::move(batch));
+		}
+
+		if (!opts.ordered) {
+			{
+				std::lock_guard<std::mutex> guard(sinkLock);
+				deliver(result);
+			}
+
+			std::lock_guard<std::mutex> guard(lock);
+			topUp(++completed);
+			return;
+		}
+
+		// Park the result; whichever thread finds itself holding the next chunk in sequence
+		// delivers it (and anything queued up behind it), while everyone else moves on.
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			finished.emplace(c, std::move(result));
+			if (delivering)
+				return;
+			delivering = true;
+		}
+
+		for (;;) {
+			std::shared_ptr<void> next;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				auto it = finished.find(nextChunk);
+				if (it == finished.end()) {
+					delivering = false;
+					return;
+				}
+				next = std::move(it->second);
+				finished.erase(it);
+				topUp(++nextChunk);
+			}
+			deliver(next);
+		}
+	};
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		topUp(0);
+	}
+
+	pool.wait();
+}
+
+std::vector<uint8_t> ntfs::VolOps::readRawMftRecord(uint64_t recNum)
+{
+	std::vector<uint8_t>	vec(geometry.bytesPerFileRecord);
+
+	readMft(recNum * vec.size(), vec.data(), vec.size());
+
+	// Unused slots may never have been initialized; hand them back as-is, just like the FSCTL would.
+	if (reinterpret_cast<NTFS_RECORD_HEADER*>(vec.data())->Type == static_cast<ULONG>(NtfsRecordType::File) && !apply_fixup(vec.data(), vec.size()))
+		throw VOL_API_INTERACTION_ERROR("File record failed update sequence validation!", ERROR_FILE_CORRUPT);
+
+	return vec;
+}
+
+std::vector<std::vector<uint8_t>> ntfs::VolOps::getMftRecords(const std::vector<uint64_t>& recNums)
+{
+	std::vector<std::vector<uint8_t>>	out(recNums.size());
+	std::vector<size_t>					order(recNums.size());
+	std::vector<uint8_t>				buf;
+	size_t								recSize = geometry.bytesPerFileRecord;
+
+	// Memory mapped images have no trips to the device to save, and hand out records already fixed up
+	if (!device || device->view(0, geometry.bytesPerSector)) {
+		for (size_t i = 0; i < recNums.size(); ++i)
+			out[i] = getMftRecord(recNums[i]);
+
+		return out;
+	}
+
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return recNums[a] < recNums[b]; });
+
+	for (size_t i = 0; i < order.size();) {
+		uint64_t	first = recNums[order[i]];
+		size_t		end = i + 1;
+
+		// Reading a few records nobody asked for is cheaper than another trip to the device
+		while (end < order.size() && recNums[order[end]] - recNums[order[end - 1]] <= mft_batch_gap_records && recNums[order[end]] - first < mft_batch_max_records)
+			++end;
+
+		buf.resize(static_cast<size_t>(recNums[order[end - 1]] - first + 1) * recSize);
+		readMft(first * recSize, buf.data(), buf.size());
+
+		for (; i < end; ++i) {
+			auto& vec = out[order[i]];
+
+			vec.assign(buf.begin() + static_cast<size_t>(recNums[order[i]] - first) * recSize, buf.begin() + static_cast<size_t>(recNums[order[i]] - first + 1) * recSize);
+			if (reinterpret_cast<NTFS_RECORD_HEADER*>(vec.data())->Type == static_cast<ULONG>(NtfsRecordType::File) && !apply_fixup(vec.data(), vec.size()))
+				throw VOL_API_INTERACTION_ERROR("File record failed update sequence validation!", ERROR_FILE_CORRUPT);
+		}
+	}
+
+	return out;
+}
+
+std::vector<std::vector<uint8_t>> ntfs::VolOps::getFileRecords(uint64_t recNum)
+{
+	std::vector<std::vector<uint8_t>> recs;
+
+	recs.push_back(getMftRecord(recNum));
+
+	auto base = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(recs.front().data());
+	if (recs.front().size() < sizeof(NTFS_FILE_RECORD_HEADER) || base->RecordHeader.Type != static_cast<ULONG>(NtfsRecordType::File) || base->BaseFileRecord)
+		return recs;
+
+	auto list = readAttributeList(base, recs.front().size());
+	if (list.empty())
+		return recs;
 
+	uint64_t	baseFrn = (static_cast<uint64_t>(base->SequenceCount) << 48) | recNum;
+	auto		extensions = extension_records(parse_attribute_list(list.data(), list.size()), recNum);
+	auto		extRecs = getMftRecords(extensions);
+
+	for (size_t i = 0; i < extRecs.size(); ++i) {
+		if (is_extension_of(reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(extRecs[i].data()), extRecs[i].size(), extensions[i], baseFrn))
+			recs.push_back(std::move(extRecs[i]));
+	}
+
+	return recs;
+}
+
+std::vector<uint8_t> ntfs::VolOps::readAttributeList(NTFS_FILE_RECORD_HEADER* record, size_t size)
+{
+	std::vector<uint8_t> list;
+
+	for (auto attr : attributes(record, size)) {
+		if (attr->AttributeType != NtfsAttributeType::AttributeAttributeList)
+			continue;
+
+		if (!attr->NonResident) {
+			auto value = resident_value<uint8_t>(attr);
+			list.assign(value, value + reinterpret_cast<NTFS_RESIDENT_ATTRIBUTE*>(attr)->ValueLength);
+			break;
+		}
+
+		// Without a device there's nothing to read it from; the base record will have to do
+		if (!device)
+			break;
+
+		// Attribute lists are never split into segments of their own
+		ExtentMap map;
+
+		if (attr->Length < sizeof(NTFS_NONRESIDENT_ATTRIBUTE))
+			throw VOL_API_INTERACTION_ERROR("Nonresident attribute list is truncated!", ERROR_FILE_CORRUPT);
+
+		map.addSegment(reinterpret_cast<NTFS_NONRESIDENT_ATTRIBUTE*>(attr));
+		if (map.dataSize() > map.clusterCount() * geometry.bytesPerCluster)
+			throw VOL_API_INTERACTION_ERROR("Attribute list is larger than its allocation!", ERROR_FILE_CORRUPT);
+
+		list.resize(static_cast<size_t>(map.dataSize()));
+		readExtents(map, 0, list.data(), list.size());
+		break;
+	}
+
+	return list;
+}
+
+uint8_t* ntfs::VolOps::mappedMftRecord(uint64_t recNum)
+{
+	uint64_t	bpc = geometry.bytesPerCluster;
+	uint64_t	offset = recNum * geometry.bytesPerFileRecord;
+	uint64_t	remaining = 0;
+
+	if (offset + geometry.bytesPerFileRecord > mftValidLength)
+		throw VOL_API_INTERACTION_ERROR("Requested range lies past the end of the MFT!", ERROR_INVALID_PARAMETER);
+
+	int64_t lcn = mftExtents->lookup(offset / bpc, &remaining);
+	if (lcn < 0 || (remaining * bpc) - (offset % bpc) < geometry.bytesPerFileRecord)
+		return nullptr;
+
+	// The device keeps track of which records it has fixed up, so this holds up across reloadMft and other instances
+	return device->fixedUpView((lcn * bpc) + (offset % bpc), geometry.bytesPerFileRecord, NtfsRecordType::File);
+}
+
+ntfs::MftRecordView ntfs::VolOps::getMftRecordView(uint64_t recNum)
+{
+	MftRecordView view;
+
+	if (!device)
+		throw VOL_API_INTERACTION_ERROR("No block device is set!", ERROR_INVALID_PARAMETER);
+
+	view.ptr = mappedMftRecord(recNum);
+	if (!view.ptr) {
+		view.owned = std::make_shared<std::vector<uint8_t>>(readRawMftRecord(recNum));
+		view.ptr = view.owned->data();
+		view.len = view.owned->size();
+		return view;
+	}
+	view.len = geometry.bytesPerFileRecord;
+
+	return view;
+}
+
+#ifdef _WIN32
 std::tuple<std::string, std::string, unsigned long> ntfs::VolOps::getVolInfo()
 {
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
@@ -37,19 +560,47 @@ std::tuple<std::string, std::string, unsigned long> ntfs::VolOps::getVolInfo()
 
 	return std::make_tuple(volName, fsName, maxCompLen);
 }
+#endif
 
 std::unique_ptr<NTFS_VOLUME_DATA_BUFFER> ntfs::VolOps::getVolData()
 {
-	unsigned long bytesRead = 0;
 	auto tmp = std::unique_ptr<NTFS_VOLUME_DATA_BUFFER>(reinterpret_cast<PNTFS_VOLUME_DATA_BUFFER>(new unsigned char [vol_data_size]));
-	
+
+	if (device) {
+		// Synthesize what FSCTL_GET_NTFS_VOLUME_DATA would have told us from the boot sector and $MFT
+		auto ext = reinterpret_cast<PNTFS_EXTENDED_VOLUME_DATA>(tmp.get() + 1);
+
+		memset(tmp.get(), 0, vol_data_size);
+		tmp->VolumeSerialNumber.QuadPart = geometry.volumeSerial;
+		tmp->NumberSectors.QuadPart = geometry.totalSectors;
+		tmp->TotalClusters.QuadPart = geometry.totalClusters;
+		tmp->BytesPerSector = geometry.bytesPerSector;
+		tmp->BytesPerCluster = geometry.bytesPerCluster;
+		tmp->BytesPerFileRecordSegment = geometry.bytesPerFileRecord;
+		tmp->ClustersPerFileRecordSegment = geometry.bytesPerFileRecord / geometry.bytesPerCluster;
+		tmp->MftValidDataLength.QuadPart = mftValidLength;
+		tmp->MftStartLcn.QuadPart = geometry.mftStartLcn;
+		tmp->Mft2StartLcn.QuadPart = geometry.mft2StartLcn;
+		ext->ByteCount = sizeof(NTFS_EXTENDED_VOLUME_DATA);
+		ext->BytesPerPhysicalSector = geometry.bytesPerSector;
+
+		return tmp;
+	}
+
+#ifdef _WIN32
+	unsigned long bytesRead = 0;
+
 	if (!DeviceIoControl(vhandle.get(), FSCTL_GET_NTFS_VOLUME_DATA, nullptr, 0, tmp.get(), vol_data_size, &bytesRead, nullptr)) {
 		throw VOL_API_INTERACTION_LASTERROR("Failed to get volume data!");
 	}
+#else
+	throw VOL_API_INTERACTION_ERROR("Volume data is only available from a block device!", ERROR_NOT_SUPPORTED);
+#endif
 
 	return tmp;
 }
 
+#ifdef _WIN32
 unsigned long ntfs::VolOps::getDriveType()
 {
 	std::string volname;
@@ -60,6 +611,7 @@ unsigned long ntfs::VolOps::getDriveType()
 
 	return GetDriveTypeA(volname.c_str());
 }
+#endif
 
 uint64_t ntfs::VolOps::getFileCount()
 {
@@ -78,8 +630,15 @@ uint64_t ntfs::VolOps::getFileCount()
 
 std::vector<uint8_t> ntfs::VolOps::getMftRecord(uint64_t recNum)
 {
-	NTFS_FILE_RECORD_INPUT_BUFFER	inBuf = { 0 };
 	std::vector<uint8_t>			vec;
+
+	if (device) {
+		auto rec = mappedMftRecord(recNum);
+		return rec ? std::vector<uint8_t>(rec, rec + geometry.bytesPerFileRecord) : readRawMftRecord(recNum);
+	}
+
+#ifdef _WIN32
+	NTFS_FILE_RECORD_INPUT_BUFFER	inBuf = { 0 };
 	size_t							recSize = sizeof(NTFS_FILE_RECORD_OUTPUT_BUFFER);
 	unsigned long					bytesReturned = 0;
 
@@ -97,39 +656,39 @@ std::vector<uint8_t> ntfs::VolOps::getMftRecord(uint64_t recNum)
 
 	vec.resize(tmpbuf->FileRecordLength);
 	memcpy(vec.data(), tmpbuf->FileRecordBuffer, tmpbuf->FileRecordLength);
+#else
+	throw VOL_API_INTERACTION_ERROR("File records are only available from a block device!", ERROR_NOT_SUPPORTED);
+#endif
 
 	return vec;
 }
 
 std::vector<uint8_t> ntfs::VolOps::processMftAttributes(uint64_t recNum, std::function<void(NTFS_ATTRIBUTE*)> func)
 {
-	std::vector<uint8_t> vec;
+	std::vector<std::vector<uint8_t>> recs;
 
 	try {
-		vec = getMftRecord(recNum);
-		processMftAttributes(vec, func);
+		recs = getFileRecords(recNum);
+		for (auto& rec : recs)
+			processMftAttributes(rec, func);
 	}
 	catch (const std::exception& e) {
 		throw std::runtime_error(std::string("[VolOps] An exception occurred while processing the requested MFT record! Error: ") + e.what());
 	}
 
-	return vec;
+	return std::move(recs.front());
 }
 
 void ntfs::VolOps::processMftAttributes(std::vector<uint8_t>& record, std::function<void(NTFS_ATTRIBUTE*)> func)
 {
-	NTFS_FILE_RECORD_HEADER*		header = reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(record.data());
-	NTFS_ATTRIBUTE*					current = nullptr;
-	unsigned long					frecSize = 0;
+	processMftAttributes(reinterpret_cast<NTFS_FILE_RECORD_HEADER*>(record.data()), record.size(), func);
+}
 
-	if (!record.size() || !func)
+void ntfs::VolOps::processMftAttributes(NTFS_FILE_RECORD_HEADER* record, size_t size, std::function<void(NTFS_ATTRIBUTE*)> func)
+{
+	if (!record || size < sizeof(NTFS_FILE_RECORD_HEADER) || !func)
 		throw VOL_API_INTERACTION_ERROR("Unable to process MFT record! Bad parameters provided.", ERROR_INVALID_PARAMETER);
 
-	for (current = (NTFS_ATTRIBUTE*)((unsigned char*)header + header->AttributeOffset);
-		current->AttributeType != NtfsAttributeType::AttributeEndOfRecord;
-		current = (NTFS_ATTRIBUTE*)((unsigned char*)current + current->Length)) 
-	{
-		func(current);
-	}
-
+	for (auto attr : attributes(record, size))
+		func(attr);
 }
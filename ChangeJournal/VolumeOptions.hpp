@@ -24,15 +24,18 @@
 * SOFTWARE.
 *********************************************************************************/
 
-#include <Windows.h>
 #include <memory>
 #include <string>
 #include <stdint.h>
 #include <vector>
 #include <tuple>
+#include <type_traits>
 #include <codecvt>
 #include <functional>
 #include "ntfs_defs.h"
+#include "BlockDevice.hpp"
+#include "Runlist.hpp"
+#include "MftBitmap.hpp"
 
 #define EXTRACT_ATTRIBUTE(base, type)\
 	((base->NonResident) ? (type*)((unsigned char*)base + ((ntfs::NTFS_NONRESIDENT_ATTRIBUTE*)base)->RunArrayOffset) :\
@@ -48,9 +51,82 @@ namespace ntfs {
 
 	constexpr uint32_t vol_data_size = sizeof(NTFS_VOLUME_DATA_BUFFER) + sizeof(NTFS_EXTENDED_VOLUME_DATA);
 
+	class MftRecordBatch;
+
+	constexpr size_t default_scan_chunk_records = 4096;
+
+	// parallelScan keeps at most this many chunks per thread read or waiting to be delivered at once
+	constexpr size_t scan_chunks_per_thread = 3;
+
+	// getMftRecords reads records this close together with one read, up to this many records at a time
+	constexpr uint64_t mft_batch_gap_records = 8;
+	constexpr uint64_t mft_batch_max_records = 256;
+
+	/**
+	* Controls how VolOps::parallelScan splits up its work and reports results.
+	*/
+	struct ParallelScanOptions {
+		size_t	threads = 0;								// 0 uses one thread per hardware thread
+		size_t	chunkRecords = default_scan_chunk_records;	// records read and processed per task
+		bool	ordered = true;								// deliver results in record number order
+		bool	skipUnused = true;							// don't read slots the $MFT's bitmap marks free
+	};
+
+	/**
+	* A non-owning, span-like view of one MFT record, as returned by VolOps::getMftRecordView. When the
+	* volume is a memory mapped image the view points straight into the mapping; otherwise it shares a
+	* copy of the record. Either way, copying a view is cheap, and the record stays valid for as long as
+	* the block device it came from is alive.
+	*/
+	class MftRecordView {
+	public:
+		MftRecordView() = default;
+
+		/**
+		* Returns the record's header, or nullptr for an empty view.
+		*/
+		NTFS_FILE_RECORD_HEADER* header() const;
+
+		/**
+		* Returns a pointer to the first byte of the record.
+		*/
+		uint8_t* data() const;
+
+		/**
+		* Returns the size of the record, in bytes.
+		*/
+		size_t size() const;
+
+		/**
+		* Indicates whether the view refers to nothing at all.
+		*/
+		bool empty() const;
+
+		uint8_t* begin() const;
+		uint8_t* end() const;
+
+		/**
+		* Indicates whether the view points into a memory mapped image rather than at a copy.
+		*/
+		bool mapped() const;
+
+	private:
+		friend class VolOps;
+
+		uint8_t*								ptr = nullptr;
+		size_t									len = 0;
+		std::shared_ptr<std::vector<uint8_t>>	owned;
+	};
+
 	class VolOps {
 	public:
 		VolOps(std::shared_ptr<void> volHandle);
+		VolOps(std::shared_ptr<BlockDevice> dev);
+
+		// Takes pointers to any particular kind of device, which would otherwise be as good a match for the HANDLE constructor
+		template <typename Device, typename = typename std::enable_if<std::is_base_of<BlockDevice, Device>::value>::type>
+		VolOps(std::shared_ptr<Device> dev) : VolOps(std::shared_ptr<BlockDevice>(std::move(dev))) {}
+
 		VolOps() = default;
 		~VolOps() = default;
 		VolOps(const VolOps&) = default;
@@ -72,6 +148,107 @@ namespace ntfs {
 		*/
 		std::shared_ptr<void> getVolHandle();
 
+		/**
+		* Switches the class over to reading the volume directly from a block device (an image file, a split
+		* image, or a live volume wrapped in a VolumeHandleDevice) rather than going through the file system
+		* control interface. The boot sector and the $MFT's data runs are parsed immediately.
+		*
+		* @throws std::runtime_error if the device does not contain a readable NTFS volume
+		* @param dev The device to read from
+		*/
+		void setBlockDevice(std::shared_ptr<BlockDevice> dev);
+
+		/**
+		* Gets the block device the class instance is currently reading from, if any.
+		*
+		* @return a shared_ptr containing the block device, or an empty shared_ptr if operating on a HANDLE
+		*/
+		std::shared_ptr<BlockDevice> getBlockDevice();
+
+		/**
+		* Returns the geometry parsed from the boot sector of the current block device.
+		*
+		* @throws std::runtime_error if no block device is set
+		* @return the current volume's geometry
+		*/
+		const VolumeGeometry& getGeometry();
+
+		/**
+		* Reads a range of clusters from the current block device.
+		*
+		* @throws std::runtime_error if no block device is set, or if the read fails
+		* @param lcn The first logical cluster to read
+		* @param count The number of clusters to read
+		* @param buf The destination; must be at least count * bytesPerCluster bytes in size
+		*/
+		void readClusters(uint64_t lcn, uint64_t count, void* buf);
+
+		/**
+		* Returns the extent map of the $MFT's data attribute on the current block device.
+		*
+		* @throws std::runtime_error if no block device is set
+		* @return the $MFT's extent map
+		*/
+		std::shared_ptr<const ExtentMap> getMftExtents();
+
+		/**
+		* Returns the $MFT's bitmap of record slots in use, reading it on first use.
+		*
+		* @throws std::runtime_error if no block device is set, or the bitmap can't be read
+		* @return the bitmap, covering every slot counted by getFileCount
+		*/
+		std::shared_ptr<const MftBitmap> getMftBitmap();
+
+		/**
+		* Re-reads the $MFT's own record, picking up any growth of the MFT since the device was set (e.g., on
+		* a live volume, where new files may land in records past the end of the MFT as it was first seen).
+		*
+		* @throws std::runtime_error if no block device is set, or the $MFT's record is corrupt
+		*/
+		void reloadMft();
+
+		/**
+		* Returns the decoded extent map of a nonresident attribute, decoding it (and caching the result) on
+		* first use. The cache is shared by every copy of this instance, and is reset when the device changes.
+		*
+		* @throws std::runtime_error if no block device is set, the record can't be read, or the record has no
+		*         nonresident attribute of the requested type and name
+		* @param recNum The file record the attribute belongs to
+		* @param type The type of the attribute
+		* @param name The name of the attribute (e.g., L"$J"); empty for unnamed attributes
+		* @return the attribute's extent map
+		*/
+		std::shared_ptr<const ExtentMap> getExtentMap(uint64_t recNum, NtfsAttributeType type, const std::basic_string<WCHAR>& name = std::basic_string<WCHAR>());
+
+		/**
+		* Returns the extent map cache for the current block device (e.g., to invalidate entries for changed files).
+		*/
+		std::shared_ptr<ExtentCache> getExtentCache();
+
+		/**
+		* Reads a byte range of a nonresident attribute, following its extent map. Sparse runs are
+		* returned as zeros without touching the device.
+		*
+		* @throws std::runtime_error if no block device is set, or if part of the range isn't mapped
+		* @param map The attribute's extent map
+		* @param offset The offset into the attribute to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		*/
+		void readExtents(const ExtentMap& map, uint64_t offset, void* buf, size_t len);
+
+		/**
+		* Reads a byte range of the $MFT's data stream from the current block device, following its data
+		* runs. No fixups are applied.
+		*
+		* @throws std::runtime_error if no block device is set, or if the range isn't mapped by the $MFT
+		* @param offset The offset into the $MFT to begin reading from
+		* @param buf The destination buffer; must be at least len bytes in size
+		* @param len The number of bytes to read
+		*/
+		void readMft(uint64_t offset, void* buf, size_t len);
+
+#ifdef _WIN32
 		/**
 		* Returns useful information about the current volume.
 		*
@@ -80,6 +257,7 @@ namespace ntfs {
 		*         and the max component length.
 		*/
 		std::tuple<std::string, std::string, unsigned long> getVolInfo();
+#endif
 
 		/**
 		* Gets the volume data for the current volume.
@@ -89,6 +267,7 @@ namespace ntfs {
 		*/
 		std::unique_ptr<NTFS_VOLUME_DATA_BUFFER> getVolData();
 
+#ifdef _WIN32
 		/**
 		* Returns the drive type of the current volume (See: MSDN documentation for GetDriveType())
 		* 
@@ -96,15 +275,26 @@ namespace ntfs {
 		* @return unsigned long indicating the drive type
 		*/
 		unsigned long getDriveType();
+#endif
 
 		/**
-		* Returns the file count on the current volume.
+		* Returns the file count on the current volume. This is the number of record slots in the MFT, used
+		* or not; see getInUseFileCount for the number of records actually in use.
 		*
 		* @throws std::runtime_error if the operation is unable to complete.
 		* @return a uint64_t containing the total number of files on the volume.
 		*/
 		uint64_t getFileCount();
 
+		/**
+		* Returns the number of MFT records in use on the current block device, counted from the $MFT's bitmap.
+		* Extension records are counted too, since they occupy slots of their own.
+		*
+		* @throws std::runtime_error if no block device is set, or the bitmap can't be read
+		* @return the number of record slots in use
+		*/
+		uint64_t getInUseFileCount();
+
 		/**
 		* Gets a Master File Table record given its number
 		*
@@ -115,12 +305,55 @@ namespace ntfs {
 		std::vector<uint8_t> getMftRecord(uint64_t recNum);
 
 		/**
-		* Retrieves an MFT record by number, maps callable func across all of its attributes, and returns the
-		* retrieved record back in a std::vector.
+		* Gets several Master File Table records at once. From a block device, records that lie close together
+		* are read with a single read rather than one read each.
+		*
+		* @throws std::runtime_error if any of the records can't be read, or fails update sequence validation
+		* @param recNums The records being requested, in any order
+		* @return one record per entry of recNums, in the same order
+		*/
+		std::vector<std::vector<uint8_t>> getMftRecords(const std::vector<uint64_t>& recNums);
+
+		/**
+		* Gets a file's base record along with the extension records its $ATTRIBUTE_LIST (if any) points to,
+		* reading the extension records as one batch. Extension records that no longer belong to the file
+		* are left out.
+		*
+		* @throws std::runtime_error if a record can't be read, or the attribute list is malformed
+		* @param recNum The file's base record
+		* @return the base record, followed by its extension records in record number order
+		*/
+		std::vector<std::vector<uint8_t>> getFileRecords(uint64_t recNum);
+
+		/**
+		* Returns the value of a record's $ATTRIBUTE_LIST attribute, reading it from the device if it's nonresident.
+		*
+		* @throws std::runtime_error if the attribute is malformed
+		* @param record The record (a base record) to look in
+		* @param size The size of the record, in bytes
+		* @return the list's raw value, or an empty vector if the record has no attribute list (or only a
+		*         nonresident one, and no block device is set to read it from)
+		*/
+		std::vector<uint8_t> readAttributeList(NTFS_FILE_RECORD_HEADER* record, size_t size);
+
+		/**
+		* Gets a Master File Table record from the current block device without copying it, when the device
+		* is a memory mapped image (see open_image and BlockDevice::fixedUpView). Records that aren't
+		* contiguous in the mapping, and devices that aren't mapped, fall back to a copy, just like getMftRecord.
+		*
+		* @throws std::runtime_error if no block device is set, the record can't be read, or the record is torn
+		* @param recNum The file being requested
+		* @return a view of the record; unused slots that were never initialized are returned as-is.
+		*/
+		MftRecordView getMftRecordView(uint64_t recNum);
+
+		/**
+		* Retrieves an MFT record by number, maps callable func across all of its attributes (including those
+		* its attribute list places in extension records), and returns the retrieved record back in a std::vector.
 		*
 		* @param recNum The record to retrieve
 		* @param func The function which will be provided each attribute
-		* @return the retrieved MFT record, after processing is complete (including changes made during by func)
+		* @return the retrieved (base) MFT record, after processing is complete (including changes made during by func)
 		*/
 		std::vector<uint8_t> processMftAttributes(uint64_t recNum, std::function<void(NTFS_ATTRIBUTE*)> func);
 
@@ -133,8 +366,46 @@ namespace ntfs {
 		*/
 		void processMftAttributes(std::vector<uint8_t>& record, std::function<void(NTFS_ATTRIBUTE*)> func);
 
+		/**
+		* Maps func across the attributes contained within a record that lives in someone else's buffer
+		* (e.g., a record handed out by an MftReader batch).
+		*
+		* @param record A pointer to the start of the MFT record.
+		* @param size The size of the record, in bytes.
+		* @param func The callable that will be mapped against all attributes contained in record.
+		* @return None
+		*/
+		void processMftAttributes(NTFS_FILE_RECORD_HEADER* record, size_t size, std::function<void(NTFS_ATTRIBUTE*)> func);
+
+		/**
+		* Scans the whole MFT of the current block device on a work-stealing thread pool. The MFT is split into
+		* chunks that are read, fixed up and handed to map in parallel; map's results are then passed to sink
+		* one at a time, either in record number order or in whatever order chunks complete.
+		* Defined in MftReader.hpp, which must be included to use it.
+		*
+		* @throws std::runtime_error if no block device is set, or the first exception thrown by map or sink
+		* @param map Called concurrently as map(recNum, record, recordSize) for every in-use record; must return
+		*        a (non-void) result, and must be safe to call from several threads at once.
+		* @param sink Called as sink(recNum, result) for every result; never called concurrently.
+		* @param opts Thread count, chunk size, and whether results must be delivered in order.
+		*/
+		template <typename Map, typename Sink>
+		void parallelScan(Map map, Sink sink, const ParallelScanOptions& opts = ParallelScanOptions());
+
 	private:
-		std::shared_ptr<void> vhandle;
+		void loadMft();
+		void scanChunks(const ParallelScanOptions& opts, std::function<std::shared_ptr<void>(MftRecordBatch&)> process, std::function<void(std::shared_ptr<void>&)> deliver);
+		std::shared_ptr<const ExtentMap> buildExtentMap(std::vector<std::vector<uint8_t>>& records, NtfsAttributeType type, const std::basic_string<WCHAR>& name);
+		std::vector<uint8_t> readRawMftRecord(uint64_t recNum);
+		uint8_t* mappedMftRecord(uint64_t recNum);
+
+		std::shared_ptr<void>			vhandle;
+		std::shared_ptr<BlockDevice>	device;
+		VolumeGeometry					geometry = {};
+		std::shared_ptr<ExtentCache>	extentCache;
+		std::shared_ptr<const ExtentMap>	mftExtents;
+		std::shared_ptr<const MftBitmap>	mftBitmap;
+		uint64_t						mftValidLength = 0;
 	};
 
 
@@ -0,0 +1,190 @@
+#pragma once
+
+/********************************************************************************
+* The MIT License (MIT)
+*
+* Copyright (c) 2015, Aaron M. Bray, aaron.m.bray@gmail.com
+
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*********************************************************************************/
+
+// On Windows, everything we need comes from the SDK. Everywhere else (e.g., when parsing
+// acquired images on a Linux box) we provide the handful of Win32 types and structures the
+// on-disk parsers rely on, with the same sizes and layouts the SDK uses.
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#else
+
+#include <stdint.h>
+#include <errno.h>
+
+typedef uint8_t		UCHAR;
+typedef uint8_t		BYTE;
+typedef uint8_t		BOOLEAN;
+typedef char		CHAR;
+typedef uint16_t	USHORT;
+typedef uint16_t	WORD;
+typedef uint32_t	ULONG;
+typedef uint32_t	DWORD;
+typedef int32_t		LONG;
+typedef int32_t		BOOL;
+typedef int64_t		LONGLONG;
+typedef uint64_t	ULONGLONG;
+typedef uint64_t	DWORDLONG;
+typedef char16_t	WCHAR;
+typedef LONGLONG	USN;
+
+#ifndef MAX_PATH
+#define MAX_PATH 260
+#endif
+
+#define ERROR_FILE_NOT_FOUND		2L
+#define ERROR_INVALID_DATA			13L
+#define ERROR_WRITE_FAULT			29L
+#define ERROR_HANDLE_EOF			38L
+#define ERROR_NOT_SUPPORTED			50L
+#define ERROR_INVALID_PARAMETER		87L
+#define ERROR_OPEN_FAILED			110L
+#define ERROR_BUFFER_ALL_ZEROS		754L
+#define ERROR_FILE_CORRUPT			1392L
+
+union LARGE_INTEGER {
+	struct {
+		ULONG	LowPart;
+		LONG	HighPart;
+	};
+	LONGLONG	QuadPart;
+};
+
+struct GUID {
+	uint32_t	Data1;
+	uint16_t	Data2;
+	uint16_t	Data3;
+	uint8_t		Data4[8];
+};
+
+struct NTFS_VOLUME_DATA_BUFFER {
+	LARGE_INTEGER	VolumeSerialNumber;
+	LARGE_INTEGER	NumberSectors;
+	LARGE_INTEGER	TotalClusters;
+	LARGE_INTEGER	FreeClusters;
+	LARGE_INTEGER	TotalReserved;
+	DWORD			BytesPerSector;
+	DWORD			BytesPerCluster;
+	DWORD			BytesPerFileRecordSegment;
+	DWORD			ClustersPerFileRecordSegment;
+	LARGE_INTEGER	MftValidDataLength;
+	LARGE_INTEGER	MftStartLcn;
+	LARGE_INTEGER	Mft2StartLcn;
+	LARGE_INTEGER	MftZoneStart;
+	LARGE_INTEGER	MftZoneEnd;
+};
+typedef NTFS_VOLUME_DATA_BUFFER* PNTFS_VOLUME_DATA_BUFFER;
+
+struct NTFS_EXTENDED_VOLUME_DATA {
+	DWORD	ByteCount;
+	WORD	MajorVersion;
+	WORD	MinorVersion;
+	DWORD	BytesPerPhysicalSector;
+	WORD	LfsMajorVersion;
+	WORD	LfsMinorVersion;
+};
+typedef NTFS_EXTENDED_VOLUME_DATA* PNTFS_EXTENDED_VOLUME_DATA;
+
+struct FILE_ID_128 {
+	BYTE	Identifier[16];
+};
+
+struct USN_RECORD_V2 {
+	DWORD			RecordLength;
+	WORD			MajorVersion;
+	WORD			MinorVersion;
+	DWORDLONG		FileReferenceNumber;
+	DWORDLONG		ParentFileReferenceNumber;
+	USN				Usn;
+	LARGE_INTEGER	TimeStamp;
+	DWORD			Reason;
+	DWORD			SourceInfo;
+	DWORD			SecurityId;
+	DWORD			FileAttributes;
+	WORD			FileNameLength;
+	WORD			FileNameOffset;
+	WCHAR			FileName[1];
+};
+typedef USN_RECORD_V2* PUSN_RECORD_V2;
+typedef USN_RECORD_V2 USN_RECORD;
+typedef USN_RECORD_V2* PUSN_RECORD;
+
+struct USN_RECORD_V3 {
+	DWORD			RecordLength;
+	WORD			MajorVersion;
+	WORD			MinorVersion;
+	FILE_ID_128		FileReferenceNumber;
+	FILE_ID_128		ParentFileReferenceNumber;
+	USN				Usn;
+	LARGE_INTEGER	TimeStamp;
+	DWORD			Reason;
+	DWORD			SourceInfo;
+	DWORD			SecurityId;
+	DWORD			FileAttributes;
+	WORD			FileNameLength;
+	WORD			FileNameOffset;
+	WCHAR			FileName[1];
+};
+typedef USN_RECORD_V3* PUSN_RECORD_V3;
+
+struct USN_RECORD_COMMON_HEADER {
+	DWORD	RecordLength;
+	WORD	MajorVersion;
+	WORD	MinorVersion;
+};
+
+struct USN_RECORD_EXTENT {
+	LONGLONG	Offset;
+	LONGLONG	Length;
+};
+
+struct USN_RECORD_V4 {
+	USN_RECORD_COMMON_HEADER	Header;
+	FILE_ID_128					FileReferenceNumber;
+	FILE_ID_128					ParentFileReferenceNumber;
+	USN							Usn;
+	DWORD						Reason;
+	DWORD						SourceInfo;
+	DWORD						RemainingExtents;
+	WORD						NumberOfExtents;
+	WORD						ExtentSize;
+	USN_RECORD_EXTENT			Extents[1];
+};
+typedef USN_RECORD_V4* PUSN_RECORD_V4;
+
+struct USN_JOURNAL_DATA {
+	DWORDLONG	UsnJournalID;
+	USN			FirstUsn;
+	USN			NextUsn;
+	USN			LowestValidUsn;
+	USN			MaxUsn;
+	DWORDLONG	MaximumSize;
+	DWORDLONG	AllocationDelta;
+};
+typedef USN_JOURNAL_DATA* PUSN_JOURNAL_DATA;
+
+#endif
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <Windows.h>
+#include "ntfs_compat.h"
 namespace ntfs {
 	enum class MftRecordNumber : LONGLONG {
 		Mft = 0,
@@ -20,6 +20,25 @@ namespace ntfs {
 		MftReparse
 	};
 
+	// Multi-sector record signatures, as stored in NTFS_RECORD_HEADER::Type
+	enum class NtfsRecordType : ULONG {
+		File = 0x454C4946, // "FILE"
+		Index = 0x58444E49, // "INDX"
+		Bad = 0x44414142 // "BAAD"
+	};
+
+	// Update sequence arrays always protect 512 byte strides, regardless of the sector size
+	constexpr ULONG update_sequence_stride = 512;
+
+	// File reference numbers pack a 48 bit record number with a 16 bit sequence number
+	constexpr ULONGLONG file_reference_record_mask = 0x0000FFFFFFFFFFFFULL;
+
+	constexpr ULONGLONG reference_record(ULONGLONG frn) { return frn & file_reference_record_mask; }
+	constexpr USHORT reference_sequence(ULONGLONG frn) { return static_cast<USHORT>(frn >> 48); }
+
+	// Lower is better when picking one of a file's names: Win32 names first, then POSIX, then DOS 8.3 names
+	constexpr UCHAR filename_rank(UCHAR nameType) { return (1 == nameType || 3 == nameType) ? 1 : (0 == nameType ? 2 : 3); }
+
 	enum class FileRecordFlags : USHORT {
 		RecordInUse = 0x0001,
 		RecordDirectory
@@ -77,6 +96,13 @@ namespace ntfs {
 		USHORT			  AttributeNumber;
 	};
 
+	enum AttributeFlags : USHORT {
+		AttributeCompressed = 0x0001,	// the low byte holds the compression format; 1 is LZNT1
+		AttributeCompressionMask = 0x00FF,
+		AttributeEncrypted = 0x4000,
+		AttributeSparse = 0x8000
+	};
+
 
 	struct NTFS_RESIDENT_ATTRIBUTE {
 		NTFS_ATTRIBUTE		Attribute;
@@ -160,6 +186,7 @@ namespace ntfs {
 		USHORT				Flags;
 	};
 
+	// Offsets are relative to the start of the DIRECTORY_INDEX itself
 	struct DIRECTORY_INDEX {
 		ULONG				EntriesOffset;
 		ULONG				IndexBlockLenght;
@@ -167,18 +194,25 @@ namespace ntfs {
 		ULONG				Flags; // 0 -> small directory | 1 -> large directory
 	};
 
+	enum DirectoryEntryFlags : ULONG {
+		EntrySubnode = 0x01,	// the last 8 bytes of the entry hold the VCN of the index block of lesser keys
+		EntryLast = 0x02		// the end of the node; carries no key
+	};
+
 	struct DIRECTORY_ENTRY {
 		ULONGLONG			FileReferenceNumber;
 		USHORT				Length;
 		USHORT				AttributeLength;
 		ULONG				Flags;
-		/* possibly - FILENAME_ATTRIBUTE and ULONGLONG? */
+		/* followed by the key (a FILENAME_ATTRIBUTE in $I30 indexes), then the subnode VCN if EntrySubnode is set */
 	};
 
 	struct INDEX_ROOT {
 		NtfsAttributeType	AttributeType;
 		ULONG				CollationRule;
 		ULONG				BytesPerIndexBlock;
+		UCHAR				ClustersPerIndexBlock;
+		UCHAR				Reserved[3];
 		DIRECTORY_INDEX		DirectoryIndex;
 	};
 
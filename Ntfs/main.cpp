@@ -1,6 +1,16 @@
 #include <Windows.h>
 #include "..\ChangeJournal\ChangeJournal.hpp"
 #include "..\ChangeJournal\VolumeOptions.hpp"
+#include "..\ChangeJournal\MftReader.hpp"
+#include "..\ChangeJournal\PathResolver.hpp"
+#include "..\ChangeJournal\FileIndex.hpp"
+#include "..\ChangeJournal\IndexUpdater.hpp"
+#include "..\ChangeJournal\FileSearch.hpp"
+#include "..\ChangeJournal\VolumeBitmap.hpp"
+#include "..\ChangeJournal\NtfsJournal.hpp"
+#include "..\ChangeJournal\OutputSink.hpp"
+#include "..\ChangeJournal\RecordOutput.hpp"
+#include "..\ChangeJournal\UsnCursor.hpp"
 #include "..\Utils\ArgParser.h"
 #include <vector>
 #include <codecvt>
@@ -15,14 +25,20 @@ typedef enum {
 	DeleteJournal,
 	ResetJournal = 4,
 	QueryMft = 8,
+	FreeSpace = 16,
 } ActionList;
 
 static WCHAR* argDescriptions[] = {
 	L"Sets the current volume to operate on; default is C:",
-	L"Specifies the file to ouput results into. Default\n\t\t is out.json",
+	L"Specifies the file to ouput results into. Default\n\t\t is out.json (NDJSON); .csv and .bin files get CSV\n\t\t and binary output, and - writes to the console",
 	L"Queries the current change journal, dumping all records.",
 	L"Deletes the current change journal.",
 	L"Resets the change journal.",
+	L"Enumerates the Master File Table, writing out\n\t\t every file.",
+	L"Reads the volume from a raw (or split .001) image\n\t\t file rather than a live volume; the journal is\n\t\t then read straight from $UsnJrnl.",
+	L"Loads the MFT index from a snapshot file when it\n\t\t matches the volume, otherwise saves a new one there.",
+	L"Prints only the files whose names contain the given\n\t\t text (case-insensitive), or match it if it has * or ?",
+	L"Reports free space and fragmentation from the\n\t\t volume's cluster bitmap.",
 	NULL,
 };
 
@@ -45,34 +61,145 @@ static WCHAR* supportedArgs[] = {
 	L"-m",
 	L"/m",
 	L"--mft",
+	L"-i",
+	L"/i",
+	L"--image",
+	L"-s",
+	L"/s",
+	L"--snapshot",
+	L"-f",
+	L"/f",
+	L"--find",
+	L"-b",
+	L"/b",
+	L"--bitmap",
 	NULL,
 };
 
-int enumerateMft(std::shared_ptr<void> volume)
+int enumerateMft(std::shared_ptr<ntfs::BlockDevice> device, std::shared_ptr<void> volume, const std::string& snapshot, const std::string& pattern, ntfs::OutputSink& sink, ntfs::OutputFormat format)
 {
 	int status = ERROR_SUCCESS;
-	uint64_t recs = 0;
 
 	try {
-		ntfs::VolOps vol(volume);
-		auto total = vol.getFileCount();
-		for (recs = 0; recs < total; ++recs) {
-			vol.processMftAttributes(recs, [](ntfs::NTFS_ATTRIBUTE* attr) {
-				wchar_t buf[MAX_PATH + 1] = { 0 };
-				unsigned long size = sizeof(wchar_t) * MAX_PATH;
-
-				if (attr->AttributeType != ntfs::NtfsAttributeType::AttributeFileName) {
-					return;
+		ntfs::VolOps vol(device);
+		ntfs::FileIndex index;
+		bool loaded = false;
+
+		if (!snapshot.empty()) {
+			try {
+				index.load(snapshot);
+				loaded = index.checkpoint().volumeSerial == vol.getGeometry().volumeSerial;
+				if (!loaded)
+					std::cout << "[!] Snapshot is of a different volume, rebuilding it" << std::endl;
+
+				// Bring the snapshot up to date from the journal, rather than rescanning. An image's journal is read
+				// straight off the image, so a snapshot of an earlier image of the volume catches up too.
+				if (loaded) {
+					ntfs::IndexUpdater updater(index, vol);
+					auto before = index.checkpoint().lastUsn;
+
+					if (volume) {
+						ntfs::ChangeJournal journal(volume);
+						loaded = updater.catchUp(journal);
+					}
+					else {
+						ntfs::NtfsJournal journal(vol);
+						loaded = updater.catchUp(journal);
+					}
+
+					if (!loaded)
+						std::cout << "[!] The change journal no longer covers the snapshot, rebuilding it" << std::endl;
+					else if (before != index.checkpoint().lastUsn)
+						index.save(snapshot);
 				}
+			}
+			catch (const std::exception& e) {
+				std::cout << "[!] Unable to load snapshot, rebuilding it: " << e.what() << std::endl;
+				loaded = false;
+			}
+		}
+
+		if (!loaded) {
+			ntfs::IndexCheckpoint checkpoint;
+
+			// The journal position is taken before the scan, so nothing that happens during it is missed later
+			try {
+				auto data = volume ? ntfs::ChangeJournal(volume).getJournalData() : ntfs::NtfsJournal(vol).getJournalData();
+				checkpoint.journalId = data->UsnJournalID;
+				checkpoint.lastUsn = data->NextUsn;
+			}
+			catch (const std::exception& e) {
+				std::cout << "[!] No change journal position for the snapshot: " << e.what() << std::endl;
+			}
+
+			index.build(vol);
+			checkpoint.volumeSerial = index.checkpoint().volumeSerial;
+			index.setCheckpoint(checkpoint);
+
+			if (!snapshot.empty())
+				index.save(snapshot);
+		}
+
+		ntfs::PathResolver paths;
+		auto out = ntfs::make_record_output(format, sink, &paths);
+
+		// The resolver is fed from the index rather than rereading the MFT
+		for (uint64_t recNum = 0; recNum < index.size(); ++recNum) {
+			if (index.flags(recNum) & ntfs::IndexNamed)
+				paths.add(recNum, index.sequence(recNum), index.parent(recNum), index.nameData(recNum), index.nameLength(recNum), index.nameType(recNum), index.isDirectory(recNum));
+		}
+		paths.resolveAll();
+
+		if (!pattern.empty()) {
+			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
+			ntfs::FileSearch search(index);
+			ntfs::SearchQuery query;
+
+			query.pattern = conv.from_bytes(pattern);
+			query.kind = (std::string::npos != pattern.find_first_of("*?")) ? ntfs::MatchKind::Glob : ntfs::MatchKind::Substring;
+
+			// writeFile looks the paths up itself
+			for (auto frn : search.find(query))
+				out->writeFile(index, ntfs::reference_record(frn));
+
+			out->flush();
+			return status;
+		}
+
+		for (uint64_t recNum = 0; recNum < index.size(); ++recNum)
+			out->writeFile(index, recNum);
+
+		out->flush();
+	}
+	catch (const std::exception& e) {
+		std::cout << e.what() << std::endl;
+		status = ERROR_EXCEPTION_IN_RESOURCE_CALL;
+	}
+
+	return status;
+}
+
+int reportFreeSpace(std::shared_ptr<ntfs::BlockDevice> device)
+{
+	int status = ERROR_SUCCESS;
+
+	try {
+		ntfs::VolOps vol(device);
+		auto stats = ntfs::volume_free_space(vol);
+		uint64_t bpc = vol.getGeometry().bytesPerCluster;
 
-				auto fname = EXTRACT_ATTRIBUTE(attr, ntfs::FILENAME_ATTRIBUTE);
-				
-				size = (size < fname->NameLen) ? size : fname->NameLen;
+		std::cout << "Clusters: " << stats.totalClusters << " Free: " << stats.freeClusters << " (" << (stats.freeClusters * bpc) << " bytes)" << std::endl;
+		std::cout << "Free extents: " << stats.freeExtents << " Largest: " << stats.largestFreeLength << " clusters at LCN " << stats.largestFreeLcn << std::endl;
 
-				_snwprintf_s(buf, size, L"%s", fname->Name);
-				std::wcout << L"Filename: " << buf << std::endl;
+		for (size_t i = 0; i < stats.extentCounts.size(); ++i) {
+			if (stats.extentCounts[i])
+				std::cout << "Extents of " << (uint64_t(1) << i) << "+ clusters: " << stats.extentCounts[i] << " (" << stats.extentClusters[i] << " clusters)" << std::endl;
+		}
 
-			});
+		for (size_t i = 0; i < stats.regionUsed.size(); ++i) {
+			uint64_t first = i * stats.regionClusters;
+			uint64_t len = std::min(stats.regionClusters, stats.totalClusters - first);
+			std::cout << "Region at LCN " << first << ": " << (stats.regionUsed[i] * 100 / len) << "% used" << std::endl;
 		}
 	}
 	catch (const std::exception& e) {
@@ -83,16 +210,41 @@ int enumerateMft(std::shared_ptr<void> volume)
 	return status;
 }
 
-int queryChangeJournal(std::shared_ptr<void> volume, std::string& outfile)
+// Writes out every record in the journal, a batch at a time
+template <typename Journal>
+void writeJournal(Journal& journal, ntfs::RecordOutput& out)
+{
+	ntfs::UsnCursor<Journal> cursor(journal, ntfs::default_batch_size, 1);
+
+	for (;;) {
+		auto batch = cursor.read();
+		if (batch.empty())
+			break;
+
+		out.writeUsnBatch(batch.data(), batch.size());
+	}
+
+	out.flush();
+}
+
+int queryChangeJournal(std::shared_ptr<void> volume, ntfs::OutputSink& sink, ntfs::OutputFormat format)
 {
 	int status = ERROR_SUCCESS;
 	try {
 		ntfs::ChangeJournal journal(volume);
-		journal.mapRecords([&](auto p) {
-			DWORD bytes;
-			auto tmp = ntfs::usn_stringify_to_json(p);
-			std::cout << "Record: " << tmp << std::endl;
-		});
+		ntfs::PathResolver paths;
+
+		// Paths come from one pass over the MFT; without raw access to the volume, records go out without them
+		try {
+			ntfs::VolOps vol(std::make_shared<ntfs::VolumeHandleDevice>(volume));
+			paths.build(vol);
+			paths.resolveAll();
+		}
+		catch (const std::exception& e) {
+			std::cout << "[!] Unable to resolve paths: " << e.what() << std::endl;
+		}
+
+		writeJournal(journal, *ntfs::make_record_output(format, sink, &paths));
 	}
 	catch (const std::exception& e) {
 		std::cout << e.what() << std::endl;
@@ -103,6 +255,27 @@ int queryChangeJournal(std::shared_ptr<void> volume, std::string& outfile)
 	return status;
 }
 
+int queryImageJournal(std::shared_ptr<ntfs::BlockDevice> device, ntfs::OutputSink& sink, ntfs::OutputFormat format)
+{
+	int status = ERROR_SUCCESS;
+	try {
+		ntfs::VolOps vol(device);
+		ntfs::NtfsJournal journal(vol);
+		ntfs::PathResolver paths;
+
+		paths.build(vol);
+		paths.resolveAll();
+
+		writeJournal(journal, *ntfs::make_record_output(format, sink, &paths));
+	}
+	catch (const std::exception& e) {
+		std::cout << e.what() << std::endl;
+		status = ERROR_FAIL_FAST_EXCEPTION;
+	}
+
+	return status;
+}
+
 int resetChangeJournal(std::shared_ptr<void> vol)
 {
 	int status = ERROR_SUCCESS;
@@ -172,6 +345,9 @@ static DWORD getActions(ArgParser& ap)
 	if (ap.getAttribute("m") || ap.getAttribute("mft"))
 		tmp |= ActionList::QueryMft;
 
+	if (ap.getAttribute("b") || ap.getAttribute("bitmap"))
+		tmp |= ActionList::FreeSpace;
+
 	return tmp;
 }
 
@@ -182,6 +358,9 @@ int main(int argc, char** argv, char** envp)
 	int status = ERROR_SUCCESS;
 	std::string volume = "\\\\.\\C:";
 	std::string outfile = "out.json";
+	std::string image;
+	std::string snapshot;
+	std::string pattern;
 	std::string outattr;
 	std::string currentOp;
 	DWORD actionMask = 0;
@@ -193,12 +372,25 @@ int main(int argc, char** argv, char** envp)
 		return status;
 	}
 
+	if (ap.getAttribute("o", outfile) || ap.getAttribute("output", outfile)) {
+		// Results go to standard output, so everything else goes to standard error rather than mix in with them
+		if ("-" == outfile) {
+			std::cout.rdbuf(std::cerr.rdbuf());
+			std::wcout.rdbuf(std::wcerr.rdbuf());
+		}
+		std::wcout << L"[*] Output file change requested" << std::endl;
+	}
+
 	if (ap.getAttribute("v", volume) || ap.getAttribute("volume", volume)) {
 		std::wcout << L"[*] Volume change requested" << std::endl;
 	}
 
-	if (ap.getAttribute("o", outfile) || ap.getAttribute("output", outfile)) {
-		std::wcout << L"[*] Output file change requested" << std::endl;
+	if (ap.getAttribute("s", snapshot) || ap.getAttribute("snapshot", snapshot)) {
+		std::wcout << L"[*] MFT snapshot requested" << std::endl;
+	}
+
+	if (ap.getAttribute("f", pattern) || ap.getAttribute("find", pattern)) {
+		std::wcout << L"[*] MFT search requested" << std::endl;
 	}
 
 	actionMask = getActions(ap);
@@ -207,6 +399,53 @@ int main(int argc, char** argv, char** envp)
 		return status;
 	}
 
+	// Results from every action go to the one file, which is only created if there'll be something in it
+	std::unique_ptr<ntfs::OutputSink> sink;
+	ntfs::OutputFormat format = ntfs::output_format(outfile);
+
+	if (actionMask & (ActionList::QueryJournal | ActionList::QueryMft)) {
+		try {
+			sink = ntfs::open_output(outfile);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return ERROR_OPEN_FAILED;
+		}
+	}
+
+	if (ap.getAttribute("i", image) || ap.getAttribute("image", image)) {
+		std::shared_ptr<ntfs::BlockDevice> device;
+
+		if (actionMask & ~(ActionList::QueryJournal | ActionList::QueryMft | ActionList::FreeSpace)) {
+			std::wcout << L"[x] Journals can't be reset or deleted when reading from an image!" << std::endl;
+			return ERROR_NOT_SUPPORTED;
+		}
+
+		std::cout << "[*] Preparing to read image: " << image << std::endl;
+		try {
+			device = ntfs::open_image(image, true);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return ERROR_OPEN_FAILED;
+		}
+
+		if ((actionMask & ActionList::QueryJournal) && ERROR_SUCCESS != (status = queryImageJournal(device, *sink, format))) {
+			std::cout << "[x] Failed to query the journal! Exited with status: " << status << std::endl;
+			return status;
+		}
+
+		if ((actionMask & ActionList::FreeSpace) && ERROR_SUCCESS != (status = reportFreeSpace(device))) {
+			std::cout << "[x] Failed to read the volume bitmap!" << std::endl;
+			return status;
+		}
+
+		if ((actionMask & ActionList::QueryMft) && ERROR_SUCCESS != (status = enumerateMft(device, nullptr, snapshot, pattern, *sink, format)))
+			std::cout << "[x] Failed to enumerate MFT!" << std::endl;
+
+		return status;
+	}
+
 	std::cout << "[*] Preparing to perform requested operations on Volume: " << volume << ", storing results in " << outfile << std::endl;
 	auto vh = CreateFileA(volume.c_str(), ntfs::vol_access_mask, ntfs::vol_share_mask, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_DEVICE, nullptr);
 	if (INVALID_HANDLE_VALUE == vh)
@@ -215,7 +454,7 @@ int main(int argc, char** argv, char** envp)
 	std::shared_ptr<void> vhandle(vh, CloseHandle);
 	if (actionMask & ActionList::QueryJournal) {
 		std::wcout << L"[*] Preparing to enumerate change journal...";
-		if (ERROR_SUCCESS != (status = queryChangeJournal(vhandle, outfile))) {
+		if (ERROR_SUCCESS != (status = queryChangeJournal(vhandle, *sink, format))) {
 			std::wcout << std::endl << L"[x] Failed to query the journal! Exited with status: " << status << std::endl;
 			return status;
 		}
@@ -245,11 +484,37 @@ int main(int argc, char** argv, char** envp)
 	
 	if (actionMask & ActionList::QueryMft) {
 		std::cout << "[*] Preparing to query the mft...";
-		if (ERROR_SUCCESS != (status = enumerateMft(vhandle))) {
+		std::shared_ptr<ntfs::BlockDevice> device;
+		try {
+			device = std::make_shared<ntfs::VolumeHandleDevice>(vhandle);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return ERROR_OPEN_FAILED;
+		}
+
+		if (ERROR_SUCCESS != (status = enumerateMft(device, vhandle, snapshot, pattern, *sink, format))) {
 			std::cout << "[x] Failed to enumerate MFT!" << std::endl;
 			return status;
 		}
 	}
 
+	if (actionMask & ActionList::FreeSpace) {
+		std::cout << "[*] Preparing to read the volume bitmap..." << std::endl;
+		std::shared_ptr<ntfs::BlockDevice> device;
+		try {
+			device = std::make_shared<ntfs::VolumeHandleDevice>(vhandle);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return ERROR_OPEN_FAILED;
+		}
+
+		if (ERROR_SUCCESS != (status = reportFreeSpace(device))) {
+			std::cout << "[x] Failed to read the volume bitmap!" << std::endl;
+			return status;
+		}
+	}
+
 	return status;
 }
\ No newline at end of file
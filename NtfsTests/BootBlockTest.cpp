@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/BlockDevice.hpp"
+#include <cstring>
+
+namespace {
+	// A 4KB cluster volume with 1KB file records and 4KB index blocks
+	ntfs::BOOT_BLOCK make_boot()
+	{
+		ntfs::BOOT_BLOCK boot;
+
+		memset(&boot, 0, sizeof(boot));
+		memcpy(boot.Format, "NTFS    ", sizeof(boot.Format));
+		boot.BytesPerSector = 512;
+		boot.SectorsPerCluster = 8;
+		boot.TotalSectors = 0x100000;
+		boot.MftStartLcn = 4;
+		boot.Mft2StartLcn = 2;
+		boot.ClustersPerFileRecord = 0xF6;	// 2^10
+		boot.ClustersPerIndexBlock = 1;
+		boot.VolumeSerialNo.QuadPart = 0x1234;
+		return boot;
+	}
+}
+
+TEST(BootBlockTest, ParsesGeometry)
+{
+	auto geom = ntfs::parse_boot_block(make_boot());
+
+	EXPECT_EQ(512u, geom.bytesPerSector);
+	EXPECT_EQ(4096u, geom.bytesPerCluster);
+	EXPECT_EQ(1024u, geom.bytesPerFileRecord);
+	EXPECT_EQ(4096u, geom.bytesPerIndexBlock);
+	EXPECT_EQ(0x100000u / 8, geom.totalClusters);
+	EXPECT_EQ(0x1234, geom.volumeSerial);
+}
+
+TEST(BootBlockTest, AcceptsClustersGivenAsAPowerOfTwo)
+{
+	auto boot = make_boot();
+
+	// 2^12 sectors of 512 bytes is the largest cluster NTFS allows
+	boot.SectorsPerCluster = 0xF4;
+	boot.ClustersPerIndexBlock = 0xF4;
+	boot.TotalSectors = 0x1000000;
+
+	auto geom = ntfs::parse_boot_block(boot);
+	EXPECT_EQ(0x200000u, geom.bytesPerCluster);
+	EXPECT_EQ(0x1000u, geom.bytesPerIndexBlock);
+}
+
+TEST(BootBlockTest, RejectsBadClusterSizes)
+{
+	for (uint8_t spc : { 0x00, 0x03, 0xF3, 0xE0, 0x81 }) {
+		auto boot = make_boot();
+
+		boot.SectorsPerCluster = spc;
+		EXPECT_THROW(ntfs::parse_boot_block(boot), std::runtime_error) << "sectors per cluster 0x" << std::hex << +spc;
+	}
+}
+
+TEST(BootBlockTest, RejectsBadRecordAndIndexSizes)
+{
+	// Shifts of 128 and 32, sizes below 256 bytes or above 64KB, and cluster counts that aren't a power of two
+	for (ULONG raw : { 0x80, 0xE0, 0xF9, 0xEF, 0x20, 0x03 }) {
+		auto boot = make_boot();
+
+		boot.ClustersPerFileRecord = raw;
+		EXPECT_THROW(ntfs::parse_boot_block(boot), std::runtime_error) << "file record 0x" << std::hex << raw;
+
+		boot = make_boot();
+		boot.ClustersPerIndexBlock = raw;
+		EXPECT_THROW(ntfs::parse_boot_block(boot), std::runtime_error) << "index block 0x" << std::hex << raw;
+	}
+
+	// File records can't be smaller than a sector
+	auto boot = make_boot();
+	boot.BytesPerSector = 4096;
+	boot.SectorsPerCluster = 1;
+	EXPECT_THROW(ntfs::parse_boot_block(boot), std::runtime_error);
+}
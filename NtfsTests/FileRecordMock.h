@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../ChangeJournal/ntfs_defs.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace mock {
+
+	constexpr size_t file_record_size = 1024;
+
+	/**
+	* Builds an in-use, already fixed up, base FILE record holding a single (Win32) $FILE_NAME attribute.
+	*/
+	inline std::vector<uint8_t> make_file_record(uint64_t parent, const std::basic_string<WCHAR>& name, bool directory = false, uint16_t sequence = 1)
+	{
+		const size_t			attrOffset = 0x38;
+		std::vector<uint8_t>	rec(file_record_size, 0);
+		auto					header = reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data());
+		auto					attr = reinterpret_cast<ntfs::NTFS_RESIDENT_ATTRIBUTE*>(rec.data() + attrOffset);
+		auto					fn = reinterpret_cast<ntfs::FILENAME_ATTRIBUTE*>(rec.data() + attrOffset + sizeof(ntfs::NTFS_RESIDENT_ATTRIBUTE));
+		size_t					valueLen = offsetof(ntfs::FILENAME_ATTRIBUTE, Name) + name.size() * sizeof(WCHAR);
+
+		header->RecordHeader.Type = static_cast<ULONG>(ntfs::NtfsRecordType::File);
+		header->SequenceCount = sequence;
+		header->LinkCount = 1;
+		header->AttributeOffset = attrOffset;
+		header->Flags = static_cast<ntfs::FileRecordFlags>(static_cast<USHORT>(ntfs::FileRecordFlags::RecordInUse) | (directory ? static_cast<USHORT>(ntfs::FileRecordFlags::RecordDirectory) : 0));
+		header->BytesInUse = file_record_size;
+		header->BytesAllocated = file_record_size;
+
+		attr->Attribute.AttributeType = ntfs::NtfsAttributeType::AttributeFileName;
+		attr->Attribute.Length = static_cast<ULONG>((sizeof(ntfs::NTFS_RESIDENT_ATTRIBUTE) + valueLen + 7) & ~static_cast<size_t>(7));
+		attr->ValueLength = static_cast<ULONG>(valueLen);
+		attr->Offset = sizeof(ntfs::NTFS_RESIDENT_ATTRIBUTE);
+
+		fn->DirectoryFileRefNumber = parent;
+		fn->NameLen = static_cast<UCHAR>(name.size());
+		fn->NameType = 1;
+		memcpy(fn->Name, name.data(), name.size() * sizeof(WCHAR));
+
+		// The end of the attributes
+		memset(rec.data() + attrOffset + attr->Attribute.Length, 0xFF, sizeof(ULONG));
+		return rec;
+	}
+
+	inline std::basic_string<WCHAR> wide(const std::string& s)
+	{
+		return std::basic_string<WCHAR>(s.begin(), s.end());
+	}
+
+}
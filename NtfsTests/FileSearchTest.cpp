@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/FileSearch.hpp"
+#include "FileRecordMock.h"
+
+namespace {
+	const uint64_t record_mask = (uint64_t(1) << 48) - 1;
+
+	void add(ntfs::FileIndex& index, uint64_t recNum, const std::string& name)
+	{
+		auto rec = mock::make_file_record(5, mock::wide(name));
+		index.addRecord(recNum, reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data()), rec.size());
+	}
+
+	std::vector<uint64_t> find(ntfs::FileSearch& search, const std::string& pattern, ntfs::MatchKind kind, bool ignoreCase)
+	{
+		ntfs::SearchQuery		query;
+		std::vector<uint64_t>	rows;
+
+		query.pattern = mock::wide(pattern);
+		query.kind = kind;
+		query.ignoreCase = ignoreCase;
+
+		for (auto frn : search.find(query))
+			rows.push_back(frn & record_mask);
+		return rows;
+	}
+
+	class GlobTest : public ::testing::Test {
+	protected:
+		void SetUp() override
+		{
+			const char* names[] = { "readme.txt", "README.TXT", "a.b.c", "abc", "ab", "photo.jpeg", "x", "archive.tar.gz", "AbC" };
+
+			for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+				add(index, i, names[i]);
+
+			trigrams.reset(new ntfs::TrigramIndex(index));
+			trigrams->build();
+		}
+
+		// Checks a pattern both by scanning and through the trigram index
+		void expect(const std::string& pattern, bool ignoreCase, const std::vector<uint64_t>& rows)
+		{
+			ntfs::FileSearch search(index, 2);
+
+			EXPECT_EQ(rows, find(search, pattern, ntfs::MatchKind::Glob, ignoreCase)) << pattern << " scanned";
+
+			search.setTrigramIndex(trigrams.get());
+			EXPECT_EQ(rows, find(search, pattern, ntfs::MatchKind::Glob, ignoreCase)) << pattern << " with trigrams";
+		}
+
+		ntfs::FileIndex						index;
+		std::unique_ptr<ntfs::TrigramIndex>	trigrams;
+	};
+}
+
+TEST_F(GlobTest, MatchesAnyRun)
+{
+	expect("*", false, { 0, 1, 2, 3, 4, 5, 6, 7, 8 });
+	expect("a*", false, { 2, 3, 4, 7 });
+	expect("a*b*c", false, { 2, 3 });
+	expect("*.*.*", false, { 2, 7 });
+	expect("*a", false, {});
+	expect("*e.t?t", false, { 0 });
+}
+
+TEST_F(GlobTest, MatchesAnyOneCharacter)
+{
+	expect("?", false, { 6 });
+	expect("???", false, { 3, 8 });
+	expect("a?c", false, { 3 });
+	expect("photo.jpeg?", false, {});
+	expect("?eadme.txt", false, { 0 });
+}
+
+TEST_F(GlobTest, LetsTrailingStarsMatchNothing)
+{
+	expect("ab*", false, { 3, 4 });
+	expect("ab**", false, { 3, 4 });
+	expect("abc*", false, { 3 });
+	expect("x*", false, { 6 });
+}
+
+TEST_F(GlobTest, FoldsCase)
+{
+	expect("*.txt", false, { 0 });
+	expect("*.txt", true, { 0, 1 });
+	expect("*.TXT", true, { 0, 1 });
+	expect("a?c", true, { 3, 8 });
+	expect("ABC", false, {});
+	expect("ABC", true, { 3, 8 });
+}
+
+TEST(FileSearchTest, FindsLiteralsAtTheEndOfTheNamePool)
+{
+	// The last name sits at the very end of the pool, with its match in the final characters, so
+	// the vector loads would read past the pool if the scan didn't copy it out first
+	for (size_t len = 1; len <= 24; ++len) {
+		ntfs::FileIndex	index;
+		std::string		last = std::string(len, 'q');
+
+		for (uint64_t row = 0; row < 40; ++row)
+			add(index, row, std::string(1 + row % 13, 'z'));
+
+		last.back() = 'E';
+		if (len > 1)
+			last[len - 2] = 'n';
+		add(index, 40, last);
+		index.shrink();
+
+		ntfs::FileSearch search(index, 2);
+		std::string tail = last.substr(len > 1 ? len - 2 : 0);
+
+		EXPECT_EQ(std::vector<uint64_t>({ 40 }), find(search, tail, ntfs::MatchKind::Substring, false)) << last;
+		EXPECT_EQ(std::vector<uint64_t>({ 40 }), find(search, "e", ntfs::MatchKind::Substring, true)) << last;
+		EXPECT_EQ(std::vector<uint64_t>({ 40 }), find(search, last, ntfs::MatchKind::Substring, true)) << last;
+		EXPECT_TRUE(find(search, last + "x", ntfs::MatchKind::Substring, true).empty()) << last;
+		EXPECT_TRUE(find(search, "e", ntfs::MatchKind::Substring, false).empty()) << last;
+	}
+}
+
+TEST(FileSearchTest, FindsLiteralsAtEveryOffset)
+{
+	ntfs::FileIndex index;
+
+	// "Key" at every position of names up to 40 characters long, in every case
+	for (uint64_t row = 0; row < 40; ++row) {
+		std::string name(40, '.');
+
+		name.replace(row, 3, (row & 1) ? "KEY" : "key");
+		name.resize(row + 3 + row % 5, '.');
+		add(index, row, name);
+	}
+	add(index, 40, "ke.y");
+
+	ntfs::FileSearch		search(index, 2);
+	std::vector<uint64_t>	all;
+	std::vector<uint64_t>	lower;
+
+	for (uint64_t row = 0; row < 40; ++row) {
+		all.push_back(row);
+		if (!(row & 1))
+			lower.push_back(row);
+	}
+
+	EXPECT_EQ(all, find(search, "Key", ntfs::MatchKind::Substring, true));
+	EXPECT_EQ(lower, find(search, "key", ntfs::MatchKind::Substring, false));
+}
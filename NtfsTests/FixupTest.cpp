@@ -0,0 +1,144 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/Fixup.hpp"
+#include <cstring>
+#include <vector>
+
+namespace {
+	const size_t	record_size = 1024;
+	const uint16_t	sequence = 0x1234;
+
+	void store16(uint8_t* p, uint16_t v)
+	{
+		memcpy(p, &v, sizeof(v));
+	}
+
+	uint16_t load16(const uint8_t* p)
+	{
+		uint16_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	uint16_t saved(size_t stride)
+	{
+		return static_cast<uint16_t>(0xA0A0 + stride);
+	}
+
+	// Writes a record as it would be read off the disk: the end of every stride replaced with the update
+	// sequence number, whose original values are saved in the update sequence array
+	void make_record(uint8_t* rec, ntfs::NtfsRecordType type = ntfs::NtfsRecordType::File)
+	{
+		auto header = reinterpret_cast<ntfs::NTFS_RECORD_HEADER*>(rec);
+
+		memset(rec, 0, record_size);
+		header->Type = static_cast<ULONG>(type);
+		header->UsaOffset = 0x30;
+		header->UsaCount = record_size / ntfs::update_sequence_stride + 1;
+
+		store16(rec + header->UsaOffset, sequence);
+		for (size_t s = 1; s < header->UsaCount; ++s) {
+			store16(rec + header->UsaOffset + s * sizeof(USHORT), saved(s));
+			store16(rec + s * ntfs::update_sequence_stride - sizeof(USHORT), sequence);
+		}
+	}
+
+	ntfs::NTFS_RECORD_HEADER* header(uint8_t* rec)
+	{
+		return reinterpret_cast<ntfs::NTFS_RECORD_HEADER*>(rec);
+	}
+
+	void expect_restored(const uint8_t* rec)
+	{
+		for (size_t s = 1; s <= record_size / ntfs::update_sequence_stride; ++s)
+			EXPECT_EQ(saved(s), load16(rec + s * ntfs::update_sequence_stride - sizeof(USHORT)));
+	}
+}
+
+TEST(FixupTest, RestoresStrideTrailers)
+{
+	std::vector<uint8_t> rec(record_size);
+
+	make_record(rec.data());
+	ASSERT_TRUE(ntfs::apply_fixup(rec.data(), record_size));
+	expect_restored(rec.data());
+}
+
+TEST(FixupTest, RejectsTornRecords)
+{
+	std::vector<uint8_t> rec(record_size);
+
+	make_record(rec.data());
+	store16(&rec[record_size - sizeof(USHORT)], sequence + 1);
+
+	auto before = rec;
+	EXPECT_FALSE(ntfs::apply_fixup(rec.data(), record_size));
+	EXPECT_EQ(before, rec);
+}
+
+TEST(FixupTest, RejectsMalformedSequenceArrays)
+{
+	std::vector<uint8_t> rec(record_size);
+
+	// One entry short of covering the record
+	make_record(rec.data());
+	header(rec.data())->UsaCount--;
+	EXPECT_FALSE(ntfs::apply_fixup(rec.data(), record_size));
+
+	// No room for a saved value at all
+	make_record(rec.data());
+	header(rec.data())->UsaCount = 1;
+	EXPECT_FALSE(ntfs::apply_fixup(rec.data(), ntfs::update_sequence_stride));
+
+	// Running off the end of the record
+	make_record(rec.data());
+	header(rec.data())->UsaOffset = record_size - sizeof(USHORT);
+	EXPECT_FALSE(ntfs::apply_fixup(rec.data(), record_size));
+}
+
+TEST(FixupTest, ClassifiesEveryRecordInABatch)
+{
+	// Long enough to cover both the four-at-a-time signature check and the records left over after it
+	const size_t				count = 11;
+	std::vector<uint8_t>		buf(count * record_size);
+	std::vector<ntfs::RecordStatus>	status(count, ntfs::RecordStatus::Unused);
+
+	for (size_t i = 0; i < count; ++i)
+		make_record(&buf[i * record_size]);
+
+	make_record(&buf[1 * record_size], ntfs::NtfsRecordType::Bad);
+	memset(&buf[2 * record_size], 0, record_size);
+	store16(&buf[5 * record_size + ntfs::update_sequence_stride - sizeof(USHORT)], sequence - 1);
+	header(&buf[6 * record_size])->UsaOffset = 0x31;
+	header(&buf[9 * record_size])->UsaCount = 2;
+	make_record(&buf[10 * record_size], ntfs::NtfsRecordType::Index);
+
+	auto before = buf;
+	EXPECT_EQ(5u, ntfs::apply_fixups(buf.data(), count, record_size, ntfs::NtfsRecordType::File, status.data()));
+
+	const ntfs::RecordStatus expected[count] = {
+		ntfs::RecordStatus::Valid, ntfs::RecordStatus::Bad, ntfs::RecordStatus::Empty, ntfs::RecordStatus::Valid,
+		ntfs::RecordStatus::Valid, ntfs::RecordStatus::Torn, ntfs::RecordStatus::Malformed, ntfs::RecordStatus::Valid,
+		ntfs::RecordStatus::Valid, ntfs::RecordStatus::Malformed, ntfs::RecordStatus::Empty
+	};
+
+	for (size_t i = 0; i < count; ++i) {
+		const uint8_t* rec = &buf[i * record_size];
+
+		EXPECT_EQ(expected[i], status[i]) << "record " << i;
+		if (ntfs::RecordStatus::Valid == status[i])
+			expect_restored(rec);
+		else
+			EXPECT_EQ(0, memcmp(rec, &before[i * record_size], record_size)) << "record " << i;
+	}
+}
+
+TEST(FixupTest, RejectsPartialStrides)
+{
+	std::vector<uint8_t>	buf(record_size);
+	ntfs::RecordStatus		status = ntfs::RecordStatus::Unused;
+
+	make_record(buf.data());
+	EXPECT_EQ(0u, ntfs::apply_fixups(buf.data(), 1, record_size - 8, ntfs::NtfsRecordType::File, &status));
+	EXPECT_EQ(0u, ntfs::apply_fixups(buf.data(), 1, 0, ntfs::NtfsRecordType::File, &status));
+	EXPECT_EQ(ntfs::RecordStatus::Unused, status);
+}
@@ -0,0 +1,233 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/FileIndex.hpp"
+#include "../ChangeJournal/IndexSnapshot.hpp"
+#include "FileRecordMock.h"
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+namespace {
+	void add(ntfs::FileIndex& index, uint64_t recNum, const std::string& name, uint64_t parent = 5, bool directory = false, uint16_t sequence = 1)
+	{
+		auto rec = mock::make_file_record(parent, mock::wide(name), directory, sequence);
+		index.addRecord(recNum, reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data()), rec.size());
+	}
+
+	// A few directories and files, with gaps, a removed file and a renamed one (which leaves a dead name behind)
+	void build(ntfs::FileIndex& index)
+	{
+		ntfs::IndexCheckpoint checkpoint;
+
+		add(index, 5, ".", 5, true, 5);
+		add(index, 40, "dir", 5, true, 2);
+		add(index, 41, "readme.txt", 40);
+		add(index, 42, "gone.tmp", 40);
+		add(index, 60, "photo.jpeg", 5, false, 7);
+		for (uint64_t recNum = 100; recNum < 300; recNum += 3)
+			add(index, recNum, "file" + std::to_string(recNum) + ".dat", 40, false, static_cast<uint16_t>(recNum));
+
+		index.remove(42);
+		auto rec = mock::make_file_record(5, mock::wide("renamed.txt"));
+		index.refresh(41, reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data()), rec.size());
+
+		checkpoint.volumeSerial = 0x1234567890ll;
+		checkpoint.journalId = 0x01D0000000000001ull;
+		checkpoint.lastUsn = 0x7654321;
+		index.setCheckpoint(checkpoint);
+	}
+
+	void expect_same(const ntfs::FileIndex& expected, const ntfs::FileIndex& actual)
+	{
+		ASSERT_EQ(expected.size(), actual.size());
+		EXPECT_EQ(expected.fileCount(), actual.fileCount());
+		EXPECT_EQ(expected.checkpoint().volumeSerial, actual.checkpoint().volumeSerial);
+		EXPECT_EQ(expected.checkpoint().journalId, actual.checkpoint().journalId);
+		EXPECT_EQ(expected.checkpoint().lastUsn, actual.checkpoint().lastUsn);
+
+		for (uint64_t recNum = 0; recNum < expected.size(); ++recNum) {
+			ASSERT_EQ(expected.contains(recNum), actual.contains(recNum)) << recNum;
+			EXPECT_EQ(expected.flags(recNum), actual.flags(recNum)) << recNum;
+			EXPECT_EQ(expected.frn(recNum), actual.frn(recNum)) << recNum;
+			EXPECT_EQ(expected.parent(recNum), actual.parent(recNum)) << recNum;
+			EXPECT_EQ(expected.nameType(recNum), actual.nameType(recNum)) << recNum;
+			EXPECT_EQ(expected.name(recNum), actual.name(recNum)) << recNum;
+			EXPECT_EQ(expected.attributes(recNum), actual.attributes(recNum)) << recNum;
+			EXPECT_EQ(expected.dataSize(recNum), actual.dataSize(recNum)) << recNum;
+			EXPECT_EQ(expected.allocatedSize(recNum), actual.allocatedSize(recNum)) << recNum;
+			EXPECT_EQ(expected.creationTime(recNum), actual.creationTime(recNum)) << recNum;
+			EXPECT_EQ(expected.changeTime(recNum), actual.changeTime(recNum)) << recNum;
+			EXPECT_EQ(expected.lastWriteTime(recNum), actual.lastWriteTime(recNum)) << recNum;
+			EXPECT_EQ(expected.lastAccessTime(recNum), actual.lastAccessTime(recNum)) << recNum;
+		}
+	}
+
+	std::vector<char> read_file(const std::string& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	void write_file(const std::string& path, const std::vector<char>& bytes)
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+	}
+
+	class IndexSnapshotTest : public ::testing::Test {
+	protected:
+		void SetUp() override
+		{
+			path = ::testing::TempDir() + "IndexSnapshotTest_" + ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".idx";
+			build(index);
+			index.save(path);
+			saved = read_file(path);
+			ASSERT_GE(saved.size(), sizeof(ntfs::SnapshotHeader));
+		}
+
+		void TearDown() override
+		{
+			std::remove(path.c_str());
+		}
+
+		ntfs::SnapshotHeader& header(std::vector<char>& bytes)
+		{
+			return *reinterpret_cast<ntfs::SnapshotHeader*>(bytes.data());
+		}
+
+		// Writes a damaged copy of the snapshot, and expects loading it to fail (leaving the index as it was)
+		void expect_rejected(const std::vector<char>& bytes, bool verify = true)
+		{
+			ntfs::FileIndex loaded;
+
+			add(loaded, 7, "untouched");
+			write_file(path, bytes);
+			EXPECT_THROW(loaded.load(path, verify), std::runtime_error);
+			EXPECT_EQ(1u, loaded.fileCount());
+			EXPECT_EQ(mock::wide("untouched"), loaded.name(7));
+		}
+
+		std::string			path;
+		ntfs::FileIndex		index;
+		std::vector<char>	saved;
+	};
+}
+
+TEST_F(IndexSnapshotTest, RoundTrips)
+{
+	ntfs::FileIndex loaded;
+
+	loaded.load(path);
+	expect_same(index, loaded);
+
+	// The header agrees with what was saved
+	auto bytes = saved;
+	EXPECT_EQ(index.size(), header(bytes).RecordCount);
+	EXPECT_EQ(saved.size(), header(bytes).FileSize);
+	for (auto& col : header(bytes).Columns)
+		EXPECT_EQ(0u, col.Offset % ntfs::snapshot_alignment);
+
+	// Changing the loaded index copies it out of the snapshot, which stays as it was
+	add(loaded, 300, "new.txt");
+	EXPECT_TRUE(loaded.contains(300));
+	EXPECT_EQ(mock::wide("renamed.txt"), loaded.name(41));
+	EXPECT_EQ(saved, read_file(path));
+
+	// And a saved, loaded index saves the same bytes again
+	ntfs::FileIndex reloaded;
+	reloaded.load(path, false);
+	reloaded.save(path + ".again");
+	EXPECT_EQ(saved, read_file(path + ".again"));
+	std::remove((path + ".again").c_str());
+}
+
+TEST_F(IndexSnapshotTest, RoundTripsAnEmptyIndex)
+{
+	ntfs::FileIndex empty;
+	ntfs::FileIndex loaded;
+
+	add(loaded, 3, "replaced");
+	empty.save(path);
+	loaded.load(path);
+	expect_same(empty, loaded);
+	EXPECT_EQ(0u, loaded.size());
+}
+
+TEST_F(IndexSnapshotTest, RejectsTruncatedSnapshots)
+{
+	for (size_t len : { size_t(0), size_t(1), sizeof(ntfs::SnapshotHeader) - 1, sizeof(ntfs::SnapshotHeader), saved.size() / 2, saved.size() - 1 })
+		expect_rejected(std::vector<char>(saved.begin(), saved.begin() + len));
+
+	// Nor can there be anything past the end
+	auto longer = saved;
+	longer.resize(saved.size() + ntfs::snapshot_alignment, 0);
+	expect_rejected(longer);
+}
+
+TEST_F(IndexSnapshotTest, RejectsCorruptHeaders)
+{
+	auto bytes = saved;
+
+	// Every byte of the header is covered by one check or another
+	for (size_t i = 0; i < offsetof(ntfs::SnapshotHeader, Reserved); ++i) {
+		bytes = saved;
+		bytes[i] ^= 0x10;
+		expect_rejected(bytes);
+	}
+
+	// A header that's been fixed up to match its checksum must still make sense, without the columns'
+	// checksums to fall back on
+	auto resealed = [&](void (*damage)(ntfs::SnapshotHeader&)) {
+		bytes = saved;
+		damage(header(bytes));
+		header(bytes).HeaderChecksum = ntfs::snapshot_header_checksum(header(bytes));
+		expect_rejected(bytes, false);
+	};
+
+	resealed([](ntfs::SnapshotHeader& h) { h.Version = ntfs::snapshot_version + 1; });
+	resealed([](ntfs::SnapshotHeader& h) { h.HeaderSize -= 8; });
+	resealed([](ntfs::SnapshotHeader& h) { h.ByteOrder = 0x04030201; });
+	resealed([](ntfs::SnapshotHeader& h) { h.FileSize += 1; });
+	resealed([](ntfs::SnapshotHeader& h) { h.Columns[ntfs::SnapshotParent].Offset += 8; });
+	resealed([](ntfs::SnapshotHeader& h) { h.Columns[ntfs::SnapshotNames].Bytes += ntfs::snapshot_alignment; });
+	resealed([](ntfs::SnapshotHeader& h) { h.Columns[ntfs::SnapshotSequence].Offset = 0; });
+	resealed([](ntfs::SnapshotHeader& h) { h.Columns[ntfs::SnapshotFlags].ElementSize = 0; });
+	resealed([](ntfs::SnapshotHeader& h) { h.Columns[ntfs::SnapshotDataSize].Bytes -= 1; });
+}
+
+TEST_F(IndexSnapshotTest, RejectsCorruptColumns)
+{
+	auto bytes = saved;
+	auto names = header(bytes).Columns[ntfs::SnapshotNames];
+
+	bytes[static_cast<size_t>(names.Offset + names.Bytes / 2)] ^= 0x01;
+	expect_rejected(bytes);
+
+	// Only the header is checked without verify
+	ntfs::FileIndex loaded;
+	write_file(path, bytes);
+	EXPECT_NO_THROW(loaded.load(path, false));
+	EXPECT_EQ(index.fileCount(), loaded.fileCount());
+}
+
+TEST_F(IndexSnapshotTest, ValidatesHeadersOnTheirOwn)
+{
+	auto bytes = saved;
+
+	EXPECT_NO_THROW(ntfs::validate_snapshot_header(header(bytes), saved.size()));
+	EXPECT_THROW(ntfs::validate_snapshot_header(header(bytes), saved.size() + 1), std::runtime_error);
+
+	// Columns are checked before any of them is looked at
+	auto resealed = [&](void (*damage)(ntfs::SnapshotColumn&)) {
+		bytes = saved;
+		damage(header(bytes).Columns[ntfs::SnapshotAllocSize]);
+		header(bytes).HeaderChecksum = ntfs::snapshot_header_checksum(header(bytes));
+		EXPECT_THROW(ntfs::validate_snapshot_header(header(bytes), saved.size()), std::runtime_error);
+	};
+
+	resealed([](ntfs::SnapshotColumn& col) { col.Offset += 8; });
+	resealed([](ntfs::SnapshotColumn& col) { col.Offset = sizeof(ntfs::SnapshotHeader) - ntfs::snapshot_alignment; });
+	resealed([](ntfs::SnapshotColumn& col) { col.Bytes = ~0ull; });
+	resealed([](ntfs::SnapshotColumn& col) { col.ElementSize = 0; });
+	resealed([](ntfs::SnapshotColumn& col) { col.Bytes -= 1; });
+}
@@ -0,0 +1,158 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/JsonWriter.hpp"
+#include "../ChangeJournal/RecordJson.hpp"
+#include "../ChangeJournal/TextFormat.hpp"
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+	std::string json_string(std::initializer_list<uint16_t> units)
+	{
+		std::vector<WCHAR>	s(units.begin(), units.end());
+		ntfs::JsonWriter	json;
+
+		json.value(s.data(), s.size());
+		return json.str();
+	}
+
+	std::string json_string(const std::string& s)
+	{
+		ntfs::JsonWriter json;
+
+		json.value(s.data(), s.size());
+		return json.str();
+	}
+
+	std::string utf8(std::initializer_list<uint16_t> units)
+	{
+		std::vector<WCHAR>	s(units.begin(), units.end());
+		std::vector<char>	out(s.size() * 3);
+		char*				end = ntfs::format_utf8(out.data(), s.data(), s.size(), [](char* p, char c) { *p = c; return p + 1; });
+
+		return std::string(out.data(), end);
+	}
+}
+
+TEST(JsonWriterTest, PlacesCommas)
+{
+	ntfs::JsonWriter json;
+
+	json.beginObject().key("a").value(1).key("b").beginArray().value(true).value(false).null().beginObject().endObject().endArray();
+	json.key("c").beginObject().key("d").value(-2).endObject().endObject().endLine();
+	json.beginArray().endArray().endLine();
+
+	EXPECT_EQ("{\"a\":1,\"b\":[true,false,null,{}],\"c\":{\"d\":-2}}\n[]\n", json.str());
+}
+
+TEST(JsonWriterTest, FormatsIntegers)
+{
+	ntfs::JsonWriter json;
+
+	json.beginArray();
+	json.value(0).value(9).value(10).value(99).value(100).value(-1);
+	json.value(std::numeric_limits<int64_t>::min()).value(std::numeric_limits<uint64_t>::max());
+	json.value(static_cast<uint8_t>(200)).value(static_cast<int16_t>(-300));
+	json.endArray();
+
+	EXPECT_EQ("[0,9,10,99,100,-1,-9223372036854775808,18446744073709551615,200,-300]", json.str());
+}
+
+TEST(JsonWriterTest, FormatsHexValues)
+{
+	ntfs::JsonWriter json;
+
+	json.beginArray().hexValue(0x2a).hexValue(0x0123456789abcdefull, 0xfedcba9876543210ull).endArray();
+
+	EXPECT_EQ("[\"0x000000000000002a\",\"0x0123456789abcdeffedcba9876543210\"]", json.str());
+}
+
+TEST(JsonWriterTest, EscapesControlCharacters)
+{
+	EXPECT_EQ("\"\\\"\\\\/\\b\\f\\n\\r\\t\\u0000\\u0001\\u001f\x7f\"", json_string(std::string("\"\\/\b\f\n\r\t\0\x01\x1f\x7f", 12)));
+	EXPECT_EQ("\"\\\"\\\\\\b\\f\\n\\r\\t\\u0000\\u0001\\u001f\x7f\"", json_string({ '"', '\\', '\b', '\f', '\n', '\r', '\t', 0, 1, 0x1F, 0x7F }));
+
+	// UTF-8 passes through untouched
+	EXPECT_EQ("\"caf\xC3\xA9\"", json_string("caf\xC3\xA9"));
+}
+
+TEST(JsonWriterTest, TranscodesUtf16)
+{
+	EXPECT_EQ("A", utf8({ 0x41 }));
+	EXPECT_EQ("\xC2\x80\xC3\xA9\xDF\xBF", utf8({ 0x80, 0xE9, 0x7FF }));
+	EXPECT_EQ("\xE0\xA0\x80\xE2\x82\xAC\xEF\xBF\xBF", utf8({ 0x800, 0x20AC, 0xFFFF }));
+
+	// U+1F600 and U+10FFFF, as surrogate pairs
+	EXPECT_EQ("\xF0\x9F\x98\x80", utf8({ 0xD83D, 0xDE00 }));
+	EXPECT_EQ("\xF4\x8F\xBF\xBF", utf8({ 0xDBFF, 0xDFFF }));
+	EXPECT_EQ("\"a\xF0\x9F\x98\x80z\"", json_string({ 'a', 0xD83D, 0xDE00, 'z' }));
+}
+
+TEST(JsonWriterTest, ReplacesUnpairedSurrogates)
+{
+	const std::string replacement = "\xEF\xBF\xBD";
+
+	// A high surrogate at the end, or followed by anything but a low one
+	EXPECT_EQ("a" + replacement, utf8({ 'a', 0xD83D }));
+	EXPECT_EQ(replacement + "b", utf8({ 0xD83D, 'b' }));
+	EXPECT_EQ(replacement + "\xF0\x9F\x98\x80", utf8({ 0xD83D, 0xD83D, 0xDE00 }));
+
+	// A low surrogate on its own, or ahead of its high one
+	EXPECT_EQ(replacement, utf8({ 0xDE00 }));
+	EXPECT_EQ(replacement + replacement, utf8({ 0xDE00, 0xD83D }));
+
+	// The code unit after a lone surrogate is still escaped
+	EXPECT_EQ("\"" + replacement + "\\\"\"", json_string({ 0xDC00, '"' }));
+}
+
+TEST(JsonWriterTest, GrowsForTheWorstCase)
+{
+	// Every code unit escaped, well past the initial capacity
+	std::vector<WCHAR>	s(5000, 1);
+	ntfs::JsonWriter	json(64);
+
+	json.beginArray().value(s.data(), s.size()).value(std::string(3000, '\n').data(), 3000).endArray();
+
+	std::string expected = "[\"";
+	for (size_t i = 0; i < s.size(); ++i)
+		expected += "\\u0001";
+	expected += "\",\"";
+	for (size_t i = 0; i < 3000; ++i)
+		expected += "\\n";
+	expected += "\"]";
+
+	EXPECT_EQ(expected, json.str());
+
+	// clear() keeps the buffer, and starts a fresh document
+	json.clear();
+	json.value(1);
+	EXPECT_EQ("1", json.str());
+}
+
+TEST(JsonWriterTest, WritesUsnRecords)
+{
+	const WCHAR			name[] = { 'a', '"', 0xD83D, 0xDE00, 0xDC00 };
+	std::vector<uint8_t>	buf((offsetof(USN_RECORD_V2, FileName) + sizeof(name) + 7) & ~7, 0);
+	auto					rec = reinterpret_cast<USN_RECORD_V2*>(buf.data());
+
+	rec->RecordLength = static_cast<DWORD>(buf.size());
+	rec->MajorVersion = 2;
+	rec->FileReferenceNumber = 0x0001000000000024ull;
+	rec->ParentFileReferenceNumber = 0x0005000000000005ull;
+	rec->Usn = 4096;
+	rec->TimeStamp.QuadPart = 132000000000000000ll;
+	rec->Reason = 0x80000100;
+	rec->FileAttributes = 0x20;
+	rec->FileNameLength = sizeof(name);
+	rec->FileNameOffset = offsetof(USN_RECORD_V2, FileName);
+	memcpy(rec->FileName, name, sizeof(name));
+
+	ntfs::JsonWriter	json;
+	ntfs::UsnRecordJson	writer;
+
+	ASSERT_TRUE(writer.write(json, reinterpret_cast<const USN_RECORD_COMMON_HEADER*>(rec)));
+	EXPECT_EQ("{\"Filename\":\"a\\\"\xF0\x9F\x98\x80\xEF\xBF\xBD\",\"MajorVersion\":2,\"Usn\":4096,\"TimeStamp\":132000000000000000,"
+		"\"Reason\":2147483904,\"SourceInfo\":0,\"SecurityId\":0,\"FileAttributes\":32,"
+		"\"FileReferenceNumber\":281474976710692,\"ParentFileReferenceNumber\":1407374883553285}\n", json.str());
+}
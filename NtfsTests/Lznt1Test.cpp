@@ -0,0 +1,237 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/Lznt1.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+	// The bits a back reference at pos (bytes into its chunk) spends on its length, worked out the way the
+	// format describes it rather than the way the decoder does
+	unsigned length_bits(size_t pos)
+	{
+		unsigned bits = 12;
+
+		for (size_t i = pos - 1; i >= 0x10; i >>= 1)
+			--bits;
+		return bits;
+	}
+
+	// Builds one compressed chunk token by token, along with what it should decompress to
+	class ChunkWriter {
+	public:
+		void literal(const std::string& s)
+		{
+			for (char c : s) {
+				flag(false);
+				data.push_back(static_cast<uint8_t>(c));
+				plain.push_back(static_cast<uint8_t>(c));
+			}
+		}
+
+		void literals(size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				literal(std::string(1, static_cast<char>('A' + (plain.size() % 53))));
+		}
+
+		void match(size_t offset, size_t len)
+		{
+			unsigned bits = length_bits(plain.size());
+			uint16_t token = static_cast<uint16_t>(((offset - 1) << bits) | (len - 3));
+
+			flag(true);
+			data.push_back(static_cast<uint8_t>(token));
+			data.push_back(static_cast<uint8_t>(token >> 8));
+
+			// One byte at a time, so overlapping references repeat themselves
+			for (size_t i = 0; i < len; ++i)
+				plain.push_back(plain[plain.size() - offset]);
+		}
+
+		std::vector<uint8_t> chunk() const
+		{
+			std::vector<uint8_t> out;
+			uint16_t header = static_cast<uint16_t>(0xB000 | (data.size() - 1));
+
+			out.push_back(static_cast<uint8_t>(header));
+			out.push_back(static_cast<uint8_t>(header >> 8));
+			out.insert(out.end(), data.begin(), data.end());
+			return out;
+		}
+
+		const std::vector<uint8_t>& expected() const
+		{
+			return plain;
+		}
+
+	private:
+		void flag(bool set)
+		{
+			if (0 == (tokens++ % 8)) {
+				flagPos = data.size();
+				data.push_back(0);
+			}
+			if (set)
+				data[flagPos] |= static_cast<uint8_t>(1 << ((tokens - 1) % 8));
+		}
+
+		std::vector<uint8_t>	data;
+		std::vector<uint8_t>	plain;
+		size_t					flagPos = 0;
+		size_t					tokens = 0;
+	};
+
+	std::vector<uint8_t> decompress(const std::vector<uint8_t>& in, size_t outLen = 4 * ntfs::lznt1_chunk_size)
+	{
+		std::vector<uint8_t>	out(outLen + 16, 0xCC);
+		size_t					written = ntfs::lznt1_decompress(in.data(), in.size(), out.data(), outLen);
+
+		// Nothing past outLen is ever touched
+		for (size_t i = outLen; i < out.size(); ++i)
+			EXPECT_EQ(0xCC, out[i]);
+
+		out.resize(written);
+		return out;
+	}
+
+	std::vector<uint8_t> bytes(const std::string& s)
+	{
+		return std::vector<uint8_t>(s.begin(), s.end());
+	}
+}
+
+TEST(Lznt1Test, DecodesAKnownChunk)
+{
+	// Eight literals, then eight bytes from eight back (offset 8, length 8, 12 length bits)
+	const std::vector<uint8_t> in = {
+		0x0B, 0xB0,
+		0x00, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h',
+		0x01, 0x05, 0x70
+	};
+
+	EXPECT_EQ(bytes("abcdefghabcdefgh"), decompress(in));
+}
+
+TEST(Lznt1Test, MovesTheSplitAtEveryBoundary)
+{
+	// A reference right at a boundary still uses the old split; one byte later, the offset gains a bit.
+	// Reaching all the way back to the start of the chunk uses the offset's top bit.
+	for (size_t boundary = 0x10; boundary <= 0x800; boundary <<= 1) {
+		for (size_t pos : { boundary, boundary + 1 }) {
+			ChunkWriter w;
+
+			w.literals(pos);
+			w.match(pos, 3);
+			w.match(1, (1u << length_bits(pos + 3)) + 2);
+
+			EXPECT_EQ(w.expected(), decompress(w.chunk())) << "back reference at 0x" << std::hex << pos;
+		}
+	}
+}
+
+TEST(Lznt1Test, RepeatsOverlappingReferences)
+{
+	for (size_t offset = 1; offset < 8; ++offset) {
+		ChunkWriter w;
+
+		w.literal(std::string("abcdefg").substr(0, offset));
+		w.match(offset, 37);
+		w.literal("z");
+		w.match(offset + 1, 9);
+
+		EXPECT_EQ(w.expected(), decompress(w.chunk())) << "offset " << offset;
+	}
+
+	// A single byte repeated to the end of the chunk
+	ChunkWriter w;
+	w.literal("x");
+	w.match(1, ntfs::lznt1_chunk_size - 1);
+
+	EXPECT_EQ(std::vector<uint8_t>(ntfs::lznt1_chunk_size, 'x'), decompress(w.chunk()));
+}
+
+TEST(Lznt1Test, CopiesLongReferencesNearTheEndOfTheOutput)
+{
+	// Word-at-a-time copies mustn't overshoot the output buffer
+	ChunkWriter w;
+	w.literals(24);
+	w.match(9, 13);
+	w.match(24, 20);
+
+	for (size_t outLen = w.expected().size() - 8; outLen <= w.expected().size(); ++outLen) {
+		auto out = decompress(w.chunk(), outLen);
+
+		EXPECT_EQ(std::vector<uint8_t>(w.expected().begin(), w.expected().begin() + outLen), out);
+	}
+}
+
+TEST(Lznt1Test, CopiesUncompressedChunks)
+{
+	std::vector<uint8_t> in = { 0xFF, 0x3F };
+	std::vector<uint8_t> expected;
+
+	for (size_t i = 0; i < ntfs::lznt1_chunk_size; ++i)
+		expected.push_back(static_cast<uint8_t>(i * 7));
+	in.insert(in.end(), expected.begin(), expected.end());
+
+	EXPECT_EQ(expected, decompress(in));
+}
+
+TEST(Lznt1Test, PadsShortChunksWithZeros)
+{
+	ChunkWriter	first;
+	ChunkWriter	last;
+
+	first.literal("abc");
+	first.match(3, 13);
+	last.literal("xyz");
+	last.match(1, 5);
+
+	auto in = first.chunk();
+	auto tail = last.chunk();
+	in.insert(in.end(), tail.begin(), tail.end());
+
+	// Every chunk but the last stands for a whole chunk of output
+	auto expected = first.expected();
+	expected.resize(ntfs::lznt1_chunk_size, 0);
+	expected.insert(expected.end(), last.expected().begin(), last.expected().end());
+
+	EXPECT_EQ(expected, decompress(in));
+
+	// ... and so does a short uncompressed chunk
+	std::vector<uint8_t> raw = { 0x02, 0x30, 'a', 'b', 'c', 0x01, 0x30, 'd', 'e' };
+	expected = bytes("abc");
+	expected.resize(ntfs::lznt1_chunk_size, 0);
+	expected.push_back('d');
+	expected.push_back('e');
+
+	EXPECT_EQ(expected, decompress(raw));
+}
+
+TEST(Lznt1Test, StopsAtAZeroHeader)
+{
+	ChunkWriter w;
+	w.literal("hello");
+
+	auto in = w.chunk();
+	in.push_back(0);
+	in.push_back(0);
+	in.insert(in.end(), { 0x01, 0x30, 'n', 'o' });
+
+	EXPECT_EQ(bytes("hello"), decompress(in));
+}
+
+TEST(Lznt1Test, RejectsMalformedStreams)
+{
+	// A reference before anything has been decoded
+	EXPECT_THROW(decompress({ 0x02, 0xB0, 0x01, 0x00, 0x00 }), std::runtime_error);
+
+	// A reference that reaches one byte further back than the chunk goes
+	EXPECT_THROW(decompress({ 0x04, 0xB0, 0x02, 'a', 0x00, 0x10 }), std::runtime_error);
+
+	// A reference cut short by the end of its chunk
+	EXPECT_THROW(decompress({ 0x02, 0xB0, 0x02, 'a', 0x00 }), std::runtime_error);
+
+	// A chunk that claims more data than there is
+	EXPECT_THROW(decompress({ 0x10, 0xB0, 0x00, 'a', 'b' }), std::runtime_error);
+	EXPECT_THROW(decompress({ 0xFF, 0x3F, 'a' }), std::runtime_error);
+}
@@ -0,0 +1,211 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/NtfsJournal.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace {
+	// Where the synthetic piece of $J starts; the Usn of each record is its offset in the stream
+	const uint64_t journal_base = 0x20000;
+
+	struct Record {
+		size_t	pos;
+		size_t	length;
+		WORD	version;
+	};
+
+	/**
+	* A few pages of $J: records (of an exact length) wherever they're put, zeroes everywhere else.
+	*/
+	class JournalPages {
+	public:
+		explicit JournalPages(size_t len) : data(len, 0) {}
+
+		// Writes a record at pos, and returns the position past it
+		size_t add(size_t pos, WORD version, size_t length, bool valid = true)
+		{
+			write(pos, version, length, journal_base + pos);
+			if (valid)
+				records.push_back({ pos, length, version });
+			return pos + length;
+		}
+
+		// Fills the rest of pos's page with one record
+		size_t addToPageEnd(size_t pos, WORD version)
+		{
+			return add(pos, version, ntfs::usn_page_size - (pos % ntfs::usn_page_size));
+		}
+
+		// A record that parses, but belongs to some older journal that used to be here
+		void addStale(size_t pos, WORD version, size_t length)
+		{
+			write(pos, version, length, journal_base + pos + 0x100000);
+		}
+
+		// What compact_usn_records should leave behind, given the piece of the stream it was handed
+		std::vector<uint8_t> expected(size_t start, size_t len, WORD minVersion, WORD maxVersion) const
+		{
+			std::vector<uint8_t> out;
+
+			for (auto& rec : records) {
+				if (rec.pos >= start && rec.pos + rec.length <= start + len && rec.version >= minVersion && rec.version <= maxVersion)
+					out.insert(out.end(), data.begin() + rec.pos, data.begin() + rec.pos + rec.length);
+			}
+			return out;
+		}
+
+		std::vector<uint8_t> compact(size_t start, size_t len, WORD minVersion = 2, WORD maxVersion = 3) const
+		{
+			std::vector<uint8_t> out(data.begin() + start, data.begin() + start + len);
+
+			out.resize(ntfs::compact_usn_records(journal_base + start, out.data(), len, minVersion, maxVersion));
+			return out;
+		}
+
+		std::vector<uint8_t>	data;
+		std::vector<Record>		records;
+
+	private:
+		void write(size_t pos, WORD version, size_t length, uint64_t usn)
+		{
+			uint8_t* p = data.data() + pos;
+
+			ASSERT_LE(pos + length, data.size());
+			memset(p, 0, length);
+			if (4 == version) {
+				auto rec = reinterpret_cast<USN_RECORD_V4*>(p);
+
+				rec->Header.RecordLength = static_cast<DWORD>(length);
+				rec->Header.MajorVersion = 4;
+				rec->Usn = static_cast<USN>(usn);
+				rec->NumberOfExtents = static_cast<WORD>((length - offsetof(USN_RECORD_V4, Extents)) / sizeof(USN_RECORD_EXTENT));
+				rec->ExtentSize = sizeof(USN_RECORD_EXTENT);
+			}
+			else if (3 == version)
+				name_record(reinterpret_cast<USN_RECORD_V3*>(p), length, usn);
+			else
+				name_record(reinterpret_cast<USN_RECORD_V2*>(p), length, usn);
+		}
+
+		template <typename Rec>
+		void name_record(Rec* rec, size_t length, uint64_t usn)
+		{
+			size_t nameLength = (length - offsetof(Rec, FileName)) & ~static_cast<size_t>(1);
+
+			rec->RecordLength = static_cast<DWORD>(length);
+			rec->MajorVersion = std::is_same<Rec, USN_RECORD_V3>::value ? 3 : 2;
+			rec->Usn = static_cast<USN>(usn);
+			rec->FileNameOffset = offsetof(Rec, FileName);
+			rec->FileNameLength = static_cast<WORD>(nameLength);
+			memset(reinterpret_cast<uint8_t*>(rec) + rec->FileNameOffset, 'a', nameLength);
+		}
+	};
+
+	/**
+	* Five pages (the last of them partial, as at the end of the stream):
+	* 0: records of every version, the last one ending exactly on the page boundary
+	* 1: a few records, then one claiming to run past the end of the page, then padding
+	* 2: a stale record at the start, which takes the page's later records down with it
+	* 3: one record filling the whole page
+	* 4: two records, the second ending at the very end of the stream
+	*/
+	JournalPages make_pages()
+	{
+		const size_t	page = ntfs::usn_page_size;
+		JournalPages	j(4 * page + 0x100);
+		size_t			pos = 0;
+
+		pos = j.add(pos, 2, 0x60);
+		pos = j.add(pos, 3, 0x70);
+		pos = j.add(pos, 4, 0x50);
+		while (pos < page - 0x200)
+			pos = j.add(pos, (pos & 0x10) ? 2 : 3, 0x80 + (pos & 0x78));
+		j.addToPageEnd(pos, 2);
+
+		pos = page;
+		pos = j.add(pos, 3, 0x88);
+		pos = j.add(pos, 4, 0x60);
+		pos = j.add(pos, 2, 0x40);
+		j.add(pos, 2, 0x68, false);
+		reinterpret_cast<USN_RECORD_V2*>(j.data.data() + pos)->RecordLength = page;
+
+		j.addStale(2 * page, 2, 0x68);
+		j.add(2 * page + 0x68, 2, 0x68, false);
+
+		j.addToPageEnd(3 * page, 3);
+
+		pos = j.add(4 * page, 2, 0x40);
+		j.add(pos, 3, j.data.size() - pos);
+		return j;
+	}
+
+	// Whether the records (laid out as in a getRecords buffer) include the one from pos
+	bool has_record(std::vector<uint8_t> records, uint64_t pos)
+	{
+		bool found = false;
+
+		for (auto rec : ntfs::UsnRecordRange(records)) {
+			ntfs::visit_usn_record(rec, [&](auto view) {
+				found = found || view.usn() == static_cast<USN>(journal_base + pos);
+			});
+		}
+		return found;
+	}
+}
+
+TEST(NtfsJournalTest, SqueezesOutPadding)
+{
+	const size_t	page = ntfs::usn_page_size;
+	auto			j = make_pages();
+	auto			out = j.compact(0, j.data.size());
+
+	EXPECT_EQ(j.expected(0, j.data.size(), 2, 3), out);
+	out.insert(out.begin(), sizeof(USN), 0);
+
+	// The records that end pages 0, 3 and 4 are kept
+	auto last = std::find_if(j.records.begin(), j.records.end(), [](const Record& rec) { return rec.pos + rec.length == ntfs::usn_page_size; });
+	ASSERT_NE(j.records.end(), last);
+	EXPECT_TRUE(has_record(out, last->pos));
+	EXPECT_TRUE(has_record(out, 3 * page));
+	EXPECT_TRUE(has_record(out, j.records.back().pos));
+	EXPECT_EQ(j.data.size(), j.records.back().pos + j.records.back().length);
+
+	// The one straddling the end of page 1, and the ones past a stale record, aren't
+	EXPECT_TRUE(has_record(out, page + 0x88 + 0x60));
+	EXPECT_FALSE(has_record(out, page + 0x88 + 0x60 + 0x40));
+	EXPECT_FALSE(has_record(out, 2 * page));
+	EXPECT_FALSE(has_record(out, 2 * page + 0x68));
+}
+
+TEST(NtfsJournalTest, StartsAndEndsAnywhereReadsCan)
+{
+	auto j = make_pages();
+
+	// Reads start on a record (where the last one left off) and end on a page boundary, or the end of the stream
+	for (auto& rec : j.records) {
+		for (size_t page = rec.pos / ntfs::usn_page_size + 1; page <= j.data.size() / ntfs::usn_page_size + 1; ++page) {
+			size_t end = std::min(j.data.size(), page * ntfs::usn_page_size);
+
+			EXPECT_EQ(j.expected(rec.pos, end - rec.pos, 2, 3), j.compact(rec.pos, end - rec.pos)) << rec.pos << " to " << end;
+		}
+	}
+}
+
+TEST(NtfsJournalTest, KeepsTheVersionsAskedFor)
+{
+	auto j = make_pages();
+
+	for (WORD minVersion = 2; minVersion <= 4; ++minVersion) {
+		for (WORD maxVersion = minVersion; maxVersion <= 4; ++maxVersion) {
+			auto out = j.compact(0, j.data.size(), minVersion, maxVersion);
+
+			EXPECT_FALSE(out.empty());
+			EXPECT_EQ(j.expected(0, j.data.size(), minVersion, maxVersion), out) << minVersion << "-" << maxVersion;
+		}
+	}
+
+	// Nothing left once no version is wanted
+	EXPECT_TRUE(j.compact(0, j.data.size(), 5, 9).empty());
+}
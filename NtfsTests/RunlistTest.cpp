@@ -0,0 +1,191 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/Runlist.hpp"
+#include <cstring>
+#include <initializer_list>
+
+namespace {
+	// Builds a nonresident $DATA segment whose mapping pairs are pairs. Unless padded, the attribute ends right
+	// after the pairs, so the decoder can't take its eight byte fast path near the end.
+	std::vector<uint8_t> make_segment(uint64_t lowVcn, uint64_t highVcn, std::initializer_list<uint8_t> pairs, bool padded = false)
+	{
+		size_t					len = sizeof(ntfs::NTFS_NONRESIDENT_ATTRIBUTE) + pairs.size();
+		std::vector<uint8_t>	buf(len + 16, 0);
+		auto					attr = reinterpret_cast<ntfs::NTFS_NONRESIDENT_ATTRIBUTE*>(buf.data());
+
+		if (padded)
+			len = (len + 15) & ~static_cast<size_t>(7);
+
+		attr->Attribute.AttributeType = ntfs::NtfsAttributeType::AttributeData;
+		attr->Attribute.Length = static_cast<ULONG>(len);
+		attr->Attribute.NonResident = 1;
+		attr->RunArrayOffset = sizeof(ntfs::NTFS_NONRESIDENT_ATTRIBUTE);
+		attr->LowVcn = lowVcn;
+		attr->HighVcn = highVcn;
+		std::copy(pairs.begin(), pairs.end(), buf.begin() + sizeof(ntfs::NTFS_NONRESIDENT_ATTRIBUTE));
+
+		return buf;
+	}
+
+	const ntfs::NTFS_NONRESIDENT_ATTRIBUTE* segment(const std::vector<uint8_t>& buf)
+	{
+		return reinterpret_cast<const ntfs::NTFS_NONRESIDENT_ATTRIBUTE*>(buf.data());
+	}
+
+	std::vector<ntfs::DataRun> decode(const std::vector<uint8_t>& buf)
+	{
+		std::vector<ntfs::DataRun> runs;
+
+		ntfs::decode_runlist(segment(buf), runs);
+		return runs;
+	}
+
+	void expect_run(const ntfs::DataRun& run, uint64_t vcn, int64_t lcn, uint64_t length)
+	{
+		EXPECT_EQ(vcn, run.vcn);
+		EXPECT_EQ(lcn, run.lcn);
+		EXPECT_EQ(length, run.length);
+	}
+}
+
+TEST(RunlistTest, DecodesNegativeLcnDeltas)
+{
+	// 0x10 clusters at 0x1000, then 8 clusters 0x10 before them (a one byte delta of -16)
+	for (bool padded : { false, true }) {
+		auto runs = decode(make_segment(0, 0x17, { 0x21, 0x10, 0x00, 0x10, 0x11, 0x08, 0xF0, 0x00 }, padded));
+
+		ASSERT_EQ(2u, runs.size());
+		expect_run(runs[0], 0, 0x1000, 0x10);
+		expect_run(runs[1], 0x10, 0xFF0, 8);
+	}
+}
+
+TEST(RunlistTest, SignExtendsMultiByteDeltas)
+{
+	// A two byte delta of 0xFF00 is -256, not 65280
+	for (bool padded : { false, true }) {
+		auto runs = decode(make_segment(0, 3, { 0x31, 0x02, 0x00, 0x00, 0x01, 0x21, 0x02, 0x00, 0xFF, 0x00 }, padded));
+
+		ASSERT_EQ(2u, runs.size());
+		expect_run(runs[0], 0, 0x10000, 2);
+		expect_run(runs[1], 2, 0xFF00, 2);
+	}
+}
+
+TEST(RunlistTest, SparseRunsLeaveTheLcnAlone)
+{
+	// 4 clusters at 0x100, 4 sparse ones, then 4 clusters at 0x100 + 0x10
+	auto runs = decode(make_segment(0, 11, { 0x21, 0x04, 0x00, 0x01, 0x01, 0x04, 0x11, 0x04, 0x10, 0x00 }));
+
+	ASSERT_EQ(3u, runs.size());
+	expect_run(runs[0], 0, 0x100, 4);
+	expect_run(runs[1], 4, ntfs::sparse_lcn, 4);
+	expect_run(runs[2], 8, 0x110, 4);
+}
+
+TEST(RunlistTest, EmptyAttributeHasNoRuns)
+{
+	EXPECT_TRUE(decode(make_segment(0, ~uint64_t(0), { 0x00 })).empty());
+}
+
+TEST(RunlistTest, RejectsNegativeLcns)
+{
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x11, 0x04, 0xFF, 0x00 })), std::runtime_error);
+}
+
+TEST(RunlistTest, RejectsTruncatedPairs)
+{
+	// The header promises a three byte delta, but the attribute ends after two
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x31, 0x04, 0x00, 0x10 })), std::runtime_error);
+
+	// ... or a length with no bytes at all
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x11 })), std::runtime_error);
+}
+
+TEST(RunlistTest, RejectsBadLengths)
+{
+	// A zero byte length field, and a zero length
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x10, 0x05, 0x00 })), std::runtime_error);
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x11, 0x00, 0x10, 0x00 })), std::runtime_error);
+
+	// Fields wider than eight bytes
+	EXPECT_THROW(decode(make_segment(0, 3, { 0x91, 0x04, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00 })), std::runtime_error);
+}
+
+TEST(RunlistTest, RejectsRunsThatMissHighVcn)
+{
+	// The runs cover VCNs 0-3
+	EXPECT_THROW(decode(make_segment(0, 4, { 0x11, 0x04, 0x10, 0x00 })), std::runtime_error);
+	EXPECT_THROW(decode(make_segment(0, 2, { 0x11, 0x04, 0x10, 0x00 })), std::runtime_error);
+	EXPECT_NO_THROW(decode(make_segment(0, 3, { 0x11, 0x04, 0x10, 0x00 })));
+
+	// A segment's runs start at its LowVcn
+	EXPECT_NO_THROW(decode(make_segment(8, 11, { 0x11, 0x04, 0x10, 0x00 })));
+}
+
+TEST(RunlistTest, RejectsResidentAttributes)
+{
+	auto buf = make_segment(0, 3, { 0x11, 0x04, 0x10, 0x00 });
+
+	reinterpret_cast<ntfs::NTFS_NONRESIDENT_ATTRIBUTE*>(buf.data())->Attribute.NonResident = 0;
+	EXPECT_THROW(decode(buf), std::runtime_error);
+}
+
+TEST(ExtentMapTest, FillsGapsBetweenSegments)
+{
+	ntfs::ExtentMap	map;
+	uint64_t		remaining = 0;
+	auto			first = make_segment(0, 3, { 0x11, 0x04, 0x10, 0x00 });
+	auto			last = make_segment(8, 11, { 0x11, 0x04, 0x40, 0x00 });
+
+	reinterpret_cast<ntfs::NTFS_NONRESIDENT_ATTRIBUTE*>(first.data())->AllocSize = 12 * 4096;
+	reinterpret_cast<ntfs::NTFS_NONRESIDENT_ATTRIBUTE*>(first.data())->DataSize = 12 * 4096 - 100;
+
+	// Segments may arrive in any order; until the middle one does, its VCNs are unmapped
+	map.addSegment(segment(last));
+	map.addSegment(segment(first));
+
+	ASSERT_EQ(3u, map.size());
+	expect_run(map.run(1), 4, ntfs::unmapped_lcn, 4);
+	EXPECT_FALSE(map.complete());
+	EXPECT_EQ(ntfs::unmapped_lcn, map.lookup(5, &remaining));
+	EXPECT_EQ(3u, remaining);
+	EXPECT_EQ(12u * 4096, map.allocatedSize());
+	EXPECT_EQ(12u * 4096 - 100, map.dataSize());
+
+	// The middle segment continues the first one on disk, so the two merge into a single run
+	map.addSegment(segment(make_segment(4, 7, { 0x11, 0x04, 0x14, 0x00 })));
+
+	ASSERT_EQ(2u, map.size());
+	expect_run(map.run(0), 0, 0x10, 8);
+	expect_run(map.run(1), 8, 0x40, 4);
+	EXPECT_TRUE(map.complete());
+	EXPECT_EQ(12u, map.clusterCount());
+	EXPECT_EQ(0x16, map.lookup(6, &remaining));
+	EXPECT_EQ(2u, remaining);
+	EXPECT_EQ(0x43, map.lookup(11, &remaining));
+	EXPECT_EQ(1u, remaining);
+	EXPECT_EQ(ntfs::unmapped_lcn, map.lookup(12, &remaining));
+	EXPECT_EQ(0u, remaining);
+}
+
+TEST(ExtentMapTest, RejectsOverlappingSegments)
+{
+	ntfs::ExtentMap map;
+
+	map.addSegment(segment(make_segment(0, 7, { 0x11, 0x08, 0x10, 0x00 })));
+	EXPECT_THROW(map.addSegment(segment(make_segment(4, 11, { 0x11, 0x08, 0x40, 0x00 }))), std::runtime_error);
+}
+
+TEST(ExtentMapTest, MergesAdjacentSparseRuns)
+{
+	ntfs::ExtentMap	map;
+	uint64_t		remaining = 0;
+
+	map.addSegment(segment(make_segment(0, 11, { 0x01, 0x04, 0x01, 0x04, 0x11, 0x04, 0x20, 0x00 })));
+
+	ASSERT_EQ(2u, map.size());
+	expect_run(map.run(0), 0, ntfs::sparse_lcn, 8);
+	EXPECT_EQ(ntfs::sparse_lcn, map.lookup(3, &remaining));
+	EXPECT_EQ(5u, remaining);
+	EXPECT_EQ(0x21, map.lookup(9));
+}
@@ -0,0 +1,196 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/TrigramIndex.hpp"
+#include "FileRecordMock.h"
+#include <algorithm>
+#include <random>
+#include <set>
+
+namespace {
+	typedef std::basic_string<WCHAR> wstr;
+
+	void add(ntfs::FileIndex& index, uint64_t recNum, const std::string& name)
+	{
+		auto rec = mock::make_file_record(5, mock::wide(name));
+		index.addRecord(recNum, reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data()), rec.size());
+	}
+
+	std::set<wstr> trigrams(const std::string& s)
+	{
+		std::set<wstr> out;
+
+		for (size_t i = 2; i < s.size(); ++i) {
+			wstr t;
+			for (size_t j = i - 2; j <= i; ++j)
+				t += static_cast<WCHAR>(toupper(static_cast<unsigned char>(s[j])));
+			out.insert(t);
+		}
+		return out;
+	}
+
+	// The records whose names hold every trigram of every literal, worked out the slow way
+	std::vector<uint32_t> brute_force(const std::vector<std::string>& names, const std::vector<std::string>& literals)
+	{
+		std::vector<uint32_t> rows;
+
+		for (uint32_t row = 0; row < names.size(); ++row) {
+			auto	have = trigrams(names[row]);
+			bool	all = true;
+
+			for (auto& literal : literals) {
+				for (auto& t : trigrams(literal))
+					all = all && have.count(t);
+			}
+
+			if (all)
+				rows.push_back(row);
+		}
+		return rows;
+	}
+
+	std::vector<wstr> wide(const std::vector<std::string>& literals)
+	{
+		std::vector<wstr> out;
+
+		for (auto& s : literals)
+			out.push_back(mock::wide(s));
+		return out;
+	}
+}
+
+TEST(TrigramIndexTest, SeeksOntoAndAroundSeekPoints)
+{
+	ntfs::FileIndex			index;
+	std::vector<std::string>	names;
+	std::vector<uint32_t>	common;
+
+	// Two thirds of the first 700 records contain "abc", so its list has several seek points
+	for (uint32_t row = 0; row < 1000; ++row) {
+		bool has = row < 700 && row % 3 != 2;
+
+		names.push_back(has ? "abc" : "qqq");
+		if (has)
+			common.push_back(row);
+	}
+
+	// "xyz" goes on the postings either side of each seek point, the first and last, ones in between,
+	// and ones past the end of the "abc" list
+	std::set<uint32_t> rare = { common.front(), common.back(), common.back() + 1, 800, 999 };
+	for (uint32_t point = ntfs::trigram_skip_interval; point < common.size(); point += ntfs::trigram_skip_interval) {
+		rare.insert(common[point - 1]);
+		rare.insert(common[point]);
+		rare.insert(common[point] + 1);
+	}
+
+	for (auto row : rare)
+		names[row] += ".xyz";
+
+	for (uint32_t row = 0; row < names.size(); ++row)
+		add(index, row, names[row]);
+
+	ntfs::TrigramIndex		trigrams(index);
+	std::vector<uint32_t>	rows;
+
+	trigrams.build();
+	ASSERT_TRUE(trigrams.candidates(wide({ "abc", "xyz" }), rows));
+	EXPECT_EQ(brute_force(names, { "abc", "xyz" }), rows);
+
+	// Just the long list, decoded in full
+	ASSERT_TRUE(trigrams.candidates(wide({ "ABC" }), rows));
+	EXPECT_EQ(common, rows);
+}
+
+TEST(TrigramIndexTest, SeeksPastTheEnd)
+{
+	ntfs::FileIndex			index;
+	std::vector<std::string>	names;
+
+	// Every "xyz" comes after the last "abc"
+	for (uint32_t row = 0; row < 600; ++row)
+		names.push_back(row < 300 ? "abc" : (row % 50 ? "def" : "xyz"));
+
+	for (uint32_t row = 0; row < names.size(); ++row)
+		add(index, row, names[row]);
+
+	ntfs::TrigramIndex		trigrams(index);
+	std::vector<uint32_t>	rows = { 1, 2, 3 };
+
+	trigrams.build();
+	EXPECT_TRUE(trigrams.candidates(wide({ "abc", "xyz" }), rows));
+	EXPECT_TRUE(rows.empty());
+
+	// A trigram nothing has
+	rows = { 1, 2, 3 };
+	EXPECT_TRUE(trigrams.candidates(wide({ "abc", "zzz" }), rows));
+	EXPECT_TRUE(rows.empty());
+}
+
+TEST(TrigramIndexTest, IgnoresShortLiterals)
+{
+	ntfs::FileIndex index;
+
+	add(index, 0, "abcdef");
+	add(index, 1, "ab");
+	add(index, 2, "xabcx");
+
+	ntfs::TrigramIndex		trigrams(index);
+	std::vector<uint32_t>	rows = { 7 };
+
+	trigrams.build();
+	EXPECT_FALSE(trigrams.candidates(wide({ "ab" }), rows));
+	EXPECT_TRUE(rows.empty());
+	EXPECT_FALSE(trigrams.candidates(wide({ "", "a", "ab" }), rows));
+
+	// Only the literals that are long enough narrow the search
+	ASSERT_TRUE(trigrams.candidates(wide({ "zz", "ABC" }), rows));
+	EXPECT_EQ(std::vector<uint32_t>({ 0, 2 }), rows);
+}
+
+TEST(TrigramIndexTest, MatchesBruteForce)
+{
+	std::mt19937				rng(7);
+	ntfs::FileIndex				index;
+	std::vector<std::string>	names;
+	const char					alphabet[] = "abcdABCD.";
+
+	// Names from a small alphabet share plenty of trigrams, so the lists are long and overlap
+	for (uint32_t row = 0; row < 3000; ++row) {
+		std::string name;
+
+		for (size_t len = 3 + rng() % 12; name.size() < len;)
+			name += alphabet[rng() % (sizeof(alphabet) - 1)];
+		names.push_back(name);
+		add(index, row, name);
+	}
+
+	ntfs::TrigramIndex		trigrams(index);
+	std::vector<uint32_t>	rows;
+
+	trigrams.build();
+	for (int query = 0; query < 200; ++query) {
+		std::vector<std::string> literals(1 + rng() % 2);
+
+		for (auto& literal : literals) {
+			for (size_t len = 3 + rng() % 3; literal.size() < len;)
+				literal += alphabet[rng() % (sizeof(alphabet) - 1)];
+		}
+
+		ASSERT_TRUE(trigrams.candidates(wide(literals), rows));
+		EXPECT_EQ(brute_force(names, literals), rows) << literals[0];
+	}
+
+	// Renamed files are found under their new names (and may linger under their old ones)
+	for (uint32_t row = 0; row < names.size(); row += 7) {
+		auto rec = mock::make_file_record(5, mock::wide("renamed.dd"));
+
+		index.refresh(row, reinterpret_cast<ntfs::NTFS_FILE_RECORD_HEADER*>(rec.data()), rec.size());
+		trigrams.update(row);
+		names[row] = "renamed.dd";
+	}
+
+	ASSERT_TRUE(trigrams.candidates(wide({ "renamed" }), rows));
+	EXPECT_EQ(brute_force(names, { "renamed" }), rows);
+
+	ASSERT_TRUE(trigrams.candidates(wide({ "abc" }), rows));
+	auto exact = brute_force(names, { "abc" });
+	EXPECT_TRUE(std::includes(rows.begin(), rows.end(), exact.begin(), exact.end()));
+}
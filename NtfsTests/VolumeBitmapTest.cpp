@@ -0,0 +1,183 @@
+#include "gtest/gtest.h"
+#include "../ChangeJournal/VolumeBitmap.hpp"
+#include <random>
+
+namespace {
+	const uint64_t total_clusters = 1000;
+
+	void set_used(std::vector<uint8_t>& bitmap, uint64_t first, uint64_t last)
+	{
+		for (uint64_t c = first; c <= last; ++c)
+			bitmap[static_cast<size_t>(c / 8)] |= static_cast<uint8_t>(1 << (c % 8));
+	}
+
+	// A 1000 cluster volume with free runs of 3 (10-12), 100 (14-113), 520 (200-719) and 40 (960-999)
+	// clusters; the bits past the end of the volume are clear, and must be ignored
+	std::vector<uint8_t> make_bitmap()
+	{
+		std::vector<uint8_t> bitmap(128, 0);
+
+		set_used(bitmap, 0, 9);
+		set_used(bitmap, 13, 13);
+		set_used(bitmap, 114, 199);
+		set_used(bitmap, 720, 959);
+		return bitmap;
+	}
+
+	// Feeds bitmap[0, len) in pieces of the given sizes (repeated as needed), from an unaligned copy if asked
+	ntfs::FreeSpaceStats scan(const std::vector<uint8_t>& bitmap, size_t len, uint64_t total, const std::vector<size_t>& pieces, bool unaligned, size_t regions = 4)
+	{
+		ntfs::FreeSpaceScanner	scanner(total, regions);
+		std::vector<uint8_t>	copy(len + 1);
+		const uint8_t*			data = copy.data() + (unaligned ? 1 : 0);
+
+		std::copy(bitmap.begin(), bitmap.begin() + len, copy.begin() + (unaligned ? 1 : 0));
+		for (size_t done = 0, i = 0; done < len; ++i) {
+			size_t n = std::min(pieces[i % pieces.size()], len - done);
+
+			scanner.feed(data + done, n);
+			done += n;
+		}
+
+		return scanner.finish();
+	}
+
+	// The same statistics, one cluster at a time
+	ntfs::FreeSpaceStats brute_force(const std::vector<uint8_t>& bitmap, uint64_t total, size_t regions)
+	{
+		ntfs::FreeSpaceStats	stats = ntfs::FreeSpaceScanner(total, regions).finish();
+		uint64_t				run = 0;
+
+		std::fill(stats.regionUsed.begin(), stats.regionUsed.end(), 0);
+		std::fill(stats.extentCounts.begin(), stats.extentCounts.end(), 0);
+		stats.freeClusters = 0;
+
+		for (uint64_t c = 0; c <= total; ++c) {
+			bool used = c == total || c / 8 >= bitmap.size() || (bitmap[static_cast<size_t>(c / 8)] >> (c % 8)) & 1;
+
+			if (c < total && used)
+				++stats.regionUsed[static_cast<size_t>(c / stats.regionClusters)];
+
+			if (!used) {
+				++run;
+				++stats.freeClusters;
+				continue;
+			}
+
+			if (run) {
+				unsigned bucket = 0;
+				while (run >> (bucket + 1))
+					++bucket;
+
+				++stats.freeExtents;
+				++stats.extentCounts[bucket];
+				stats.extentClusters[bucket] += run;
+				if (run > stats.largestFreeLength) {
+					stats.largestFreeLength = run;
+					stats.largestFreeLcn = c - run;
+				}
+			}
+			run = 0;
+		}
+
+		return stats;
+	}
+
+	void expect_stats(const ntfs::FreeSpaceStats& expected, const ntfs::FreeSpaceStats& actual)
+	{
+		EXPECT_EQ(expected.totalClusters, actual.totalClusters);
+		EXPECT_EQ(expected.freeClusters, actual.freeClusters);
+		EXPECT_EQ(expected.freeExtents, actual.freeExtents);
+		EXPECT_EQ(expected.largestFreeLcn, actual.largestFreeLcn);
+		EXPECT_EQ(expected.largestFreeLength, actual.largestFreeLength);
+		EXPECT_EQ(expected.extentCounts, actual.extentCounts);
+		EXPECT_EQ(expected.extentClusters, actual.extentClusters);
+		EXPECT_EQ(expected.regionClusters, actual.regionClusters);
+		EXPECT_EQ(expected.regionUsed, actual.regionUsed);
+	}
+}
+
+TEST(VolumeBitmapTest, FindsRunsAcrossPieces)
+{
+	auto bitmap = make_bitmap();
+
+	// Pieces that split runs mid-byte and mid-word, from aligned and unaligned buffers
+	for (auto& pieces : std::vector<std::vector<size_t>>{ { 128 }, { 1 }, { 1, 7, 3, 60, 2, 55 }, { 9 }, { 8, 64, 56 } }) {
+		for (bool unaligned : { false, true }) {
+			auto stats = scan(bitmap, bitmap.size(), total_clusters, pieces, unaligned);
+
+			EXPECT_EQ(total_clusters, stats.totalClusters);
+			EXPECT_EQ(663u, stats.freeClusters);
+			EXPECT_EQ(4u, stats.freeExtents);
+			EXPECT_EQ(200u, stats.largestFreeLcn);
+			EXPECT_EQ(520u, stats.largestFreeLength);
+
+			// Each run has a bucket to itself
+			std::vector<uint64_t> counts(ntfs::free_extent_buckets), clusters(ntfs::free_extent_buckets);
+			counts[1] = 1, clusters[1] = 3;
+			counts[5] = 1, clusters[5] = 40;
+			counts[6] = 1, clusters[6] = 100;
+			counts[9] = 1, clusters[9] = 520;
+			EXPECT_EQ(counts, stats.extentCounts);
+			EXPECT_EQ(clusters, stats.extentClusters);
+
+			EXPECT_EQ(256u, stats.regionClusters);
+			EXPECT_EQ(std::vector<uint64_t>({ 97, 0, 48, 192 }), stats.regionUsed);
+		}
+	}
+}
+
+TEST(VolumeBitmapTest, IgnoresBitsPastTheEndOfTheVolume)
+{
+	auto bitmap = make_bitmap();
+
+	// Just the 125 bytes the volume needs, so the final word is partial and finish() completes it
+	for (auto& pieces : std::vector<std::vector<size_t>>{ { 125 }, { 3 }, { 120, 5 }, { 124, 1 } }) {
+		auto stats = scan(bitmap, 125, total_clusters, pieces, true);
+
+		EXPECT_EQ(663u, stats.freeClusters);
+		EXPECT_EQ(4u, stats.freeExtents);
+		EXPECT_EQ(std::vector<uint64_t>({ 97, 0, 48, 192 }), stats.regionUsed);
+	}
+
+	expect_stats(brute_force(bitmap, total_clusters, 4), scan(bitmap, 125, total_clusters, { 7 }, false));
+}
+
+TEST(VolumeBitmapTest, CountsWhatTheBitmapMissesAsUsed)
+{
+	auto bitmap = make_bitmap();
+
+	// A bitmap that stops at cluster 800 takes the last free run with it
+	auto stats = scan(bitmap, 100, total_clusters, { 33 }, false);
+
+	EXPECT_EQ(623u, stats.freeClusters);
+	EXPECT_EQ(3u, stats.freeExtents);
+	EXPECT_EQ(std::vector<uint64_t>({ 97, 0, 48, 232 }), stats.regionUsed);
+	expect_stats(brute_force(std::vector<uint8_t>(bitmap.begin(), bitmap.begin() + 100), total_clusters, 4), stats);
+}
+
+TEST(VolumeBitmapTest, MatchesBruteForce)
+{
+	std::mt19937 rng(3);
+
+	for (int trial = 0; trial < 50; ++trial) {
+		uint64_t				total = 1 + rng() % 5000;
+		std::vector<uint8_t>	bitmap(static_cast<size_t>((total + 7) / 8));
+		size_t					regions = 1 + rng() % 16;
+
+		// Long uniform stretches, so that whole words are skipped as well as scanned bit by bit
+		for (size_t i = 0; i < bitmap.size();) {
+			size_t		len = 1 + rng() % 40;
+			unsigned	kind = rng() % 3;
+
+			for (; len && i < bitmap.size(); --len, ++i)
+				bitmap[i] = (0 == kind) ? 0 : (1 == kind) ? 0xFF : static_cast<uint8_t>(rng());
+		}
+
+		std::vector<size_t> pieces;
+		for (int i = 0; i < 5; ++i)
+			pieces.push_back(1 + rng() % 70);
+
+		expect_stats(brute_force(bitmap, total, regions), scan(bitmap, bitmap.size(), total, pieces, 0 != trial % 2, regions));
+	}
+}